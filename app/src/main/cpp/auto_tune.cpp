@@ -0,0 +1,501 @@
+/**
+ * auto_tune.cpp - On-device benchmark of context configurations
+ */
+
+#include "auto_tune.h"
+#include "cpu_threadpool.h"
+#include "cpu_topology.h"
+#include "kv_estimate.h"
+#include "logging.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+
+#ifdef __ANDROID__
+#include <sys/system_properties.h>
+#else
+#include <sys/utsname.h>
+#endif
+
+#define LOG_TAG "AutoTune"
+
+namespace {
+
+constexpr const char * STORE_FILE = "autotune.txt";
+constexpr size_t HASH_CHUNK_BYTES = 64 * 1024;
+
+// Text fed to the trials, repeated up to the prompt length
+constexpr const char * TRIAL_TEXT =
+    "The library opens at nine in the morning and closes at six in the evening. "
+    "Visitors can borrow up to five books at a time and return them within three weeks. "
+    "Study rooms on the second floor must be reserved a day in advance. ";
+
+struct stored_entry {
+    std::string model_hash;
+    std::string device;
+    auto_tune_result result;
+};
+
+std::mutex g_tune_mutex;      // guards the maps and the store
+std::mutex g_run_mutex;       // held for the duration of auto_tune_run
+std::atomic<bool> g_abort_requested{false};
+std::string g_store_dir;
+bool g_enabled = true;
+std::map<const llama_model *, std::string> g_model_hashes;
+std::vector<stored_entry> g_entries;
+
+uint64_t fnv1a(uint64_t hash, const void * data, size_t size) {
+    const unsigned char * bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+std::string to_hex(uint64_t value) {
+    char buf[17];
+    snprintf(buf, sizeof(buf), "%016llx", (unsigned long long) value);
+    return buf;
+}
+
+// Hash of the file size plus its first and last chunk; the GGUF header holds the metadata
+std::string hash_model_file(const std::string & path) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) return "";
+
+    const uint64_t size = (uint64_t) file.tellg();
+    uint64_t hash = fnv1a(14695981039346656037ULL, &size, sizeof(size));
+
+    std::vector<char> buf(HASH_CHUNK_BYTES);
+    file.seekg(0);
+    file.read(buf.data(), (std::streamsize) std::min<uint64_t>(size, buf.size()));
+    hash = fnv1a(hash, buf.data(), (size_t) file.gcount());
+
+    if (size > HASH_CHUNK_BYTES) {
+        file.clear();
+        file.seekg((std::streamoff) (size - HASH_CHUNK_BYTES));
+        file.read(buf.data(), (std::streamsize) buf.size());
+        hash = fnv1a(hash, buf.data(), (size_t) file.gcount());
+    }
+    return to_hex(hash);
+}
+
+const std::string & device_fingerprint() {
+    static const std::string fingerprint = [] {
+        std::string text;
+#ifdef __ANDROID__
+        for (const char * prop : {"ro.product.manufacturer", "ro.product.model", "ro.board.platform"}) {
+            char value[PROP_VALUE_MAX] = {0};
+            __system_property_get(prop, value);
+            text += value;
+            text += '|';
+        }
+#else
+        utsname name = {};
+        if (uname(&name) == 0) {
+            text += std::string(name.nodename) + "|" + name.machine + "|";
+        }
+#endif
+        text += cpu_topology_json(cpu_topology_system());
+        return to_hex(fnv1a(14695981039346656037ULL, text.data(), text.size()));
+    }();
+    return fingerprint;
+}
+
+std::string store_path_locked() {
+    return g_store_dir.empty() ? "" : g_store_dir + "/" + STORE_FILE;
+}
+
+void load_store_locked() {
+    g_entries.clear();
+    const std::string path = store_path_locked();
+    if (path.empty()) return;
+
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream in(line);
+        stored_entry entry;
+        auto_tune_config & config = entry.result.config;
+        int type_k = 0, type_v = 0, flash_attn = 0;
+        if (in >> entry.model_hash >> entry.device >> config.n_threads >> config.n_batch >> config.n_ubatch
+               >> type_k >> type_v >> flash_attn >> entry.result.prefill_tps >> entry.result.decode_tps
+               >> entry.result.kv_bytes_per_token) {
+            config.type_k = kv_cache_type_from_int(type_k);
+            config.type_v = kv_cache_type_from_int(type_v);
+            config.flash_attn = (llama_flash_attn_type) flash_attn;
+            g_entries.push_back(entry);
+        }
+    }
+    LOGI("Loaded %zu tuned configurations", g_entries.size());
+}
+
+void save_store_locked() {
+    const std::string path = store_path_locked();
+    if (path.empty()) return;
+
+    // Write to a temp file and rename so a crash never leaves a truncated store
+    const std::string tmp = path + ".tmp";
+    {
+        std::ofstream file(tmp, std::ios::trunc);
+        for (const auto & entry : g_entries) {
+            const auto_tune_config & config = entry.result.config;
+            file << entry.model_hash << ' ' << entry.device << ' ' << config.n_threads << ' '
+                 << config.n_batch << ' ' << config.n_ubatch << ' ' << (int) config.type_k << ' '
+                 << (int) config.type_v << ' ' << (int) config.flash_attn << ' '
+                 << entry.result.prefill_tps << ' ' << entry.result.decode_tps << ' '
+                 << entry.result.kv_bytes_per_token << '\n';
+        }
+        if (!file) {
+            LOGE("Failed to write %s", tmp.c_str());
+            return;
+        }
+    }
+    std::rename(tmp.c_str(), path.c_str());
+}
+
+std::string model_hash_locked(const llama_model * model) {
+    auto it = g_model_hashes.find(model);
+    return it == g_model_hashes.end() ? "" : it->second;
+}
+
+bool same_config(const auto_tune_config & a, const auto_tune_config & b) {
+    return a.n_threads == b.n_threads && a.n_batch == b.n_batch && a.n_ubatch == b.n_ubatch &&
+           a.type_k == b.type_k && a.type_v == b.type_v && a.flash_attn == b.flash_attn;
+}
+
+llama_context_params params_for(const auto_tune_config & config, int n_ctx) {
+    llama_context_params params = llama_context_default_params();
+    params.n_ctx = n_ctx;
+    params.n_batch = config.n_batch;
+    params.n_ubatch = std::min(config.n_ubatch, config.n_batch);
+    params.n_threads = config.n_threads;
+    params.n_threads_batch = config.n_threads;
+    params.type_k = config.type_k;
+    params.type_v = config.type_v;
+    params.flash_attn_type = config.flash_attn;
+    return params;
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Time one configuration; false if the context could not be created, decode failed or the run was aborted
+bool run_trial(llama_model * model, const auto_tune_config & config, const auto_tune_options & options,
+               std::vector<llama_token> tokens, const std::function<bool()> & should_abort,
+               auto_tune_result & out) {
+    llama_context * ctx = llama_init_from_model(model, params_for(config, options.n_ctx));
+    if (ctx == nullptr) {
+        LOGW("Configuration not supported (threads=%d, ubatch=%d, kv=%s/%s, fa=%d)",
+             config.n_threads, config.n_ubatch, ggml_type_name(config.type_k),
+             ggml_type_name(config.type_v), (int) config.flash_attn);
+        return false;
+    }
+    cpu_threadpool_attach(ctx, config.n_threads);
+
+    bool ok = true;
+    auto decode = [&](llama_token * data, int n) {
+        if (ok && (g_abort_requested.load() || should_abort() || llama_decode(ctx, llama_batch_get_one(data, n)) != 0)) ok = false;
+        return ok;
+    };
+
+    // Warm up: fault in mmapped weights and allocate compute buffers
+    decode(tokens.data(), std::min<int>(16, (int) tokens.size()));
+    llama_memory_clear(llama_get_memory(ctx), true);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; ok && i < options.n_prompt; i += config.n_batch) {
+        decode(tokens.data() + i, std::min(config.n_batch, options.n_prompt - i));
+    }
+    const double prefill_seconds = seconds_since(start);
+
+    llama_token token = tokens[0];
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; ok && i < options.n_decode; i++) {
+        decode(&token, 1);
+    }
+    const double decode_seconds = seconds_since(start);
+
+    cpu_threadpool_detach(ctx);
+    llama_free(ctx);
+    if (!ok) return false;
+
+    out.config = config;
+    out.prefill_tps = options.n_prompt / std::max(prefill_seconds, 1e-6);
+    out.decode_tps = options.n_decode / std::max(decode_seconds, 1e-6);
+    out.kv_bytes_per_token = kv_cache_estimate_bytes(model, 1, config.type_k, config.type_v);
+    LOGI("threads=%d batch=%d ubatch=%d kv=%s/%s fa=%d: prefill %.1f tok/s, decode %.1f tok/s",
+         config.n_threads, config.n_batch, config.n_ubatch, ggml_type_name(config.type_k),
+         ggml_type_name(config.type_v), (int) config.flash_attn, out.prefill_tps, out.decode_tps);
+    return true;
+}
+
+// Keep results that no other result beats on both time and memory, fastest first
+std::vector<auto_tune_result> pareto_front(const std::vector<auto_tune_result> & results) {
+    std::vector<auto_tune_result> front;
+    for (const auto & a : results) {
+        bool dominated = false;
+        for (const auto & b : results) {
+            const bool no_worse = b.reference_seconds() <= a.reference_seconds() &&
+                                  b.kv_bytes_per_token <= a.kv_bytes_per_token;
+            const bool better = b.reference_seconds() < a.reference_seconds() ||
+                                b.kv_bytes_per_token < a.kv_bytes_per_token;
+            if (no_worse && better) {
+                dominated = true;
+                break;
+            }
+        }
+        if (!dominated) front.push_back(a);
+    }
+    std::sort(front.begin(), front.end(), [](const auto_tune_result & a, const auto_tune_result & b) {
+        return a.reference_seconds() < b.reference_seconds();
+    });
+    return front;
+}
+
+std::string result_json(const auto_tune_result & result) {
+    const auto_tune_config & config = result.config;
+    std::string json = "{";
+    json += "\"n_threads\":" + std::to_string(config.n_threads) + ",";
+    json += "\"n_batch\":" + std::to_string(config.n_batch) + ",";
+    json += "\"n_ubatch\":" + std::to_string(config.n_ubatch) + ",";
+    json += "\"type_k\":\"" + std::string(ggml_type_name(config.type_k)) + "\",";
+    json += "\"type_v\":\"" + std::string(ggml_type_name(config.type_v)) + "\",";
+    json += "\"flash_attn\":" + std::to_string((int) config.flash_attn) + ",";
+    json += "\"prefill_tps\":" + std::to_string(result.prefill_tps) + ",";
+    json += "\"decode_tps\":" + std::to_string(result.decode_tps) + ",";
+    json += "\"kv_bytes_per_token\":" + std::to_string(result.kv_bytes_per_token);
+    json += "}";
+    return json;
+}
+
+} // namespace
+
+double auto_tune_result::reference_seconds() const {
+    if (prefill_tps <= 0 || decode_tps <= 0) return 1e9;
+    return 512.0 / prefill_tps + 128.0 / decode_tps;
+}
+
+void auto_tune_set_store_dir(const std::string & dir) {
+    std::lock_guard<std::mutex> lock(g_tune_mutex);
+    if (dir == g_store_dir) return;
+    g_store_dir = dir;
+    load_store_locked();
+}
+
+void auto_tune_set_enabled(bool enabled) {
+    std::lock_guard<std::mutex> lock(g_tune_mutex);
+    g_enabled = enabled;
+}
+
+void auto_tune_register_model(const llama_model * model, const std::string & path) {
+    const std::string hash = hash_model_file(path);
+    std::lock_guard<std::mutex> lock(g_tune_mutex);
+    if (hash.empty()) {
+        g_model_hashes.erase(model);
+        return;
+    }
+    g_model_hashes[model] = hash;
+}
+
+std::vector<auto_tune_result> auto_tune_run(llama_model * model, const auto_tune_options & options,
+                                            const std::function<bool()> & should_abort) {
+    std::lock_guard<std::mutex> run_lock(g_run_mutex);
+
+    std::string model_hash;
+    {
+        std::lock_guard<std::mutex> lock(g_tune_mutex);
+        model_hash = model_hash_locked(model);
+    }
+    if (model_hash.empty()) {
+        LOGE("Model is not registered for auto-tuning");
+        return {};
+    }
+
+    // Build the trial prompt from real text so the tokens look like a normal request
+    const llama_vocab * vocab = llama_model_get_vocab(model);
+    std::vector<llama_token> tokens(options.n_prompt + 64);
+    std::vector<llama_token> prompt;
+    while ((int) prompt.size() < options.n_prompt) {
+        const int n = llama_tokenize(vocab, TRIAL_TEXT, (int32_t) strlen(TRIAL_TEXT),
+                                     tokens.data(), (int32_t) tokens.size(), prompt.empty(), false);
+        if (n <= 0) return {};
+        prompt.insert(prompt.end(), tokens.begin(), tokens.begin() + n);
+    }
+    prompt.resize(options.n_prompt);
+
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<auto_tune_result> results;
+    results.reserve(16);  // try_config hands out pointers into this vector
+    bool aborted = false;
+
+    auto try_config = [&](const auto_tune_config & config) -> const auto_tune_result * {
+        for (const auto & r : results) {
+            if (same_config(r.config, config)) return &r;
+        }
+        if (aborted || seconds_since(start) > options.max_seconds) return nullptr;
+        auto_tune_result result;
+        if (!run_trial(model, config, options, prompt, should_abort, result)) {
+            aborted = aborted || g_abort_requested.load() || should_abort();
+            return nullptr;
+        }
+        results.push_back(result);
+        return &results.back();
+    };
+
+    // Coordinate descent over threads, batch sizes and flash attention with an F16 cache
+    auto_tune_config best;
+    best.n_threads = cpu_threadpool_default_threads();
+    const auto_tune_result * best_result = try_config(best);
+    if (best_result == nullptr) return {};
+    double best_seconds = best_result->reference_seconds();
+
+    auto climb = [&](const std::vector<auto_tune_config> & candidates) {
+        for (const auto & candidate : candidates) {
+            const auto_tune_result * r = try_config(candidate);
+            if (r != nullptr && r->reference_seconds() < best_seconds) {
+                best = candidate;
+                best_seconds = r->reference_seconds();
+            }
+        }
+    };
+
+    const int performance = cpu_threadpool_default_threads();
+    const int all_cores = std::max(performance, (int) cpu_topology_system().cores.size());
+    std::vector<auto_tune_config> candidates;
+    for (int n : {all_cores, std::max(1, performance / 2)}) {
+        auto_tune_config c = best;
+        c.n_threads = n;
+        candidates.push_back(c);
+    }
+    climb(candidates);
+
+    candidates.clear();
+    for (auto batch : std::vector<std::pair<int, int>>{{512, 256}, {512, 128}, {256, 256}}) {
+        auto_tune_config c = best;
+        c.n_batch = batch.first;
+        c.n_ubatch = batch.second;
+        candidates.push_back(c);
+    }
+    climb(candidates);
+
+    candidates.clear();
+    for (auto fa : {LLAMA_FLASH_ATTN_TYPE_DISABLED, LLAMA_FLASH_ATTN_TYPE_ENABLED}) {
+        auto_tune_config c = best;
+        c.flash_attn = fa;
+        candidates.push_back(c);
+    }
+    climb(candidates);
+
+    // Smaller caches trade speed for memory; they only feed the Pareto front
+    for (ggml_type type : {GGML_TYPE_Q8_0, GGML_TYPE_Q4_0}) {
+        auto_tune_config c = best;
+        c.type_k = type;
+        c.type_v = type;
+        c.flash_attn = LLAMA_FLASH_ATTN_TYPE_ENABLED;
+        try_config(c);
+    }
+
+    if (aborted) {
+        LOGI("Auto-tune aborted after %zu trials", results.size());
+        return {};
+    }
+
+    std::vector<auto_tune_result> front = pareto_front(results);
+    LOGI("Auto-tune finished: %zu trials, %zu on the Pareto front, %.1f s",
+         results.size(), front.size(), seconds_since(start));
+
+    std::lock_guard<std::mutex> lock(g_tune_mutex);
+    const std::string & device = device_fingerprint();
+    g_entries.erase(std::remove_if(g_entries.begin(), g_entries.end(), [&](const stored_entry & e) {
+        return e.model_hash == model_hash && e.device == device;
+    }), g_entries.end());
+    for (const auto & result : front) {
+        g_entries.push_back({model_hash, device, result});
+    }
+    save_store_locked();
+    return front;
+}
+
+void auto_tune_wait_idle() {
+    std::lock_guard<std::mutex> run_lock(g_run_mutex);
+}
+
+void auto_tune_abort() {
+    g_abort_requested.store(true);
+    {
+        std::lock_guard<std::mutex> run_lock(g_run_mutex);
+    }
+    g_abort_requested.store(false);
+}
+
+bool auto_tune_apply(const llama_model * model, llama_context_params & params) {
+    std::lock_guard<std::mutex> lock(g_tune_mutex);
+    if (!g_enabled) return false;
+
+    const std::string model_hash = model_hash_locked(model);
+    if (model_hash.empty()) return false;
+
+    // The requested KV types set the memory ceiling
+    const size_t max_kv = kv_cache_estimate_bytes(model, 1, params.type_k, params.type_v);
+    const std::string & device = device_fingerprint();
+    const auto_tune_result * best = nullptr;
+    for (const auto & entry : g_entries) {
+        if (entry.model_hash != model_hash || entry.device != device) continue;
+        if (entry.result.kv_bytes_per_token > max_kv) continue;
+        if (best == nullptr || entry.result.reference_seconds() < best->reference_seconds()) {
+            best = &entry.result;
+        }
+    }
+    if (best == nullptr) return false;
+
+    const auto_tune_config & config = best->config;
+    params.n_threads = config.n_threads;
+    params.n_threads_batch = config.n_threads;
+    params.n_batch = config.n_batch;
+    params.n_ubatch = std::min(config.n_ubatch, config.n_batch);
+    params.type_k = config.type_k;
+    params.type_v = config.type_v;
+    params.flash_attn_type = config.flash_attn;
+    return true;
+}
+
+bool auto_tune_has_results(const llama_model * model) {
+    std::lock_guard<std::mutex> lock(g_tune_mutex);
+    const std::string model_hash = model_hash_locked(model);
+    if (model_hash.empty()) return false;
+    const std::string & device = device_fingerprint();
+    return std::any_of(g_entries.begin(), g_entries.end(), [&](const stored_entry & e) {
+        return e.model_hash == model_hash && e.device == device;
+    });
+}
+
+std::string auto_tune_results_json(const llama_model * model) {
+    std::lock_guard<std::mutex> lock(g_tune_mutex);
+    const std::string model_hash = model_hash_locked(model);
+    const std::string & device = device_fingerprint();
+
+    std::string json = "{";
+    json += "\"model_hash\":\"" + model_hash + "\",";
+    json += "\"device\":\"" + device + "\",";
+    json += "\"enabled\":" + std::string(g_enabled ? "true" : "false") + ",";
+    json += "\"pareto\":[";
+    bool first = true;
+    for (const auto & entry : g_entries) {
+        if (model_hash.empty() || entry.model_hash != model_hash || entry.device != device) continue;
+        if (!first) json += ",";
+        first = false;
+        json += result_json(entry.result);
+    }
+    json += "]}";
+    return json;
+}
@@ -0,0 +1,83 @@
+/**
+ * auto_tune.h - On-device benchmark of context configurations
+ *
+ * Static device info says little about which thread count, batch sizes, KV
+ * cache type and flash attention mode run fastest for a given model on a given
+ * SoC. The auto-tuner runs short prefill/decode trials over these settings
+ * and keeps the configurations on the speed/memory Pareto front. Results are
+ * stored in a text file keyed by a model hash and a device fingerprint, and
+ * are applied when contexts for the same model are created later.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "llama.h"
+
+struct auto_tune_config {
+    int n_threads = 0;
+    int n_batch = 512;
+    int n_ubatch = 512;
+    ggml_type type_k = GGML_TYPE_F16;
+    ggml_type type_v = GGML_TYPE_F16;
+    llama_flash_attn_type flash_attn = LLAMA_FLASH_ATTN_TYPE_AUTO;
+};
+
+struct auto_tune_result {
+    auto_tune_config config;
+    double prefill_tps = 0;
+    double decode_tps = 0;
+    size_t kv_bytes_per_token = 0;  // KV cache bytes per context token
+
+    // Seconds for a reference request of 512 prompt and 128 generated tokens
+    double reference_seconds() const;
+};
+
+struct auto_tune_options {
+    int n_ctx = 1024;           // context size of the trial contexts
+    int n_prompt = 256;         // prompt tokens per trial
+    int n_decode = 32;          // generated tokens per trial
+    double max_seconds = 90;    // stop starting new trials after this long
+};
+
+// Directory for the results file, e.g. the app's files dir; results are kept in memory only without it
+void auto_tune_set_store_dir(const std::string & dir);
+
+// Enable or disable applying stored results in auto_tune_apply
+void auto_tune_set_enabled(bool enabled);
+
+/**
+ * Hash the model file (size, head and tail) and remember it for the handle,
+ * so later lookups for the model do not touch the file.
+ */
+void auto_tune_register_model(const llama_model * model, const std::string & path);
+
+/**
+ * Benchmark configurations for a registered model. should_abort is polled
+ * between decode calls; an aborted run stores nothing.
+ * Returns the Pareto front, fastest first.
+ */
+std::vector<auto_tune_result> auto_tune_run(llama_model * model, const auto_tune_options & options,
+                                            const std::function<bool()> & should_abort);
+
+// Block until a running auto_tune_run has returned
+void auto_tune_wait_idle();
+
+// Stop a running auto_tune_run (without storing results) and wait for it to return
+void auto_tune_abort();
+
+/**
+ * Replace the performance settings in params with the fastest stored
+ * configuration whose KV cache is no larger than the one params asks for.
+ * Returns false, leaving params untouched, when nothing is stored or tuning is disabled.
+ */
+bool auto_tune_apply(const llama_model * model, llama_context_params & params);
+
+bool auto_tune_has_results(const llama_model * model);
+
+std::string auto_tune_results_json(const llama_model * model);
@@ -0,0 +1,597 @@
+/**
+ * chat_session.cpp - Native chat session with incremental template rendering
+ */
+
+#include "chat_session.h"
+#include "kv_spill.h"
+#include "logging.h"
+#include "prompt_snapshot.h"
+#include "token_pieces.h"
+#include "tokenizer.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+#define LOG_TAG "ChatSession"
+
+// A conversation variant parked in its own sequence of the context
+struct chat_branch {
+    llama_seq_id seq = 0;
+    std::vector<llama_token> kv;           // tokens the sequence holds from position 0
+    uint64_t last_used = 0;
+};
+
+struct chat_session {
+    llama_model * model = nullptr;
+    llama_context * ctx = nullptr;
+    std::string tmpl;                      // template text or built-in name for llama_chat_apply_template
+    std::string template_source;           // "gguf" or "builtin"
+
+    std::vector<chat_session_message> messages;
+    std::string rendered;                  // messages rendered without the assistant prompt
+    std::vector<llama_token> tokens;       // tokens of rendered
+
+    std::string conversation;              // id the KV state is spilled under, empty for none
+    std::vector<llama_token> kv;           // mirror of the KV cache, sequence 0 from position 0
+    uint64_t kv_epoch = 0;
+    std::vector<chat_branch> branches;     // variants forked off sequence 0, resident until evicted
+    uint64_t branch_clock = 0;
+
+    // Last turn, so its reply can be reused when it comes back as a message
+    size_t reply_after = SIZE_MAX;         // number of messages the reply followed
+    std::string reply_header;              // assistant prompt text the template added
+    std::vector<llama_token> reply_header_tokens;
+    std::string reply_text;
+    std::vector<llama_token> reply_tokens;
+
+    std::vector<llama_chat_message> chat;  // scratch for llama_chat_apply_template
+    std::string buf;
+
+    uint64_t turns = 0;
+    uint64_t rebuilds = 0;
+    uint64_t replies_reused = 0;
+    uint64_t tokens_tokenized = 0;
+    uint64_t tokens_reused = 0;
+    uint64_t tokens_decoded = 0;
+    uint64_t forks = 0;
+    uint64_t branch_switches = 0;
+    uint64_t branch_evictions = 0;
+};
+
+namespace {
+
+// Shorter divergent tails are cheaper to decode again than to keep resident
+constexpr size_t MIN_BRANCH_TOKENS = 16;
+
+// Live sessions, so contexts that are replaced or trimmed can reach them
+std::mutex g_sessions_mutex;
+std::vector<chat_session *> g_sessions;
+
+// App template ids and the llama.cpp built-in templates they correspond to
+const char * builtin_template_name(const std::string & id) {
+    static const struct { const char * id; const char * name; } names[] = {
+        {"chatml", "chatml"},
+        {"llama2", "llama2"},
+        {"llama3", "llama3"},
+        {"mistral", "mistral-v1"},
+        {"vicuna", "vicuna"},
+        {"zephyr", "zephyr"},
+        {"phi3", "phi3"},
+        {"gemma", "gemma"},
+        {"deepseek", "deepseek"},
+        {"cohere", "command-r"},
+    };
+    for (const auto & entry : names) {
+        if (id == entry.id) return entry.name;
+    }
+    return nullptr;
+}
+
+bool template_supported(const char * tmpl) {
+    llama_chat_message probe = {"user", "hi"};
+    return tmpl != nullptr && llama_chat_apply_template(tmpl, &probe, 1, true, nullptr, 0) >= 0;
+}
+
+// Render the first n messages into out
+bool render(chat_session & s, size_t n, bool add_assistant, std::string & out) {
+    s.chat.clear();
+    for (size_t i = 0; i < n; i++) {
+        s.chat.push_back({s.messages[i].role.c_str(), s.messages[i].content.c_str()});
+    }
+    if (s.buf.size() < s.rendered.size() + 1024) s.buf.resize(s.rendered.size() * 2 + 1024);
+
+    int32_t len = llama_chat_apply_template(s.tmpl.c_str(), s.chat.data(), n, add_assistant,
+                                            &s.buf[0], (int32_t) s.buf.size());
+    if (len > (int32_t) s.buf.size()) {
+        s.buf.resize(len);
+        len = llama_chat_apply_template(s.tmpl.c_str(), s.chat.data(), n, add_assistant,
+                                        &s.buf[0], (int32_t) s.buf.size());
+    }
+    if (len < 0) return false;
+    out.assign(s.buf.data(), len);
+    return true;
+}
+
+bool starts_with(const std::string & s, const std::string & prefix) {
+    return s.size() >= prefix.size() && s.compare(0, prefix.size(), prefix) == 0;
+}
+
+// Tokenize text and append it; BOS and friends are only added at the start of the sequence
+bool append_tokens(chat_session & s, const std::string & text, std::vector<llama_token> & out) {
+    if (text.empty()) return true;
+    tokenizer_flags flags;
+    flags.add_special = out.empty();
+    flags.parse_special = true;
+    std::vector<llama_token> delta;
+    if (!tokenizer_tokenize(s.model, text.data(), text.size(), flags, delta)) return false;
+    out.insert(out.end(), delta.begin(), delta.end());
+    s.tokens_tokenized += delta.size();
+    return true;
+}
+
+void clear_committed(chat_session & s) {
+    s.messages.clear();
+    s.rendered.clear();
+    s.tokens.clear();
+}
+
+// Add one message, tokenizing only the text it adds to the rendering
+bool commit_message(chat_session & s, const chat_session_message & message, std::string & error) {
+    const size_t index = s.messages.size();
+    s.messages.push_back(message);
+
+    std::string next;
+    if (!render(s, s.messages.size(), false, next)) {
+        error = "Failed to apply chat template";
+        return false;
+    }
+
+    if (!starts_with(next, s.rendered)) {
+        // The template rewrote earlier turns: tokenize the whole conversation again
+        LOGD("Template output is not prefix-stable at message %zu, re-tokenizing", index);
+        s.rebuilds++;
+        s.tokens.clear();
+        s.rendered = next;
+        if (!append_tokens(s, next, s.tokens)) {
+            error = "Failed to tokenize conversation";
+            return false;
+        }
+        return true;
+    }
+
+    // Reuse last turn's sampled tokens if this is that reply, rendered verbatim
+    const size_t reply_start = s.rendered.size() + s.reply_header.size();
+    if (index == s.reply_after && message.role == "assistant" && message.content == s.reply_text &&
+        next.size() >= reply_start + s.reply_text.size() &&
+        next.compare(s.rendered.size(), s.reply_header.size(), s.reply_header) == 0 &&
+        next.compare(reply_start, s.reply_text.size(), s.reply_text) == 0) {
+        s.tokens.insert(s.tokens.end(), s.reply_header_tokens.begin(), s.reply_header_tokens.end());
+        s.tokens.insert(s.tokens.end(), s.reply_tokens.begin(), s.reply_tokens.end());
+        s.replies_reused++;
+        const std::string closing = next.substr(reply_start + s.reply_text.size());
+        s.rendered = next;
+        if (!append_tokens(s, closing, s.tokens)) {
+            error = "Failed to tokenize message";
+            return false;
+        }
+        return true;
+    }
+
+    const std::string delta = next.substr(s.rendered.size());
+    s.rendered = next;
+    if (!append_tokens(s, delta, s.tokens)) {
+        error = "Failed to tokenize message";
+        return false;
+    }
+    return true;
+}
+
+size_t common_prefix(const std::vector<llama_token> & a, const std::vector<llama_token> & b) {
+    const size_t n = std::min(a.size(), b.size());
+    size_t i = 0;
+    while (i < n && a[i] == b[i]) i++;
+    return i;
+}
+
+// Forget the cache mirror if something else cleared or wrote to the context
+void check_kv(chat_session & s) {
+    llama_memory_t mem = llama_get_memory(s.ctx);
+    const bool epoch_changed = generation_kv_epoch(s.ctx) != s.kv_epoch;
+    const bool length_changed = mem != nullptr && llama_memory_seq_pos_max(mem, 0) + 1 != (llama_pos) s.kv.size();
+    if (!epoch_changed && !length_changed) return;
+
+    if (!s.kv.empty()) LOGD("KV cache changed outside the session, dropping %zu cached tokens", s.kv.size());
+    if (mem != nullptr) llama_memory_clear(mem, true);
+    s.kv.clear();
+    s.branches.clear();
+    s.kv_epoch = generation_kv_epoch(s.ctx);
+}
+
+void evict_branch(chat_session & s, llama_memory_t mem, size_t index) {
+    LOGD("Evicting branch in sequence %d (%zu tokens)", s.branches[index].seq, s.branches[index].kv.size());
+    llama_memory_seq_rm(mem, s.branches[index].seq, -1, -1);
+    s.branches.erase(s.branches.begin() + index);
+    s.branch_evictions++;
+}
+
+// Least recently used branch other than keep, or SIZE_MAX
+size_t lru_branch(const chat_session & s, llama_seq_id keep) {
+    size_t lru = SIZE_MAX;
+    for (size_t i = 0; i < s.branches.size(); i++) {
+        if (s.branches[i].seq == keep) continue;
+        if (lru == SIZE_MAX || s.branches[i].last_used < s.branches[lru].last_used) lru = i;
+    }
+    return lru;
+}
+
+// A sequence no branch uses, evicting the least recently used branch other than keep if needed
+llama_seq_id free_sequence(chat_session & s, llama_memory_t mem, llama_seq_id keep) {
+    const llama_seq_id n_seq = (llama_seq_id) llama_n_seq_max(s.ctx);
+    for (llama_seq_id seq = 1; seq < n_seq; seq++) {
+        bool used = false;
+        for (const auto & branch : s.branches) used = used || branch.seq == seq;
+        if (!used) return seq;
+    }
+    const size_t lru = lru_branch(s, keep);
+    if (lru == SIZE_MAX) return -1;
+    const llama_seq_id seq = s.branches[lru].seq;
+    evict_branch(s, mem, lru);
+    return seq;
+}
+
+// Fork sequence 0 before it loses everything after n_keep, so the variant stays resident
+void park_active(chat_session & s, llama_memory_t mem, size_t n_keep, llama_seq_id keep) {
+    if (s.kv.size() < n_keep + MIN_BRANCH_TOKENS) return;
+    for (const auto & branch : s.branches) {
+        if (common_prefix(branch.kv, s.kv) == s.kv.size()) return;  // already held by a branch
+    }
+    const llama_seq_id seq = free_sequence(s, mem, keep);
+    if (seq < 0) return;
+    llama_memory_seq_cp(mem, 0, seq, -1, -1);
+    s.branches.push_back({seq, s.kv, ++s.branch_clock});
+    s.forks++;
+    LOGD("Forked %zu tokens into sequence %d, diverging at %zu", s.kv.size(), seq, n_keep);
+}
+
+// Cells the branches hold beyond the part they share with sequence 0
+size_t branch_cells(const chat_session & s) {
+    size_t cells = 0;
+    for (const auto & branch : s.branches) cells += branch.kv.size() - common_prefix(branch.kv, s.kv);
+    return cells;
+}
+
+// Move the conversation's KV state to the disk tier and empty the context. Returns the tokens spilled.
+size_t spill(chat_session & s) {
+    check_kv(s);
+    const size_t n_spilled = kv_spill_save(s.ctx, s.model, 0, s.conversation, s.kv) ? s.kv.size() : 0;
+    llama_memory_t mem = llama_get_memory(s.ctx);
+    if (mem != nullptr) llama_memory_clear(mem, true);
+    generation_invalidate_kv(s.ctx);
+    s.kv.clear();
+    s.branches.clear();
+    s.kv_epoch = generation_kv_epoch(s.ctx);
+    return n_spilled;
+}
+
+/**
+ * Make sequence 0 the resident variant sharing the longest prefix with
+ * prompt: keep it if no branch matches more, otherwise park it and move
+ * the best branch into sequence 0. Only cache metadata is touched.
+ */
+void select_branch(chat_session & s, llama_memory_t mem, const std::vector<llama_token> & prompt) {
+    const size_t limit = prompt.size() - 1;
+    size_t best_match = std::min(common_prefix(s.kv, prompt), limit);
+    size_t best = SIZE_MAX;
+    for (size_t i = 0; i < s.branches.size(); i++) {
+        const size_t match = std::min(common_prefix(s.branches[i].kv, prompt), limit);
+        if (match > best_match) {
+            best_match = match;
+            best = i;
+        }
+    }
+    if (best == SIZE_MAX) {
+        park_active(s, mem, best_match, -1);
+        return;
+    }
+
+    const llama_seq_id seq = s.branches[best].seq;
+    park_active(s, mem, best_match, seq);
+    for (auto it = s.branches.begin(); it != s.branches.end(); ++it) {
+        if (it->seq != seq) continue;
+        llama_memory_seq_rm(mem, 0, -1, -1);
+        llama_memory_seq_cp(mem, seq, 0, -1, -1);
+        llama_memory_seq_rm(mem, seq, -1, -1);
+        s.kv = std::move(it->kv);
+        s.branches.erase(it);
+        s.branch_switches++;
+        LOGD("Switched to branch from sequence %d, %zu tokens match", seq, best_match);
+        break;
+    }
+}
+
+} // namespace
+
+int chat_session_cells_needed(const chat_session * session, const std::vector<chat_session_message> & messages,
+                              int max_tokens) {
+    // Template markup around a message and the assistant prompt, in tokens
+    constexpr size_t MESSAGE_MARKUP = 16;
+
+    size_t cells = (size_t) std::max(0, max_tokens) + MESSAGE_MARKUP;
+    size_t known = 0;
+    if (session != nullptr && session->messages.size() <= messages.size()) {
+        known = session->messages.size();
+        for (size_t i = 0; i < known; i++) {
+            if (session->messages[i].role != messages[i].role || session->messages[i].content != messages[i].content) {
+                known = 0;
+                break;
+            }
+        }
+    }
+    if (known > 0) cells += session->tokens.size();
+    // A token covers at least one byte of text
+    for (size_t i = known; i < messages.size(); i++) cells += messages[i].content.size() + MESSAGE_MARKUP;
+    if (session != nullptr) cells += branch_cells(*session);
+    return (int) std::min<size_t>(cells, INT32_MAX);
+}
+
+chat_session * chat_session_create(llama_model * model, llama_context * ctx, const std::string & template_id) {
+    if (model == nullptr || ctx == nullptr) return nullptr;
+
+    const char * builtin = builtin_template_name(template_id);
+    if (builtin == nullptr && template_id != "auto" && !template_id.empty()) {
+        LOGD("No built-in chat template for '%s'", template_id.c_str());
+        return nullptr;
+    }
+
+    std::unique_ptr<chat_session> session(new chat_session());
+    const char * embedded = llama_model_chat_template(model, nullptr);
+    if (template_supported(embedded)) {
+        session->tmpl = embedded;
+        session->template_source = "gguf";
+    } else if (template_supported(builtin)) {
+        session->tmpl = builtin;
+        session->template_source = "builtin";
+    } else {
+        LOGW("Chat template '%s' is not supported by llama.cpp", template_id.c_str());
+        return nullptr;
+    }
+
+    session->model = model;
+    session->ctx = ctx;
+    session->kv_epoch = generation_kv_epoch(ctx) - 1;  // never trust what the cache holds now
+    LOGI("Created chat session (%s template, requested '%s')",
+         session->template_source.c_str(), template_id.c_str());
+
+    std::lock_guard<std::mutex> lock(g_sessions_mutex);
+    g_sessions.push_back(session.get());
+    return session.release();
+}
+
+void chat_session_free(chat_session * session) {
+    if (session == nullptr) return;
+    {
+        std::lock_guard<std::mutex> lock(g_sessions_mutex);
+        g_sessions.erase(std::remove(g_sessions.begin(), g_sessions.end(), session), g_sessions.end());
+    }
+    delete session;
+}
+
+bool chat_session_generate(chat_session * session, const std::vector<chat_session_message> & messages,
+                           const generation_params & params,
+                           const std::function<void(const std::string & piece)> & on_piece,
+                           std::string & error, generation_stats * stats) {
+    TRACE_SCOPE("chat_session_generate");
+    if (session == nullptr) {
+        error = "No chat session";
+        return false;
+    }
+    chat_session & s = *session;
+    if (messages.empty()) {
+        error = "No messages";
+        return false;
+    }
+
+    // Keep the messages that did not change, start over from the first one that did
+    size_t keep = 0;
+    while (keep < s.messages.size() && keep < messages.size() &&
+           s.messages[keep].role == messages[keep].role &&
+           s.messages[keep].content == messages[keep].content) {
+        keep++;
+    }
+    if (keep < s.messages.size()) {
+        LOGD("Conversation changed at message %zu of %zu, rebuilding", keep, s.messages.size());
+        s.rebuilds++;
+        clear_committed(s);
+        keep = 0;
+    }
+    {
+        TRACE_SCOPE("render_tokenize");
+        for (size_t i = keep; i < messages.size(); i++) {
+            if (!commit_message(s, messages[i], error)) {
+                clear_committed(s);
+                return false;
+            }
+        }
+    }
+
+    // Assistant prompt: the text the template adds to ask for the reply
+    std::string full;
+    if (!render(s, s.messages.size(), true, full)) {
+        error = "Failed to apply chat template";
+        return false;
+    }
+    std::vector<llama_token> prompt;
+    std::string header;
+    std::vector<llama_token> header_tokens;
+    const bool incremental = starts_with(full, s.rendered);
+    if (incremental) {
+        header = full.substr(s.rendered.size());
+        prompt = s.tokens;
+        const size_t n_before = prompt.size();
+        if (!append_tokens(s, header, prompt)) {
+            error = "Failed to tokenize prompt";
+            return false;
+        }
+        header_tokens.assign(prompt.begin() + n_before, prompt.end());
+    } else if (!append_tokens(s, full, prompt)) {
+        error = "Failed to tokenize prompt";
+        return false;
+    }
+    if (prompt.empty()) {
+        error = "Prompt tokenized to zero tokens";
+        return false;
+    }
+
+    // Decode from the first token that differs from the cache, keeping at least one for logits
+    check_kv(s);
+    if (s.kv.empty() && !s.conversation.empty()) {
+        // The conversation was spilled when it went idle: read it back instead of prefilling
+        std::vector<llama_token> restored;
+        if (kv_spill_restore(s.ctx, s.model, 0, s.conversation, restored)) s.kv = std::move(restored);
+    }
+    if (s.kv.empty()) {
+        // Cold cache: start from a stored snapshot of the system prompt if there is one
+        const int n_restored = prompt_snapshot_restore(s.ctx, s.model, prompt.data(), (int) prompt.size());
+        s.kv.assign(prompt.begin(), prompt.begin() + n_restored);
+    }
+    llama_memory_t mem = llama_get_memory(s.ctx);
+    if (mem != nullptr && !s.kv.empty()) select_branch(s, mem, prompt);
+    size_t n_keep = std::min(common_prefix(s.kv, prompt), prompt.size() - 1);
+    if (n_keep < s.kv.size() && mem != nullptr && !llama_memory_seq_rm(mem, 0, (llama_pos) n_keep, -1)) {
+        LOGW("Could not trim the KV cache, decoding the whole prompt");
+        llama_memory_clear(mem, true);
+        s.branches.clear();
+        n_keep = 0;
+    }
+    s.kv.resize(n_keep);
+
+    // All sequences share the context's cells: make room for this turn
+    const size_t n_ctx = llama_n_ctx(s.ctx);
+    const size_t n_needed = std::min(n_ctx, prompt.size() + (size_t) std::max(0, params.max_tokens));
+    while (!s.branches.empty() && n_needed + branch_cells(s) > n_ctx) {
+        evict_branch(s, mem, lru_branch(s, -1));
+    }
+
+    LOGI("Chat turn: %zu messages, %zu prompt tokens, %zu reused from the cache",
+         s.messages.size(), prompt.size(), n_keep);
+
+    std::vector<llama_token> generated;
+    generated.reserve(std::max(0, params.max_tokens));
+    bool ok = generation_run_tokens(s.ctx, s.model, prompt.data() + n_keep, (int) (prompt.size() - n_keep),
+                                    (int) n_keep, params, on_piece, error, stats, &generated);
+    s.turns++;
+    s.tokens_reused += n_keep;
+    s.kv_epoch = generation_kv_epoch(s.ctx);
+    if (!ok) {
+        // A failed prefill leaves the cache partly written; start clean next turn
+        if (mem != nullptr) llama_memory_clear(mem, true);
+        s.kv.clear();
+        s.branches.clear();
+        s.reply_after = SIZE_MAX;
+        return false;
+    }
+    s.tokens_decoded += prompt.size() - n_keep;
+
+    s.kv = std::move(prompt);
+    s.kv.insert(s.kv.end(), generated.begin(), generated.end());
+
+    // Remember the reply for reuse when it comes back as the assistant message
+    s.reply_after = incremental ? s.messages.size() : SIZE_MAX;
+    s.reply_header = std::move(header);
+    s.reply_header_tokens = std::move(header_tokens);
+    s.reply_tokens = std::move(generated);
+    s.reply_text.clear();
+    std::shared_ptr<const token_piece_table> pieces = token_pieces_for(s.model);
+    if (pieces != nullptr) {
+        token_pieces_detokenize(*pieces, s.reply_tokens.data(), s.reply_tokens.size(), true, s.reply_text);
+    }
+    return true;
+}
+
+void chat_session_set_context(chat_session * session, llama_context * ctx) {
+    if (session != nullptr && ctx != nullptr) session->ctx = ctx;
+}
+
+void chat_session_set_conversation(chat_session * session, const std::string & id) {
+    if (session == nullptr || session->conversation == id) return;
+    chat_session & s = *session;
+    if (!s.conversation.empty() || !s.kv.empty()) spill(s);
+    clear_committed(s);
+    s.reply_after = SIZE_MAX;
+    s.conversation = id;
+}
+
+size_t chat_session_spill(const llama_context * ctx) {
+    std::lock_guard<std::mutex> lock(g_sessions_mutex);
+    size_t n_spilled = 0;
+    for (chat_session * session : g_sessions) {
+        if (ctx != nullptr && session->ctx != ctx) continue;
+        n_spilled += spill(*session);
+    }
+    return n_spilled;
+}
+
+void chat_session_move_context(const llama_context * from, llama_context * to) {
+    std::lock_guard<std::mutex> lock(g_sessions_mutex);
+    for (chat_session * session : g_sessions) {
+        if (session->ctx == from) session->ctx = to;
+    }
+}
+
+size_t chat_session_drop_branches() {
+    std::lock_guard<std::mutex> lock(g_sessions_mutex);
+    size_t cells = 0;
+    for (chat_session * session : g_sessions) {
+        chat_session & s = *session;
+        if (s.branches.empty()) continue;
+        // After another user of the context the sequences are no longer the branches'
+        if (generation_kv_epoch(s.ctx) != s.kv_epoch) {
+            s.branches.clear();
+            continue;
+        }
+        cells += branch_cells(s);
+        llama_memory_t mem = llama_get_memory(s.ctx);
+        while (!s.branches.empty()) evict_branch(s, mem, s.branches.size() - 1);
+    }
+    if (cells > 0) LOGI("Dropped parked branches holding %zu cells", cells);
+    return cells;
+}
+
+const llama_model * chat_session_model(const chat_session * session) {
+    return session != nullptr ? session->model : nullptr;
+}
+
+void chat_session_reset(chat_session * session) {
+    if (session == nullptr) return;
+    clear_committed(*session);
+    session->kv.clear();
+    session->branches.clear();
+    session->kv_epoch = generation_kv_epoch(session->ctx) - 1;
+    session->reply_after = SIZE_MAX;
+}
+
+std::string chat_session_stats_json(const chat_session * session) {
+    if (session == nullptr) return "{}";
+    const chat_session & s = *session;
+    std::string json = "{";
+    json += "\"template_source\":\"" + s.template_source + "\",";
+    json += "\"messages\":" + std::to_string(s.messages.size()) + ",";
+    json += "\"conversation_tokens\":" + std::to_string(s.tokens.size()) + ",";
+    json += "\"kv_tokens\":" + std::to_string(s.kv.size()) + ",";
+    json += "\"branches\":" + std::to_string(s.branches.size()) + ",";
+    json += "\"branch_cells\":" + std::to_string(branch_cells(s)) + ",";
+    json += "\"turns\":" + std::to_string(s.turns) + ",";
+    json += "\"rebuilds\":" + std::to_string(s.rebuilds) + ",";
+    json += "\"replies_reused\":" + std::to_string(s.replies_reused) + ",";
+    json += "\"tokens_tokenized\":" + std::to_string(s.tokens_tokenized) + ",";
+    json += "\"tokens_reused\":" + std::to_string(s.tokens_reused) + ",";
+    json += "\"tokens_decoded\":" + std::to_string(s.tokens_decoded) + ",";
+    json += "\"forks\":" + std::to_string(s.forks) + ",";
+    json += "\"branch_switches\":" + std::to_string(s.branch_switches) + ",";
+    json += "\"branch_evictions\":" + std::to_string(s.branch_evictions);
+    json += "}";
+    return json;
+}
@@ -0,0 +1,120 @@
+/**
+ * chat_session.h - Native chat session with incremental template rendering
+ *
+ * A session holds the messages of one conversation and mirrors the tokens in
+ * its context's KV cache. Every turn the caller passes the full message list.
+ * Messages unchanged since the last turn keep their tokens. New messages are
+ * rendered with llama_chat_apply_template, and only the text they add to the
+ * rendering is tokenized. The prompt is then decoded from the first token
+ * that differs from the cache, so a follow-up question costs its own tokens
+ * plus the template's turn markers.
+ *
+ * When the reply generated last turn comes back unchanged as the assistant
+ * message, its sampled tokens are reused as is instead of being
+ * re-tokenized, so they stay aligned with the cache.
+ *
+ * Regenerating or editing forks the conversation: before sequence 0 is
+ * trimmed back to the shared prefix, its cells are copied into a spare
+ * sequence with llama_memory_seq_cp, so the abandoned variant stays resident.
+ * A later turn that continues a parked variant switches it back into
+ * sequence 0 without decoding. Branches are evicted least recently used
+ * first, when sequences run out or the cells are needed for a new turn.
+ *
+ * A session tagged with a conversation id spills its KV state to disk
+ * (kv_spill) when it switches to another conversation or is trimmed, and
+ * reads it back on the next turn of that conversation.
+ */
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "generation.h"
+#include "llama.h"
+
+struct chat_session;
+
+struct chat_session_message {
+    std::string role;     // "system", "user" or "assistant"
+    std::string content;
+};
+
+/**
+ * Create a session that generates in ctx, which it then expects to have to
+ * itself: other users of the context are detected through
+ * generation_kv_epoch and cost a full prefill on the next turn. Branches
+ * need a context with more than one sequence (generation_context_params).
+ *
+ * template_id is an app template name ("chatml", "llama3", ...) or "auto".
+ * The model's embedded GGUF template is preferred when llama.cpp recognises
+ * it. Otherwise the built-in template of that name is used. Returns nullptr
+ * when neither is available (e.g. "alpaca" or "raw"); callers then build the
+ * prompt themselves.
+ */
+chat_session * chat_session_create(llama_model * model, llama_context * ctx, const std::string & template_id);
+
+// Free the session. Its tokens stay in the context's KV cache until the next user clears them.
+void chat_session_free(chat_session * session);
+
+/**
+ * Bring the session to messages, render the assistant prompt and generate
+ * the reply. The reply is not added to the session: pass it back as the last
+ * message of the next turn.
+ */
+bool chat_session_generate(chat_session * session, const std::vector<chat_session_message> & messages,
+                           const generation_params & params,
+                           const std::function<void(const std::string & piece)> & on_piece,
+                           std::string & error, generation_stats * stats = nullptr);
+
+/**
+ * KV cells the session needs to answer messages with up to max_tokens:
+ * the cached tokens of the messages it already holds, an upper bound
+ * (bytes plus template markup) for the others, and its parked branches.
+ * Nothing is tokenized, so it is cheap enough to size the context every turn.
+ */
+int chat_session_cells_needed(const chat_session * session, const std::vector<chat_session_message> & messages,
+                              int max_tokens);
+
+/**
+ * Generate in ctx from now on, e.g. after the context was replaced by a
+ * larger one holding the same KV contents (generation_move_kv keeps the
+ * cached tokens valid; otherwise the next turn prefills again).
+ */
+void chat_session_set_context(chat_session * session, llama_context * ctx);
+
+/**
+ * Continue conversation id (empty for none) from the next turn on. When it
+ * differs from the current one, the current conversation's KV state is
+ * spilled to disk and the context emptied; the first turn of id reads its
+ * own state back if it was spilled before.
+ */
+void chat_session_set_conversation(chat_session * session, const std::string & id);
+
+/**
+ * Spill the conversations of all sessions generating in ctx (all sessions
+ * for nullptr) and empty their contexts, e.g. before the cache is cleared or
+ * under memory pressure. Call while no session generates. Returns the
+ * tokens written to the disk tier.
+ */
+size_t chat_session_spill(const llama_context * ctx);
+
+// Re-point every session generating in from to to, which holds the same KV contents
+void chat_session_move_context(const llama_context * from, llama_context * to);
+
+/**
+ * Evict the parked branches of every session, e.g. under memory pressure.
+ * Call while no session generates. Returns the KV cells they held beyond the
+ * active conversation.
+ */
+size_t chat_session_drop_branches();
+
+// Model the session generates with
+const llama_model * chat_session_model(const chat_session * session);
+
+// Drop all messages and forget the cached tokens
+void chat_session_reset(chat_session * session);
+
+// Template in use, message and token counts, and reuse counters as a JSON object string
+std::string chat_session_stats_json(const chat_session * session);
@@ -0,0 +1,131 @@
+/**
+ * chunk_dedup.cpp - Near-duplicate detection for RAG document chunks
+ */
+
+#include "chunk_dedup.h"
+
+#include <cctype>
+#include <unordered_map>
+
+namespace {
+
+uint64_t fnv1a(const char * data, size_t len) {
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (uint8_t) data[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// splitmix64 finalizer, used to derive independent hash permutations
+uint64_t mix64(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+void split_words(const std::string & text, std::vector<uint64_t> & words) {
+    words.clear();
+    std::string word;
+    for (size_t i = 0; i <= text.size(); i++) {
+        const unsigned char c = i < text.size() ? (unsigned char) text[i] : ' ';
+        // Bytes >= 0x80 belong to UTF-8 sequences and are kept as word characters
+        if (std::isalnum(c) || c >= 0x80) {
+            word += (char) std::tolower(c);
+        } else if (!word.empty()) {
+            words.push_back(fnv1a(word.data(), word.size()));
+            word.clear();
+        }
+    }
+}
+
+uint64_t band_key(const chunk_signature & sig, int band) {
+    uint64_t h = mix64((uint64_t) band);
+    for (int r = 0; r < CHUNK_DEDUP_ROWS; r++) {
+        h = mix64(h ^ sig.mins[band * CHUNK_DEDUP_ROWS + r]);
+    }
+    return h;
+}
+
+} // namespace
+
+void chunk_dedup_signature(const std::string & text, chunk_signature & sig) {
+    for (auto & m : sig.mins) m = UINT64_MAX;
+    sig.empty = true;
+
+    std::vector<uint64_t> words;
+    split_words(text, words);
+    if (words.empty()) return;
+
+    const size_t n_shingles = words.size() >= CHUNK_DEDUP_SHINGLE
+        ? words.size() - CHUNK_DEDUP_SHINGLE + 1
+        : 1;
+
+    for (size_t i = 0; i < n_shingles; i++) {
+        uint64_t shingle = 0;
+        for (size_t w = i; w < words.size() && w < i + CHUNK_DEDUP_SHINGLE; w++) {
+            shingle = mix64(shingle ^ words[w]);
+        }
+        for (int k = 0; k < CHUNK_DEDUP_NUM_HASHES; k++) {
+            const uint64_t h = mix64(shingle ^ (0x5bd1e995ULL * (k + 1)));
+            if (h < sig.mins[k]) sig.mins[k] = h;
+        }
+    }
+    sig.empty = false;
+}
+
+float chunk_dedup_similarity(const chunk_signature & a, const chunk_signature & b) {
+    if (a.empty || b.empty) return 0.0f;
+    int equal = 0;
+    for (int k = 0; k < CHUNK_DEDUP_NUM_HASHES; k++) {
+        if (a.mins[k] == b.mins[k]) equal++;
+    }
+    return (float) equal / CHUNK_DEDUP_NUM_HASHES;
+}
+
+std::vector<int> chunk_dedup_representatives(const std::vector<std::string> & texts,
+                                             float similarity_threshold) {
+    const int n = (int) texts.size();
+    std::vector<int> reps(n);
+    std::vector<chunk_signature> sigs(n);
+
+    // LSH buckets only hold representatives, so clusters anchor on first occurrence
+    std::unordered_map<uint64_t, std::vector<int>> buckets;
+    std::vector<int> candidates;
+
+    for (int i = 0; i < n; i++) {
+        reps[i] = i;
+        chunk_dedup_signature(texts[i], sigs[i]);
+        if (sigs[i].empty) continue;
+
+        candidates.clear();
+        for (int b = 0; b < CHUNK_DEDUP_BANDS; b++) {
+            auto it = buckets.find(band_key(sigs[i], b));
+            if (it == buckets.end()) continue;
+            candidates.insert(candidates.end(), it->second.begin(), it->second.end());
+        }
+
+        int best = -1;
+        float best_sim = similarity_threshold;
+        for (int j : candidates) {
+            const float sim = chunk_dedup_similarity(sigs[i], sigs[j]);
+            if (sim >= best_sim) {
+                best_sim = sim;
+                best = j;
+            }
+        }
+
+        if (best >= 0) {
+            reps[i] = best;
+            continue;
+        }
+
+        for (int b = 0; b < CHUNK_DEDUP_BANDS; b++) {
+            buckets[band_key(sigs[i], b)].push_back(i);
+        }
+    }
+
+    return reps;
+}
@@ -0,0 +1,44 @@
+/**
+ * chunk_dedup.h - Near-duplicate detection for RAG document chunks
+ *
+ * Uses MinHash signatures over word shingles with LSH banding to find
+ * candidate pairs, then verifies candidates by estimated Jaccard similarity.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Number of MinHash permutations; must equal CHUNK_DEDUP_BANDS * CHUNK_DEDUP_ROWS
+#define CHUNK_DEDUP_NUM_HASHES 64
+#define CHUNK_DEDUP_BANDS 16
+#define CHUNK_DEDUP_ROWS 4
+
+// Words per shingle
+#define CHUNK_DEDUP_SHINGLE 3
+
+struct chunk_signature {
+    uint64_t mins[CHUNK_DEDUP_NUM_HASHES];
+    bool empty = true;
+};
+
+/**
+ * Compute the MinHash signature of a chunk. Text is lowercased and split on
+ * non-alphanumeric characters, so punctuation and spacing changes are ignored.
+ */
+void chunk_dedup_signature(const std::string & text, chunk_signature & sig);
+
+// Estimated Jaccard similarity between two signatures
+float chunk_dedup_similarity(const chunk_signature & a, const chunk_signature & b);
+
+/**
+ * Find a representative for every chunk. Chunks are visited in order and a
+ * chunk whose estimated similarity to an earlier representative reaches the
+ * threshold is mapped to it; otherwise it becomes its own representative.
+ *
+ * @return representative index per input chunk (reps[i] == i for kept chunks)
+ */
+std::vector<int> chunk_dedup_representatives(const std::vector<std::string> & texts,
+                                             float similarity_threshold);
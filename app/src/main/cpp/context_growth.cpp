@@ -0,0 +1,227 @@
+/**
+ * context_growth.cpp - Contexts whose KV cache grows with the conversation
+ */
+
+#include "context_growth.h"
+#include "chat_session.h"
+#include "context_pool.h"
+#include "generation.h"
+#include "kv_estimate.h"
+#include "logging.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#define LOG_TAG "ContextGrowth"
+
+struct growing_context {
+    llama_model * model = nullptr;
+    llama_context_params params = {};  // n_ctx is the current size
+    int max_cells = 0;
+    bool grow = false;
+    llama_context * ctx = nullptr;
+};
+
+namespace {
+
+std::mutex g_growth_mutex;
+std::vector<growing_context *> g_live;
+uint64_t g_growths = 0;
+uint64_t g_growth_failures = 0;
+uint64_t g_shrinks = 0;
+uint64_t g_bytes_copied = 0;
+double g_growth_ms = 0;
+
+double ms_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int initial_cells(int max_cells) {
+    return std::min(max_cells, CONTEXT_GROWTH_MIN_CELLS);
+}
+
+// Next size for n_cells: the current size doubled until it fits, capped at the ceiling
+int grown_cells(const growing_context & gc, int n_cells) {
+    int cells = std::max<int>(gc.params.n_ctx, 1);
+    while (cells < n_cells && cells < gc.max_cells) cells *= 2;
+    return std::min(cells, gc.max_cells);
+}
+
+// Swap in a context of n_cells; with copy, the KV contents move over first
+bool replace_locked(growing_context & gc, int n_cells, bool copy) {
+    llama_context_params params = gc.params;
+    params.n_ctx = (uint32_t) n_cells;
+    llama_context * next = context_pool_acquire(gc.model, params);
+    if (next == nullptr) return false;
+
+    if (copy) {
+        std::vector<uint8_t> state(llama_state_get_size(gc.ctx));
+        if (state.empty() ||
+            llama_state_get_data(gc.ctx, state.data(), state.size()) != state.size() ||
+            llama_state_set_data(next, state.data(), state.size()) != state.size()) {
+            LOGE("Failed to move KV contents to a context of %d cells", n_cells);
+            context_pool_discard(next);
+            return false;
+        }
+        g_bytes_copied += state.size();
+        generation_move_kv(gc.ctx, next);
+    }
+
+    chat_session_move_context(gc.ctx, next);
+    context_pool_discard(gc.ctx);
+    gc.ctx = next;
+    gc.params = params;
+    return true;
+}
+
+// Cells held across ctx's sequences; cells shared by several sequences count once per sequence
+int used_cells(llama_context * ctx) {
+    llama_memory_t mem = llama_get_memory(ctx);
+    if (mem == nullptr) return 0;
+    int used = 0;
+    for (llama_seq_id seq = 0; seq < (llama_seq_id) llama_n_seq_max(ctx); seq++) {
+        used += llama_memory_seq_pos_max(mem, seq) + 1;
+    }
+    return used;
+}
+
+size_t kv_bytes(const growing_context & gc, uint32_t n_cells) {
+    return kv_cache_estimate_bytes(gc.model, n_cells, gc.params.type_k, gc.params.type_v);
+}
+
+} // namespace
+
+llama_context_params growing_context_initial_params(const llama_context_params & params, bool grow) {
+    llama_context_params initial = params;
+    if (grow) initial.n_ctx = (uint32_t) initial_cells((int) params.n_ctx);
+    return initial;
+}
+
+growing_context * growing_context_create(llama_model * model, const llama_context_params & params, bool grow) {
+    const llama_context_params initial = growing_context_initial_params(params, grow);
+    llama_context * ctx = context_pool_acquire(model, initial);
+    if (ctx == nullptr) return nullptr;
+
+    growing_context * gc = new growing_context();
+    gc->model = model;
+    gc->params = initial;
+    gc->max_cells = (int) params.n_ctx;
+    gc->grow = grow && initial.n_ctx < params.n_ctx;
+    gc->ctx = ctx;
+    if (gc->grow) {
+        LOGI("Growing context: %u of %d cells, est. KV %zu of %zu bytes", initial.n_ctx, gc->max_cells,
+             kv_cache_estimate_bytes(model, initial.n_ctx, initial.type_k, initial.type_v),
+             kv_cache_estimate_bytes(model, gc->max_cells, initial.type_k, initial.type_v));
+    }
+
+    std::lock_guard<std::mutex> lock(g_growth_mutex);
+    g_live.push_back(gc);
+    return gc;
+}
+
+void growing_context_free(growing_context * gc) {
+    if (gc == nullptr) return;
+    {
+        std::lock_guard<std::mutex> lock(g_growth_mutex);
+        g_live.erase(std::remove(g_live.begin(), g_live.end(), gc), g_live.end());
+    }
+    // A grown context is not what the next create asks for, so it is not kept idle
+    const bool grown = gc->grow && (int) gc->params.n_ctx > initial_cells(gc->max_cells);
+    if (grown ? !context_pool_discard(gc->ctx) : !context_pool_release(gc->ctx)) {
+        generation_release(gc->ctx);
+        llama_free(gc->ctx);
+    }
+    delete gc;
+}
+
+llama_context * growing_context_get(const growing_context * gc) {
+    std::lock_guard<std::mutex> lock(g_growth_mutex);
+    return gc != nullptr ? gc->ctx : nullptr;
+}
+
+int growing_context_max_cells(const growing_context * gc) {
+    return gc != nullptr ? gc->max_cells : 0;
+}
+
+llama_context * growing_context_reserve(growing_context * gc, int n_cells) {
+    if (gc == nullptr) return nullptr;
+    std::lock_guard<std::mutex> lock(g_growth_mutex);
+    if (!gc->grow || n_cells <= (int) gc->params.n_ctx || (int) gc->params.n_ctx >= gc->max_cells) {
+        return gc->ctx;
+    }
+
+    TRACE_SCOPE("context_grow");
+    const auto start = std::chrono::steady_clock::now();
+    const uint32_t from = gc->params.n_ctx;
+    const int to = grown_cells(*gc, n_cells);
+    if (!replace_locked(*gc, to, true)) {
+        g_growth_failures++;
+        LOGW("Could not grow context from %u to %d cells, keeping it", from, to);
+        return gc->ctx;
+    }
+    g_growths++;
+    g_growth_ms += ms_since(start);
+    LOGI("Grew context from %u to %d cells for %d needed in %.0f ms", from, to, n_cells, ms_since(start));
+    return gc->ctx;
+}
+
+llama_context * growing_context_clear(growing_context * gc) {
+    if (gc == nullptr) return nullptr;
+    std::lock_guard<std::mutex> lock(g_growth_mutex);
+    const int initial = initial_cells(gc->max_cells);
+    if (gc->grow && (int) gc->params.n_ctx > initial && replace_locked(*gc, initial, false)) {
+        g_shrinks++;
+        LOGI("Shrank context to %d cells", initial);
+        return gc->ctx;
+    }
+
+    llama_memory_t mem = llama_get_memory(gc->ctx);
+    if (mem) llama_memory_clear(mem, true);
+    generation_invalidate_kv(gc->ctx);
+    return gc->ctx;
+}
+
+size_t growing_context_trim() {
+    std::lock_guard<std::mutex> lock(g_growth_mutex);
+    size_t freed = 0;
+    for (growing_context * gc : g_live) {
+        const int initial = initial_cells(gc->max_cells);
+        if (!gc->grow || (int) gc->params.n_ctx <= initial) continue;
+
+        const int used = used_cells(gc->ctx);
+        int cells = initial;
+        while (cells < used) cells *= 2;
+        if (cells >= (int) gc->params.n_ctx) continue;
+
+        const uint32_t from = gc->params.n_ctx;
+        if (!replace_locked(*gc, cells, used > 0)) continue;
+        freed += kv_bytes(*gc, from) - kv_bytes(*gc, cells);
+        g_shrinks++;
+        LOGI("Shrank context from %u to %d cells holding %d", from, cells, used);
+    }
+    return freed;
+}
+
+std::string growing_context_stats_json() {
+    std::lock_guard<std::mutex> lock(g_growth_mutex);
+    std::string json = "{";
+    json += "\"contexts\":[";
+    for (size_t i = 0; i < g_live.size(); i++) {
+        if (i > 0) json += ",";
+        json += "{\"cells\":" + std::to_string(g_live[i]->params.n_ctx) + ",";
+        json += "\"max_cells\":" + std::to_string(g_live[i]->max_cells) + ",";
+        json += "\"grow\":" + std::string(g_live[i]->grow ? "true" : "false") + "}";
+    }
+    json += "],";
+    json += "\"growths\":" + std::to_string(g_growths) + ",";
+    json += "\"growth_failures\":" + std::to_string(g_growth_failures) + ",";
+    json += "\"shrinks\":" + std::to_string(g_shrinks) + ",";
+    json += "\"bytes_copied\":" + std::to_string(g_bytes_copied) + ",";
+    json += "\"avg_growth_ms\":" + std::to_string(g_growths > 0 ? g_growth_ms / g_growths : 0.0);
+    json += "}";
+    return json;
+}
@@ -0,0 +1,71 @@
+/**
+ * context_growth.h - Contexts whose KV cache grows with the conversation
+ *
+ * llama.cpp allocates and clears a context's KV cache for all n_ctx cells
+ * when the context is created, so a short chat on an 8k context keeps the
+ * memory of 8k tokens resident. A growing context starts with a cache of
+ * CONTEXT_GROWTH_MIN_CELLS and is replaced by a larger context (twice the
+ * size, or more if needed, up to n_ctx) when a request needs more cells;
+ * the KV contents are copied over with llama_state_get_data/set_data. When
+ * the cache is cleared, it goes back to the initial size.
+ *
+ * Callers hold the growing_context and look up its current llama_context
+ * for every request, since the context changes on growth. Chat sessions,
+ * which keep a llama_context pointer beyond one request, are re-pointed
+ * when their context is replaced. Replacements go through the context pool.
+ */
+
+#pragma once
+
+#include <string>
+
+#include "llama.h"
+
+// Initial KV cells of a growing context
+#define CONTEXT_GROWTH_MIN_CELLS 1024
+
+struct growing_context;
+
+/**
+ * Create a context for params. With grow set, its KV cache starts small and
+ * params.n_ctx becomes the ceiling; otherwise it is allocated in full and
+ * never replaced. Returns nullptr if the context could not be created.
+ */
+growing_context * growing_context_create(llama_model * model, const llama_context_params & params, bool grow);
+
+// Return the current context to the pool (freeing it if it grew) and free the wrapper
+void growing_context_free(growing_context * gc);
+
+llama_context * growing_context_get(const growing_context * gc);
+
+// Most cells the context may grow to (its configured n_ctx)
+int growing_context_max_cells(const growing_context * gc);
+
+/**
+ * Make room for n_cells cells (capped at the ceiling), replacing the context
+ * with a larger one that holds the same KV contents if needed. Returns the
+ * context to use; if growing failed, the current one is kept and returned.
+ */
+llama_context * growing_context_reserve(growing_context * gc, int n_cells);
+
+/**
+ * Clear the KV cache and go back to the initial size. Returns the context to
+ * use from now on.
+ */
+llama_context * growing_context_clear(growing_context * gc);
+
+/**
+ * Replace every grown context with the smallest size (doubling from the
+ * initial one) that still holds its KV contents, which are copied over.
+ * Call while no request runs in them. Returns the estimated KV bytes freed.
+ */
+size_t growing_context_trim();
+
+/**
+ * Parameters of the context a growing context starts with, e.g. to prewarm
+ * the pool for it.
+ */
+llama_context_params growing_context_initial_params(const llama_context_params & params, bool grow);
+
+// Growth and shrink counters and current sizes as a JSON object string
+std::string growing_context_stats_json();
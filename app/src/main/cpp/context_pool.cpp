@@ -0,0 +1,229 @@
+/**
+ * context_pool.cpp - Pool of reusable llama contexts
+ */
+
+#include "context_pool.h"
+#include "cpu_threadpool.h"
+#include "generation.h"
+#include "kv_estimate.h"
+#include "logging.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#define LOG_TAG "ContextPool"
+
+namespace {
+
+struct pool_key {
+    const llama_model * model = nullptr;
+    uint32_t n_ctx = 0;
+    uint32_t n_batch = 0;
+    uint32_t n_ubatch = 0;
+    ggml_type type_k = GGML_TYPE_F16;
+    ggml_type type_v = GGML_TYPE_F16;
+    llama_flash_attn_type flash_attn = LLAMA_FLASH_ATTN_TYPE_AUTO;
+
+    bool operator==(const pool_key & other) const {
+        return model == other.model && n_ctx == other.n_ctx && n_batch == other.n_batch &&
+               n_ubatch == other.n_ubatch && type_k == other.type_k && type_v == other.type_v &&
+               flash_attn == other.flash_attn;
+    }
+};
+
+struct pool_entry {
+    pool_key key;
+    llama_context * ctx = nullptr;
+    bool in_use = false;
+    uint64_t last_used = 0;
+};
+
+std::mutex g_pool_mutex;
+std::vector<pool_entry> g_contexts;
+size_t g_max_idle = 2;
+uint64_t g_clock = 0;
+uint64_t g_created = 0;
+uint64_t g_reused = 0;
+
+pool_key key_of(const llama_model * model, const llama_context_params & params) {
+    pool_key key;
+    key.model = model;
+    key.n_ctx = params.n_ctx;
+    key.n_batch = params.n_batch;
+    key.n_ubatch = params.n_ubatch;
+    key.type_k = params.type_k;
+    key.type_v = params.type_v;
+    key.flash_attn = params.flash_attn_type;
+    return key;
+}
+
+size_t idle_count_locked() {
+    return (size_t) std::count_if(g_contexts.begin(), g_contexts.end(),
+                                  [](const pool_entry & e) { return !e.in_use; });
+}
+
+void free_entry_locked(std::vector<pool_entry>::iterator it) {
+    cpu_threadpool_detach(it->ctx);
+    generation_release(it->ctx);
+    llama_free(it->ctx);
+    g_contexts.erase(it);
+}
+
+// Free least recently used idle contexts until at most max_idle remain
+void enforce_max_idle_locked(size_t max_idle) {
+    while (idle_count_locked() > max_idle) {
+        auto lru = g_contexts.end();
+        for (auto it = g_contexts.begin(); it != g_contexts.end(); ++it) {
+            if (it->in_use) continue;
+            if (lru == g_contexts.end() || it->last_used < lru->last_used) lru = it;
+        }
+        if (lru == g_contexts.end()) break;
+        free_entry_locked(lru);
+    }
+}
+
+} // namespace
+
+llama_context * context_pool_acquire(llama_model * model, const llama_context_params & params) {
+    const pool_key key = key_of(model, params);
+    {
+        std::lock_guard<std::mutex> lock(g_pool_mutex);
+        for (auto & entry : g_contexts) {
+            if (entry.in_use || !(entry.key == key)) continue;
+            entry.in_use = true;
+            entry.last_used = ++g_clock;
+            g_reused++;
+            cpu_threadpool_resume(entry.ctx);
+            llama_set_n_threads(entry.ctx, params.n_threads, params.n_threads_batch);
+            LOGI("Reusing pooled context %p (n_ctx=%u, n_batch=%u)", entry.ctx, key.n_ctx, key.n_batch);
+            return entry.ctx;
+        }
+    }
+
+    // Allocate outside the lock, this is the slow path the pool exists to avoid
+    llama_context * ctx = llama_init_from_model(model, params);
+    if (ctx == nullptr) {
+        LOGE("Failed to create context");
+        return nullptr;
+    }
+    cpu_threadpool_attach(ctx, std::max(params.n_threads, params.n_threads_batch));
+
+    std::lock_guard<std::mutex> lock(g_pool_mutex);
+    pool_entry entry;
+    entry.key = key;
+    entry.ctx = ctx;
+    entry.in_use = true;
+    entry.last_used = ++g_clock;
+    g_contexts.push_back(entry);
+    g_created++;
+    return ctx;
+}
+
+bool context_pool_release(llama_context * ctx) {
+    std::lock_guard<std::mutex> lock(g_pool_mutex);
+    for (auto & entry : g_contexts) {
+        if (entry.ctx != ctx) continue;
+
+        llama_memory_t mem = llama_get_memory(ctx);
+        if (mem) {
+            llama_memory_clear(mem, true);
+        }
+        generation_invalidate_kv(ctx);
+        llama_perf_context_reset(ctx);
+        cpu_threadpool_pause(ctx);
+
+        entry.in_use = false;
+        entry.last_used = ++g_clock;
+        enforce_max_idle_locked(g_max_idle);
+        return true;
+    }
+    return false;
+}
+
+bool context_pool_discard(llama_context * ctx) {
+    std::lock_guard<std::mutex> lock(g_pool_mutex);
+    for (auto it = g_contexts.begin(); it != g_contexts.end(); ++it) {
+        if (it->ctx != ctx) continue;
+        free_entry_locked(it);
+        return true;
+    }
+    return false;
+}
+
+int context_pool_prewarm(llama_model * model, const llama_context_params & params, int count) {
+    const pool_key key = key_of(model, params);
+    int idle = 0;
+    {
+        std::lock_guard<std::mutex> lock(g_pool_mutex);
+        for (const auto & entry : g_contexts) {
+            if (!entry.in_use && entry.key == key) idle++;
+        }
+    }
+
+    // Hold every new context until all are created, otherwise acquire would reuse them
+    std::vector<llama_context *> created;
+    while (idle + (int) created.size() < count) {
+        llama_context * ctx = context_pool_acquire(model, params);
+        if (ctx == nullptr) break;
+        created.push_back(ctx);
+    }
+    for (llama_context * ctx : created) {
+        context_pool_release(ctx);
+    }
+    LOGI("Prewarmed %zu contexts (n_ctx=%u)", created.size(), key.n_ctx);
+    return (int) created.size();
+}
+
+size_t context_pool_drop_model(const llama_model * model) {
+    std::lock_guard<std::mutex> lock(g_pool_mutex);
+    size_t freed = 0;
+    for (auto it = g_contexts.begin(); it != g_contexts.end();) {
+        if (it->key.model == model && !it->in_use) {
+            cpu_threadpool_detach(it->ctx);
+            generation_release(it->ctx);
+            llama_free(it->ctx);
+            it = g_contexts.erase(it);
+            freed++;
+        } else {
+            ++it;
+        }
+    }
+    return freed;
+}
+
+size_t context_pool_trim(size_t * bytes_freed) {
+    std::lock_guard<std::mutex> lock(g_pool_mutex);
+    const size_t idle = idle_count_locked();
+    if (bytes_freed != nullptr) {
+        *bytes_freed = 0;
+        for (const auto & entry : g_contexts) {
+            if (entry.in_use) continue;
+            *bytes_freed += kv_cache_estimate_bytes(entry.key.model, entry.key.n_ctx, entry.key.type_k, entry.key.type_v);
+        }
+    }
+    enforce_max_idle_locked(0);
+    return idle;
+}
+
+void context_pool_set_max_idle(int max_idle) {
+    std::lock_guard<std::mutex> lock(g_pool_mutex);
+    g_max_idle = max_idle > 0 ? (size_t) max_idle : 0;
+    enforce_max_idle_locked(g_max_idle);
+}
+
+std::string context_pool_stats_json() {
+    std::lock_guard<std::mutex> lock(g_pool_mutex);
+    const size_t idle = idle_count_locked();
+
+    std::string json = "{";
+    json += "\"contexts\":" + std::to_string(g_contexts.size()) + ",";
+    json += "\"idle\":" + std::to_string(idle) + ",";
+    json += "\"in_use\":" + std::to_string(g_contexts.size() - idle) + ",";
+    json += "\"max_idle\":" + std::to_string(g_max_idle) + ",";
+    json += "\"created\":" + std::to_string(g_created) + ",";
+    json += "\"reused\":" + std::to_string(g_reused);
+    json += "}";
+    return json;
+}
@@ -0,0 +1,49 @@
+/**
+ * context_pool.h - Pool of reusable llama contexts
+ *
+ * llama_init_from_model allocates the KV cache and compute buffers, which
+ * takes hundreds of milliseconds for larger contexts. Released contexts are
+ * kept per (model, n_ctx, batch sizes, KV type, flash attention) with their memory cleared and are
+ * handed out again to the next matching request, so buffers keep the same
+ * fixed sizes for the lifetime of the model.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include "llama.h"
+
+/**
+ * Take a context matching params from the pool, or create one if none is idle.
+ * Thread counts are applied to reused contexts, they are not part of the key.
+ */
+llama_context * context_pool_acquire(llama_model * model, const llama_context_params & params);
+
+/**
+ * Return a context to the pool. Its memory is cleared before it becomes
+ * available again. Returns false if the context did not come from the pool.
+ */
+bool context_pool_release(llama_context * ctx);
+
+/**
+ * Free a context taken from the pool instead of keeping it idle, e.g. one
+ * of a size that is not needed again soon. Returns false if the context did
+ * not come from the pool.
+ */
+bool context_pool_discard(llama_context * ctx);
+
+// Create idle contexts up front so the next acquire is immediate (capped by max idle)
+int context_pool_prewarm(llama_model * model, const llama_context_params & params, int count);
+
+// Free idle contexts of a model; must be called before the model is freed
+size_t context_pool_drop_model(const llama_model * model);
+
+// Free all idle contexts, returns the number freed. bytes_freed receives their estimated KV cache bytes.
+size_t context_pool_trim(size_t * bytes_freed = nullptr);
+
+// Set the maximum number of idle contexts kept across all keys
+void context_pool_set_max_idle(int max_idle);
+
+std::string context_pool_stats_json();
@@ -0,0 +1,132 @@
+/**
+ * cpu_threadpool.cpp - Persistent ggml threadpools pinned to performance cores
+ */
+
+#include "cpu_threadpool.h"
+#include "cpu_topology.h"
+#include "logging.h"
+
+#include "ggml-cpu.h"
+
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define LOG_TAG "CpuThreadpool"
+
+namespace {
+
+struct pool_entry {
+    llama_context * ctx = nullptr;
+    ggml_threadpool * threadpool = nullptr;
+    int n_threads = 0;
+    bool paused = false;
+};
+
+std::mutex g_threadpool_mutex;
+std::vector<pool_entry> g_pools;
+cpu_threadpool_config g_config;
+
+std::vector<pool_entry>::iterator find_locked(llama_context * ctx) {
+    return std::find_if(g_pools.begin(), g_pools.end(),
+                        [ctx](const pool_entry & e) { return e.ctx == ctx; });
+}
+
+} // namespace
+
+void cpu_threadpool_configure(const cpu_threadpool_config & config) {
+    std::lock_guard<std::mutex> lock(g_threadpool_mutex);
+    g_config = config;
+    g_config.poll = std::max(0, std::min(100, config.poll));
+    LOGI("Threadpool config: enabled=%d, poll=%d, strict_cpu=%d",
+         g_config.enabled, g_config.poll, g_config.strict_cpu);
+}
+
+cpu_threadpool_config cpu_threadpool_get_config() {
+    std::lock_guard<std::mutex> lock(g_threadpool_mutex);
+    return g_config;
+}
+
+int cpu_threadpool_default_threads() {
+    const int performance = cpu_topology_default_threads(cpu_topology_system());
+    if (performance > 0) return performance;
+    return std::max(1, (int) std::thread::hardware_concurrency());
+}
+
+bool cpu_threadpool_attach(llama_context * ctx, int n_threads) {
+    std::lock_guard<std::mutex> lock(g_threadpool_mutex);
+    if (!g_config.enabled || ctx == nullptr || n_threads <= 0) return false;
+    if (find_locked(ctx) != g_pools.end()) return true;
+
+    ggml_threadpool_params params = ggml_threadpool_params_default(n_threads);
+    params.poll = (uint32_t) g_config.poll;
+    params.strict_cpu = g_config.strict_cpu;
+
+    const std::vector<int> cores = cpu_topology_allowed_cores(cpu_topology_system(), n_threads);
+    if (!cores.empty()) {
+        std::fill(std::begin(params.cpumask), std::end(params.cpumask), false);
+        for (int id : cores) {
+            if (id >= 0 && id < GGML_MAX_N_THREADS) params.cpumask[id] = true;
+        }
+    }
+
+    ggml_threadpool * threadpool = ggml_threadpool_new(&params);
+    if (threadpool == nullptr) {
+        LOGW("Failed to create threadpool with %d threads", n_threads);
+        return false;
+    }
+    llama_attach_threadpool(ctx, threadpool, threadpool);
+
+    pool_entry entry;
+    entry.ctx = ctx;
+    entry.threadpool = threadpool;
+    entry.n_threads = n_threads;
+    g_pools.push_back(entry);
+
+    LOGI("Attached threadpool to %p: %d threads on %zu cores, poll=%d",
+         ctx, n_threads, cores.size(), g_config.poll);
+    return true;
+}
+
+void cpu_threadpool_detach(llama_context * ctx) {
+    std::lock_guard<std::mutex> lock(g_threadpool_mutex);
+    auto it = find_locked(ctx);
+    if (it == g_pools.end()) return;
+
+    llama_detach_threadpool(ctx);
+    ggml_threadpool_free(it->threadpool);
+    g_pools.erase(it);
+}
+
+void cpu_threadpool_pause(llama_context * ctx) {
+    std::lock_guard<std::mutex> lock(g_threadpool_mutex);
+    auto it = find_locked(ctx);
+    if (it == g_pools.end() || it->paused) return;
+    ggml_threadpool_pause(it->threadpool);
+    it->paused = true;
+}
+
+void cpu_threadpool_resume(llama_context * ctx) {
+    std::lock_guard<std::mutex> lock(g_threadpool_mutex);
+    auto it = find_locked(ctx);
+    if (it == g_pools.end() || !it->paused) return;
+    ggml_threadpool_resume(it->threadpool);
+    it->paused = false;
+}
+
+std::string cpu_threadpool_stats_json() {
+    std::lock_guard<std::mutex> lock(g_threadpool_mutex);
+    int paused = 0;
+    for (const auto & entry : g_pools) paused += entry.paused ? 1 : 0;
+
+    std::string json = "{";
+    json += "\"enabled\":" + std::string(g_config.enabled ? "true" : "false") + ",";
+    json += "\"poll\":" + std::to_string(g_config.poll) + ",";
+    json += "\"strict_cpu\":" + std::string(g_config.strict_cpu ? "true" : "false") + ",";
+    json += "\"threadpools\":" + std::to_string(g_pools.size()) + ",";
+    json += "\"paused\":" + std::to_string(paused) + ",";
+    json += "\"topology\":" + cpu_topology_json(cpu_topology_system());
+    json += "}";
+    return json;
+}
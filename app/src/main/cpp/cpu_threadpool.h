@@ -0,0 +1,45 @@
+/**
+ * cpu_threadpool.h - Persistent ggml threadpools pinned to performance cores
+ *
+ * Without an attached threadpool llama.cpp spreads its workers over every
+ * core, and on big.LITTLE SoCs the efficiency cores then gate each matmul.
+ * Each context gets one persistent threadpool whose workers are restricted to
+ * the performance cores from cpu_topology. Workers spin for a configurable
+ * poll level after each graph before sleeping, which trades idle power for
+ * lower per-token wake-up latency.
+ */
+
+#pragma once
+
+#include <string>
+
+#include "llama.h"
+
+struct cpu_threadpool_config {
+    bool enabled = true;
+    int poll = 50;            // 0 = sleep right away, 100 = spin the longest between graphs
+    bool strict_cpu = false;  // pin each worker to one core instead of the whole performance set
+};
+
+void cpu_threadpool_configure(const cpu_threadpool_config & config);
+
+cpu_threadpool_config cpu_threadpool_get_config();
+
+// Thread count to use when the caller does not pass one: the number of performance cores
+int cpu_threadpool_default_threads();
+
+/**
+ * Create a threadpool with n_threads workers and attach it to ctx for both
+ * prompt processing and generation. n_threads is the upper bound, fewer can
+ * be selected later with llama_set_n_threads. Returns false when disabled.
+ */
+bool cpu_threadpool_attach(llama_context * ctx, int n_threads);
+
+// Detach and free the threadpool of ctx; call before llama_free
+void cpu_threadpool_detach(llama_context * ctx);
+
+// Park the workers of an idle context, and wake them again before it is reused
+void cpu_threadpool_pause(llama_context * ctx);
+void cpu_threadpool_resume(llama_context * ctx);
+
+std::string cpu_threadpool_stats_json();
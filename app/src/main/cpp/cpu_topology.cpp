@@ -0,0 +1,143 @@
+/**
+ * cpu_topology.cpp - CPU core cluster detection for heterogeneous SoCs
+ */
+
+#include "cpu_topology.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <dirent.h>
+#include <fstream>
+#include <functional>
+
+namespace {
+
+// Read the first integer in a sysfs file, or -1 if it does not exist
+long read_long(const std::string & path) {
+    std::ifstream file(path);
+    long value = -1;
+    if (!(file >> value)) return -1;
+    return value;
+}
+
+// Parse "cpuN" directory names, rejecting cpufreq, cpuidle and friends
+bool parse_cpu_dir(const char * name, int & id) {
+    if (name[0] != 'c' || name[1] != 'p' || name[2] != 'u' || name[3] == '\0') return false;
+    for (const char * p = name + 3; *p; p++) {
+        if (!isdigit((unsigned char) *p)) return false;
+    }
+    id = atoi(name + 3);
+    return true;
+}
+
+// Rank used for clustering, capacity when every core exposes it
+long rank_of(const cpu_core_info & core, bool use_capacity) {
+    return use_capacity ? core.capacity : core.max_freq_khz;
+}
+
+} // namespace
+
+cpu_topology cpu_topology_detect(const std::string & sysfs_root) {
+    cpu_topology topology;
+
+    DIR * dir = opendir(sysfs_root.c_str());
+    if (dir == nullptr) return topology;
+
+    while (dirent * entry = readdir(dir)) {
+        int id = 0;
+        if (!parse_cpu_dir(entry->d_name, id)) continue;
+
+        const std::string base = sysfs_root + "/" + entry->d_name;
+        // cpu0 usually has no "online" file; a 0 means the core is hotplugged out
+        if (read_long(base + "/online") == 0) continue;
+
+        cpu_core_info core;
+        core.id = id;
+        core.capacity = std::max(0L, read_long(base + "/cpu_capacity"));
+        core.max_freq_khz = std::max(0L, read_long(base + "/cpufreq/cpuinfo_max_freq"));
+        topology.cores.push_back(core);
+    }
+    closedir(dir);
+
+    if (topology.cores.empty()) return topology;
+
+    std::sort(topology.cores.begin(), topology.cores.end(),
+              [](const cpu_core_info & a, const cpu_core_info & b) { return a.id < b.id; });
+
+    const bool use_capacity = std::all_of(topology.cores.begin(), topology.cores.end(),
+                                          [](const cpu_core_info & c) { return c.capacity > 0; });
+
+    // Group cores with the same rank, fastest first
+    std::vector<long> ranks;
+    for (const auto & core : topology.cores) ranks.push_back(rank_of(core, use_capacity));
+    std::sort(ranks.begin(), ranks.end(), std::greater<long>());
+    ranks.erase(std::unique(ranks.begin(), ranks.end()), ranks.end());
+
+    for (long rank : ranks) {
+        std::vector<int> cluster;
+        for (const auto & core : topology.cores) {
+            if (rank_of(core, use_capacity) == rank) cluster.push_back(core.id);
+        }
+        topology.clusters.push_back(cluster);
+    }
+
+    if (topology.clusters.size() == 1) {
+        topology.performance_cores = topology.clusters[0];
+    } else {
+        for (size_t i = 0; i + 1 < topology.clusters.size(); i++) {
+            const auto & cluster = topology.clusters[i];
+            topology.performance_cores.insert(topology.performance_cores.end(), cluster.begin(), cluster.end());
+        }
+        topology.efficiency_cores = topology.clusters.back();
+        std::sort(topology.performance_cores.begin(), topology.performance_cores.end());
+    }
+    return topology;
+}
+
+const cpu_topology & cpu_topology_system() {
+    static const cpu_topology topology = cpu_topology_detect();
+    return topology;
+}
+
+int cpu_topology_default_threads(const cpu_topology & topology) {
+    return (int) topology.performance_cores.size();
+}
+
+std::vector<int> cpu_topology_allowed_cores(const cpu_topology & topology, int n_threads) {
+    if ((int) topology.performance_cores.size() >= n_threads) return topology.performance_cores;
+    std::vector<int> cores;
+    for (const auto & core : topology.cores) cores.push_back(core.id);
+    return cores;
+}
+
+std::string cpu_topology_json(const cpu_topology & topology) {
+    auto ids_json = [](const std::vector<int> & ids) {
+        std::string json = "[";
+        for (size_t i = 0; i < ids.size(); i++) {
+            if (i > 0) json += ",";
+            json += std::to_string(ids[i]);
+        }
+        return json + "]";
+    };
+
+    std::string json = "{";
+    json += "\"cores\":[";
+    for (size_t i = 0; i < topology.cores.size(); i++) {
+        const auto & core = topology.cores[i];
+        if (i > 0) json += ",";
+        json += "{\"id\":" + std::to_string(core.id) + ",";
+        json += "\"capacity\":" + std::to_string(core.capacity) + ",";
+        json += "\"max_freq_khz\":" + std::to_string(core.max_freq_khz) + "}";
+    }
+    json += "],\"clusters\":[";
+    for (size_t i = 0; i < topology.clusters.size(); i++) {
+        if (i > 0) json += ",";
+        json += ids_json(topology.clusters[i]);
+    }
+    json += "],";
+    json += "\"performance_cores\":" + ids_json(topology.performance_cores) + ",";
+    json += "\"efficiency_cores\":" + ids_json(topology.efficiency_cores);
+    json += "}";
+    return json;
+}
@@ -0,0 +1,47 @@
+/**
+ * cpu_topology.h - CPU core cluster detection for heterogeneous SoCs
+ *
+ * Most phone SoCs mix performance and efficiency cores. Cores are ranked by
+ * cpu_capacity (the scheduler's relative performance figure) or, on kernels
+ * that do not expose it, by cpuinfo_max_freq. Cores with equal rank form a
+ * cluster. The sysfs root is a parameter so detection can be run against a
+ * fake directory tree on a Linux host.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+struct cpu_core_info {
+    int id = 0;
+    long capacity = 0;      // cpu_capacity, 0 if not exposed
+    long max_freq_khz = 0;  // cpufreq/cpuinfo_max_freq, 0 if not exposed
+};
+
+struct cpu_topology {
+    std::vector<cpu_core_info> cores;           // sorted by id
+    std::vector<std::vector<int>> clusters;     // core ids, fastest cluster first
+    std::vector<int> performance_cores;         // every core outside the slowest cluster
+    std::vector<int> efficiency_cores;          // the slowest cluster
+};
+
+#define CPU_TOPOLOGY_SYSFS_ROOT "/sys/devices/system/cpu"
+
+/**
+ * Read the core layout below sysfs_root (expects cpuN/ directories).
+ * On a homogeneous CPU every core is a performance core. Returns an empty
+ * topology if nothing could be read.
+ */
+cpu_topology cpu_topology_detect(const std::string & sysfs_root = CPU_TOPOLOGY_SYSFS_ROOT);
+
+// Detected once from the real sysfs and cached for the process lifetime
+const cpu_topology & cpu_topology_system();
+
+// Threads to run by default: one per performance core, 0 if nothing was detected
+int cpu_topology_default_threads(const cpu_topology & topology);
+
+// Cores n_threads workers may run on: the performance cores if there are enough, otherwise every core
+std::vector<int> cpu_topology_allowed_cores(const cpu_topology & topology, int n_threads);
+
+std::string cpu_topology_json(const cpu_topology & topology);
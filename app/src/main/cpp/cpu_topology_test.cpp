@@ -0,0 +1,157 @@
+/**
+ * cpu_topology_test.cpp - Host test for cpu_topology against fake sysfs trees
+ *
+ * Each case writes a cpuN/cpu_capacity and cpufreq/cpuinfo_max_freq layout
+ * into a temporary directory, runs cpu_topology_detect on it and checks the
+ * clusters, the performance/efficiency split, the default thread count and
+ * the cores the threadpool may pin to. Exits non-zero if any check fails.
+ */
+
+#include "cpu_topology.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+namespace {
+
+int g_failures = 0;
+const char * g_case = "";
+
+#define CHECK(cond) do { \
+        if (!(cond)) { fprintf(stderr, "%s:%d: %s: CHECK(%s) failed\n", __FILE__, __LINE__, g_case, #cond); g_failures++; } \
+    } while (0)
+
+struct fake_core {
+    int id;
+    long capacity;      // -1 = no cpu_capacity file
+    long max_freq_khz;  // -1 = no cpufreq directory
+    int online;         // -1 = no online file
+};
+
+void write_file(const std::string & path, long value) {
+    FILE * f = fopen(path.c_str(), "w");
+    if (f == nullptr) {
+        perror(path.c_str());
+        exit(2);
+    }
+    fprintf(f, "%ld\n", value);
+    fclose(f);
+}
+
+void remove_tree(const std::string & path) {
+    const std::string cmd = "rm -rf '" + path + "'";
+    if (system(cmd.c_str()) != 0) fprintf(stderr, "Failed to remove %s\n", path.c_str());
+}
+
+// Fake /sys/devices/system/cpu with the given cores plus the non-core entries the kernel has there
+std::string make_tree(const std::vector<fake_core> & cores) {
+    char root[] = "/tmp/cpu_topology_test.XXXXXX";
+    if (mkdtemp(root) == nullptr) {
+        perror("mkdtemp");
+        exit(2);
+    }
+    const std::string base = root;
+    mkdir((base + "/cpufreq").c_str(), 0755);
+    mkdir((base + "/cpuidle").c_str(), 0755);
+    write_file(base + "/possible", 0);
+    for (const auto & core : cores) {
+        const std::string dir = base + "/cpu" + std::to_string(core.id);
+        mkdir(dir.c_str(), 0755);
+        if (core.capacity >= 0) write_file(dir + "/cpu_capacity", core.capacity);
+        if (core.online >= 0) write_file(dir + "/online", core.online);
+        if (core.max_freq_khz >= 0) {
+            mkdir((dir + "/cpufreq").c_str(), 0755);
+            write_file(dir + "/cpufreq/cpuinfo_max_freq", core.max_freq_khz);
+        }
+    }
+    return base;
+}
+
+cpu_topology detect(const std::vector<fake_core> & cores) {
+    const std::string root = make_tree(cores);
+    cpu_topology topology = cpu_topology_detect(root);
+    remove_tree(root);
+    return topology;
+}
+
+typedef std::vector<int> ids;
+
+void test_capacity_clusters() {
+    g_case = "capacity_clusters";
+    // 4 little, 3 mid (cpu5 hotplugged out), 1 prime; frequencies disagree with capacity on purpose
+    const cpu_topology t = detect({
+        {0, 400, 2000000, -1}, {1, 400, 2000000, 1}, {2, 400, 2000000, 1}, {3, 400, 2000000, 1},
+        {4, 900, 1800000, 1},  {5, 900, 1800000, 0}, {6, 900, 1800000, 1}, {7, 1024, 3000000, 1},
+    });
+    CHECK(t.cores.size() == 7);
+    CHECK(t.clusters.size() == 3);
+    CHECK(t.clusters.size() == 3 && t.clusters[0] == ids({7}));
+    CHECK(t.clusters.size() == 3 && t.clusters[1] == ids({4, 6}));
+    CHECK(t.clusters.size() == 3 && t.clusters[2] == ids({0, 1, 2, 3}));
+    CHECK(t.performance_cores == ids({4, 6, 7}));
+    CHECK(t.efficiency_cores == ids({0, 1, 2, 3}));
+    CHECK(cpu_topology_default_threads(t) == 3);
+    CHECK(cpu_topology_allowed_cores(t, 3) == ids({4, 6, 7}));
+    CHECK(cpu_topology_allowed_cores(t, 2) == ids({4, 6, 7}));
+    CHECK(cpu_topology_allowed_cores(t, 4) == ids({0, 1, 2, 3, 4, 6, 7}));
+}
+
+void test_frequency_fallback() {
+    g_case = "frequency_fallback";
+    // cpu_capacity missing on some cores, so every core is ranked by frequency
+    const cpu_topology t = detect({
+        {0, 512, 1800000, -1}, {1, -1, 1800000, 1}, {2, -1, 1800000, 1}, {3, -1, 1800000, 1},
+        {10, -1, 2400000, 1},  {11, 1024, 2400000, 1},
+    });
+    CHECK(t.cores.size() == 6);
+    CHECK(t.clusters.size() == 2);
+    CHECK(t.performance_cores == ids({10, 11}));
+    CHECK(t.efficiency_cores == ids({0, 1, 2, 3}));
+    CHECK(cpu_topology_default_threads(t) == 2);
+}
+
+void test_homogeneous() {
+    g_case = "homogeneous";
+    const cpu_topology t = detect({
+        {0, 1024, 2400000, -1}, {1, 1024, 2400000, 1}, {2, 1024, 2400000, 1}, {3, 1024, 2400000, 1},
+    });
+    CHECK(t.clusters.size() == 1);
+    CHECK(t.performance_cores == ids({0, 1, 2, 3}));
+    CHECK(t.efficiency_cores.empty());
+    CHECK(cpu_topology_default_threads(t) == 4);
+    CHECK(cpu_topology_allowed_cores(t, 8) == ids({0, 1, 2, 3}));
+}
+
+void test_nothing_exposed() {
+    g_case = "nothing_exposed";
+    // Cores without capacity or frequency files count as one cluster
+    const cpu_topology t = detect({{0, -1, -1, -1}, {1, -1, -1, 1}});
+    CHECK(t.cores.size() == 2);
+    CHECK(t.performance_cores == ids({0, 1}));
+    CHECK(cpu_topology_default_threads(t) == 2);
+
+    g_case = "missing_root";
+    const cpu_topology missing = cpu_topology_detect("/nonexistent/cpu_topology_test");
+    CHECK(missing.cores.empty());
+    CHECK(missing.clusters.empty());
+    CHECK(cpu_topology_default_threads(missing) == 0);
+    CHECK(cpu_topology_allowed_cores(missing, 4).empty());
+}
+
+} // namespace
+
+int main() {
+    test_capacity_clusters();
+    test_frequency_fallback();
+    test_homogeneous();
+    test_nothing_exposed();
+    if (g_failures > 0) {
+        fprintf(stderr, "%d check(s) failed\n", g_failures);
+        return 1;
+    }
+    printf("cpu_topology_test: all checks passed\n");
+    return 0;
+}
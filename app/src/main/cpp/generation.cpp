@@ -0,0 +1,662 @@
+/**
+ * generation.cpp - Prompt processing and token generation loop
+ */
+
+#include "generation.h"
+#include "cpu_threadpool.h"
+#include "generation_metrics.h"
+#include "kv_estimate.h"
+#include "logging.h"
+#include "model_registry.h"
+#include "prompt_snapshot.h"
+#include "token_pieces.h"
+#include "thread_tuner.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#define LOG_TAG "Generation"
+
+namespace {
+
+// ============================================================================
+// Batch helper functions - matching official llama.cpp common.h implementation
+// ============================================================================
+
+// Clear a batch for reuse (just reset n_tokens counter)
+void batch_clear(struct llama_batch & batch) {
+    batch.n_tokens = 0;
+}
+
+// Add a token to the batch - matches common_batch_add from common.h
+void batch_add(
+        struct llama_batch & batch,
+        llama_token id,
+        llama_pos pos,
+        llama_seq_id seq_id,
+        bool logits) {
+    batch.token[batch.n_tokens] = id;
+    batch.pos[batch.n_tokens] = pos;
+    batch.n_seq_id[batch.n_tokens] = 1;
+    batch.seq_id[batch.n_tokens][0] = seq_id;
+    batch.logits[batch.n_tokens] = logits ? 1 : 0;
+    batch.n_tokens++;
+}
+
+double ms_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Buffers kept per context so steady-state generation does not allocate
+struct generation_arena {
+    llama_batch batch = {};
+    int batch_capacity = 0;
+    std::vector<llama_token> prompt_tokens;
+    llama_sampler * sampler = nullptr;
+    float sampler_temperature = 0;
+    float sampler_top_p = 0;
+    int sampler_top_k = 0;
+    uint32_t sampler_seed = 0;
+    std::string piece;
+    token_detokenizer detokenizer;
+    std::atomic<uint64_t> kv_epoch{0};  // changes whenever the KV cache is cleared
+
+    ~generation_arena() {
+        if (batch_capacity > 0) llama_batch_free(batch);
+        if (sampler != nullptr) llama_sampler_free(sampler);
+    }
+};
+
+std::mutex g_arena_mutex;
+std::map<const llama_context *, std::unique_ptr<generation_arena>> g_arenas;
+// Epochs are unique across contexts, so a context reallocated at the same address never matches
+std::atomic<uint64_t> g_next_kv_epoch{1};
+
+generation_arena & arena_for(const llama_context * ctx) {
+    std::lock_guard<std::mutex> lock(g_arena_mutex);
+    std::unique_ptr<generation_arena> & arena = g_arenas[ctx];
+    if (!arena) {
+        arena.reset(new generation_arena());
+        arena->kv_epoch = g_next_kv_epoch++;
+    }
+    return *arena;
+}
+
+} // namespace
+
+const char * generation_stop_reason_name(generation_stop_reason reason) {
+    switch (reason) {
+        case GENERATION_STOP_EOG: return "eog";
+        case GENERATION_STOP_MAX_TOKENS: return "max_tokens";
+        case GENERATION_STOP_BUDGET: return "budget";
+        case GENERATION_STOP_CANCELLED: return "cancelled";
+        case GENERATION_STOP_CONTEXT: return "context";
+        case GENERATION_STOP_ERROR: return "error";
+        default: return "none";
+    }
+}
+
+llama_sampler * generation_make_sampler(const generation_params & params) {
+    LOGD("Initializing sampler with temp=%.2f, top_p=%.2f, top_k=%d",
+         params.temperature, params.top_p, params.top_k);
+    llama_sampler * sampler = llama_sampler_chain_init(llama_sampler_chain_default_params());
+    if (sampler == nullptr) return nullptr;
+
+    if (params.temperature <= 0) {
+        // Temperature 0 is deterministic, which is what makes exact cache hits valid
+        llama_sampler_chain_add(sampler, llama_sampler_init_greedy());
+    } else {
+        llama_sampler_chain_add(sampler, llama_sampler_init_top_k(params.top_k > 0 ? params.top_k : 40));
+        llama_sampler_chain_add(sampler, llama_sampler_init_top_p(params.top_p > 0 ? params.top_p : 0.95f, 1));
+        llama_sampler_chain_add(sampler, llama_sampler_init_temp(params.temperature));
+        llama_sampler_chain_add(sampler, llama_sampler_init_dist(params.seed));
+    }
+    return sampler;
+}
+
+namespace {
+
+// Reuse the arena's sampler chain unless the sampling parameters changed
+llama_sampler * arena_sampler(generation_arena & arena, const generation_params & params) {
+    if (arena.sampler != nullptr &&
+        arena.sampler_temperature == params.temperature &&
+        arena.sampler_top_p == params.top_p &&
+        arena.sampler_top_k == params.top_k &&
+        arena.sampler_seed == params.seed) {
+        llama_sampler_reset(arena.sampler);
+        return arena.sampler;
+    }
+    if (arena.sampler != nullptr) llama_sampler_free(arena.sampler);
+    arena.sampler = generation_make_sampler(params);
+    arena.sampler_temperature = params.temperature;
+    arena.sampler_top_p = params.top_p;
+    arena.sampler_top_k = params.top_k;
+    arena.sampler_seed = params.seed;
+    return arena.sampler;
+}
+
+bool arena_reserve_batch(generation_arena & arena, int n_tokens) {
+    if (arena.batch_capacity >= n_tokens) return true;
+    if (arena.batch_capacity > 0) llama_batch_free(arena.batch);
+    LOGD("Allocating batch with size %d using llama_batch_init", n_tokens);
+    arena.batch = llama_batch_init(n_tokens, 0, 1);  // n_tokens, embd=0, n_seq_max=1
+    arena.batch_capacity = arena.batch.token != nullptr ? n_tokens : 0;
+    return arena.batch_capacity > 0;
+}
+
+// Fit a request that still has n_prefill tokens to decode into its time budgets, using the
+// model's measured rates. Returns false (stop reason BUDGET) when the first token cannot
+// arrive in time; otherwise max_tokens is what the total budget allows.
+bool plan_budget(const llama_model * model, const generation_params & params, int n_prefill,
+                 std::chrono::steady_clock::time_point start, generation_stats & st,
+                 int & max_tokens, std::string & error);
+
+// Clear ctx, restore a matching preamble snapshot and run the rest of the prompt
+bool run_prompt(llama_context * ctx, const llama_model * model, generation_arena & arena,
+                const llama_token * prompt_tokens, int n_prompt_tokens,
+                const generation_params & params,
+                const std::function<void(const std::string & piece)> & on_piece,
+                std::string & error, generation_stats & st,
+                std::chrono::steady_clock::time_point start);
+
+// Decode n_prompt_tokens at positions from n_past on, then sample up to max_tokens
+// as planned by plan_budget
+bool run_tokens(llama_context * ctx, const llama_model * model, generation_arena & arena,
+                const llama_token * prompt_tokens, int n_prompt_tokens, int n_past,
+                const generation_params & params, int max_tokens,
+                const std::function<void(const std::string & piece)> & on_piece,
+                std::string & error, generation_stats & st,
+                std::chrono::steady_clock::time_point start,
+                std::vector<llama_token> * generated);
+
+} // namespace
+
+llama_context_params generation_context_params(int n_ctx, int n_batch, int n_ubatch, int n_threads,
+                                               int type_k, int type_v, int flash_attn) {
+    llama_context_params ctx_params = llama_context_default_params();
+    ctx_params.n_ctx = n_ctx > 0 ? n_ctx : 2048;
+    ctx_params.n_batch = n_batch > 0 ? n_batch : 512;
+    ctx_params.n_ubatch = n_ubatch > 0 ? std::min<uint32_t>(n_ubatch, ctx_params.n_batch) : ctx_params.n_batch;
+    ctx_params.n_threads = n_threads > 0 ? n_threads : cpu_threadpool_default_threads();
+    ctx_params.n_threads_batch = ctx_params.n_threads;
+    ctx_params.type_k = kv_cache_type_from_int(type_k);
+    ctx_params.type_v = kv_cache_type_from_int(type_v);
+
+    // One cache for all sequences: a fork shares the cells of its prefix, and
+    // sequence 0 can still use the whole context when nothing is forked
+    ctx_params.n_seq_max = GENERATION_MAX_SEQUENCES;
+    ctx_params.kv_unified = true;
+
+    // -1 = let llama.cpp decide, 0 = off, 1 = on
+    if (flash_attn == 0) {
+        ctx_params.flash_attn_type = LLAMA_FLASH_ATTN_TYPE_DISABLED;
+    } else if (flash_attn > 0) {
+        ctx_params.flash_attn_type = LLAMA_FLASH_ATTN_TYPE_ENABLED;
+    } else {
+        ctx_params.flash_attn_type = LLAMA_FLASH_ATTN_TYPE_AUTO;
+    }
+
+    // A quantized V cache is only supported with flash attention
+    bool v_quantized = ctx_params.type_v != GGML_TYPE_F16 &&
+                       ctx_params.type_v != GGML_TYPE_F32 &&
+                       ctx_params.type_v != GGML_TYPE_BF16;
+    if (v_quantized && ctx_params.flash_attn_type == LLAMA_FLASH_ATTN_TYPE_DISABLED) {
+        LOGW("Quantized V cache requires flash attention, enabling it");
+        ctx_params.flash_attn_type = LLAMA_FLASH_ATTN_TYPE_ENABLED;
+    }
+    return ctx_params;
+}
+
+bool generation_tokenize(const llama_model * model, const std::string & prompt,
+                         std::vector<llama_token> & tokens, std::string & error) {
+    const llama_vocab * vocab = llama_model_get_vocab(model);
+    if (vocab == nullptr) {
+        LOGE("Failed to get vocab from model");
+        error = "Failed to get vocabulary";
+        return false;
+    }
+
+    int max_prompt_tokens = prompt.length() + 256;
+    tokens.resize(max_prompt_tokens);
+
+    LOGD("Tokenizing prompt...");
+    int n_prompt_tokens = 0;
+    {
+        TRACE_SCOPE("tokenize");
+        n_prompt_tokens = llama_tokenize(vocab, prompt.c_str(), prompt.length(),
+                                         tokens.data(), max_prompt_tokens,
+                                         true, true);
+
+        if (n_prompt_tokens < 0) {
+            LOGD("Need more space for tokens: %d", -n_prompt_tokens);
+            tokens.resize(-n_prompt_tokens + 100);
+            n_prompt_tokens = llama_tokenize(vocab, prompt.c_str(), prompt.length(),
+                                             tokens.data(), tokens.size(),
+                                             true, true);
+        }
+    }
+
+    if (n_prompt_tokens < 0) {
+        LOGE("Failed to tokenize prompt, error code: %d", n_prompt_tokens);
+        error = "Failed to tokenize prompt";
+        return false;
+    }
+
+    if (n_prompt_tokens == 0) {
+        LOGE("Tokenization returned 0 tokens");
+        error = "Prompt tokenized to zero tokens";
+        return false;
+    }
+
+    tokens.resize(n_prompt_tokens);
+    LOGI("Prompt tokenized to %d tokens", n_prompt_tokens);
+    return true;
+}
+
+bool generation_run(llama_context * ctx, const llama_model * model, const std::string & prompt,
+                    const generation_params & params,
+                    const std::function<void(const std::string & piece)> & on_piece,
+                    std::string & error, generation_stats * stats) {
+    TRACE_SCOPE("generate");
+    const auto start = std::chrono::steady_clock::now();
+    generation_stats local_stats;
+    generation_stats & st = stats != nullptr ? *stats : local_stats;
+    st = generation_stats();
+    generation_arena & arena = arena_for(ctx);
+
+    std::vector<llama_token> & prompt_tokens = arena.prompt_tokens;
+    if (!generation_tokenize(model, prompt, prompt_tokens, error)) return false;
+    st.tokenize_ms = ms_since(start);
+
+    return run_prompt(ctx, model, arena, prompt_tokens.data(), (int) prompt_tokens.size(), params,
+                      on_piece, error, st, start);
+}
+
+bool generation_run(llama_context * ctx, const llama_model * model, const std::vector<llama_token> & prompt_tokens,
+                    const generation_params & params,
+                    const std::function<void(const std::string & piece)> & on_piece,
+                    std::string & error, generation_stats * stats) {
+    TRACE_SCOPE("generate");
+    const auto start = std::chrono::steady_clock::now();
+    generation_stats local_stats;
+    generation_stats & st = stats != nullptr ? *stats : local_stats;
+    st = generation_stats();
+    if (prompt_tokens.empty()) {
+        error = "Prompt tokenized to zero tokens";
+        return false;
+    }
+    return run_prompt(ctx, model, arena_for(ctx), prompt_tokens.data(), (int) prompt_tokens.size(), params,
+                      on_piece, error, st, start);
+}
+
+bool generation_run_tokens(llama_context * ctx, const llama_model * model,
+                           const llama_token * tokens, int n_tokens, int n_past,
+                           const generation_params & params,
+                           const std::function<void(const std::string & piece)> & on_piece,
+                           std::string & error, generation_stats * stats,
+                           std::vector<llama_token> * generated) {
+    TRACE_SCOPE("generate");
+    const auto start = std::chrono::steady_clock::now();
+    generation_stats local_stats;
+    generation_stats & st = stats != nullptr ? *stats : local_stats;
+    st = generation_stats();
+    if (n_tokens <= 0) {
+        error = "Nothing to decode";
+        return false;
+    }
+    int max_tokens = params.max_tokens;
+    if (!plan_budget(model, params, n_tokens, start, st, max_tokens, error)) return false;
+    return run_tokens(ctx, model, arena_for(ctx), tokens, n_tokens, n_past, params, max_tokens,
+                      on_piece, error, st, start, generated);
+}
+
+uint64_t generation_kv_epoch(const llama_context * ctx) {
+    return arena_for(ctx).kv_epoch;
+}
+
+void generation_invalidate_kv(const llama_context * ctx) {
+    arena_for(ctx).kv_epoch = g_next_kv_epoch++;
+}
+
+void generation_move_kv(const llama_context * from, const llama_context * to) {
+    arena_for(to).kv_epoch = arena_for(from).kv_epoch.load();
+}
+
+namespace {
+
+bool run_prompt(llama_context * ctx, const llama_model * model, generation_arena & arena,
+                const llama_token * prompt_tokens, int n_prompt_tokens,
+                const generation_params & params,
+                const std::function<void(const std::string & piece)> & on_piece,
+                std::string & error, generation_stats & st,
+                std::chrono::steady_clock::time_point start) {
+    // Requests that cannot meet their budgets are turned away before the context is touched
+    int max_tokens = params.max_tokens;
+    const int n_snapshot = prompt_snapshot_match(model, prompt_tokens, n_prompt_tokens);
+    if (!plan_budget(model, params, n_prompt_tokens - n_snapshot, start, st, max_tokens, error)) {
+        return false;
+    }
+
+    // Clear KV cache completely for fresh generation
+    LOGD("Clearing KV cache...");
+    llama_memory_t mem = llama_get_memory(ctx);
+    if (mem) {
+        llama_memory_clear(mem, false);  // false = keep structure, just clear data
+        LOGD("KV cache cleared");
+    } else {
+        LOGW("Could not get memory handle - proceeding without cache clear");
+    }
+    arena.kv_epoch = g_next_kv_epoch++;
+
+    // A stored preamble snapshot replaces prefilling the start of the prompt
+    const int n_restored = prompt_snapshot_restore(ctx, model, prompt_tokens, n_prompt_tokens);
+
+    return run_tokens(ctx, model, arena, prompt_tokens + n_restored, n_prompt_tokens - n_restored,
+                      n_restored, params, max_tokens, on_piece, error, st, start, nullptr);
+}
+
+bool plan_budget(const llama_model * model, const generation_params & params, int n_prefill,
+                 std::chrono::steady_clock::time_point start, generation_stats & st,
+                 int & max_tokens, std::string & error) {
+    max_tokens = params.max_tokens;
+    if (params.ttft_budget_ms <= 0 && params.total_budget_ms <= 0) return true;
+
+    double prefill_tps = 0;
+    double decode_tps = 0;
+    if (!generation_metrics_rates(model_registry_fingerprint(model), prefill_tps, decode_tps)) return true;
+
+    const double elapsed = ms_since(start);
+    const double token_ms = 1000.0 / decode_tps;
+    const double first_token_ms = elapsed + n_prefill * 1000.0 / prefill_tps + token_ms;
+    const double deadline = params.total_budget_ms > 0 ? params.total_budget_ms : first_token_ms;
+    if ((params.ttft_budget_ms > 0 && first_token_ms > params.ttft_budget_ms) || first_token_ms > deadline) {
+        LOGI("Budget cannot be met: first token expected after %.0f ms (ttft budget %.0f, total %.0f)",
+             first_token_ms, params.ttft_budget_ms, params.total_budget_ms);
+        st.stop_reason = GENERATION_STOP_BUDGET;
+        error = "Time budget cannot be met";
+        return false;
+    }
+    if (params.total_budget_ms > 0) {
+        const int fit = 1 + (int) ((params.total_budget_ms - first_token_ms) / token_ms);
+        if (fit < max_tokens) {
+            LOGI("Lowering max_tokens from %d to %d for a %.0f ms budget", max_tokens, fit, params.total_budget_ms);
+            max_tokens = fit;
+            st.budget_max_tokens = fit;
+        }
+    }
+    return true;
+}
+
+bool run_tokens(llama_context * ctx, const llama_model * model, generation_arena & arena,
+                const llama_token * prompt_tokens, int n_prompt_tokens, int n_past,
+                const generation_params & params, int max_tokens,
+                const std::function<void(const std::string & piece)> & on_piece,
+                std::string & error, generation_stats & st,
+                std::chrono::steady_clock::time_point start,
+                std::vector<llama_token> * generated) {
+    st.n_prompt = n_prompt_tokens;
+    st.n_reused = n_past;
+    st.token_ms.reserve(std::max(0, params.max_tokens));
+
+    auto cancelled = [&params]() {
+        return params.cancel != nullptr && params.cancel->load();
+    };
+
+    const llama_vocab * vocab = llama_model_get_vocab(model);
+    const std::shared_ptr<const token_piece_table> pieces = token_pieces_for(model);
+    if (vocab == nullptr || pieces == nullptr) {
+        LOGE("Failed to get vocab from model");
+        error = "Failed to get vocabulary";
+        return false;
+    }
+
+    // Get context size and batch size
+    int n_ctx = llama_n_ctx(ctx);
+    int n_batch = llama_n_batch(ctx);
+    if (n_batch <= 0) n_batch = 512;
+
+    LOGD("Context size: %d, Batch size: %d", n_ctx, n_batch);
+
+    if (n_past + n_prompt_tokens >= n_ctx) {
+        LOGE("Prompt (%d tokens after %d cached) exceeds context size (%d)", n_prompt_tokens, n_past, n_ctx);
+        error = "Prompt too long for context";
+        return false;
+    }
+
+    // The prompt is decoded in n_batch chunks, so one batch of that size serves every call
+    if (!arena_reserve_batch(arena, n_batch)) {
+        LOGE("Failed to allocate batch");
+        error = "Failed to allocate batch";
+        return false;
+    }
+    llama_batch & batch = arena.batch;
+
+    // Prefill batches use n_threads_batch, single-token decode uses n_threads.
+    // Prefill keeps the context's thread count, decode gets the tuned one.
+    const std::string model_id = model_registry_fingerprint(model);
+    const int prefill_threads = llama_n_threads_batch(ctx);
+    int decode_threads = thread_tuner_decode_threads(model_id, prefill_threads);
+    llama_set_n_threads(ctx, decode_threads, prefill_threads);
+    LOGI("Threads: prefill=%d, decode=%d", prefill_threads, decode_threads);
+
+    const bool has_budget = params.ttft_budget_ms > 0 || params.total_budget_ms > 0;
+
+    // Process prompt in chunks
+    LOGD("Processing prompt in batches...");
+    const auto prefill_start = std::chrono::steady_clock::now();
+    int n_cur = n_past;  // Current position in KV cache
+
+    for (int i = 0; i < n_prompt_tokens; i += n_batch) {
+        int n_eval = std::min(n_batch, n_prompt_tokens - i);
+
+        // Clear and fill batch
+        batch_clear(batch);
+        for (int j = 0; j < n_eval; j++) {
+            // logits = true only for last token of the prompt
+            bool is_last = (i + j == n_prompt_tokens - 1);
+            batch_add(batch, prompt_tokens[i + j], n_cur + j, 0, is_last);
+        }
+
+        LOGD("Processing prompt tokens %d to %d (batch of %d)", i, i + n_eval - 1, n_eval);
+
+        int ret = 0;
+        {
+            TRACE_SCOPE("prefill_decode");
+            ret = llama_decode(ctx, batch);
+        }
+        if (ret != 0) {
+            LOGE("llama_decode failed during prompt processing at pos %d, error: %d", i, ret);
+            error = "Failed to process prompt";
+            return false;
+        }
+
+        n_cur += n_eval;
+        // Prefill ran slower than measured before; the first token would come too late
+        const double elapsed = has_budget && i + n_eval < n_prompt_tokens ? ms_since(start) : 0;
+        if ((params.ttft_budget_ms > 0 && elapsed > params.ttft_budget_ms) ||
+            (params.total_budget_ms > 0 && elapsed > params.total_budget_ms)) {
+            LOGI("Time budget exceeded during prefill after %.0f ms", elapsed);
+            st.stop_reason = GENERATION_STOP_BUDGET;
+            error = "Time budget exceeded";
+            return false;
+        }
+    }
+
+    st.prefill_ms = ms_since(prefill_start);
+    LOGD("Prompt processing complete, n_cur=%d", n_cur);
+
+    // Initialize sampler
+    llama_sampler * sampler = arena_sampler(arena, params);
+    if (sampler == nullptr) {
+        LOGE("Failed to create sampler");
+        error = "Failed to create sampler";
+        return false;
+    }
+
+    // Generate tokens
+    std::string & piece = arena.piece;
+    piece.reserve(256);
+    token_detokenizer & detokenizer = arena.detokenizer;
+    detokenizer.reset(pieces.get(), true);
+    bool completed = true;
+    double window_ms = 0;
+    int window_tokens = 0;
+
+    // Allocation accounting for the steady state (every token after the first),
+    // excluding allocations made inside llama_sampler_sample and llama_decode
+    auto alloc_count = [&params]() -> uint64_t {
+        return params.alloc_count != nullptr ? params.alloc_count() : 0;
+    };
+    uint64_t token_allocs_start = 0;
+    uint64_t llama_allocs = 0;
+
+    LOGD("Starting token generation, max_tokens=%d", max_tokens);
+    st.stop_reason = max_tokens < params.max_tokens ? GENERATION_STOP_BUDGET : GENERATION_STOP_MAX_TOKENS;
+    if (max_tokens < params.max_tokens) completed = false;
+
+    for (int i = 0; i < max_tokens; i++) {
+        // Check for cancellation
+        if (cancelled()) {
+            LOGI("Generation cancelled by user at token %d", i);
+            st.stop_reason = GENERATION_STOP_CANCELLED;
+            completed = false;
+            break;
+        }
+
+        // Stop when the next token would land past the deadline
+        if (has_budget) {
+            const double elapsed = ms_since(start);
+            const double token_ms = i > 0 ? st.decode_ms / i : 0;
+            if ((i == 0 && params.ttft_budget_ms > 0 && elapsed > params.ttft_budget_ms) ||
+                (params.total_budget_ms > 0 && elapsed + token_ms > params.total_budget_ms)) {
+                LOGI("Time budget reached at token %d after %.0f ms", i, elapsed);
+                st.stop_reason = GENERATION_STOP_BUDGET;
+                completed = false;
+                break;
+            }
+        }
+
+        const auto token_start = std::chrono::steady_clock::now();
+        token_allocs_start = alloc_count();
+        llama_allocs = 0;
+
+        // Sample next token
+        llama_token new_token = 0;
+        {
+            TRACE_SCOPE("sample");
+            const uint64_t sample_allocs = alloc_count();
+            new_token = llama_sampler_sample(sampler, ctx, -1);
+            llama_allocs += alloc_count() - sample_allocs;
+        }
+        st.sample_ms += ms_since(token_start);
+
+        // Check for end of generation
+        if (!params.ignore_eog && llama_vocab_is_eog(vocab, new_token)) {
+            LOGD("End of generation token received at token %d", i);
+            st.stop_reason = GENERATION_STOP_EOG;
+            completed = true;
+            break;
+        }
+
+        if (i == 0) {
+            st.ttft_ms = ms_since(start);
+        }
+        st.n_generated++;
+
+        // Convert token to text; bytes of an unfinished UTF-8 character wait for the next token
+        bool has_text = false;
+        {
+            TRACE_SCOPE("token_to_piece");
+            detokenizer.push(new_token);
+            has_text = detokenizer.take(piece);
+        }
+        if (has_text) {
+            TRACE_SCOPE("callback");
+            const auto callback_start = std::chrono::steady_clock::now();
+            on_piece(piece);
+            st.callback_ms += ms_since(callback_start);
+
+            if (i % 50 == 0) {
+                LOGD("Generated %d tokens so far", i + 1);
+            }
+        }
+
+        // Check context limit
+        if (n_cur >= n_ctx - 1) {
+            LOGW("Reached context limit at token %d", i);
+            st.stop_reason = GENERATION_STOP_CONTEXT;
+            completed = false;
+            break;
+        }
+
+        // Prepare batch for next token decode
+        batch_clear(batch);
+        batch_add(batch, new_token, n_cur, 0, true);
+        n_cur++;
+
+        auto decode_start = std::chrono::steady_clock::now();
+        int decode_result = 0;
+        {
+            TRACE_SCOPE("decode");
+            const uint64_t decode_allocs = alloc_count();
+            decode_result = llama_decode(ctx, batch);
+            llama_allocs += alloc_count() - decode_allocs;
+        }
+        if (decode_result != 0) {
+            LOGE("Failed to decode token %d, error: %d", i, decode_result);
+            st.stop_reason = GENERATION_STOP_ERROR;
+            completed = false;
+            break;
+        }
+        if (generated != nullptr) generated->push_back(new_token);
+        const double decode_ms = ms_since(decode_start);
+        window_ms += decode_ms;
+        st.decode_ms += decode_ms;
+        st.token_ms.push_back(ms_since(token_start));
+
+        // Feed the decode latency of each window back into the thread tuner
+        if (++window_tokens == THREAD_TUNER_WINDOW) {
+            thread_tuner_report(model_id, decode_threads, window_ms / window_tokens);
+            window_ms = 0;
+            window_tokens = 0;
+            int next_threads = thread_tuner_decode_threads(model_id, prefill_threads);
+            if (next_threads != decode_threads) {
+                decode_threads = next_threads;
+                llama_set_n_threads(ctx, decode_threads, prefill_threads);
+            }
+        }
+
+        if (i > 0) {
+            st.loop_allocations += alloc_count() - token_allocs_start - llama_allocs;
+        }
+    }
+
+    if (detokenizer.pending() > 0) {
+        LOGD("Dropping %zu bytes of an incomplete UTF-8 character", detokenizer.pending());
+    }
+    st.completed = completed;
+    st.kv_cells_used = n_cur;
+    st.total_ms = ms_since(start);
+    LOGI("Generation complete, generated %d tokens in %.0f ms (%s)", st.n_generated, st.total_ms,
+         generation_stop_reason_name(st.stop_reason));
+
+    return true;
+}
+
+} // namespace
+
+void generation_release(const llama_context * ctx) {
+    std::unique_ptr<generation_arena> arena;
+    {
+        std::lock_guard<std::mutex> lock(g_arena_mutex);
+        auto it = g_arenas.find(ctx);
+        if (it == g_arenas.end()) return;
+        arena = std::move(it->second);
+        g_arenas.erase(it);
+    }
+}
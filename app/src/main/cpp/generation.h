@@ -0,0 +1,147 @@
+/**
+ * generation.h - Prompt processing and token generation loop
+ *
+ * The generate path shared by the JNI bridge and the host benchmark:
+ * tokenize, prefill in n_batch chunks, set up the sampler chain and decode
+ * token by token. Callers receive each text piece through a callback and can
+ * read per-phase timings from generation_stats.
+ *
+ * Each context gets an arena holding its batch, prompt token buffer, sampler
+ * chain (rebuilt only when sampling parameters change) and piece buffer, so
+ * after the first call the decode loop makes no heap allocations of its own.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "llama.h"
+
+// Sequences per context: generation uses sequence 0, the others hold forked conversation branches
+#define GENERATION_MAX_SEQUENCES 8
+
+// Why the decode loop stopped
+enum generation_stop_reason {
+    GENERATION_STOP_NONE = 0,         // not started, or failed before the first token
+    GENERATION_STOP_EOG,              // the model ended its output
+    GENERATION_STOP_MAX_TOKENS,
+    GENERATION_STOP_BUDGET,           // a time budget ran out or could not be met
+    GENERATION_STOP_CANCELLED,
+    GENERATION_STOP_CONTEXT,          // the context is full
+    GENERATION_STOP_ERROR,            // a decode failed
+};
+
+struct generation_params {
+    int max_tokens = 256;
+    float temperature = 0.7f;  // <= 0 selects greedy sampling
+    float top_p = 0.95f;
+    int top_k = 40;
+    uint32_t seed = LLAMA_DEFAULT_SEED;
+    bool ignore_eog = false;   // keep generating through end-of-generation tokens (benchmarks)
+    // Time budgets from the start of the call, 0 = none. Requests that cannot
+    // meet them at the model's measured rates stop before prefill, and
+    // max_tokens is lowered to what the total budget allows.
+    double ttft_budget_ms = 0;
+    double total_budget_ms = 0;
+    const std::atomic<bool> * cancel = nullptr;
+    bool preemptible = false;  // parallel generation parks between steps for interactive requests (generation_scheduler)
+    // Test hook: returns a running count of heap allocations. When set,
+    // stats.loop_allocations reports allocations made by the decode loop itself.
+    uint64_t (*alloc_count)() = nullptr;
+};
+
+struct generation_stats {
+    int n_prompt = 0;                 // prompt tokens decoded by this call
+    int n_reused = 0;                 // prompt tokens already in the KV cache (generation_run_tokens)
+    int n_generated = 0;
+    int kv_cells_used = 0;            // KV positions occupied when generation stopped
+    double tokenize_ms = 0;
+    double prefill_ms = 0;
+    double ttft_ms = 0;               // from the start of the call to the first generated token
+    double sample_ms = 0;             // total time in the sampler chain
+    double decode_ms = 0;             // total time in single-token llama_decode calls
+    double callback_ms = 0;           // total time spent in on_piece
+    double total_ms = 0;
+    std::vector<double> token_ms;     // wall time of every generated token (sample, callback, decode)
+    bool completed = false;           // false when cancelled, truncated by the context or failed
+    generation_stop_reason stop_reason = GENERATION_STOP_NONE;
+    int budget_max_tokens = 0;        // max_tokens as lowered to fit total_budget_ms, 0 if not lowered
+    uint64_t loop_allocations = 0;    // allocations in tokens after the first, outside llama.cpp calls
+};
+
+/**
+ * Build context parameters, applying defaults for values <= 0.
+ * flash_attn: -1 = auto, 0 = off, 1 = on. A quantized V cache forces flash attention on.
+ * The KV cache is unified across GENERATION_MAX_SEQUENCES sequences.
+ */
+llama_context_params generation_context_params(int n_ctx, int n_batch, int n_ubatch, int n_threads,
+                                               int type_k, int type_v, int flash_attn);
+
+// Lowercase name of a stop reason, e.g. "eog", for logs and JSON
+const char * generation_stop_reason_name(generation_stop_reason reason);
+
+// Sampler chain for params: greedy when temperature <= 0, else top-k, top-p, temperature and a seeded dist
+llama_sampler * generation_make_sampler(const generation_params & params);
+
+/**
+ * Run prompt through ctx (its memory is cleared first) and generate up to
+ * max_tokens. on_piece receives the text of every generated token in a
+ * buffer that is reused for the next one; copy it to keep it.
+ * Returns false with a message in error if nothing could be generated,
+ * including when the time budgets cannot be met (stats.stop_reason =
+ * GENERATION_STOP_BUDGET); a generation cut short by cancel, a budget, the
+ * context limit or a decode failure still returns true with
+ * stats.completed = false and the reason in stats.stop_reason.
+ */
+bool generation_run(llama_context * ctx, const llama_model * model, const std::string & prompt,
+                    const generation_params & params,
+                    const std::function<void(const std::string & piece)> & on_piece,
+                    std::string & error, generation_stats * stats = nullptr);
+
+/**
+ * Tokenize prompt the way generation_run does (BOS added, special tokens
+ * parsed). Whole prompts go straight to llama_tokenize rather than through
+ * the tokenizer cache, where they would only push out reusable entries.
+ */
+bool generation_tokenize(const llama_model * model, const std::string & prompt,
+                         std::vector<llama_token> & tokens, std::string & error);
+
+// generation_run for a prompt already tokenized with generation_tokenize
+bool generation_run(llama_context * ctx, const llama_model * model, const std::vector<llama_token> & prompt_tokens,
+                    const generation_params & params,
+                    const std::function<void(const std::string & piece)> & on_piece,
+                    std::string & error, generation_stats * stats = nullptr);
+
+/**
+ * Continue from what ctx's KV cache already holds: decode tokens at
+ * positions n_past onward (sequence 0), then generate as generation_run does.
+ * The cache must hold exactly n_past positions; remove anything after them first.
+ * Generated tokens that were decoded into the cache are appended to generated,
+ * so the caller can keep an exact mirror of the cache contents.
+ */
+bool generation_run_tokens(llama_context * ctx, const llama_model * model,
+                           const llama_token * tokens, int n_tokens, int n_past,
+                           const generation_params & params,
+                           const std::function<void(const std::string & piece)> & on_piece,
+                           std::string & error, generation_stats * stats = nullptr,
+                           std::vector<llama_token> * generated = nullptr);
+
+/**
+ * Counter bumped every time ctx's KV cache is cleared by generation_run or
+ * generation_invalidate_kv. Callers that keep state in the cache compare it
+ * against the value they saw last to learn that their tokens are gone.
+ */
+uint64_t generation_kv_epoch(const llama_context * ctx);
+
+// Record that ctx's KV cache was cleared or modified outside this module
+void generation_invalidate_kv(const llama_context * ctx);
+
+// Record that to now holds the KV contents of from, so state kept against from's epoch stays valid
+void generation_move_kv(const llama_context * from, const llama_context * to);
+
+// Free the arena kept for ctx. Call before llama_free(ctx).
+void generation_release(const llama_context * ctx);
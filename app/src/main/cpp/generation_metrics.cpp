@@ -0,0 +1,235 @@
+/**
+ * generation_metrics.cpp - Per-request generation metrics and rolling histograms
+ */
+
+#include "generation_metrics.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+struct metrics_record {
+    double ttft_ms = 0;
+    double prefill_tps = 0;
+    double decode_tps = 0;
+    double sample_ms_per_token = 0;
+    double callback_ms_per_token = 0;
+    int kv_cells_used = 0;
+    bool completed = false;
+    std::array<uint32_t, GENERATION_METRICS_BUCKETS> token_buckets{};
+};
+
+struct model_metrics {
+    std::deque<metrics_record> window;
+    uint64_t generations = 0;
+    uint64_t cache_hits = 0;
+};
+
+std::mutex g_metrics_mutex;
+std::map<std::string, model_metrics> g_models;
+std::string g_last_json = "{}";
+
+int bucket_for(double ms) {
+    if (ms < 1) return 0;
+    int bucket = 1 + (int) std::floor(std::log2(ms));
+    return std::min(bucket, GENERATION_METRICS_BUCKETS - 1);
+}
+
+// Upper bound of a bucket in ms (the open-ended last bucket reports its lower bound)
+double bucket_bound(int bucket) {
+    return std::ldexp(1.0, std::min(bucket, GENERATION_METRICS_BUCKETS - 2));
+}
+
+double rate(int tokens, double ms) {
+    return ms > 0 ? tokens * 1000.0 / ms : 0;
+}
+
+std::string escape_json(const std::string & s) {
+    std::string out;
+    for (char c : s) {
+        if (c == '"' || c == '\\') out += '\\';
+        out += c;
+    }
+    return out;
+}
+
+std::string summary_json(std::vector<double> values) {
+    if (values.empty()) return "null";
+    std::sort(values.begin(), values.end());
+    double sum = 0;
+    for (double v : values) sum += v;
+    auto at = [&values](double p) {
+        return values[std::min(values.size() - 1, (size_t) (p * (values.size() - 1) + 0.5))];
+    };
+
+    std::string json = "{";
+    json += "\"mean\":" + std::to_string(sum / values.size()) + ",";
+    json += "\"p50\":" + std::to_string(at(0.50)) + ",";
+    json += "\"p90\":" + std::to_string(at(0.90)) + ",";
+    json += "\"p99\":" + std::to_string(at(0.99)) + "}";
+    return json;
+}
+
+std::string histogram_json(const std::array<uint64_t, GENERATION_METRICS_BUCKETS> & counts) {
+    uint64_t total = 0;
+    for (uint64_t c : counts) total += c;
+    auto at = [&](double p) {
+        uint64_t target = (uint64_t) std::ceil(p * total);
+        uint64_t seen = 0;
+        for (int i = 0; i < GENERATION_METRICS_BUCKETS; i++) {
+            seen += counts[i];
+            if (seen >= target && seen > 0) return bucket_bound(i);
+        }
+        return 0.0;
+    };
+
+    std::string json = "{\"count\":" + std::to_string(total) + ",";
+    json += "\"p50\":" + std::to_string(at(0.50)) + ",";
+    json += "\"p90\":" + std::to_string(at(0.90)) + ",";
+    json += "\"p99\":" + std::to_string(at(0.99)) + ",";
+    json += "\"buckets\":[";
+    for (int i = 0; i < GENERATION_METRICS_BUCKETS; i++) {
+        if (i > 0) json += ",";
+        json += std::to_string(counts[i]);
+    }
+    json += "]}";
+    return json;
+}
+
+std::string record_json(const std::string & model_id, const generation_stats & stats, bool cache_hit) {
+    const int decoded = (int) stats.token_ms.size();
+    std::string json = "{";
+    json += "\"model\":\"" + escape_json(model_id) + "\",";
+    json += "\"cache_hit\":" + std::string(cache_hit ? "true" : "false") + ",";
+    json += "\"completed\":" + std::string(stats.completed ? "true" : "false") + ",";
+    json += "\"stop_reason\":\"" + std::string(generation_stop_reason_name(stats.stop_reason)) + "\",";
+    json += "\"n_prompt\":" + std::to_string(stats.n_prompt) + ",";
+    json += "\"n_generated\":" + std::to_string(stats.n_generated) + ",";
+    json += "\"kv_cells_used\":" + std::to_string(stats.kv_cells_used) + ",";
+    json += "\"tokenize_ms\":" + std::to_string(stats.tokenize_ms) + ",";
+    json += "\"prefill_ms\":" + std::to_string(stats.prefill_ms) + ",";
+    json += "\"prefill_tps\":" + std::to_string(rate(stats.n_prompt, stats.prefill_ms)) + ",";
+    json += "\"ttft_ms\":" + std::to_string(stats.ttft_ms) + ",";
+    json += "\"decode_ms\":" + std::to_string(stats.decode_ms) + ",";
+    json += "\"decode_tps\":" + std::to_string(rate(decoded, stats.decode_ms)) + ",";
+    json += "\"sample_ms\":" + std::to_string(stats.sample_ms) + ",";
+    json += "\"callback_ms\":" + std::to_string(stats.callback_ms) + ",";
+    json += "\"total_ms\":" + std::to_string(stats.total_ms);
+    json += "}";
+    return json;
+}
+
+} // namespace
+
+void generation_metrics_record(const std::string & model_id, const generation_stats & stats, bool cache_hit) {
+    std::string json = record_json(model_id, stats, cache_hit);
+
+    std::lock_guard<std::mutex> lock(g_metrics_mutex);
+    g_last_json = std::move(json);
+
+    model_metrics & metrics = g_models[model_id];
+    metrics.generations++;
+    if (cache_hit) {
+        metrics.cache_hits++;
+        return;
+    }
+
+    metrics_record record;
+    const int n = std::max(1, stats.n_generated);
+    record.ttft_ms = stats.ttft_ms;
+    record.prefill_tps = rate(stats.n_prompt, stats.prefill_ms);
+    record.decode_tps = rate((int) stats.token_ms.size(), stats.decode_ms);
+    record.sample_ms_per_token = stats.sample_ms / n;
+    record.callback_ms_per_token = stats.callback_ms / n;
+    record.kv_cells_used = stats.kv_cells_used;
+    record.completed = stats.completed;
+    for (double ms : stats.token_ms) record.token_buckets[bucket_for(ms)]++;
+
+    metrics.window.push_back(record);
+    while (metrics.window.size() > GENERATION_METRICS_WINDOW) metrics.window.pop_front();
+}
+
+bool generation_metrics_rates(const std::string & model_id, double & prefill_tps, double & decode_tps) {
+    std::lock_guard<std::mutex> lock(g_metrics_mutex);
+    auto it = g_models.find(model_id);
+    if (it == g_models.end()) return false;
+
+    std::vector<double> prefill, decode;
+    for (const auto & record : it->second.window) {
+        if (record.prefill_tps > 0) prefill.push_back(record.prefill_tps);
+        if (record.decode_tps > 0) decode.push_back(record.decode_tps);
+    }
+    if (prefill.empty() || decode.empty()) return false;
+    auto median = [](std::vector<double> & values) {
+        std::nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+        return values[values.size() / 2];
+    };
+    prefill_tps = median(prefill);
+    decode_tps = median(decode);
+    return true;
+}
+
+std::string generation_metrics_last_json() {
+    std::lock_guard<std::mutex> lock(g_metrics_mutex);
+    return g_last_json;
+}
+
+std::string generation_metrics_histogram_json() {
+    std::lock_guard<std::mutex> lock(g_metrics_mutex);
+
+    std::string json = "{\"window\":" + std::to_string(GENERATION_METRICS_WINDOW) + ",";
+    json += "\"token_ms_bounds\":[";
+    for (int i = 0; i < GENERATION_METRICS_BUCKETS - 1; i++) {
+        if (i > 0) json += ",";
+        json += std::to_string((int) bucket_bound(i));
+    }
+    json += "],\"models\":[";
+
+    bool first = true;
+    for (const auto & kv : g_models) {
+        const model_metrics & metrics = kv.second;
+        std::vector<double> ttft, prefill, decode, sample, callback, kv_cells;
+        std::array<uint64_t, GENERATION_METRICS_BUCKETS> token_counts{};
+        int completed = 0;
+        for (const auto & record : metrics.window) {
+            if (record.ttft_ms > 0) ttft.push_back(record.ttft_ms);
+            if (record.prefill_tps > 0) prefill.push_back(record.prefill_tps);
+            if (record.decode_tps > 0) decode.push_back(record.decode_tps);
+            sample.push_back(record.sample_ms_per_token);
+            callback.push_back(record.callback_ms_per_token);
+            kv_cells.push_back(record.kv_cells_used);
+            completed += record.completed ? 1 : 0;
+            for (int i = 0; i < GENERATION_METRICS_BUCKETS; i++) token_counts[i] += record.token_buckets[i];
+        }
+
+        if (!first) json += ",";
+        first = false;
+        json += "{\"model\":\"" + escape_json(kv.first) + "\",";
+        json += "\"generations\":" + std::to_string(metrics.generations) + ",";
+        json += "\"cache_hits\":" + std::to_string(metrics.cache_hits) + ",";
+        json += "\"samples\":" + std::to_string(metrics.window.size()) + ",";
+        json += "\"completed\":" + std::to_string(completed) + ",";
+        json += "\"ttft_ms\":" + summary_json(ttft) + ",";
+        json += "\"prefill_tps\":" + summary_json(prefill) + ",";
+        json += "\"decode_tps\":" + summary_json(decode) + ",";
+        json += "\"sample_ms_per_token\":" + summary_json(sample) + ",";
+        json += "\"callback_ms_per_token\":" + summary_json(callback) + ",";
+        json += "\"kv_cells_used\":" + summary_json(kv_cells) + ",";
+        json += "\"token_ms\":" + histogram_json(token_counts) + "}";
+    }
+    json += "]}";
+    return json;
+}
+
+void generation_metrics_reset() {
+    std::lock_guard<std::mutex> lock(g_metrics_mutex);
+    g_models.clear();
+    g_last_json = "{}";
+}
@@ -0,0 +1,41 @@
+/**
+ * generation_metrics.h - Per-request generation metrics and rolling histograms
+ *
+ * Every generateNative call records where its time went (tokenize, prefill,
+ * sampling, decode, callbacks) and how much KV it used. The latest record is
+ * kept for the caller, and the last GENERATION_METRICS_WINDOW records of each
+ * model feed rolling distributions so regressions show up per model and device.
+ */
+
+#pragma once
+
+#include <string>
+
+#include "generation.h"
+
+// Records per model kept for the rolling distributions
+#define GENERATION_METRICS_WINDOW 128
+
+// Log2 latency buckets: bucket 0 is < 1 ms, bucket i is [2^(i-1), 2^i) ms, the last is open ended
+#define GENERATION_METRICS_BUCKETS 16
+
+/**
+ * Record one generation. Cache hits are reported as the latest record but
+ * kept out of the distributions, which track model performance only.
+ */
+void generation_metrics_record(const std::string & model_id, const generation_stats & stats, bool cache_hit);
+
+/**
+ * Median prefill and decode rates (tokens per second) over the model's recent
+ * generations, for planning requests with time budgets. Returns false until
+ * both have been measured.
+ */
+bool generation_metrics_rates(const std::string & model_id, double & prefill_tps, double & decode_tps);
+
+// The most recent record as a JSON object string, "{}" before the first generation
+std::string generation_metrics_last_json();
+
+// Rolling distributions per model as a JSON object string
+std::string generation_metrics_histogram_json();
+
+void generation_metrics_reset();
@@ -0,0 +1,172 @@
+/**
+ * generation_scheduler.cpp - Priority classes for requests sharing a context
+ */
+
+#include "generation_scheduler.h"
+#include "logging.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+#define LOG_TAG "GenScheduler"
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+enum class owner_type { none, interactive, background };
+
+std::mutex g_scheduler_mutex;
+std::condition_variable g_scheduler_cv;
+owner_type g_owner = owner_type::none;
+int g_interactive_waiting = 0;
+bool g_background_parked = false;
+bool g_background_due = false;         // the parked job has waited its longest and goes next
+float g_background_share = 0.2f;
+
+clock_type::time_point g_owner_since;   // when the current owner took the context
+double g_last_interactive_ms = 0;       // how long the running background job was last parked
+
+uint64_t g_interactive_requests = 0;
+uint64_t g_background_jobs = 0;
+uint64_t g_preemptions = 0;
+double g_interactive_wait_ms = 0;
+double g_max_interactive_wait_ms = 0;
+double g_background_parked_ms = 0;
+
+double ms_since(clock_type::time_point start) {
+    return std::chrono::duration<double, std::milli>(clock_type::now() - start).count();
+}
+
+// Time a resumed background job runs before a waiting interactive request gets the context
+double background_slice_ms_locked() {
+    const double share = g_background_share;
+    const double slice = g_last_interactive_ms * share / (1.0 - share);
+    return std::min<double>(slice, GENERATION_SCHEDULER_MAX_SLICE_MS);
+}
+
+// Longest a parked job waits while interactive requests keep queueing; the full
+// slice it then gets is its share of the two. Negative for no guaranteed share.
+double max_parked_ms_locked() {
+    const double share = g_background_share;
+    if (share <= 0) return -1;
+    return GENERATION_SCHEDULER_MAX_SLICE_MS * (1.0 - share) / share;
+}
+
+// A parked job resumes once the context is free and nobody else is waiting, or once it is due
+bool can_resume_locked() {
+    return g_owner == owner_type::none && (g_interactive_waiting == 0 || g_background_due);
+}
+
+} // namespace
+
+void generation_scheduler_acquire(generation_priority priority) {
+    std::unique_lock<std::mutex> lock(g_scheduler_mutex);
+    if (priority == GENERATION_PRIORITY_INTERACTIVE) {
+        const auto wait_start = clock_type::now();
+        g_interactive_waiting++;
+        g_scheduler_cv.wait(lock, [] { return g_owner == owner_type::none && !g_background_due; });
+        g_interactive_waiting--;
+        const double waited = ms_since(wait_start);
+        g_interactive_wait_ms += waited;
+        g_max_interactive_wait_ms = std::max(g_max_interactive_wait_ms, waited);
+        g_interactive_requests++;
+        g_owner = owner_type::interactive;
+    } else {
+        g_scheduler_cv.wait(lock, [] {
+            return g_owner == owner_type::none && g_interactive_waiting == 0 && !g_background_parked;
+        });
+        g_background_jobs++;
+        g_owner = owner_type::background;
+        g_owner_since = clock_type::now();
+        g_last_interactive_ms = 0;
+    }
+}
+
+bool generation_scheduler_try_acquire() {
+    std::lock_guard<std::mutex> lock(g_scheduler_mutex);
+    if (g_owner != owner_type::none || g_interactive_waiting > 0 || g_background_parked) return false;
+    g_owner = owner_type::interactive;
+    return true;
+}
+
+void generation_scheduler_release(generation_priority priority) {
+    {
+        std::lock_guard<std::mutex> lock(g_scheduler_mutex);
+        const owner_type owner = priority == GENERATION_PRIORITY_INTERACTIVE ? owner_type::interactive
+                                                                              : owner_type::background;
+        if (g_owner == owner) g_owner = owner_type::none;
+    }
+    g_scheduler_cv.notify_all();
+}
+
+bool generation_scheduler_should_yield() {
+    std::lock_guard<std::mutex> lock(g_scheduler_mutex);
+    if (g_interactive_waiting == 0 || g_owner != owner_type::background) return false;
+    return ms_since(g_owner_since) >= background_slice_ms_locked();
+}
+
+void generation_scheduler_yield() {
+    std::unique_lock<std::mutex> lock(g_scheduler_mutex);
+    const auto parked_start = clock_type::now();
+    g_preemptions++;
+    g_background_parked = true;
+    g_owner = owner_type::none;
+    g_scheduler_cv.notify_all();
+    LOGD("Background job parked for %d interactive request(s)", g_interactive_waiting);
+
+    const double max_parked = max_parked_ms_locked();
+    if (max_parked >= 0) {
+        const auto deadline = parked_start + std::chrono::duration_cast<clock_type::duration>(
+                std::chrono::duration<double, std::milli>(max_parked));
+        if (!g_scheduler_cv.wait_until(lock, deadline, can_resume_locked)) {
+            // Interactive requests kept coming: take the context at the next handover
+            g_background_due = true;
+            LOGD("Background job due after %.0f ms parked, %d interactive request(s) waiting",
+                 ms_since(parked_start), g_interactive_waiting);
+        }
+    }
+    g_scheduler_cv.wait(lock, can_resume_locked);
+    g_background_due = false;
+    g_background_parked = false;
+    g_owner = owner_type::background;
+    g_owner_since = clock_type::now();
+    // Every interactive request served while parked counts towards the next slice
+    const double parked = ms_since(parked_start);
+    g_last_interactive_ms = parked;
+    g_background_parked_ms += parked;
+    LOGD("Background job resumed after %.0f ms", parked);
+}
+
+bool generation_scheduler_busy() {
+    std::lock_guard<std::mutex> lock(g_scheduler_mutex);
+    return g_owner != owner_type::none || g_background_parked;
+}
+
+bool generation_scheduler_parked() {
+    std::lock_guard<std::mutex> lock(g_scheduler_mutex);
+    return g_background_parked;
+}
+
+void generation_scheduler_set_background_share(float share) {
+    std::lock_guard<std::mutex> lock(g_scheduler_mutex);
+    g_background_share = std::max(0.0f, std::min(share, 0.9f));
+}
+
+std::string generation_scheduler_stats_json() {
+    std::lock_guard<std::mutex> lock(g_scheduler_mutex);
+    std::string json = "{";
+    json += "\"background_share\":" + std::to_string(g_background_share) + ",";
+    json += "\"interactive_requests\":" + std::to_string(g_interactive_requests) + ",";
+    json += "\"background_jobs\":" + std::to_string(g_background_jobs) + ",";
+    json += "\"preemptions\":" + std::to_string(g_preemptions) + ",";
+    json += "\"avg_interactive_wait_ms\":" +
+            std::to_string(g_interactive_requests > 0 ? g_interactive_wait_ms / g_interactive_requests : 0.0) + ",";
+    json += "\"max_interactive_wait_ms\":" + std::to_string(g_max_interactive_wait_ms) + ",";
+    json += "\"background_parked_ms\":" + std::to_string(g_background_parked_ms);
+    json += "}";
+    return json;
+}
@@ -0,0 +1,85 @@
+/**
+ * generation_scheduler.h - Priority classes for requests sharing a context
+ *
+ * Interactive requests (chat, prompt lab) and background jobs (batched
+ * flashcard and quiz generation) run on the same llama context, one at a
+ * time. A background job holds the context between its decode steps only
+ * loosely: when an interactive request is waiting, the job saves its KV
+ * state, hands the context over at the next step boundary and resumes from
+ * the saved state once no interactive request is left. The interactive
+ * request so waits for at most one decode step instead of the whole job.
+ *
+ * So that back-to-back interactive requests cannot starve background work,
+ * a parked job that has waited MAX_SLICE_MS * (1 - share) / share takes the
+ * context back at the next handover even while interactive requests are
+ * queued, and a resumed job keeps the context until it has had its minimum
+ * share of the time since the last handover (capped at
+ * GENERATION_SCHEDULER_MAX_SLICE_MS).
+ */
+
+#pragma once
+
+#include <string>
+
+// Longest a background job keeps the context while an interactive request waits
+#define GENERATION_SCHEDULER_MAX_SLICE_MS 1000
+
+enum generation_priority {
+    GENERATION_PRIORITY_INTERACTIVE = 0,
+    GENERATION_PRIORITY_BACKGROUND = 1,
+};
+
+/**
+ * Wait until a request of the given priority may use the context and take
+ * it. Interactive requests wait for a running background job to step aside;
+ * background jobs wait until no other request runs, is waiting or is parked.
+ */
+void generation_scheduler_acquire(generation_priority priority);
+
+/**
+ * Take the context for an interactive caller only if nobody holds it, waits
+ * for it or is parked, without blocking. Release with
+ * generation_scheduler_release(GENERATION_PRIORITY_INTERACTIVE).
+ */
+bool generation_scheduler_try_acquire();
+
+void generation_scheduler_release(generation_priority priority);
+
+// Holds the context for a scope
+class generation_scheduler_lease {
+public:
+    explicit generation_scheduler_lease(generation_priority priority) : priority_(priority) {
+        generation_scheduler_acquire(priority_);
+    }
+    ~generation_scheduler_lease() { generation_scheduler_release(priority_); }
+
+    generation_scheduler_lease(const generation_scheduler_lease &) = delete;
+    generation_scheduler_lease & operator=(const generation_scheduler_lease &) = delete;
+
+private:
+    generation_priority priority_;
+};
+
+/**
+ * Called by a background job between decode steps: true when an interactive
+ * request is waiting and the job has had its minimum share since it resumed.
+ */
+bool generation_scheduler_should_yield();
+
+/**
+ * Hand the context to the waiting interactive requests and block until they
+ * are done. The caller saves whatever it keeps in the context first and
+ * restores it afterwards.
+ */
+void generation_scheduler_yield();
+
+// True while any request holds the context or a background job is parked
+bool generation_scheduler_busy();
+
+// True while a background job is parked; it looks its context up again when it resumes
+bool generation_scheduler_parked();
+
+// Minimum fraction of time background jobs get while interactive requests keep arriving (0..0.9)
+void generation_scheduler_set_background_share(float share);
+
+std::string generation_scheduler_stats_json();
@@ -0,0 +1,58 @@
+/**
+ * kv_estimate.cpp - KV cache type selection and memory estimation
+ */
+
+#include "kv_estimate.h"
+
+#include <cstdlib>
+#include <string>
+
+// Read an integer GGUF metadata value such as "llama.attention.key_length"
+static int64_t model_meta_int(const llama_model * model, const std::string & key, int64_t fallback) {
+    char buf[64];
+    if (llama_model_meta_val_str(model, key.c_str(), buf, sizeof(buf)) <= 0) {
+        return fallback;
+    }
+    char * end = nullptr;
+    long long value = std::strtoll(buf, &end, 10);
+    return end != buf ? value : fallback;
+}
+
+ggml_type kv_cache_type_from_int(int type) {
+    switch (type) {
+        case GGML_TYPE_F32:
+        case GGML_TYPE_F16:
+        case GGML_TYPE_BF16:
+        case GGML_TYPE_Q8_0:
+        case GGML_TYPE_Q4_0:
+        case GGML_TYPE_Q4_1:
+        case GGML_TYPE_Q5_0:
+        case GGML_TYPE_Q5_1:
+            return (ggml_type) type;
+        default:
+            return GGML_TYPE_F16;
+    }
+}
+
+size_t kv_cache_estimate_bytes(const llama_model * model, uint32_t n_ctx,
+                               ggml_type type_k, ggml_type type_v) {
+    if (model == nullptr || n_ctx == 0) return 0;
+
+    const int64_t n_layer = llama_model_n_layer(model);
+    const int64_t n_embd = llama_model_n_embd(model);
+    const int64_t n_head = llama_model_n_head(model);
+    const int64_t n_head_kv = llama_model_n_head_kv(model);
+    if (n_layer <= 0 || n_head <= 0 || n_head_kv <= 0) return 0;
+
+    char arch[64] = {0};
+    llama_model_meta_val_str(model, "general.architecture", arch, sizeof(arch));
+
+    const int64_t head_dim = n_embd / n_head;
+    const int64_t head_dim_k = model_meta_int(model, std::string(arch) + ".attention.key_length", head_dim);
+    const int64_t head_dim_v = model_meta_int(model, std::string(arch) + ".attention.value_length", head_dim);
+
+    const size_t k_row = ggml_row_size(type_k, head_dim_k * n_head_kv);
+    const size_t v_row = ggml_row_size(type_v, head_dim_v * n_head_kv);
+
+    return (size_t) n_layer * n_ctx * (k_row + v_row);
+}
@@ -0,0 +1,24 @@
+/**
+ * kv_estimate.h - KV cache type selection and memory estimation
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "llama.h"
+
+/**
+ * Map a ggml type id coming from Kotlin to a KV cache type llama.cpp supports.
+ * Unknown or unsupported ids fall back to F16.
+ */
+ggml_type kv_cache_type_from_int(int type);
+
+/**
+ * Estimate the bytes the KV cache of a context will occupy before allocating it.
+ * Uses the per-layer K/V widths from GGUF metadata when present. Models with
+ * sliding-window or recurrent layers allocate less, so this is an upper bound.
+ */
+size_t kv_cache_estimate_bytes(const llama_model * model, uint32_t n_ctx,
+                               ggml_type type_k, ggml_type type_v);
@@ -0,0 +1,453 @@
+/**
+ * kv_spill.cpp - Disk tier for the KV state of idle conversations
+ */
+
+#include "kv_spill.h"
+#include "generation_metrics.h"
+#include "logging.h"
+#include "model_registry.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <utime.h>
+#include <zlib.h>
+
+#define LOG_TAG "KvSpill"
+
+namespace {
+
+constexpr const char * SPILL_SUFFIX = ".kvz";
+constexpr uint32_t SPILL_MAGIC = 0x5053564bu;  // "KVSP"
+constexpr uint32_t SPILL_VERSION = 2;
+// Unit of byte shuffling and of the deflate and inflate buffers
+constexpr size_t CHUNK_BYTES = 256 * 1024;
+// Conversations with statistics kept; the least recently used are forgotten
+constexpr size_t MAX_TRACKED = 256;
+// Restore throughput assumed until one has been measured (read and inflate on a phone)
+constexpr double DEFAULT_RESTORE_BYTES_PER_MS = 200.0 * 1024;
+
+struct spill_header {
+    uint32_t magic = SPILL_MAGIC;
+    uint32_t version = SPILL_VERSION;
+    uint32_t n_tokens = 0;
+    uint32_t reserved = 0;
+    uint64_t raw_bytes = 0;
+    uint64_t compressed_bytes = 0;
+};
+
+struct conversation_stats {
+    uint64_t spills = 0;
+    uint64_t skipped = 0;       // not spilled because a prefill would be as fast
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t tokens_restored = 0;
+    double restore_ms = 0;
+    uint64_t last_used = 0;
+};
+
+std::mutex g_spill_mutex;
+std::condition_variable g_spill_cv;
+std::string g_dir;
+size_t g_max_bytes = 0;
+std::vector<std::string> g_pending;  // files being written
+std::map<std::string, conversation_stats> g_conversations;
+uint64_t g_clock = 0;
+
+uint64_t g_spills = 0;
+uint64_t g_spill_failures = 0;
+uint64_t g_skipped = 0;
+uint64_t g_hits = 0;
+uint64_t g_misses = 0;
+uint64_t g_raw_bytes_written = 0;
+uint64_t g_bytes_written = 0;
+uint64_t g_raw_bytes_restored = 0;
+double g_write_ms = 0;
+double g_restore_ms = 0;
+
+double ms_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+uint64_t fnv1a(const std::string & s) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : s) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+std::string hex(uint64_t value) {
+    char buf[17];
+    snprintf(buf, sizeof(buf), "%016llx", (unsigned long long) value);
+    return buf;
+}
+
+// <model>-<conversation>.kvz, so a conversation continued with another model does not collide
+std::string path_locked(const std::string & model_id, const std::string & id) {
+    return g_dir + "/" + hex(fnv1a(model_id)) + "-" + hex(fnv1a(id)) + SPILL_SUFFIX;
+}
+
+conversation_stats & stats_locked(const std::string & id) {
+    conversation_stats & stats = g_conversations[id];
+    stats.last_used = ++g_clock;
+    if (g_conversations.size() > MAX_TRACKED) {
+        auto lru = g_conversations.end();
+        for (auto it = g_conversations.begin(); it != g_conversations.end(); ++it) {
+            if (lru == g_conversations.end() || it->second.last_used < lru->second.last_used) lru = it;
+        }
+        g_conversations.erase(lru);
+    }
+    return g_conversations[id];
+}
+
+double restore_bytes_per_ms_locked() {
+    return g_restore_ms > 0 ? g_raw_bytes_restored / g_restore_ms : DEFAULT_RESTORE_BYTES_PER_MS;
+}
+
+bool pending_locked(const std::string & path) {
+    return std::find(g_pending.begin(), g_pending.end(), path) != g_pending.end();
+}
+
+// Group the low and high bytes of 16-bit values: the exponent bytes of F16 KV data then deflate well
+void shuffle16(const uint8_t * in, size_t n, uint8_t * out) {
+    const size_t half = n / 2;
+    for (size_t i = 0; i < half; i++) {
+        out[i] = in[2 * i];
+        out[half + i] = in[2 * i + 1];
+    }
+    if (n & 1) out[n - 1] = in[n - 1];
+}
+
+void unshuffle16(const uint8_t * in, size_t n, uint8_t * out) {
+    const size_t half = n / 2;
+    for (size_t i = 0; i < half; i++) {
+        out[2 * i] = in[i];
+        out[2 * i + 1] = in[half + i];
+    }
+    if (n & 1) out[n - 1] = in[n - 1];
+}
+
+// Delete the least recently used files until the directory fits the budget
+void enforce_budget_locked() {
+    struct file_info {
+        std::string path;
+        size_t size;
+        time_t mtime;
+    };
+    std::vector<file_info> files;
+    size_t total = 0;
+    DIR * dir = opendir(g_dir.c_str());
+    if (dir == nullptr) return;
+    while (dirent * entry = readdir(dir)) {
+        const std::string name = entry->d_name;
+        if (name.size() <= strlen(SPILL_SUFFIX) ||
+            name.compare(name.size() - strlen(SPILL_SUFFIX), std::string::npos, SPILL_SUFFIX) != 0) {
+            continue;
+        }
+        const std::string path = g_dir + "/" + name;
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0) continue;
+        files.push_back({path, (size_t) st.st_size, st.st_mtime});
+        total += (size_t) st.st_size;
+    }
+    closedir(dir);
+
+    std::sort(files.begin(), files.end(), [](const file_info & a, const file_info & b) { return a.mtime < b.mtime; });
+    for (const auto & file : files) {
+        if (total <= g_max_bytes) break;
+        if (pending_locked(file.path)) continue;
+        LOGD("Deleting spilled sequence %s (%zu bytes) over budget", file.path.c_str(), file.size);
+        remove(file.path.c_str());
+        total -= file.size;
+    }
+}
+
+// Deflate n bytes of data to file, shuffling each CHUNK_BYTES piece on its own, so only
+// two chunk buffers are needed besides the data. written receives the compressed size.
+bool deflate_to(FILE * file, const uint8_t * data, size_t n, uint64_t & written) {
+    z_stream zs = {};
+    if (deflateInit(&zs, Z_BEST_SPEED) != Z_OK) return false;
+    std::vector<uint8_t> in(CHUNK_BYTES);
+    std::vector<uint8_t> out(CHUNK_BYTES);
+    written = 0;
+    bool ok = true;
+    size_t off = 0;
+    int flush = Z_NO_FLUSH;
+    while (ok && flush != Z_FINISH) {
+        const size_t len = std::min(CHUNK_BYTES, n - off);
+        shuffle16(data + off, len, in.data());
+        off += len;
+        flush = off == n ? Z_FINISH : Z_NO_FLUSH;
+        zs.next_in = in.data();
+        zs.avail_in = (uInt) len;
+        do {
+            zs.next_out = out.data();
+            zs.avail_out = (uInt) out.size();
+            if (deflate(&zs, flush) == Z_STREAM_ERROR) {
+                ok = false;
+                break;
+            }
+            const size_t have = out.size() - zs.avail_out;
+            if (fwrite(out.data(), 1, have, file) != have) {
+                ok = false;
+                break;
+            }
+            written += have;
+        } while (zs.avail_out == 0);
+    }
+    deflateEnd(&zs);
+    return ok;
+}
+
+// Inflate compressed_bytes from file into the n bytes at data, undoing the per-chunk shuffle
+bool inflate_from(FILE * file, uint64_t compressed_bytes, uint8_t * data, size_t n) {
+    z_stream zs = {};
+    if (inflateInit(&zs) != Z_OK) return false;
+    std::vector<uint8_t> in(CHUNK_BYTES);
+    std::vector<uint8_t> out(CHUNK_BYTES);
+    size_t off = 0;
+    size_t room = std::min(CHUNK_BYTES, n);  // size of the chunk being inflated
+    zs.next_out = out.data();
+    zs.avail_out = (uInt) room;
+    int ret = Z_OK;
+    while (ret != Z_STREAM_END) {
+        if (zs.avail_in == 0) {
+            const size_t len = (size_t) std::min<uint64_t>(CHUNK_BYTES, compressed_bytes);
+            if (len == 0 || fread(in.data(), 1, len, file) != len) break;
+            compressed_bytes -= len;
+            zs.next_in = in.data();
+            zs.avail_in = (uInt) len;
+        }
+        ret = inflate(&zs, Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END) break;
+        if (zs.avail_out != 0 && ret != Z_STREAM_END) continue;
+
+        const size_t got = room - zs.avail_out;
+        if (off + got > n) {
+            ret = Z_DATA_ERROR;
+            break;
+        }
+        unshuffle16(out.data(), got, data + off);
+        off += got;
+        if (ret == Z_STREAM_END) break;
+        // Once everything is in, one spare byte of room exposes trailing data
+        room = off < n ? std::min(CHUNK_BYTES, n - off) : 1;
+        zs.next_out = out.data();
+        zs.avail_out = (uInt) room;
+    }
+    inflateEnd(&zs);
+    return ret == Z_STREAM_END && off == n;
+}
+
+// Compress and write one spilled sequence; runs on its own thread
+void write_spill(std::string path, std::string id, std::vector<llama_token> tokens, std::vector<uint8_t> state) {
+    const auto start = std::chrono::steady_clock::now();
+    spill_header header;
+    header.n_tokens = (uint32_t) tokens.size();
+    header.raw_bytes = state.size();
+
+    // The header is written again once the compressed size is known
+    const std::string tmp_path = path + ".tmp";
+    FILE * file = fopen(tmp_path.c_str(), "wb");
+    bool ok = file != nullptr &&
+              fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(tokens.data(), sizeof(llama_token), tokens.size(), file) == tokens.size() &&
+              deflate_to(file, state.data(), state.size(), header.compressed_bytes) &&
+              fseek(file, 0, SEEK_SET) == 0 &&
+              fwrite(&header, sizeof(header), 1, file) == 1;
+    if (file != nullptr && fclose(file) != 0) ok = false;
+    ok = ok && rename(tmp_path.c_str(), path.c_str()) == 0;
+    if (!ok) remove(tmp_path.c_str());
+    std::vector<uint8_t>().swap(state);
+    const double ms = ms_since(start);
+
+    {
+        std::lock_guard<std::mutex> lock(g_spill_mutex);
+        g_pending.erase(std::find(g_pending.begin(), g_pending.end(), path));
+        if (ok) {
+            g_spills++;
+            stats_locked(id).spills++;
+            g_raw_bytes_written += header.raw_bytes;
+            g_bytes_written += sizeof(header) + tokens.size() * sizeof(llama_token) + header.compressed_bytes;
+            g_write_ms += ms;
+            enforce_budget_locked();
+        } else {
+            g_spill_failures++;
+        }
+    }
+    g_spill_cv.notify_all();
+
+    if (ok) {
+        LOGI("Spilled %zu tokens of conversation: %llu -> %llu bytes in %.0f ms", tokens.size(),
+             (unsigned long long) header.raw_bytes, (unsigned long long) header.compressed_bytes, ms);
+    } else {
+        LOGW("Failed to write spilled sequence %s", path.c_str());
+    }
+}
+
+} // namespace
+
+void kv_spill_set_dir(const std::string & dir, size_t max_bytes) {
+    std::lock_guard<std::mutex> lock(g_spill_mutex);
+    g_dir = dir;
+    g_max_bytes = max_bytes;
+    if (dir.empty()) return;
+    mkdir(dir.c_str(), 0700);
+    enforce_budget_locked();
+}
+
+bool kv_spill_save(llama_context * ctx, const llama_model * model, llama_seq_id seq,
+                   const std::string & id, const std::vector<llama_token> & tokens) {
+    TRACE_SCOPE("kv_spill_save");
+    if (id.empty() || tokens.size() < KV_SPILL_MIN_TOKENS) return false;
+
+    const std::string model_id = model_registry_fingerprint(model);
+    const size_t raw_bytes = llama_state_seq_get_size(ctx, seq);
+    std::string path;
+    {
+        std::unique_lock<std::mutex> lock(g_spill_mutex);
+        if (g_dir.empty() || g_max_bytes == 0 || raw_bytes == 0) return false;
+
+        // Worth it only if reading the state back beats prefilling its tokens
+        double prefill_tps = 0;
+        double decode_tps = 0;
+        if (generation_metrics_rates(model_id, prefill_tps, decode_tps) && prefill_tps > 0) {
+            const double prefill_ms = tokens.size() * 1000.0 / prefill_tps;
+            const double restore_ms = raw_bytes / restore_bytes_per_ms_locked();
+            if (restore_ms >= prefill_ms) {
+                g_skipped++;
+                stats_locked(id).skipped++;
+                LOGD("Not spilling %zu tokens: restore %.0f ms, prefill %.0f ms",
+                     tokens.size(), restore_ms, prefill_ms);
+                return false;
+            }
+        }
+
+        path = path_locked(model_id, id);
+        // A write of the same conversation still running finishes first
+        g_spill_cv.wait(lock, [&] { return !pending_locked(path); });
+        g_pending.push_back(path);
+    }
+
+    std::vector<uint8_t> state(raw_bytes);
+    if (llama_state_seq_get_data(ctx, state.data(), state.size(), seq) != state.size()) {
+        std::lock_guard<std::mutex> lock(g_spill_mutex);
+        g_pending.erase(std::find(g_pending.begin(), g_pending.end(), path));
+        g_spill_failures++;
+        g_spill_cv.notify_all();
+        return false;
+    }
+
+    std::thread(write_spill, path, id, tokens, std::move(state)).detach();
+    return true;
+}
+
+bool kv_spill_restore(llama_context * ctx, const llama_model * model, llama_seq_id seq,
+                      const std::string & id, std::vector<llama_token> & tokens) {
+    TRACE_SCOPE("kv_spill_restore");
+    tokens.clear();
+    if (id.empty()) return false;
+
+    const std::string model_id = model_registry_fingerprint(model);
+    std::string path;
+    {
+        std::unique_lock<std::mutex> lock(g_spill_mutex);
+        if (g_dir.empty()) return false;
+        path = path_locked(model_id, id);
+        g_spill_cv.wait(lock, [&] { return !pending_locked(path); });
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    bool ok = false;
+    spill_header header;
+    std::vector<uint8_t> state;
+    FILE * file = fopen(path.c_str(), "rb");
+    if (file != nullptr) {
+        ok = fread(&header, sizeof(header), 1, file) == 1 &&
+             header.magic == SPILL_MAGIC && header.version == SPILL_VERSION &&
+             header.n_tokens > 0 && header.n_tokens < llama_n_ctx(ctx) && header.raw_bytes > 0;
+        if (ok) {
+            tokens.resize(header.n_tokens);
+            state.resize(header.raw_bytes);
+            ok = fread(tokens.data(), sizeof(llama_token), tokens.size(), file) == tokens.size() &&
+                 inflate_from(file, header.compressed_bytes, state.data(), state.size());
+        }
+        fclose(file);
+
+        ok = ok && llama_state_seq_set_data(ctx, state.data(), state.size(), seq) == state.size();
+        if (!ok) {
+            LOGW("Discarding unreadable spilled sequence %s", path.c_str());
+            llama_memory_t mem = llama_get_memory(ctx);
+            if (mem != nullptr) llama_memory_seq_rm(mem, seq, -1, -1);
+            remove(path.c_str());
+        } else {
+            utime(path.c_str(), nullptr);  // recently used for the disk budget
+        }
+    }
+    const double ms = ms_since(start);
+
+    std::lock_guard<std::mutex> lock(g_spill_mutex);
+    conversation_stats & stats = stats_locked(id);
+    if (!ok) {
+        tokens.clear();
+        g_misses++;
+        stats.misses++;
+        return false;
+    }
+    g_hits++;
+    stats.hits++;
+    stats.tokens_restored += tokens.size();
+    stats.restore_ms += ms;
+    g_raw_bytes_restored += state.size();
+    g_restore_ms += ms;
+    LOGI("Restored %zu tokens of conversation from disk in %.0f ms", tokens.size(), ms);
+    return true;
+}
+
+std::string kv_spill_stats_json() {
+    std::lock_guard<std::mutex> lock(g_spill_mutex);
+    std::string json = "{";
+    json += "\"spills\":" + std::to_string(g_spills) + ",";
+    json += "\"spill_failures\":" + std::to_string(g_spill_failures) + ",";
+    json += "\"skipped\":" + std::to_string(g_skipped) + ",";
+    json += "\"hits\":" + std::to_string(g_hits) + ",";
+    json += "\"misses\":" + std::to_string(g_misses) + ",";
+    json += "\"compression_ratio\":" +
+            std::to_string(g_bytes_written > 0 ? (double) g_raw_bytes_written / g_bytes_written : 0.0) + ",";
+    json += "\"avg_write_ms\":" + std::to_string(g_spills > 0 ? g_write_ms / g_spills : 0.0) + ",";
+    json += "\"avg_restore_ms\":" + std::to_string(g_hits > 0 ? g_restore_ms / g_hits : 0.0) + ",";
+    json += "\"restore_mb_per_s\":" + std::to_string(restore_bytes_per_ms_locked() * 1000.0 / (1024 * 1024)) + ",";
+    json += "\"conversations\":[";
+    bool first = true;
+    for (const auto & entry : g_conversations) {
+        std::string id;
+        for (char c : entry.first) {
+            if (c == '"' || c == '\\') id += '\\';
+            id += c;
+        }
+        const conversation_stats & stats = entry.second;
+        if (!first) json += ",";
+        first = false;
+        json += "{\"id\":\"" + id + "\",";
+        json += "\"spills\":" + std::to_string(stats.spills) + ",";
+        json += "\"skipped\":" + std::to_string(stats.skipped) + ",";
+        json += "\"hits\":" + std::to_string(stats.hits) + ",";
+        json += "\"misses\":" + std::to_string(stats.misses) + ",";
+        json += "\"tokens_restored\":" + std::to_string(stats.tokens_restored) + ",";
+        json += "\"avg_restore_ms\":" + std::to_string(stats.hits > 0 ? stats.restore_ms / stats.hits : 0.0) + "}";
+    }
+    json += "]}";
+    return json;
+}
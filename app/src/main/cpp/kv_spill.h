@@ -0,0 +1,53 @@
+/**
+ * kv_spill.h - Disk tier for the KV state of idle conversations
+ *
+ * Only the active conversation's KV cache fits in RAM. When a chat session
+ * switches to another conversation, or memory runs short, the sequence it
+ * held is copied out with llama_state_seq_get_data, compressed (zlib at its
+ * fastest level, after grouping the low and high bytes of the F16 values)
+ * and written to app storage under the conversation id. Coming back to the
+ * conversation reads it into sequence 0 instead of prefilling it again; the
+ * session keeps whatever prefix of the stored tokens still matches.
+ *
+ * A sequence is only spilled when reading it back is expected to be faster
+ * than prefilling its tokens: the model's measured prefill rate is compared
+ * with the measured restore throughput. Compression and the write run on a
+ * background thread; a restore of the same conversation waits for it. Spills
+ * happen under memory pressure, so the state is copied out once and streamed
+ * through deflate in fixed-size chunks, and a restore inflates straight into
+ * the buffer handed to llama_state_seq_set_data.
+ * Files beyond the disk budget are deleted least recently used first.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "llama.h"
+
+// Shorter sequences are cheaper to prefill than to read back
+#define KV_SPILL_MIN_TOKENS 64
+
+// Directory and disk budget for spilled sequences; spilling is disabled until set
+void kv_spill_set_dir(const std::string & dir, size_t max_bytes);
+
+/**
+ * Spill sequence seq of ctx, holding tokens, under conversation id. Returns
+ * false if it was not worth storing (too short, restore not faster than
+ * prefill) or spilling is disabled. The caller may clear the sequence as
+ * soon as this returns.
+ */
+bool kv_spill_save(llama_context * ctx, const llama_model * model, llama_seq_id seq,
+                   const std::string & id, const std::vector<llama_token> & tokens);
+
+/**
+ * Read conversation id back into sequence seq of ctx, which must be empty.
+ * tokens receives the tokens the sequence now holds. Returns false on a miss.
+ */
+bool kv_spill_restore(llama_context * ctx, const llama_model * model, llama_seq_id seq,
+                      const std::string & id, std::vector<llama_token> & tokens);
+
+// Totals and per-conversation hit/miss counters as a JSON object string
+std::string kv_spill_stats_json();
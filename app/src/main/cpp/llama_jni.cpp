@@ -8,55 +8,50 @@
  */
 
 #include <jni.h>
-#include <android/log.h>
 #include <string>
 #include <vector>
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
 #include <thread>
 #include <atomic>
+#include <chrono>
 #include <mutex>
 #include <condition_variable>
 
 #include "llama.h"
+#include "auto_tune.h"
+#include "chat_session.h"
+#include "context_growth.h"
+#include "context_pool.h"
+#include "cpu_threadpool.h"
+#include "generation.h"
+#include "generation_metrics.h"
+#include "generation_scheduler.h"
+#include "kv_estimate.h"
+#include "kv_spill.h"
+#include "logging.h"
+#include "memory_trim.h"
+#include "model_registry.h"
+#include "parallel_generation.h"
+#include "prompt_snapshot.h"
+#include "response_cache.h"
+#include "thread_tuner.h"
+#include "token_pieces.h"
+#include "tokenizer.h"
+#include "trace.h"
 
 #ifdef GGML_USE_VULKAN
 #include "ggml-vulkan.h"
 #endif
 
 #define LOG_TAG "LlamaJNI"
-#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
-#define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
-#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
-#define LOGW(...) __android_log_print(ANDROID_LOG_WARN, LOG_TAG, __VA_ARGS__)
-
-// ============================================================================
-// Batch helper functions - matching official llama.cpp common.h implementation
-// ============================================================================
-
-// Clear a batch for reuse (just reset n_tokens counter)
-static void batch_clear(struct llama_batch & batch) {
-    batch.n_tokens = 0;
-}
-
-// Add a token to the batch - matches common_batch_add from common.h
-static void batch_add(
-        struct llama_batch & batch,
-        llama_token id,
-        llama_pos pos,
-        llama_seq_id seq_id,
-        bool logits) {
-    batch.token[batch.n_tokens] = id;
-    batch.pos[batch.n_tokens] = pos;
-    batch.n_seq_id[batch.n_tokens] = 1;
-    batch.seq_id[batch.n_tokens][0] = seq_id;
-    batch.logits[batch.n_tokens] = logits ? 1 : 0;
-    batch.n_tokens++;
-}
 
 // Global state
 static std::atomic<bool> g_is_generating{false};
 static std::atomic<bool> g_cancel_requested{false};
+static std::atomic<bool> g_background_cancel_requested{false};
+static std::atomic<int> g_last_stop_reason{GENERATION_STOP_NONE};
 static std::mutex g_mutex;
 
 // Helper to convert jstring to std::string
@@ -73,6 +68,55 @@ static jstring string_to_jstring(JNIEnv *env, const std::string &str) {
     return env->NewStringUTF(str.c_str());
 }
 
+// Context handle whose KV cache was asked to be cleared while a request held it
+static std::atomic<jlong> g_pending_clear{0};
+
+// Spill the conversation held in the cache and shrink the context back to its
+// initial size. Call with the scheduler lease held.
+static void clear_kv(jlong ctx_ptr) {
+    growing_context *gc = reinterpret_cast<growing_context *>(ctx_ptr);
+    chat_session_spill(growing_context_get(gc));
+    growing_context_clear(gc);
+    LOGD("KV cache cleared");
+}
+
+// Context behind a context handle, grown to hold n_cells first. Call with the
+// scheduler lease held. A parked background job has its sequences saved and
+// looks the context up again when it resumes, so the context may be replaced
+// meanwhile. A clear deferred by clearKVCacheNative runs here.
+static llama_context *context_for(jlong ctx_ptr, int n_cells = 0) {
+    growing_context *gc = reinterpret_cast<growing_context *>(ctx_ptr);
+    if (n_cells <= 0) return growing_context_get(gc);
+    jlong pending = ctx_ptr;
+    if (g_pending_clear.compare_exchange_strong(pending, 0)) clear_kv(ctx_ptr);
+    return growing_context_reserve(gc, n_cells);
+}
+
+// Report why a request stopped: to the request's callback (TokenCallback.onStop), so
+// the caller gets its own reason, and to getLastStopReasonNative
+static void report_stop(JNIEnv *env, jobject callback, generation_stop_reason reason) {
+    g_last_stop_reason.store(reason);
+    if (callback == nullptr) return;
+    jclass callback_class = env->GetObjectClass(callback);
+    jmethodID on_stop = callback_class != nullptr
+            ? env->GetMethodID(callback_class, "onStop", "(Ljava/lang/String;)V") : nullptr;
+    if (on_stop != nullptr) {
+        jstring jreason = string_to_jstring(env, generation_stop_reason_name(reason));
+        env->CallVoidMethod(callback, on_stop, jreason);
+        env->DeleteLocalRef(jreason);
+    }
+    if (env->ExceptionCheck()) env->ExceptionClear();
+    if (callback_class != nullptr) env->DeleteLocalRef(callback_class);
+}
+
+// Token count of text through the tokenizer cache, for sizing the context before
+// parallel generation and snapshots, which tokenize the same text through the cache
+static int count_tokens(const llama_model *model, const std::string &text) {
+    std::vector<llama_token> tokens;
+    tokenizer_tokenize(model, text.data(), text.size(), tokenizer_flags(), tokens);
+    return (int) tokens.size();
+}
+
 extern "C" {
 
 // Initialize the llama backend
@@ -119,7 +163,7 @@ Java_com_localllm_app_inference_LlamaAndroid_loadModelNative(
     
     try {
         // Initialize model parameters
-        llama_model_params model_params = llama_model_default_params();
+        model_registry_params model_params;
         model_params.use_mmap = use_mmap;
         model_params.use_mlock = use_mlock;
         
@@ -130,13 +174,19 @@ Java_com_localllm_app_inference_LlamaAndroid_loadModelNative(
         LOGI("Model params: mmap=%d, mlock=%d, gpu_layers=%d", 
              model_params.use_mmap, model_params.use_mlock, model_params.n_gpu_layers);
         
-        // Load the model
-        llama_model *model = llama_model_load_from_file(path.c_str(), model_params);
+        // Load the model, or take another reference to it if it is still resident
+        llama_model *model = model_registry_acquire(path, model_params);
         if (model == nullptr) {
             LOGE("Failed to load model from: %s", path.c_str());
             return 0;
         }
         
+        // Hash the file now so contexts pick up stored tuning results without touching it again
+        auto_tune_register_model(model, path);
+        
+        // Render every vocab piece once so generation and detokenization are plain copies
+        token_pieces_for(model);
+        
         LOGI("Model loaded successfully with %d GPU layers, ptr: %p", n_gpu_layers, model);
         return reinterpret_cast<jlong>(model);
     } catch (const std::exception& e) {
@@ -155,9 +205,13 @@ Java_com_localllm_app_inference_LlamaAndroid_freeModelNative(JNIEnv *env, jobjec
     
     try {
         llama_model *model = reinterpret_cast<llama_model *>(model_ptr);
-        LOGI("Freeing model: %p", model);
-        llama_model_free(model);
-        LOGI("Model freed");
+        LOGI("Releasing model: %p", model);
+        if (!model_registry_release(model)) {
+            token_pieces_drop(model);
+            tokenizer_drop_model(model);
+            llama_model_free(model);
+            LOGI("Model freed");
+        }
     } catch (...) {
         LOGE("Exception freeing model");
     }
@@ -171,7 +225,12 @@ Java_com_localllm_app_inference_LlamaAndroid_createContextNative(
         jlong model_ptr,
         jint n_ctx,
         jint n_batch,
-        jint n_threads) {
+        jint n_ubatch,
+        jint n_threads,
+        jint type_k,
+        jint type_v,
+        jint flash_attn,
+        jboolean grow_kv) {
     
     if (model_ptr == 0) {
         LOGE("Cannot create context: model is null");
@@ -182,23 +241,27 @@ Java_com_localllm_app_inference_LlamaAndroid_createContextNative(
         llama_model *model = reinterpret_cast<llama_model *>(model_ptr);
         
         // Initialize context parameters
-        llama_context_params ctx_params = llama_context_default_params();
-        ctx_params.n_ctx = n_ctx > 0 ? n_ctx : 2048;
-        ctx_params.n_batch = n_batch > 0 ? n_batch : 512;
-        ctx_params.n_threads = n_threads > 0 ? n_threads : std::thread::hardware_concurrency();
-        ctx_params.n_threads_batch = ctx_params.n_threads;
+        llama_context_params ctx_params = generation_context_params(
+                n_ctx, n_batch, n_ubatch, n_threads, type_k, type_v, flash_attn);
+        if (auto_tune_apply(model, ctx_params)) {
+            LOGI("Applying tuned configuration for this model and device");
+        }
         
-        LOGI("Creating context with n_ctx=%d, n_batch=%d, n_threads=%d",
-             ctx_params.n_ctx, ctx_params.n_batch, ctx_params.n_threads);
+        LOGI("Creating context with n_ctx=%d, n_batch=%d, n_ubatch=%d, n_threads=%d, "
+             "type_k=%s, type_v=%s, flash_attn=%d, est. KV %zu bytes",
+             ctx_params.n_ctx, ctx_params.n_batch, ctx_params.n_ubatch, ctx_params.n_threads,
+             ggml_type_name(ctx_params.type_k), ggml_type_name(ctx_params.type_v),
+             (int) ctx_params.flash_attn_type,
+             kv_cache_estimate_bytes(model, ctx_params.n_ctx, ctx_params.type_k, ctx_params.type_v));
         
-        llama_context *ctx = llama_init_from_model(model, ctx_params);
-        if (ctx == nullptr) {
+        growing_context *gc = growing_context_create(model, ctx_params, grow_kv);
+        if (gc == nullptr) {
             LOGE("Failed to create context");
             return 0;
         }
         
-        LOGI("Context created successfully, ptr: %p", ctx);
-        return reinterpret_cast<jlong>(ctx);
+        LOGI("Context created successfully, ptr: %p", growing_context_get(gc));
+        return reinterpret_cast<jlong>(gc);
     } catch (const std::exception& e) {
         LOGE("Exception creating context: %s", e.what());
         return 0;
@@ -214,26 +277,30 @@ Java_com_localllm_app_inference_LlamaAndroid_freeContextNative(JNIEnv *env, jobj
     if (ctx_ptr == 0) return;
     
     try {
-        llama_context *ctx = reinterpret_cast<llama_context *>(ctx_ptr);
-        LOGI("Freeing context: %p", ctx);
-        llama_free(ctx);
-        LOGI("Context freed");
+        growing_context *gc = reinterpret_cast<growing_context *>(ctx_ptr);
+        LOGI("Returning context to pool: %p", growing_context_get(gc));
+        jlong pending = ctx_ptr;
+        g_pending_clear.compare_exchange_strong(pending, 0);
+        growing_context_free(gc);
     } catch (...) {
         LOGE("Exception freeing context");
     }
 }
 
-// Clear the KV cache
+// Clear the KV cache. The context is only touched under the scheduler lease; while a
+// request holds it, the clear is deferred to the start of the next request.
 JNIEXPORT void JNICALL
 Java_com_localllm_app_inference_LlamaAndroid_clearKVCacheNative(JNIEnv *env, jobject thiz, jlong ctx_ptr) {
     if (ctx_ptr == 0) return;
     
-    llama_context *ctx = reinterpret_cast<llama_context *>(ctx_ptr);
-    llama_memory_t mem = llama_get_memory(ctx);
-    if (mem) {
-        llama_memory_clear(mem, true);
+    if (g_is_generating || !generation_scheduler_try_acquire()) {
+        g_pending_clear.store(ctx_ptr);
+        LOGD("KV cache clear deferred until the running request finishes");
+        return;
     }
-    LOGD("KV cache cleared");
+    g_pending_clear.store(0);
+    clear_kv(ctx_ptr);
+    generation_scheduler_release(GENERATION_PRIORITY_INTERACTIVE);
 }
 
 // Tokenize a string
@@ -255,37 +322,21 @@ Java_com_localllm_app_inference_LlamaAndroid_tokenizeNative(
         llama_model *model = reinterpret_cast<llama_model *>(model_ptr);
         std::string str = jstring_to_string(env, text);
         
-        // Get vocab for tokenization
-        const llama_vocab *vocab = llama_model_get_vocab(model);
-        
-        // Estimate token count (usually ~4 chars per token)
-        int max_tokens = str.length() / 2 + 128;
-        std::vector<llama_token> tokens(max_tokens);
-        
-        int n_tokens = llama_tokenize(vocab, str.c_str(), str.length(),
-                                       tokens.data(), max_tokens,
-                                       add_special, parse_special);
-        
-        if (n_tokens < 0) {
-            // Need more space
-            tokens.resize(-n_tokens);
-            n_tokens = llama_tokenize(vocab, str.c_str(), str.length(),
-                                       tokens.data(), -n_tokens,
-                                       add_special, parse_special);
-        }
-        
-        if (n_tokens < 0) {
+        tokenizer_flags flags;
+        flags.add_special = add_special;
+        flags.parse_special = parse_special;
+        std::vector<llama_token> tokens;
+        if (!tokenizer_tokenize(model, str.data(), str.size(), flags, tokens)) {
             LOGE("Failed to tokenize string");
             return nullptr;
         }
-        
-        tokens.resize(n_tokens);
+        jsize n_tokens = (jsize) tokens.size();
         
         // Convert to Java array
         jintArray result = env->NewIntArray(n_tokens);
         env->SetIntArrayRegion(result, 0, n_tokens, reinterpret_cast<jint *>(tokens.data()));
         
-        LOGD("Tokenized %zu chars into %d tokens", str.length(), n_tokens);
+        LOGD("Tokenized %zu bytes into %d tokens", str.size(), n_tokens);
         return result;
     } catch (const std::exception& e) {
         LOGE("Exception tokenizing: %s", e.what());
@@ -296,6 +347,89 @@ Java_com_localllm_app_inference_LlamaAndroid_tokenizeNative(
     }
 }
 
+// Tokenize many texts in one call. utf8 holds the texts back to back, text i spanning
+// [offsets[i], offsets[i + 1]). Returns n counts when counts_only is set, otherwise
+// n + 1 token offsets followed by the flattened tokens.
+JNIEXPORT jintArray JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_tokenizeBatchNative(
+        JNIEnv *env,
+        jobject thiz,
+        jlong model_ptr,
+        jbyteArray utf8,
+        jintArray offsets,
+        jboolean add_special,
+        jboolean parse_special,
+        jboolean counts_only) {
+    
+    if (model_ptr == 0 || utf8 == nullptr || offsets == nullptr) {
+        LOGE("Cannot tokenize batch: model or input is null");
+        return nullptr;
+    }
+    
+    try {
+        llama_model *model = reinterpret_cast<llama_model *>(model_ptr);
+        TRACE_SCOPE("tokenizeBatchNative");
+        
+        jsize n_offsets = env->GetArrayLength(offsets);
+        jsize n_bytes = env->GetArrayLength(utf8);
+        if (n_offsets < 1) {
+            return env->NewIntArray(0);
+        }
+        std::vector<int32_t> text_offsets(n_offsets);
+        env->GetIntArrayRegion(offsets, 0, n_offsets, reinterpret_cast<jint *>(text_offsets.data()));
+        for (jsize i = 0; i < n_offsets; i++) {
+            if (text_offsets[i] < 0 || text_offsets[i] > n_bytes || (i > 0 && text_offsets[i] < text_offsets[i - 1])) {
+                LOGE("Invalid text offset %d at index %d", text_offsets[i], (int) i);
+                return nullptr;
+            }
+        }
+        
+        // Copied out rather than pinned: the pool tokenizes on other threads
+        std::vector<char> bytes(n_bytes);
+        env->GetByteArrayRegion(utf8, 0, n_bytes, reinterpret_cast<jbyte *>(bytes.data()));
+        
+        tokenizer_flags flags;
+        flags.add_special = add_special;
+        flags.parse_special = parse_special;
+        const size_t n_texts = n_offsets - 1;
+        std::vector<llama_token> tokens;
+        std::vector<int32_t> token_offsets;
+        if (!tokenizer_tokenize_batch(model, bytes.data(), text_offsets.data(), n_texts, flags,
+                                      counts_only ? nullptr : &tokens, token_offsets)) {
+            LOGE("Failed to tokenize batch");
+            return nullptr;
+        }
+        
+        jintArray result;
+        if (counts_only) {
+            std::vector<int32_t> counts(n_texts);
+            for (size_t i = 0; i < n_texts; i++) counts[i] = token_offsets[i + 1] - token_offsets[i];
+            result = env->NewIntArray((jsize) n_texts);
+            env->SetIntArrayRegion(result, 0, (jsize) n_texts, reinterpret_cast<jint *>(counts.data()));
+        } else {
+            const jsize n_header = (jsize) token_offsets.size();
+            result = env->NewIntArray(n_header + (jsize) tokens.size());
+            env->SetIntArrayRegion(result, 0, n_header, reinterpret_cast<jint *>(token_offsets.data()));
+            env->SetIntArrayRegion(result, n_header, (jsize) tokens.size(), reinterpret_cast<jint *>(tokens.data()));
+        }
+        
+        LOGD("Tokenized batch of %zu texts (%d bytes) into %d tokens", n_texts, (int) n_bytes, token_offsets.back());
+        return result;
+    } catch (const std::exception& e) {
+        LOGE("Exception tokenizing batch: %s", e.what());
+        return nullptr;
+    } catch (...) {
+        LOGE("Unknown exception tokenizing batch");
+        return nullptr;
+    }
+}
+
+// Get tokenizer cache and worker pool statistics as JSON
+JNIEXPORT jstring JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_getTokenizerStatsNative(JNIEnv *env, jobject thiz) {
+    return string_to_jstring(env, tokenizer_stats_json());
+}
+
 // Detokenize tokens to string
 JNIEXPORT jstring JNICALL
 Java_com_localllm_app_inference_LlamaAndroid_detokenizeNative(
@@ -310,22 +444,22 @@ Java_com_localllm_app_inference_LlamaAndroid_detokenizeNative(
     
     try {
         llama_model *model = reinterpret_cast<llama_model *>(model_ptr);
-        const llama_vocab *vocab = llama_model_get_vocab(model);
+        std::shared_ptr<const token_piece_table> table = token_pieces_for(model);
+        if (table == nullptr) {
+            return string_to_jstring(env, "");
+        }
         
         jsize n_tokens = env->GetArrayLength(tokens);
-        jint *token_data = env->GetIntArrayElements(tokens, nullptr);
-        
         std::string result;
-        char buf[256];
         
-        for (int i = 0; i < n_tokens; i++) {
-            int len = llama_token_to_piece(vocab, token_data[i], buf, sizeof(buf), 0, false);
-            if (len > 0) {
-                result.append(buf, len);
-            }
+        // Pure memcpy work, so the array can be read in place without a copy
+        void *token_data = env->GetPrimitiveArrayCritical(tokens, nullptr);
+        if (token_data == nullptr) {
+            return string_to_jstring(env, "");
         }
+        token_pieces_detokenize(*table, static_cast<const int32_t *>(token_data), n_tokens, false, result);
+        env->ReleasePrimitiveArrayCritical(tokens, token_data, JNI_ABORT);
         
-        env->ReleaseIntArrayElements(tokens, token_data, 0);
         return string_to_jstring(env, result);
     } catch (const std::exception& e) {
         LOGE("Exception detokenizing: %s", e.what());
@@ -349,9 +483,15 @@ Java_com_localllm_app_inference_LlamaAndroid_generateNative(
         jfloat top_p,
         jint top_k,
         jfloat repeat_penalty,
-        jobject callback) {
+        jobject callback,
+        jstring cache_namespace,
+        jstring cache_query,
+        jboolean cache_refresh,
+        jint ttft_budget_ms,
+        jint total_budget_ms) {
     
-    LOGI("generateNative called: ctx_ptr=%ld, model_ptr=%ld", (long)ctx_ptr, (long)model_ptr);
+    TRACE_SCOPE("generateNative");
+    LOGD("generateNative called: ctx_ptr=%ld, model_ptr=%ld", (long)ctx_ptr, (long)model_ptr);
     
     if (ctx_ptr == 0 || model_ptr == 0) {
         LOGE("Cannot generate: context or model is null (ctx=%ld, model=%ld)", 
@@ -368,29 +508,12 @@ Java_com_localllm_app_inference_LlamaAndroid_generateNative(
     
     g_cancel_requested.store(false);
     std::string result;
-    llama_sampler *sampler = nullptr;
-    llama_batch batch = {0, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr};
-    bool batch_allocated = false;
     
     try {
-        llama_context *ctx = reinterpret_cast<llama_context *>(ctx_ptr);
         llama_model *model = reinterpret_cast<llama_model *>(model_ptr);
         
-        if (ctx == nullptr || model == nullptr) {
-            LOGE("Context or model pointer is invalid");
-            g_is_generating.store(false);
-            return string_to_jstring(env, "Error: Invalid context or model");
-        }
-        
-        const llama_vocab *vocab = llama_model_get_vocab(model);
-        if (vocab == nullptr) {
-            LOGE("Failed to get vocab from model");
-            g_is_generating.store(false);
-            return string_to_jstring(env, "Error: Failed to get vocabulary");
-        }
-        
         std::string prompt_str = jstring_to_string(env, prompt);
-        LOGI("Starting generation, prompt length: %zu chars", prompt_str.length());
+        LOGD("Starting generation, prompt length: %zu chars", prompt_str.length());
         
         if (prompt_str.empty()) {
             LOGE("Empty prompt provided");
@@ -411,208 +534,600 @@ Java_com_localllm_app_inference_LlamaAndroid_generateNative(
             }
         }
         
-        // Tokenize the prompt
-        int max_prompt_tokens = prompt_str.length() + 256;
-        std::vector<llama_token> prompt_tokens(max_prompt_tokens);
-        
-        LOGI("Tokenizing prompt...");
-        int n_prompt_tokens = llama_tokenize(vocab, prompt_str.c_str(), prompt_str.length(),
-                                              prompt_tokens.data(), max_prompt_tokens,
-                                              true, true);
-        
-        if (n_prompt_tokens < 0) {
-            LOGI("Need more space for tokens: %d", -n_prompt_tokens);
-            prompt_tokens.resize(-n_prompt_tokens + 100);
-            n_prompt_tokens = llama_tokenize(vocab, prompt_str.c_str(), prompt_str.length(),
-                                              prompt_tokens.data(), prompt_tokens.size(),
-                                              true, true);
-        }
+        auto emit_token = [&](const std::string &token_str) {
+            if (callback_method == nullptr || callback == nullptr) return;
+            jstring jtoken = string_to_jstring(env, token_str);
+            if (jtoken != nullptr) {
+                env->CallVoidMethod(callback, callback_method, jtoken);
+                if (env->ExceptionCheck()) {
+                    LOGW("Exception in callback, clearing and continuing");
+                    env->ExceptionClear();
+                }
+                env->DeleteLocalRef(jtoken);
+            }
+        };
         
-        if (n_prompt_tokens < 0) {
-            LOGE("Failed to tokenize prompt, error code: %d", n_prompt_tokens);
-            g_is_generating.store(false);
-            return string_to_jstring(env, "Error: Failed to tokenize prompt");
-        }
+        const auto start = std::chrono::steady_clock::now();
+        const std::string model_id = model_registry_fingerprint(model);
         
-        if (n_prompt_tokens == 0) {
-            LOGE("Tokenization returned 0 tokens");
-            g_is_generating.store(false);
-            return string_to_jstring(env, "Error: Prompt tokenized to zero tokens");
+        // Serve from the response cache when the caller opted in with a namespace;
+        // a refresh generates anew and replaces the cached response. A hit only
+        // replays strings, so it neither waits for auto-tune nor parks a background job.
+        bool use_cache = cache_namespace != nullptr && response_cache_enabled();
+        response_cache_key cache_key;
+        const std::string query_str = cache_query != nullptr ? jstring_to_string(env, cache_query) : "";
+        if (use_cache) {
+            cache_key.model_id = model_id;
+            cache_key.ns = jstring_to_string(env, cache_namespace);
+            cache_key.temperature = temperature;
+            cache_key.top_p = top_p;
+            cache_key.top_k = top_k;
+            cache_key.repeat_penalty = repeat_penalty;
+            cache_key.max_tokens = max_tokens;
         }
-        
-        prompt_tokens.resize(n_prompt_tokens);
-        LOGI("Prompt tokenized to %d tokens", n_prompt_tokens);
-        
-        // Clear KV cache completely for fresh generation
-        LOGI("Clearing KV cache...");
-        llama_memory_t mem = llama_get_memory(ctx);
-        if (mem) {
-            llama_memory_clear(mem, false);  // false = keep structure, just clear data
-            LOGI("KV cache cleared");
-        } else {
-            LOGW("Could not get memory handle - proceeding without cache clear");
+        if (use_cache && !cache_refresh) {
+            response_cache_hit hit;
+            bool cache_hit = false;
+            {
+                TRACE_SCOPE("response_cache_lookup");
+                cache_hit = response_cache_lookup(cache_key, prompt_str, query_str, hit);
+            }
+            if (cache_hit) {
+                LOGI("Response cache hit (%s, similarity=%.3f, %zu pieces)",
+                     hit.exact ? "exact" : "semantic", hit.similarity, hit.pieces.size());
+                generation_stats stats;
+                stats.completed = true;
+                // Replayed as the original ended: a response cut at max_tokens stays "max_tokens"
+                stats.stop_reason = (generation_stop_reason) hit.stop_reason;
+                for (const auto &piece : hit.pieces) {
+                    if (g_cancel_requested.load()) {
+                        stats.completed = false;
+                        stats.stop_reason = GENERATION_STOP_CANCELLED;
+                        break;
+                    }
+                    result += piece;
+                    emit_token(piece);
+                    stats.n_generated++;
+                }
+                stats.total_ms = std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - start).count();
+                stats.callback_ms = stats.total_ms;
+                generation_metrics_record(model_id, stats, true);
+                report_stop(env, callback, stats.stop_reason);
+                g_is_generating.store(false);
+                return string_to_jstring(env, result);
+            }
         }
         
-        // Get context size and batch size
-        int n_ctx = llama_n_ctx(ctx);
-        int n_batch = llama_n_batch(ctx);
-        if (n_batch <= 0) n_batch = 512;
+        // A running auto-tune sees the flag and stops after its current decode
+        auto_tune_wait_idle();
+        // A background job steps aside at its next decode step
+        generation_scheduler_lease lease(GENERATION_PRIORITY_INTERACTIVE);
         
-        LOGI("Context size: %d, Batch size: %d", n_ctx, n_batch);
-
-        if (n_prompt_tokens >= n_ctx) {
-            LOGE("Prompt (%d tokens) exceeds context size (%d)", n_prompt_tokens, n_ctx);
+        generation_params params;
+        params.max_tokens = max_tokens;
+        params.temperature = temperature;
+        params.top_p = top_p;
+        params.top_k = top_k;
+        params.cancel = &g_cancel_requested;
+        params.ttft_budget_ms = ttft_budget_ms;
+        params.total_budget_ms = total_budget_ms;
+        
+        // Sized up front so appending pieces does not reallocate while decoding
+        result.reserve(std::max(0, (int) max_tokens) * 16);
+        std::vector<std::string> pieces;
+        if (use_cache) pieces.reserve(std::max(0, (int) max_tokens));
+        generation_stats stats;
+        std::string error;
+        // Tokenized once: the count sizes the context, the tokens are what gets decoded
+        std::vector<llama_token> prompt_tokens;
+        if (!generation_tokenize(model, prompt_str, prompt_tokens, error)) {
+            report_stop(env, callback, GENERATION_STOP_ERROR);
             g_is_generating.store(false);
-            return string_to_jstring(env, "Error: Prompt too long for context");
+            return string_to_jstring(env, "Error: " + error);
         }
-
-        // Allocate batch using official llama_batch_init API
-        // Allocate enough for at least the batch size
-        int batch_size = std::max(n_batch, n_prompt_tokens);
-        LOGI("Allocating batch with size %d using llama_batch_init", batch_size);
-        batch = llama_batch_init(batch_size, 0, 1);  // n_tokens, embd=0, n_seq_max=1
-        batch_allocated = true;
-        
-        if (batch.token == nullptr) {
-            LOGE("Failed to allocate batch");
+        llama_context *ctx = context_for(ctx_ptr, (int) prompt_tokens.size() + std::max(0, (int) max_tokens));
+        bool ok = generation_run(ctx, model, prompt_tokens, params,
+                                 [&](const std::string &piece) {
+                                     result += piece;
+                                     if (use_cache) pieces.push_back(piece);
+                                     emit_token(piece);
+                                 },
+                                 error, &stats);
+        report_stop(env, callback, stats.stop_reason);
+        if (!ok && stats.stop_reason == GENERATION_STOP_BUDGET) {
+            // Not an error: the request was dropped because it could not finish in time
+            generation_metrics_record(model_id, stats, false);
             g_is_generating.store(false);
-            return string_to_jstring(env, "Error: Failed to allocate batch");
+            return string_to_jstring(env, "");
         }
-        LOGI("Batch allocated successfully");
-
-        // Process prompt in chunks
-        LOGI("Processing prompt in batches...");
-        int n_cur = 0;  // Current position in KV cache
-        
-        for (int i = 0; i < n_prompt_tokens; i += n_batch) {
-            int n_eval = std::min(n_batch, n_prompt_tokens - i);
-            
-            // Clear and fill batch
-            batch_clear(batch);
-            for (int j = 0; j < n_eval; j++) {
-                // logits = true only for last token of the prompt
-                bool is_last = (i + j == n_prompt_tokens - 1);
-                batch_add(batch, prompt_tokens[i + j], n_cur + j, 0, is_last);
-            }
-            
-            LOGI("Processing prompt tokens %d to %d (batch of %d)", i, i + n_eval - 1, n_eval);
-            
-            int ret = llama_decode(ctx, batch);
-            if (ret != 0) {
-                LOGE("llama_decode failed during prompt processing at pos %d, error: %d", i, ret);
-                llama_batch_free(batch);
-                g_is_generating.store(false);
-                return string_to_jstring(env, "Error: Failed to process prompt");
-            }
-            
-            n_cur += n_eval;
+        if (!ok) {
+            g_is_generating.store(false);
+            return string_to_jstring(env, "Error: " + error);
         }
         
-        LOGI("Prompt processing complete, n_cur=%d", n_cur);
+        LOGI("Generation complete, generated %zu chars", result.length());
+        generation_metrics_record(model_id, stats, false);
         
-        // Initialize sampler
-        LOGI("Initializing sampler with temp=%.2f, top_p=%.2f, top_k=%d", 
-             temperature, top_p, top_k);
-        sampler = llama_sampler_chain_init(llama_sampler_chain_default_params());
-        if (sampler == nullptr) {
-            LOGE("Failed to create sampler");
-            llama_batch_free(batch);
-            g_is_generating.store(false);
-            return string_to_jstring(env, "Error: Failed to create sampler");
+        if (use_cache && stats.completed) {
+            response_cache_insert(cache_key, prompt_str, query_str, pieces, stats.stop_reason);
         }
         
-        llama_sampler_chain_add(sampler, llama_sampler_init_top_k(top_k > 0 ? top_k : 40));
-        llama_sampler_chain_add(sampler, llama_sampler_init_top_p(top_p > 0 ? top_p : 0.95f, 1));
-        llama_sampler_chain_add(sampler, llama_sampler_init_temp(temperature > 0 ? temperature : 0.8f));
-        llama_sampler_chain_add(sampler, llama_sampler_init_dist(LLAMA_DEFAULT_SEED));
+        g_is_generating.store(false);
+        return string_to_jstring(env, result);
         
-        // Generate tokens
-        char token_buf[256];
+    } catch (const std::exception& e) {
+        LOGE("Exception during generation: %s", e.what());
+        g_is_generating.store(false);
+        return string_to_jstring(env, std::string("Error: ") + e.what());
+    } catch (...) {
+        LOGE("Unknown exception during generation");
+        g_is_generating.store(false);
+        return string_to_jstring(env, "Error: Unknown native error");
+    }
+}
+
+// Create a chat session that renders and caches a conversation in the given context
+JNIEXPORT jlong JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_createChatSessionNative(
+        JNIEnv *env,
+        jobject thiz,
+        jlong model_ptr,
+        jlong ctx_ptr,
+        jstring template_id) {
+    
+    if (model_ptr == 0 || ctx_ptr == 0) return 0;
+    
+    try {
+        llama_model *model = reinterpret_cast<llama_model *>(model_ptr);
+        llama_context *ctx = context_for(ctx_ptr);
+        chat_session *session = chat_session_create(model, ctx, jstring_to_string(env, template_id));
+        return reinterpret_cast<jlong>(session);
+    } catch (const std::exception& e) {
+        LOGE("Exception creating chat session: %s", e.what());
+        return 0;
+    } catch (...) {
+        LOGE("Unknown exception creating chat session");
+        return 0;
+    }
+}
+
+// Free a chat session
+JNIEXPORT void JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_freeChatSessionNative(JNIEnv *env, jobject thiz, jlong session_ptr) {
+    chat_session_free(reinterpret_cast<chat_session *>(session_ptr));
+}
+
+// Drop the messages and cached tokens of a chat session
+JNIEXPORT void JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_resetChatSessionNative(JNIEnv *env, jobject thiz, jlong session_ptr) {
+    chat_session_reset(reinterpret_cast<chat_session *>(session_ptr));
+}
+
+// Get chat session reuse statistics as JSON
+JNIEXPORT jstring JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_getChatSessionStatsNative(JNIEnv *env, jobject thiz, jlong session_ptr) {
+    return string_to_jstring(env, chat_session_stats_json(reinterpret_cast<chat_session *>(session_ptr)));
+}
+
+// Generate the next assistant reply for a conversation. roles and contents hold the
+// full message list; only what changed since the previous turn is tokenized and decoded.
+JNIEXPORT jstring JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_chatSessionGenerateNative(
+        JNIEnv *env,
+        jobject thiz,
+        jlong session_ptr,
+        jlong ctx_ptr,
+        jstring conversation_id,
+        jobjectArray roles,
+        jobjectArray contents,
+        jint max_tokens,
+        jfloat temperature,
+        jfloat top_p,
+        jint top_k,
+        jobject callback) {
+    
+    TRACE_SCOPE("chatSessionGenerateNative");
+    if (session_ptr == 0 || ctx_ptr == 0 || roles == nullptr || contents == nullptr) {
+        return string_to_jstring(env, "Error: No chat session");
+    }
+    
+    bool expected = false;
+    if (!g_is_generating.compare_exchange_strong(expected, true)) {
+        LOGW("Generation already in progress");
+        return string_to_jstring(env, "Error: Generation already in progress");
+    }
+    auto_tune_wait_idle();
+    generation_scheduler_lease lease(GENERATION_PRIORITY_INTERACTIVE);
+    g_cancel_requested.store(false);
+    
+    try {
+        chat_session *session = reinterpret_cast<chat_session *>(session_ptr);
         
-        LOGI("Starting token generation, max_tokens=%d", max_tokens);
+        jsize n_messages = std::min(env->GetArrayLength(roles), env->GetArrayLength(contents));
+        std::vector<chat_session_message> messages(n_messages);
+        for (jsize i = 0; i < n_messages; i++) {
+            jstring role = (jstring) env->GetObjectArrayElement(roles, i);
+            jstring content = (jstring) env->GetObjectArrayElement(contents, i);
+            messages[i].role = jstring_to_string(env, role);
+            messages[i].content = jstring_to_string(env, content);
+            env->DeleteLocalRef(role);
+            env->DeleteLocalRef(content);
+        }
         
-        for (int i = 0; i < max_tokens; i++) {
-            // Check for cancellation
-            if (g_cancel_requested.load()) {
-                LOGI("Generation cancelled by user at token %d", i);
-                break;
-            }
-            
-            // Sample next token
-            llama_token new_token = llama_sampler_sample(sampler, ctx, -1);
-            
-            // Check for end of generation
-            if (llama_vocab_is_eog(vocab, new_token)) {
-                LOGI("End of generation token received at token %d", i);
-                break;
-            }
-            
-            // Convert token to string
-            int token_len = llama_token_to_piece(vocab, new_token, token_buf, sizeof(token_buf) - 1, 0, true);
-            if (token_len > 0) {
-                token_buf[token_len] = '\0';
-                std::string token_str(token_buf, token_len);
-                result += token_str;
-                
-                // Call callback if provided
-                if (callback_method != nullptr && callback != nullptr) {
-                    jstring jtoken = string_to_jstring(env, token_str);
-                    if (jtoken != nullptr) {
-                        env->CallVoidMethod(callback, callback_method, jtoken);
-                        if (env->ExceptionCheck()) {
-                            LOGW("Exception in callback, clearing and continuing");
-                            env->ExceptionClear();
-                        }
-                        env->DeleteLocalRef(jtoken);
-                    }
-                }
-                
-                if (i % 50 == 0) {
-                    LOGD("Generated %d tokens so far", i + 1);
-                }
-            }
-            
-            // Check context limit
-            if (n_cur >= n_ctx - 1) {
-                LOGW("Reached context limit at token %d", i);
-                break;
-            }
-            
-            // Prepare batch for next token decode
-            batch_clear(batch);
-            batch_add(batch, new_token, n_cur, 0, true);
-            n_cur++;
-            
-            int decode_result = llama_decode(ctx, batch);
-            if (decode_result != 0) {
-                LOGE("Failed to decode token %d, error: %d", i, decode_result);
-                break;
+        jmethodID callback_method = nullptr;
+        if (callback != nullptr) {
+            jclass callback_class = env->GetObjectClass(callback);
+            if (callback_class != nullptr) {
+                callback_method = env->GetMethodID(callback_class, "onToken", "(Ljava/lang/String;)V");
             }
         }
         
-        LOGI("Generation complete, generated %zu chars", result.length());
+        generation_params params;
+        params.max_tokens = max_tokens;
+        params.temperature = temperature;
+        params.top_p = top_p;
+        params.top_k = top_k;
+        params.cancel = &g_cancel_requested;
         
-        if (batch_allocated) llama_batch_free(batch);
-        if (sampler) llama_sampler_free(sampler);
+        // Room for the conversation and the reply, from what the session already holds
+        const int n_cells = chat_session_cells_needed(session, messages, max_tokens);
+        chat_session_set_context(session, context_for(ctx_ptr, n_cells));
+        chat_session_set_conversation(session, jstring_to_string(env, conversation_id));
+        
+        std::string result;
+        result.reserve(std::max(0, (int) max_tokens) * 16);
+        generation_stats stats;
+        std::string error;
+        bool ok = chat_session_generate(session, messages, params,
+                                        [&](const std::string &piece) {
+                                            result += piece;
+                                            if (callback_method == nullptr) return;
+                                            jstring jtoken = string_to_jstring(env, piece);
+                                            if (jtoken == nullptr) return;
+                                            env->CallVoidMethod(callback, callback_method, jtoken);
+                                            if (env->ExceptionCheck()) {
+                                                LOGW("Exception in callback, clearing and continuing");
+                                                env->ExceptionClear();
+                                            }
+                                            env->DeleteLocalRef(jtoken);
+                                        },
+                                        error, &stats);
+        report_stop(env, callback, stats.stop_reason);
         g_is_generating.store(false);
+        if (!ok) {
+            return string_to_jstring(env, "Error: " + error);
+        }
         
+        LOGI("Chat reply complete: %zu chars, %d prompt tokens decoded, %d reused",
+             result.length(), stats.n_prompt, stats.n_reused);
+        generation_metrics_record(model_registry_fingerprint(chat_session_model(session)), stats, false);
         return string_to_jstring(env, result);
-        
     } catch (const std::exception& e) {
-        LOGE("Exception during generation: %s", e.what());
-        if (batch_allocated) llama_batch_free(batch);
-        if (sampler) llama_sampler_free(sampler);
+        LOGE("Exception during chat generation: %s", e.what());
         g_is_generating.store(false);
         return string_to_jstring(env, std::string("Error: ") + e.what());
     } catch (...) {
-        LOGE("Unknown exception during generation");
-        if (batch_allocated) llama_batch_free(batch);
-        if (sampler) llama_sampler_free(sampler);
+        LOGE("Unknown exception during chat generation");
         g_is_generating.store(false);
         return string_to_jstring(env, "Error: Unknown native error");
     }
 }
 
+// Set the directory where preamble KV snapshots are stored
+JNIEXPORT void JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_setPromptSnapshotDirNative(JNIEnv *env, jobject thiz, jstring dir) {
+    prompt_snapshot_set_dir(jstring_to_string(env, dir));
+}
+
+// Set the directory and disk budget for the KV state of idle conversations
+JNIEXPORT void JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_setKvSpillDirNative(JNIEnv *env, jobject thiz, jstring dir, jlong max_bytes) {
+    kv_spill_set_dir(jstring_to_string(env, dir), (size_t) std::max<jlong>(0, max_bytes));
+}
+
+// Get spilled conversation statistics (hits, misses, compression) as JSON
+JNIEXPORT jstring JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_getKvSpillStatsNative(JNIEnv *env, jobject thiz) {
+    return string_to_jstring(env, kv_spill_stats_json());
+}
+
+// Compute and store the KV state of a named preamble unless it is already stored.
+// Uses the context, so it waits its turn like a generation and fails while one runs.
+JNIEXPORT jboolean JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_preparePromptSnapshotNative(
+        JNIEnv *env,
+        jobject thiz,
+        jlong model_ptr,
+        jlong ctx_ptr,
+        jstring name,
+        jstring text) {
+    
+    if (model_ptr == 0 || ctx_ptr == 0) return JNI_FALSE;
+    
+    bool expected = false;
+    if (!g_is_generating.compare_exchange_strong(expected, true)) {
+        LOGD("Generation in progress, not preparing snapshot now");
+        return JNI_FALSE;
+    }
+    auto_tune_wait_idle();
+    generation_scheduler_lease lease(GENERATION_PRIORITY_INTERACTIVE);
+    
+    bool ok = false;
+    try {
+        llama_model *model = reinterpret_cast<llama_model *>(model_ptr);
+        std::string snapshot_name = jstring_to_string(env, name);
+        std::string snapshot_text = jstring_to_string(env, text);
+        llama_context *ctx = context_for(ctx_ptr, count_tokens(model, snapshot_text));
+        std::string error;
+        ok = prompt_snapshot_prepare(ctx, model, snapshot_name, snapshot_text, error);
+        if (!ok) {
+            LOGW("Snapshot '%s' not prepared: %s", snapshot_name.c_str(), error.c_str());
+        }
+    } catch (const std::exception& e) {
+        LOGE("Exception preparing snapshot: %s", e.what());
+    } catch (...) {
+        LOGE("Unknown exception preparing snapshot");
+    }
+    g_is_generating.store(false);
+    return ok ? JNI_TRUE : JNI_FALSE;
+}
+
+// Delete all stored snapshots, returns the number of files removed
+JNIEXPORT jint JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_clearPromptSnapshotsNative(JNIEnv *env, jobject thiz) {
+    return prompt_snapshot_clear();
+}
+
+// Get snapshot store statistics as JSON
+JNIEXPORT jstring JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_getPromptSnapshotStatsNative(JNIEnv *env, jobject thiz) {
+    return string_to_jstring(env, prompt_snapshot_stats_json());
+}
+
+// Run a parallel generation, reporting tokens and finished items with their
+// index to callback. Returns the n results in order, or null on error.
+static jobjectArray run_parallel(
+        JNIEnv *env, jobject callback, jint n,
+        const std::function<bool(const std::function<void(int, const std::string &)> &,
+                                 const std::function<void(int, const parallel_result &)> &,
+                                 std::string &)> &run) {
+    jmethodID token_method = nullptr;
+    jmethodID complete_method = nullptr;
+    if (callback != nullptr) {
+        jclass callback_class = env->GetObjectClass(callback);
+        if (callback_class != nullptr) {
+            token_method = env->GetMethodID(callback_class, "onToken", "(ILjava/lang/String;)V");
+            complete_method = env->GetMethodID(callback_class, "onComplete", "(ILjava/lang/String;)V");
+        }
+    }
+    auto call = [&](jmethodID method, int index, const std::string &text) {
+        if (method == nullptr) return;
+        jstring jtext = string_to_jstring(env, text);
+        if (jtext == nullptr) return;
+        env->CallVoidMethod(callback, method, (jint) index, jtext);
+        if (env->ExceptionCheck()) {
+            LOGW("Exception in callback, clearing and continuing");
+            env->ExceptionClear();
+        }
+        env->DeleteLocalRef(jtext);
+    };
+
+    std::vector<std::string> results(n);
+    std::string error;
+    bool ok = run([&](int index, const std::string &piece) { call(token_method, index, piece); },
+                  [&](int index, const parallel_result &result) {
+                      results[index] = result.text;
+                      call(complete_method, index, result.text);
+                  },
+                  error);
+    if (!ok) {
+        LOGE("Parallel generation failed: %s", error.c_str());
+        return nullptr;
+    }
+
+    jobjectArray array = env->NewObjectArray(n, env->FindClass("java/lang/String"), nullptr);
+    if (array == nullptr) return nullptr;
+    for (jint i = 0; i < n; i++) {
+        jstring jtext = string_to_jstring(env, results[i]);
+        env->SetObjectArrayElement(array, i, jtext);
+        env->DeleteLocalRef(jtext);
+    }
+    return array;
+}
+
+// Generate n completions of one prompt, prefilled once and decoded together.
+// Returns the completions in order, or null on error.
+JNIEXPORT jobjectArray JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_generateCompletionsNative(
+        JNIEnv *env,
+        jobject thiz,
+        jlong model_ptr,
+        jlong ctx_ptr,
+        jstring prompt,
+        jint n,
+        jint max_tokens,
+        jfloat temperature,
+        jfloat top_p,
+        jint top_k,
+        jint seed,
+        jobject callback) {
+
+    TRACE_SCOPE("generateCompletionsNative");
+    if (model_ptr == 0 || ctx_ptr == 0 || n <= 0) {
+        return nullptr;
+    }
+
+    bool expected = false;
+    if (!g_is_generating.compare_exchange_strong(expected, true)) {
+        LOGW("Generation already in progress");
+        return nullptr;
+    }
+    auto_tune_wait_idle();
+    generation_scheduler_lease lease(GENERATION_PRIORITY_INTERACTIVE);
+    g_cancel_requested.store(false);
+
+    try {
+        llama_model *model = reinterpret_cast<llama_model *>(model_ptr);
+        const std::string prompt_str = jstring_to_string(env, prompt);
+        // The prompt is decoded once and shared; every sequence adds its own completion
+        llama_context *ctx = context_for(ctx_ptr, count_tokens(model, prompt_str) +
+                                                  std::min((int) n, GENERATION_MAX_SEQUENCES) * std::max(0, (int) max_tokens));
+
+        generation_params params;
+        params.max_tokens = max_tokens;
+        params.temperature = temperature;
+        params.top_p = top_p;
+        params.top_k = top_k;
+        params.seed = (uint32_t) seed;
+        params.cancel = &g_cancel_requested;
+
+        jobjectArray results = run_parallel(env, callback, n, [&](const auto &on_piece, const auto &on_done, std::string &error) {
+            return parallel_generation_completions(ctx, model, prompt_str, n, params, on_piece, on_done, error);
+        });
+        g_is_generating.store(false);
+        return results;
+    } catch (const std::exception& e) {
+        LOGE("Exception during completions: %s", e.what());
+        g_is_generating.store(false);
+        return nullptr;
+    } catch (...) {
+        LOGE("Unknown exception during completions");
+        g_is_generating.store(false);
+        return nullptr;
+    }
+}
+
+// Generate one completion per suffix after a shared prefix, decoding the items
+// as parallel sequences. Runs as a background job: it waits for interactive
+// requests and is parked whenever one arrives. With a cache namespace, items
+// found in the response cache are replayed first and only the others are
+// generated (cache_refresh generates them all anew). Returns the completions
+// in order, or null on error.
+JNIEXPORT jobjectArray JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_generateBatchNative(
+        JNIEnv *env,
+        jobject thiz,
+        jlong model_ptr,
+        jlong ctx_ptr,
+        jstring prefix,
+        jobjectArray suffixes,
+        jint max_tokens,
+        jfloat temperature,
+        jfloat top_p,
+        jint top_k,
+        jint seed,
+        jobject callback,
+        jstring cache_namespace,
+        jboolean cache_refresh) {
+
+    TRACE_SCOPE("generateBatchNative");
+    if (model_ptr == 0 || ctx_ptr == 0 || suffixes == nullptr) {
+        return nullptr;
+    }
+
+    try {
+        llama_model *model = reinterpret_cast<llama_model *>(model_ptr);
+        const std::string prefix_str = jstring_to_string(env, prefix);
+
+        const jsize n_items = env->GetArrayLength(suffixes);
+        std::vector<std::string> items(n_items);
+        for (jsize i = 0; i < n_items; i++) {
+            jstring item = (jstring) env->GetObjectArrayElement(suffixes, i);
+            items[i] = jstring_to_string(env, item);
+            env->DeleteLocalRef(item);
+        }
+
+        // Each item is cached as its own request: the prompt is prefix + suffix and
+        // the suffix is the variable part. Hits are replayed without the context.
+        const bool use_cache = cache_namespace != nullptr && response_cache_enabled();
+        response_cache_key cache_key;
+        if (use_cache) {
+            cache_key.model_id = model_registry_fingerprint(model);
+            cache_key.ns = jstring_to_string(env, cache_namespace);
+            cache_key.temperature = temperature;
+            cache_key.top_p = top_p;
+            cache_key.top_k = top_k;
+            cache_key.max_tokens = max_tokens;
+        }
+        std::vector<response_cache_hit> hits(n_items);
+        std::vector<bool> is_hit(n_items, false);
+        std::vector<int> pending;              // items to generate, by index
+        std::vector<std::string> pending_items;
+        for (jsize i = 0; i < n_items; i++) {
+            if (use_cache && !cache_refresh) {
+                TRACE_SCOPE("response_cache_lookup");
+                is_hit[i] = response_cache_lookup(cache_key, prefix_str + items[i], items[i], hits[i]);
+            }
+            if (is_hit[i]) continue;
+            pending.push_back(i);
+            pending_items.push_back(items[i]);
+        }
+        if (use_cache) LOGI("Batch response cache: %zu of %d items hit", n_items - pending.size(), (int) n_items);
+
+        return run_parallel(env, callback, n_items, [&](const auto &on_piece, const auto &on_done, std::string &error) {
+            for (jsize i = 0; i < n_items; i++) {
+                if (!is_hit[i]) continue;
+                parallel_result result;
+                for (const auto &piece : hits[i].pieces) {
+                    result.text += piece;
+                    result.n_generated++;
+                    on_piece(i, piece);
+                }
+                result.completed = true;
+                on_done(i, result);
+            }
+            if (pending.empty()) return true;
+
+            auto_tune_wait_idle();
+            generation_scheduler_lease lease(GENERATION_PRIORITY_BACKGROUND);
+            g_background_cancel_requested.store(false);
+
+            // Room for the shared prefix and as many items as can run at once
+            int n_cells = count_tokens(model, prefix_str);
+            for (size_t i = 0; i < std::min<size_t>(pending_items.size(), GENERATION_MAX_SEQUENCES); i++) {
+                n_cells += count_tokens(model, pending_items[i]) + std::max(0, (int) max_tokens);
+            }
+            context_for(ctx_ptr, n_cells);
+
+            generation_params params;
+            params.max_tokens = max_tokens;
+            params.temperature = temperature;
+            params.top_p = top_p;
+            params.top_k = top_k;
+            params.seed = (uint32_t) seed;
+            params.cancel = &g_background_cancel_requested;
+            params.preemptible = true;
+
+            std::vector<std::vector<std::string>> pieces(use_cache ? pending.size() : 0);
+            // The job holds the handle, not the context: it may be replaced while the job is parked
+            return parallel_generation_run(reinterpret_cast<growing_context *>(ctx_ptr), model, prefix_str,
+                    pending_items, params,
+                    [&](int index, const std::string &piece) {
+                        if (use_cache) pieces[index].push_back(piece);
+                        on_piece(pending[index], piece);
+                    },
+                    [&](int index, const parallel_result &result) {
+                        if (use_cache && result.completed) {
+                            // A completed item ended at end-of-generation or at max_tokens
+                            const generation_stop_reason reason = result.n_generated >= max_tokens
+                                    ? GENERATION_STOP_MAX_TOKENS : GENERATION_STOP_EOG;
+                            response_cache_insert(cache_key, prefix_str + pending_items[index], pending_items[index],
+                                                  pieces[index], reason);
+                        }
+                        on_done(pending[index], result);
+                    },
+                    error);
+        });
+    } catch (const std::exception& e) {
+        LOGE("Exception during batch generation: %s", e.what());
+        return nullptr;
+    } catch (...) {
+        LOGE("Unknown exception during batch generation");
+        return nullptr;
+    }
+}
+
 // Cancel ongoing generation
 JNIEXPORT void JNICALL
 Java_com_localllm_app_inference_LlamaAndroid_cancelGenerationNative(JNIEnv *env, jobject thiz) {
@@ -620,12 +1135,340 @@ Java_com_localllm_app_inference_LlamaAndroid_cancelGenerationNative(JNIEnv *env,
     g_cancel_requested.store(true);
 }
 
+// Cancel the running background job, leaving interactive generation alone
+JNIEXPORT void JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_cancelBackgroundGenerationNative(JNIEnv *env, jobject thiz) {
+    LOGI("Cancel background generation requested");
+    g_background_cancel_requested.store(true);
+}
+
 // Check if generation is in progress
 JNIEXPORT jboolean JNICALL
 Java_com_localllm_app_inference_LlamaAndroid_isGeneratingNative(JNIEnv *env, jobject thiz) {
     return g_is_generating.load();
 }
 
+// Why the last generateNative or chat session reply stopped, e.g. "eog" or "budget"
+JNIEXPORT jstring JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_getLastStopReasonNative(JNIEnv *env, jobject thiz) {
+    return string_to_jstring(env, generation_stop_reason_name((generation_stop_reason) g_last_stop_reason.load()));
+}
+
+// Minimum fraction of time background jobs keep while interactive requests keep arriving
+JNIEXPORT void JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_setBackgroundShareNative(JNIEnv *env, jobject thiz, jfloat share) {
+    generation_scheduler_set_background_share(share);
+}
+
+// Get interactive/background scheduling statistics as JSON
+JNIEXPORT jstring JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_getSchedulerStatsNative(JNIEnv *env, jobject thiz) {
+    return string_to_jstring(env, generation_scheduler_stats_json());
+}
+
+// Pre-create idle contexts for a model so the next createContextNative is immediate
+JNIEXPORT jint JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_prewarmContextsNative(
+        JNIEnv *env,
+        jobject thiz,
+        jlong model_ptr,
+        jint n_ctx,
+        jint n_batch,
+        jint n_ubatch,
+        jint n_threads,
+        jint type_k,
+        jint type_v,
+        jint flash_attn,
+        jboolean grow_kv,
+        jint count) {
+    if (model_ptr == 0 || count <= 0) return 0;
+    
+    try {
+        llama_model *model = reinterpret_cast<llama_model *>(model_ptr);
+        llama_context_params ctx_params = generation_context_params(
+                n_ctx, n_batch, n_ubatch, n_threads, type_k, type_v, flash_attn);
+        auto_tune_apply(model, ctx_params);
+        return context_pool_prewarm(model, growing_context_initial_params(ctx_params, grow_kv), count);
+    } catch (const std::exception& e) {
+        LOGE("Exception prewarming contexts: %s", e.what());
+        return 0;
+    }
+}
+
+// Estimate KV cache bytes for a context configuration without allocating it
+JNIEXPORT jlong JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_estimateKvCacheBytesNative(
+        JNIEnv *env,
+        jobject thiz,
+        jlong model_ptr,
+        jint n_ctx,
+        jint type_k,
+        jint type_v) {
+    if (model_ptr == 0 || n_ctx <= 0) return 0;
+    
+    try {
+        llama_model *model = reinterpret_cast<llama_model *>(model_ptr);
+        return (jlong) kv_cache_estimate_bytes(model, n_ctx,
+                kv_cache_type_from_int(type_k), kv_cache_type_from_int(type_v));
+    } catch (...) {
+        return 0;
+    }
+}
+
+// Set the directory where auto-tune results are stored
+JNIEXPORT void JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_setAutoTuneStoreDirNative(
+        JNIEnv *env,
+        jobject thiz,
+        jstring dir) {
+    auto_tune_set_store_dir(jstring_to_string(env, dir));
+}
+
+// Enable or disable applying tuned configurations to new contexts
+JNIEXPORT void JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_setAutoTuneEnabledNative(
+        JNIEnv *env,
+        jobject thiz,
+        jboolean enabled) {
+    auto_tune_set_enabled(enabled);
+}
+
+// Benchmark context configurations for a model, returns the Pareto front as JSON
+JNIEXPORT jstring JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_runAutoTuneNative(
+        JNIEnv *env,
+        jobject thiz,
+        jlong model_ptr,
+        jfloat max_seconds) {
+    if (model_ptr == 0) {
+        return string_to_jstring(env, "Error: Model not loaded");
+    }
+    if (g_is_generating.load() || generation_scheduler_busy()) {
+        return string_to_jstring(env, "Error: Generation in progress");
+    }
+    
+    try {
+        llama_model *model = reinterpret_cast<llama_model *>(model_ptr);
+        auto_tune_options options;
+        if (max_seconds > 0) options.max_seconds = max_seconds;
+        
+        // Generation has priority, a request arriving mid-run aborts the tune
+        auto_tune_run(model, options, [] { return g_is_generating.load() || generation_scheduler_busy(); });
+        return string_to_jstring(env, auto_tune_results_json(model));
+    } catch (const std::exception& e) {
+        LOGE("Exception during auto-tune: %s", e.what());
+        return string_to_jstring(env, std::string("Error: ") + e.what());
+    } catch (...) {
+        LOGE("Unknown exception during auto-tune");
+        return string_to_jstring(env, "Error: Unknown native error");
+    }
+}
+
+// Stop a running auto-tune, e.g. before the model it benchmarks is freed
+JNIEXPORT void JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_abortAutoTuneNative(JNIEnv *env, jobject thiz) {
+    auto_tune_abort();
+}
+
+// Check whether tuned configurations are stored for a model on this device
+JNIEXPORT jboolean JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_hasAutoTuneResultsNative(
+        JNIEnv *env,
+        jobject thiz,
+        jlong model_ptr) {
+    if (model_ptr == 0) return false;
+    return auto_tune_has_results(reinterpret_cast<llama_model *>(model_ptr));
+}
+
+// Get stored tuned configurations for a model as JSON
+JNIEXPORT jstring JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_getAutoTuneResultsNative(
+        JNIEnv *env,
+        jobject thiz,
+        jlong model_ptr) {
+    return string_to_jstring(env, auto_tune_results_json(reinterpret_cast<llama_model *>(model_ptr)));
+}
+
+// Enable or disable online tuning of the decode thread count
+JNIEXPORT void JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_setDecodeThreadTuningNative(
+        JNIEnv *env,
+        jobject thiz,
+        jboolean enabled,
+        jboolean reset) {
+    thread_tuner_set_enabled(enabled);
+    if (reset) thread_tuner_reset();
+}
+
+// Get measured decode latency per thread count as JSON
+JNIEXPORT jstring JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_getDecodeThreadStatsNative(JNIEnv *env, jobject thiz) {
+    return string_to_jstring(env, thread_tuner_stats_json());
+}
+
+// Metrics of the most recent generateNative call as JSON
+JNIEXPORT jstring JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_getLastGenerationMetricsNative(JNIEnv *env, jobject thiz) {
+    return string_to_jstring(env, generation_metrics_last_json());
+}
+
+// Rolling per-model distributions of generation metrics as JSON
+JNIEXPORT jstring JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_getGenerationMetricsNative(JNIEnv *env, jobject thiz) {
+    return string_to_jstring(env, generation_metrics_histogram_json());
+}
+
+JNIEXPORT void JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_resetGenerationMetricsNative(JNIEnv *env, jobject thiz) {
+    generation_metrics_reset();
+}
+
+// Enable or disable recording of native trace spans
+JNIEXPORT void JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_setTraceEnabledNative(
+        JNIEnv *env,
+        jobject thiz,
+        jboolean enabled,
+        jboolean clear) {
+    if (clear) trace_clear();
+    trace_set_enabled(enabled);
+}
+
+// Write buffered trace spans as Chrome Trace Event JSON, returns the span count or -1
+JNIEXPORT jint JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_dumpTraceNative(
+        JNIEnv *env,
+        jobject thiz,
+        jstring path) {
+    try {
+        return trace_dump(jstring_to_string(env, path));
+    } catch (const std::exception& e) {
+        LOGE("Exception dumping trace: %s", e.what());
+        return -1;
+    }
+}
+
+JNIEXPORT jstring JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_getTraceStatsNative(JNIEnv *env, jobject thiz) {
+    return string_to_jstring(env, trace_stats_json());
+}
+
+// Set the runtime log level and whether messages below ERROR are buffered in the log ring
+JNIEXPORT void JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_setNativeLogLevelNative(
+        JNIEnv *env,
+        jobject thiz,
+        jint level,
+        jboolean use_ring) {
+    log_set_level(level);
+    log_set_ring(use_ring);
+}
+
+// Flush the log ring to logcat, returns the number of messages written
+JNIEXPORT jint JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_dumpNativeLogNative(JNIEnv *env, jobject thiz) {
+    return log_dump();
+}
+
+// Configure the per-context ggml threadpools used for new contexts
+JNIEXPORT void JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_configureThreadpoolNative(
+        JNIEnv *env,
+        jobject thiz,
+        jboolean enabled,
+        jint poll,
+        jboolean strict_cpu) {
+    cpu_threadpool_config config;
+    config.enabled = enabled;
+    config.poll = poll;
+    config.strict_cpu = strict_cpu;
+    cpu_threadpool_configure(config);
+}
+
+// Number of performance cores, the default thread count for contexts
+JNIEXPORT jint JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_getPerformanceCoreCountNative(JNIEnv *env, jobject thiz) {
+    return cpu_threadpool_default_threads();
+}
+
+// Get threadpool configuration and CPU topology as JSON
+JNIEXPORT jstring JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_getThreadpoolStatsNative(JNIEnv *env, jobject thiz) {
+    return string_to_jstring(env, cpu_threadpool_stats_json());
+}
+
+// Get context pool statistics as JSON
+JNIEXPORT jstring JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_getContextPoolStatsNative(JNIEnv *env, jobject thiz) {
+    return string_to_jstring(env, context_pool_stats_json());
+}
+
+// Get KV cache growth statistics and current context sizes as JSON
+JNIEXPORT jstring JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_getContextGrowthStatsNative(JNIEnv *env, jobject thiz) {
+    return string_to_jstring(env, growing_context_stats_json());
+}
+
+// Set the RAM budget for resident models (0 = free idle models immediately)
+JNIEXPORT void JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_setModelMemoryBudgetNative(
+        JNIEnv *env,
+        jobject thiz,
+        jlong budget_bytes) {
+    model_registry_set_budget(budget_bytes > 0 ? (size_t) budget_bytes : 0);
+    LOGI("Model memory budget set to %lld bytes", (long long) budget_bytes);
+}
+
+// Free native memory up to a trim level (see memory_trim.h), returns what each step freed as JSON.
+// Never waits for a running request: live contexts are then left alone.
+JNIEXPORT jstring JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_trimMemoryNative(JNIEnv *env, jobject thiz, jint level) {
+    const memory_trim_level trim_level =
+            (memory_trim_level) std::max((int) MEMORY_TRIM_NONE, std::min((int) level, (int) MEMORY_TRIM_MODELS));
+    const bool contexts_idle = generation_scheduler_try_acquire();
+    memory_trim_report report = memory_trim(trim_level, contexts_idle);
+    if (contexts_idle) generation_scheduler_release(GENERATION_PRIORITY_INTERACTIVE);
+    return string_to_jstring(env, memory_trim_report_json(report));
+}
+
+// Get trim counts per level and total bytes freed as JSON
+JNIEXPORT jstring JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_getMemoryTrimStatsNative(JNIEnv *env, jobject thiz) {
+    return string_to_jstring(env, memory_trim_stats_json());
+}
+
+// Get model registry contents and accounting as JSON
+JNIEXPORT jstring JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_getModelRegistryStatsNative(JNIEnv *env, jobject thiz) {
+    return string_to_jstring(env, model_registry_stats_json());
+}
+
+// Configure the response cache (threshold <= 0 and capacity <= 0 keep current values)
+JNIEXPORT void JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_configureResponseCacheNative(
+        JNIEnv *env,
+        jobject thiz,
+        jboolean enabled,
+        jfloat similarity_threshold,
+        jint capacity) {
+    response_cache_configure(enabled, similarity_threshold, capacity);
+    LOGI("Response cache configured: enabled=%d, threshold=%.3f, capacity=%d",
+         enabled, similarity_threshold, capacity);
+}
+
+// Get response cache hit-rate statistics as JSON
+JNIEXPORT jstring JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_getResponseCacheStatsNative(JNIEnv *env, jobject thiz) {
+    return string_to_jstring(env, response_cache_stats_json());
+}
+
+// Drop all cached responses and reset statistics
+JNIEXPORT void JNICALL
+Java_com_localllm_app_inference_LlamaAndroid_clearResponseCacheNative(JNIEnv *env, jobject thiz) {
+    response_cache_clear();
+    LOGD("Response cache cleared");
+}
+
 // Get model info
 JNIEXPORT jstring JNICALL
 Java_com_localllm_app_inference_LlamaAndroid_getModelInfoNative(JNIEnv *env, jobject thiz, jlong model_ptr) {
@@ -657,8 +1500,8 @@ JNIEXPORT jint JNICALL
 Java_com_localllm_app_inference_LlamaAndroid_getContextSizeNative(JNIEnv *env, jobject thiz, jlong ctx_ptr) {
     if (ctx_ptr == 0) return 0;
     try {
-        llama_context *ctx = reinterpret_cast<llama_context *>(ctx_ptr);
-        return llama_n_ctx(ctx);
+        // The configured size; a growing context may hold fewer cells until it needs them
+        return growing_context_max_cells(reinterpret_cast<growing_context *>(ctx_ptr));
     } catch (...) {
         return 0;
     }
@@ -0,0 +1,335 @@
+/**
+ * localllm_bench.cpp - Host benchmark for the inference core
+ *
+ * Runs the same generation path as the app (context pool, threadpool,
+ * thread tuner, generation_run) on a desktop or CI machine so prefill and
+ * decode throughput can be compared across changes without a device.
+ * Greedy sampling with end-of-generation ignored keeps every run the same
+ * length. Results are printed as a JSON object on stdout, logs go to stderr.
+ *
+ * --check-allocs counts operator new calls and fails if the decode loop
+ * allocates after its first token (allocations inside llama.cpp excluded).
+ *
+ * --trim N releases the context and model as the app does when idle, then
+ * runs memory_trim at level N and adds its report to the output.
+ */
+
+#include "context_pool.h"
+#include "cpu_threadpool.h"
+#include "generation.h"
+#include "memory_trim.h"
+#include "model_registry.h"
+#include "thread_tuner.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+std::atomic<uint64_t> g_allocations{0};
+
+void * operator new(size_t size) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void * ptr = malloc(size > 0 ? size : 1)) return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void * ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void * ptr, size_t) noexcept {
+    free(ptr);
+}
+
+namespace {
+
+uint64_t allocation_count() {
+    return g_allocations.load(std::memory_order_relaxed);
+}
+
+struct bench_args {
+    std::string model_path;
+    std::string prompt_file;
+    int n_prompt = 512;
+    int n_gen = 128;
+    int n_threads = 0;
+    int n_ctx = 0;
+    int n_batch = 512;
+    int n_ubatch = 0;
+    int repetitions = 3;
+    int type_k = 1;       // F16
+    int type_v = 1;
+    int flash_attn = -1;
+    bool tune_threads = true;
+    bool check_allocs = false;
+    int trim_level = 0;
+};
+
+void print_usage(const char * argv0) {
+    fprintf(stderr,
+            "usage: %s -m model.gguf [options]\n"
+            "  -p N        approximate prompt length in tokens (default 512)\n"
+            "  -f FILE     read the prompt from FILE instead\n"
+            "  -n N        tokens to generate (default 128)\n"
+            "  -t N        threads (default: performance cores)\n"
+            "  -c N        context size (default: prompt + generated tokens)\n"
+            "  -b N        batch size (default 512)\n"
+            "  -ub N       micro-batch size (default: batch size)\n"
+            "  -r N        repetitions (default 3)\n"
+            "  --ctk N     K cache ggml type (1 = f16, 8 = q8_0, 2 = q4_0)\n"
+            "  --ctv N     V cache ggml type\n"
+            "  --fa N      flash attention: -1 auto, 0 off, 1 on\n"
+            "  --no-tune   keep decode threads fixed instead of tuning online\n"
+            "  --check-allocs  fail if the decode loop allocates per token\n"
+            "  --trim N    release the model and context, then trim memory at level N (1-4)\n",
+            argv0);
+}
+
+bool parse_args(int argc, char ** argv, bench_args & args) {
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        auto next = [&](const char * name) -> const char * {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "missing value for %s\n", name);
+                return nullptr;
+            }
+            return argv[++i];
+        };
+        const char * value = nullptr;
+        if (arg == "--no-tune") {
+            args.tune_threads = false;
+            continue;
+        }
+        if (arg == "--check-allocs") {
+            args.check_allocs = true;
+            continue;
+        }
+        if (arg == "-h" || arg == "--help") return false;
+        if ((value = next(arg.c_str())) == nullptr) return false;
+
+        if (arg == "-m") args.model_path = value;
+        else if (arg == "-f") args.prompt_file = value;
+        else if (arg == "-p") args.n_prompt = atoi(value);
+        else if (arg == "-n") args.n_gen = atoi(value);
+        else if (arg == "-t") args.n_threads = atoi(value);
+        else if (arg == "-c") args.n_ctx = atoi(value);
+        else if (arg == "-b") args.n_batch = atoi(value);
+        else if (arg == "-ub") args.n_ubatch = atoi(value);
+        else if (arg == "-r") args.repetitions = std::max(1, atoi(value));
+        else if (arg == "--ctk") args.type_k = atoi(value);
+        else if (arg == "--ctv") args.type_v = atoi(value);
+        else if (arg == "--fa") args.flash_attn = atoi(value);
+        else if (arg == "--trim") args.trim_level = atoi(value);
+        else {
+            fprintf(stderr, "unknown argument: %s\n", arg.c_str());
+            return false;
+        }
+    }
+    return !args.model_path.empty();
+}
+
+// Repeat a plain-text paragraph until the prompt tokenizes to about n_tokens
+std::string synthetic_prompt(const llama_model * model, int n_tokens) {
+    static const char * paragraph =
+            "The quick brown fox jumps over the lazy dog while the farmer counts sheep "
+            "in the meadow, and the river carries leaves past the old stone mill. ";
+    const llama_vocab * vocab = llama_model_get_vocab(model);
+    const int per_paragraph = -llama_tokenize(vocab, paragraph, (int32_t) strlen(paragraph),
+                                              nullptr, 0, false, false);
+    const int repeats = std::max(1, n_tokens / std::max(1, per_paragraph));
+
+    std::string prompt;
+    for (int i = 0; i < repeats; i++) prompt += paragraph;
+    return prompt;
+}
+
+double percentile(std::vector<double> values, double p) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    size_t index = (size_t) (p * (values.size() - 1) + 0.5);
+    return values[std::min(index, values.size() - 1)];
+}
+
+std::string escape_json(const std::string & s) {
+    std::string out;
+    for (char c : s) {
+        if (c == '"' || c == '\\') out += '\\';
+        out += c;
+    }
+    return out;
+}
+
+} // namespace
+
+int main(int argc, char ** argv) {
+    bench_args args;
+    if (!parse_args(argc, argv, args)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    llama_backend_init();
+    thread_tuner_set_enabled(args.tune_threads);
+
+    llama_model * model = model_registry_acquire(args.model_path, model_registry_params());
+    if (model == nullptr) {
+        fprintf(stderr, "failed to load model %s\n", args.model_path.c_str());
+        llama_backend_free();
+        return 1;
+    }
+
+    std::string prompt;
+    if (!args.prompt_file.empty()) {
+        std::ifstream file(args.prompt_file);
+        if (!file) {
+            fprintf(stderr, "failed to read %s\n", args.prompt_file.c_str());
+            model_registry_release(model);
+            llama_backend_free();
+            return 1;
+        }
+        std::stringstream buffer;
+        buffer << file.rdbuf();
+        prompt = buffer.str();
+    } else {
+        prompt = synthetic_prompt(model, args.n_prompt);
+    }
+
+    // Tokenized once: a prompt file can be any length, so the context is sized from the real count
+    std::vector<llama_token> prompt_tokens;
+    std::string error;
+    if (!generation_tokenize(model, prompt, prompt_tokens, error)) {
+        fprintf(stderr, "failed to tokenize the prompt: %s\n", error.c_str());
+        model_registry_release(model);
+        llama_backend_free();
+        return 1;
+    }
+
+    const int n_ctx = args.n_ctx > 0 ? args.n_ctx : (int) prompt_tokens.size() + args.n_gen + 64;
+    llama_context_params ctx_params = generation_context_params(
+            n_ctx, args.n_batch, args.n_ubatch, args.n_threads,
+            args.type_k, args.type_v, args.flash_attn);
+    llama_context * ctx = context_pool_acquire(model, ctx_params);
+    if (ctx == nullptr) {
+        fprintf(stderr, "failed to create context\n");
+        model_registry_release(model);
+        llama_backend_free();
+        return 1;
+    }
+
+    generation_params params;
+    params.max_tokens = args.n_gen;
+    params.temperature = 0;
+    params.ignore_eog = true;
+    if (args.check_allocs) params.alloc_count = allocation_count;
+
+    std::vector<generation_stats> runs;
+    std::vector<double> token_ms;
+    token_ms.reserve((size_t) args.n_gen * args.repetitions);
+    uint64_t loop_allocations = 0;
+    int exit_code = 0;
+
+    for (int r = 0; r < args.repetitions; r++) {
+        generation_stats stats;
+        if (!generation_run(ctx, model, prompt_tokens, params, [](const std::string &) {}, error, &stats)) {
+            fprintf(stderr, "generation failed: %s\n", error.c_str());
+            exit_code = 1;
+            break;
+        }
+        token_ms.insert(token_ms.end(), stats.token_ms.begin(), stats.token_ms.end());
+        loop_allocations += stats.loop_allocations;
+        runs.push_back(stats);
+    }
+
+    // Idle as the app is between requests: the context back in the pool, the model kept warm
+    std::string trim_json;
+    if (args.trim_level > 0) {
+        context_pool_release(ctx);
+        ctx = nullptr;
+        model_registry_set_budget(SIZE_MAX);
+        model_registry_release(model);
+        model = nullptr;
+        trim_json = memory_trim_report_json(memory_trim((memory_trim_level) args.trim_level, true));
+    }
+
+    if (!runs.empty()) {
+        double prefill_ms = 0;
+        double decode_ms = 0;
+        double ttft_ms = 0;
+        int n_prompt = 0;
+        int n_generated = 0;
+
+        std::string runs_json = "[";
+        for (size_t i = 0; i < runs.size(); i++) {
+            const generation_stats & stats = runs[i];
+
+            // Throughput from llama_decode time alone; token_ms also holds sampling and
+            // detokenizing and only feeds the latency percentiles
+            prefill_ms += stats.prefill_ms;
+            decode_ms += stats.decode_ms;
+            ttft_ms += stats.ttft_ms;
+            n_prompt += stats.n_prompt;
+            n_generated += (int) stats.token_ms.size();
+
+            if (i > 0) runs_json += ",";
+            runs_json += "{\"prefill_ms\":" + std::to_string(stats.prefill_ms) + ",";
+            runs_json += "\"ttft_ms\":" + std::to_string(stats.ttft_ms) + ",";
+            runs_json += "\"decode_ms\":" + std::to_string(stats.decode_ms) + ",";
+            runs_json += "\"n_generated\":" + std::to_string(stats.n_generated) + "}";
+        }
+        runs_json += "]";
+
+        std::string json = "{";
+        json += "\"model\":\"" + escape_json(args.model_path) + "\",";
+        json += "\"n_prompt\":" + std::to_string(runs[0].n_prompt) + ",";
+        json += "\"n_gen\":" + std::to_string(args.n_gen) + ",";
+        json += "\"n_ctx\":" + std::to_string(ctx_params.n_ctx) + ",";
+        json += "\"n_batch\":" + std::to_string(ctx_params.n_batch) + ",";
+        json += "\"n_ubatch\":" + std::to_string(ctx_params.n_ubatch) + ",";
+        json += "\"threads\":" + std::to_string(ctx_params.n_threads) + ",";
+        json += "\"repetitions\":" + std::to_string(runs.size()) + ",";
+        json += "\"prefill_tps\":" + std::to_string(prefill_ms > 0 ? n_prompt * 1000.0 / prefill_ms : 0) + ",";
+        json += "\"decode_tps\":" + std::to_string(decode_ms > 0 ? n_generated * 1000.0 / decode_ms : 0) + ",";
+        json += "\"ttft_ms\":" + std::to_string(ttft_ms / runs.size()) + ",";
+        json += "\"token_ms\":{";
+        json += "\"p50\":" + std::to_string(percentile(token_ms, 0.50)) + ",";
+        json += "\"p90\":" + std::to_string(percentile(token_ms, 0.90)) + ",";
+        json += "\"p99\":" + std::to_string(percentile(token_ms, 0.99)) + ",";
+        json += "\"max\":" + std::to_string(percentile(token_ms, 1.0)) + "},";
+        json += "\"runs\":" + runs_json + ",";
+        if (args.check_allocs) {
+            json += "\"loop_allocations\":" + std::to_string(loop_allocations) + ",";
+        }
+        if (!trim_json.empty()) {
+            json += "\"trim\":" + trim_json + ",";
+        }
+        json += "\"decode_threads\":" + thread_tuner_stats_json() + ",";
+        json += "\"threadpool\":" + cpu_threadpool_stats_json();
+        json += "}";
+        printf("%s\n", json.c_str());
+
+        if (args.check_allocs && loop_allocations > 0) {
+            fprintf(stderr, "decode loop made %llu heap allocations after the first token\n",
+                    (unsigned long long) loop_allocations);
+            exit_code = 2;
+        }
+    }
+
+    if (ctx != nullptr) context_pool_release(ctx);
+    if (model != nullptr) {
+        context_pool_drop_model(model);
+        model_registry_set_budget(0);
+        model_registry_release(model);
+    } else {
+        model_registry_set_budget(0);  // unloads the model left idle for --trim
+    }
+    llama_backend_free();
+    return exit_code;
+}
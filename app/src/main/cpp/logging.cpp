@@ -0,0 +1,145 @@
+/**
+ * logging.cpp - Leveled logging shared by the app and host tools
+ */
+
+#include "logging.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+
+#ifdef __ANDROID__
+#include <android/log.h>
+#endif
+
+std::atomic<int> g_log_level{LOCALLLM_LOG_MIN_LEVEL};
+
+namespace {
+
+// seq is 2*n+1 while entry n is being written and 2*n+2 once it is complete
+struct log_entry {
+    std::atomic<uint64_t> seq{0};
+    int level = 0;
+    const char * tag = nullptr;
+    int64_t time_ms = 0;
+    char message[LOG_RING_MESSAGE];
+};
+
+log_entry g_ring[LOG_RING_ENTRIES];
+std::atomic<uint64_t> g_ring_head{0};
+uint64_t g_ring_tail = 0;            // first entry not yet dumped, guarded by g_dump_mutex
+std::mutex g_dump_mutex;
+
+#ifdef NDEBUG
+std::atomic<bool> g_ring_enabled{true};
+#else
+std::atomic<bool> g_ring_enabled{false};
+#endif
+
+int64_t now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void emit(int level, const char * tag, const char * message) {
+#ifdef __ANDROID__
+    static const int priorities[] = {ANDROID_LOG_DEBUG, ANDROID_LOG_INFO, ANDROID_LOG_WARN, ANDROID_LOG_ERROR};
+    __android_log_write(priorities[level], tag, message);
+#else
+    static const char levels[] = {'D', 'I', 'W', 'E'};
+    fprintf(stderr, "%c/%s: %s\n", levels[level], tag, message);
+#endif
+}
+
+void ring_push(int level, const char * tag, const char * fmt, va_list args) {
+    const uint64_t n = g_ring_head.fetch_add(1, std::memory_order_relaxed);
+    log_entry & entry = g_ring[n % LOG_RING_ENTRIES];
+    entry.seq.store(2 * n + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    entry.level = level;
+    entry.tag = tag;
+    entry.time_ms = now_ms();
+    vsnprintf(entry.message, sizeof(entry.message), fmt, args);
+    entry.seq.store(2 * n + 2, std::memory_order_release);
+}
+
+int dump_locked() {
+    const uint64_t head = g_ring_head.load(std::memory_order_acquire);
+    uint64_t begin = std::max(g_ring_tail, head > LOG_RING_ENTRIES ? head - LOG_RING_ENTRIES : 0);
+    if (begin > g_ring_tail) {
+        char notice[64];
+        snprintf(notice, sizeof(notice), "%llu log messages overwritten",
+                 (unsigned long long) (begin - g_ring_tail));
+        emit(LOG_LEVEL_WARN, "LogRing", notice);
+    }
+
+    const int64_t now = now_ms();
+    int written = 0;
+    for (uint64_t n = begin; n < head; n++) {
+        const log_entry & entry = g_ring[n % LOG_RING_ENTRIES];
+        const uint64_t seq = entry.seq.load(std::memory_order_acquire);
+        if (seq != 2 * n + 2) continue;  // still being written or already overwritten
+
+        const int level = entry.level;
+        const char * tag = entry.tag;
+        const int64_t age_ms = now - entry.time_ms;
+        char message[LOG_RING_MESSAGE + 32];
+        snprintf(message, sizeof(message), "[-%lldms] %s", (long long) age_ms, entry.message);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (entry.seq.load(std::memory_order_relaxed) != seq) continue;
+        emit(level, tag, message);
+        written++;
+    }
+    g_ring_tail = head;
+    return written;
+}
+
+} // namespace
+
+void log_set_level(int level) {
+    g_log_level.store(std::max(LOG_LEVEL_DEBUG, std::min(LOG_LEVEL_ERROR, level)), std::memory_order_relaxed);
+}
+
+int log_get_level() {
+    return g_log_level.load(std::memory_order_relaxed);
+}
+
+void log_set_ring(bool enabled) {
+    if (!enabled) log_dump();
+    g_ring_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool log_ring_enabled() {
+    return g_ring_enabled.load(std::memory_order_relaxed);
+}
+
+void log_write(int level, const char * tag, const char * fmt, ...) {
+    level = std::max(LOG_LEVEL_DEBUG, std::min(LOG_LEVEL_ERROR, level));
+    va_list args;
+    va_start(args, fmt);
+
+    if (level < LOG_LEVEL_ERROR && g_ring_enabled.load(std::memory_order_relaxed)) {
+        ring_push(level, tag, fmt, args);
+    } else {
+        char message[1024];
+        vsnprintf(message, sizeof(message), fmt, args);
+        if (level == LOG_LEVEL_ERROR) {
+            // Flush the lead-up to the error before the error itself
+            std::lock_guard<std::mutex> lock(g_dump_mutex);
+            dump_locked();
+        }
+        emit(level, tag, message);
+    }
+
+    va_end(args);
+}
+
+int log_dump() {
+    std::lock_guard<std::mutex> lock(g_dump_mutex);
+    return dump_locked();
+}
@@ -0,0 +1,66 @@
+/**
+ * logging.h - Leveled logging shared by the app and host tools
+ *
+ * Files define LOG_TAG and use LOGD/LOGI/LOGW/LOGE. Levels below
+ * LOCALLLM_LOG_MIN_LEVEL are compiled out (release builds drop LOGD), and a
+ * runtime level filters the rest before any formatting happens.
+ *
+ * With the ring enabled (the default for NDEBUG builds) debug, info and
+ * warning messages are formatted into a lock-free in-memory ring instead of
+ * being written to logcat. The ring is flushed by log_dump() and
+ * automatically before every error, so the lead-up to a failure still
+ * reaches logcat. Without the ring, messages go to logcat on Android and
+ * to stderr elsewhere as they are logged.
+ */
+
+#pragma once
+
+#include <atomic>
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_ERROR 3
+
+#ifndef LOCALLLM_LOG_MIN_LEVEL
+#ifdef NDEBUG
+#define LOCALLLM_LOG_MIN_LEVEL LOG_LEVEL_INFO
+#else
+#define LOCALLLM_LOG_MIN_LEVEL LOG_LEVEL_DEBUG
+#endif
+#endif
+
+// Messages kept in the ring, and the longest message stored per entry
+#define LOG_RING_ENTRIES 512
+#define LOG_RING_MESSAGE 192
+
+extern std::atomic<int> g_log_level;
+
+inline bool log_level_enabled(int level) {
+    return level >= g_log_level.load(std::memory_order_relaxed);
+}
+
+// Runtime level, clamped to LOG_LEVEL_DEBUG..LOG_LEVEL_ERROR
+void log_set_level(int level);
+int log_get_level();
+
+// Route messages below LOG_LEVEL_ERROR into the ring (true) or straight to the log (false)
+void log_set_ring(bool enabled);
+bool log_ring_enabled();
+
+__attribute__((format(printf, 3, 4)))
+void log_write(int level, const char * tag, const char * fmt, ...);
+
+// Write buffered ring messages to the log in order and empty the ring. Returns the count written.
+int log_dump();
+
+#define LOG_PRINT(prio, ...)                                                            \
+    do {                                                                                \
+        if (LOG_LEVEL_##prio >= LOCALLLM_LOG_MIN_LEVEL && log_level_enabled(LOG_LEVEL_##prio)) \
+            log_write(LOG_LEVEL_##prio, LOG_TAG, __VA_ARGS__);                          \
+    } while (0)
+
+#define LOGD(...) LOG_PRINT(DEBUG, __VA_ARGS__)
+#define LOGI(...) LOG_PRINT(INFO, __VA_ARGS__)
+#define LOGW(...) LOG_PRINT(WARN, __VA_ARGS__)
+#define LOGE(...) LOG_PRINT(ERROR, __VA_ARGS__)
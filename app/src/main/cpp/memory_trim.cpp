@@ -0,0 +1,107 @@
+/**
+ * memory_trim.cpp - Graded release of native memory under pressure
+ */
+
+#include "memory_trim.h"
+#include "chat_session.h"
+#include "context_growth.h"
+#include "context_pool.h"
+#include "logging.h"
+#include "model_registry.h"
+#include "response_cache.h"
+#include "tokenizer.h"
+#include "trace.h"
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+#define LOG_TAG "MemoryTrim"
+
+namespace {
+
+constexpr int N_LEVELS = MEMORY_TRIM_MODELS + 1;
+
+std::mutex g_trim_mutex;
+uint64_t g_trims[N_LEVELS] = {};
+uint64_t g_bytes_freed = 0;
+uint64_t g_contexts_skipped = 0;
+
+} // namespace
+
+memory_trim_report memory_trim(memory_trim_level level, bool contexts_idle) {
+    TRACE_SCOPE("memory_trim");
+    // One trim at a time; a second signal arriving meanwhile finds less to free
+    std::lock_guard<std::mutex> lock(g_trim_mutex);
+    const auto start = std::chrono::steady_clock::now();
+
+    memory_trim_report report;
+    report.level = level;
+
+    if (level >= MEMORY_TRIM_CACHES) {
+        report.cache_bytes = response_cache_trim() + tokenizer_trim_cache();
+    }
+
+    if (level >= MEMORY_TRIM_SEQUENCES) {
+        if (contexts_idle) {
+            // Branches are dropped, conversations move to the disk tier, then the caches shrink
+            report.branch_cells = chat_session_drop_branches();
+            report.spilled_tokens = chat_session_spill(nullptr);
+            report.kv_bytes = growing_context_trim();
+        } else {
+            report.contexts_skipped = true;
+        }
+        context_pool_trim(&report.idle_context_bytes);
+    }
+
+    if (level >= MEMORY_TRIM_PAGES) {
+        report.page_bytes = model_registry_release_pages();
+    }
+
+    if (level >= MEMORY_TRIM_MODELS) {
+        report.model_bytes = model_registry_evict_idle(0);
+    }
+
+    report.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    if (level > MEMORY_TRIM_NONE && level < N_LEVELS) g_trims[level]++;
+    g_bytes_freed += report.total_bytes();
+    if (report.contexts_skipped) g_contexts_skipped++;
+
+    LOGI("Trim level %d freed %zu bytes in %.1f ms (caches %zu, kv %zu, contexts %zu, pages %zu, models %zu%s)",
+         (int) level, report.total_bytes(), report.ms, report.cache_bytes, report.kv_bytes,
+         report.idle_context_bytes, report.page_bytes, report.model_bytes,
+         report.contexts_skipped ? ", live contexts skipped" : "");
+    return report;
+}
+
+std::string memory_trim_report_json(const memory_trim_report & report) {
+    std::string json = "{";
+    json += "\"level\":" + std::to_string((int) report.level) + ",";
+    json += "\"total_bytes\":" + std::to_string(report.total_bytes()) + ",";
+    json += "\"cache_bytes\":" + std::to_string(report.cache_bytes) + ",";
+    json += "\"branch_cells\":" + std::to_string(report.branch_cells) + ",";
+    json += "\"spilled_tokens\":" + std::to_string(report.spilled_tokens) + ",";
+    json += "\"kv_bytes\":" + std::to_string(report.kv_bytes) + ",";
+    json += "\"idle_context_bytes\":" + std::to_string(report.idle_context_bytes) + ",";
+    json += "\"page_bytes\":" + std::to_string(report.page_bytes) + ",";
+    json += "\"model_bytes\":" + std::to_string(report.model_bytes) + ",";
+    json += "\"contexts_skipped\":" + std::string(report.contexts_skipped ? "true" : "false") + ",";
+    json += "\"ms\":" + std::to_string(report.ms);
+    json += "}";
+    return json;
+}
+
+std::string memory_trim_stats_json() {
+    std::lock_guard<std::mutex> lock(g_trim_mutex);
+    std::string json = "{";
+    json += "\"trims\":[";
+    for (int level = MEMORY_TRIM_CACHES; level < N_LEVELS; level++) {
+        if (level > MEMORY_TRIM_CACHES) json += ",";
+        json += std::to_string(g_trims[level]);
+    }
+    json += "],";
+    json += "\"bytes_freed\":" + std::to_string(g_bytes_freed) + ",";
+    json += "\"contexts_skipped\":" + std::to_string(g_contexts_skipped);
+    json += "}";
+    return json;
+}
@@ -0,0 +1,62 @@
+/**
+ * memory_trim.h - Graded release of native memory under pressure
+ *
+ * Android reports memory pressure to the app through onTrimMemory, and a
+ * process that keeps its footprint under pressure is killed, so the next
+ * launch pays a full model load. memory_trim gives back native memory in
+ * steps of increasing cost to the user, each level including the ones below:
+ *
+ *   CACHES     response and tokenizer caches (recomputed on demand)
+ *   SEQUENCES  parked chat branches, conversations spilled to disk,
+ *              grown KV caches shrunk to their contents, idle pooled contexts
+ *   PAGES      resident pages of idle memory-mapped models (read back from
+ *              the file on next use, no reload)
+ *   MODELS     idle models kept warm by the registry, unloaded
+ *
+ * Models and contexts in use are never touched. The report lists the bytes
+ * each step freed; KV and context figures are estimates, page and model
+ * figures are resident bytes. The function has no JNI dependencies, so it
+ * can be driven directly on a host (see localllm_bench --trim).
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+enum memory_trim_level {
+    MEMORY_TRIM_NONE = 0,
+    MEMORY_TRIM_CACHES = 1,
+    MEMORY_TRIM_SEQUENCES = 2,
+    MEMORY_TRIM_PAGES = 3,
+    MEMORY_TRIM_MODELS = 4,
+};
+
+struct memory_trim_report {
+    memory_trim_level level = MEMORY_TRIM_NONE;
+    size_t cache_bytes = 0;          // response and tokenizer caches
+    size_t branch_cells = 0;         // KV cells of parked chat branches dropped
+    size_t spilled_tokens = 0;       // conversation tokens moved to the disk tier (kv_spill)
+    size_t kv_bytes = 0;             // grown KV caches shrunk
+    size_t idle_context_bytes = 0;   // idle pooled contexts freed
+    size_t page_bytes = 0;           // resident pages of idle mapped models dropped
+    size_t model_bytes = 0;          // idle models unloaded
+    bool contexts_skipped = false;   // a request was running, live contexts were left alone
+    double ms = 0;
+
+    size_t total_bytes() const {
+        return cache_bytes + kv_bytes + idle_context_bytes + page_bytes + model_bytes;
+    }
+};
+
+/**
+ * Free memory up to and including level. Live contexts (chat branches,
+ * grown KV caches) are only trimmed with contexts_idle set, which the caller
+ * guarantees by holding the context for the duration of the call.
+ */
+memory_trim_report memory_trim(memory_trim_level level, bool contexts_idle);
+
+std::string memory_trim_report_json(const memory_trim_report & report);
+
+// Trims per level and bytes freed so far as a JSON object string
+std::string memory_trim_stats_json();
@@ -0,0 +1,264 @@
+/**
+ * model_registry.cpp - Shared registry of loaded llama models
+ */
+
+#include "model_registry.h"
+#include "context_pool.h"
+#include "token_pieces.h"
+#include "tokenizer.h"
+#include "logging.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include <sys/mman.h>
+
+#define LOG_TAG "ModelRegistry"
+
+namespace {
+
+struct registry_entry {
+    std::string path;
+    model_registry_params params;
+    llama_model * model = nullptr;
+    size_t resident_bytes = 0;
+    int refs = 0;
+    uint64_t last_used = 0;
+};
+
+std::mutex g_registry_mutex;
+std::vector<registry_entry> g_models;
+size_t g_budget_bytes = 0;
+uint64_t g_clock = 0;
+uint64_t g_loads = 0;
+uint64_t g_reuses = 0;
+uint64_t g_evictions = 0;
+
+bool same_params(const model_registry_params & a, const model_registry_params & b) {
+    return a.n_gpu_layers == b.n_gpu_layers && a.use_mmap == b.use_mmap && a.use_mlock == b.use_mlock;
+}
+
+size_t resident_bytes_locked() {
+    size_t total = 0;
+    for (const auto & entry : g_models) total += entry.resident_bytes;
+    return total;
+}
+
+size_t evict_idle_locked(size_t target_bytes) {
+    size_t freed = 0;
+    size_t resident = resident_bytes_locked();
+
+    while (resident > target_bytes) {
+        auto lru = g_models.end();
+        for (auto it = g_models.begin(); it != g_models.end(); ++it) {
+            if (it->refs > 0) continue;
+            if (lru == g_models.end() || it->last_used < lru->last_used) lru = it;
+        }
+        if (lru == g_models.end()) break;  // everything left is in use
+
+        LOGI("Evicting idle model %s (%zu bytes)", lru->path.c_str(), lru->resident_bytes);
+        context_pool_drop_model(lru->model);
+        token_pieces_drop(lru->model);
+        tokenizer_drop_model(lru->model);
+        llama_model_free(lru->model);
+        resident -= lru->resident_bytes;
+        freed += lru->resident_bytes;
+        g_evictions++;
+        g_models.erase(lru);
+    }
+    return freed;
+}
+
+/**
+ * Drop the resident pages of every mapping of the file at path with
+ * MADV_DONTNEED. The mappings stay valid and fault their pages back in from
+ * the file when touched. Returns the resident bytes dropped, read from
+ * /proc/self/smaps.
+ */
+size_t release_mapped_pages(const std::string & path) {
+    char resolved[PATH_MAX];
+    const std::string target = realpath(path.c_str(), resolved) != nullptr ? std::string(resolved) : path;
+
+    FILE * smaps = fopen("/proc/self/smaps", "r");
+    if (smaps == nullptr) return 0;
+
+    size_t freed = 0;
+    unsigned long start = 0;
+    unsigned long end = 0;
+    bool match = false;
+    char line[PATH_MAX + 128];
+    while (fgets(line, sizeof(line), smaps) != nullptr) {
+        unsigned long a = 0;
+        unsigned long b = 0;
+        int name_at = 0;
+        // Mapping header: "start-end perms offset dev inode   path"
+        if (sscanf(line, "%lx-%lx %*s %*s %*s %*s %n", &a, &b, &name_at) == 2 && name_at > 0) {
+            std::string name(line + name_at);
+            while (!name.empty() && (name.back() == '\n' || name.back() == ' ')) name.pop_back();
+            start = a;
+            end = b;
+            match = name == target;
+            continue;
+        }
+        size_t rss_kb = 0;
+        if (match && sscanf(line, "Rss: %zu kB", &rss_kb) == 1) {
+            match = false;
+            if (rss_kb == 0) continue;
+            if (madvise(reinterpret_cast<void *>(start), end - start, MADV_DONTNEED) == 0) {
+                freed += rss_kb * 1024;
+            } else {
+                LOGW("madvise failed for %s: %s", target.c_str(), strerror(errno));
+            }
+        }
+    }
+    fclose(smaps);
+    return freed;
+}
+
+} // namespace
+
+llama_model * model_registry_acquire(const std::string & path, const model_registry_params & params) {
+    std::lock_guard<std::mutex> lock(g_registry_mutex);
+
+    for (auto & entry : g_models) {
+        if (entry.path == path && same_params(entry.params, params)) {
+            entry.refs++;
+            entry.last_used = ++g_clock;
+            g_reuses++;
+            LOGI("Reusing resident model %s (refs=%d)", path.c_str(), entry.refs);
+            return entry.model;
+        }
+    }
+
+    llama_model_params model_params = llama_model_default_params();
+    model_params.n_gpu_layers = params.n_gpu_layers;
+    model_params.use_mmap = params.use_mmap;
+    model_params.use_mlock = params.use_mlock;
+
+    llama_model * model = llama_model_load_from_file(path.c_str(), model_params);
+    if (model == nullptr) {
+        LOGE("Failed to load model from: %s", path.c_str());
+        return nullptr;
+    }
+
+    registry_entry entry;
+    entry.path = path;
+    entry.params = params;
+    entry.model = model;
+    entry.resident_bytes = llama_model_size(model);
+    entry.refs = 1;
+    entry.last_used = ++g_clock;
+    g_models.push_back(entry);
+    g_loads++;
+
+    // Make room for the new model by dropping idle ones
+    if (g_budget_bytes > 0) {
+        evict_idle_locked(g_budget_bytes);
+        if (resident_bytes_locked() > g_budget_bytes) {
+            LOGW("Models in use exceed budget: %zu > %zu bytes", resident_bytes_locked(), g_budget_bytes);
+        }
+    }
+
+    LOGI("Registered model %s (%zu bytes)", path.c_str(), entry.resident_bytes);
+    return model;
+}
+
+bool model_registry_release(llama_model * model) {
+    std::lock_guard<std::mutex> lock(g_registry_mutex);
+
+    for (auto & entry : g_models) {
+        if (entry.model != model) continue;
+        if (entry.refs > 0) entry.refs--;
+        entry.last_used = ++g_clock;
+        LOGI("Released model %s (refs=%d)", entry.path.c_str(), entry.refs);
+        if (entry.refs == 0) {
+            evict_idle_locked(g_budget_bytes);
+        }
+        return true;
+    }
+    return false;
+}
+
+std::string model_registry_path(const llama_model * model) {
+    std::lock_guard<std::mutex> lock(g_registry_mutex);
+    for (const auto & entry : g_models) {
+        if (entry.model == model) return entry.path;
+    }
+    return "";
+}
+
+std::string model_registry_fingerprint(const llama_model * model) {
+    char desc[256];
+    llama_model_desc(model, desc, sizeof(desc));
+    return std::string(desc) + "|" + std::to_string(llama_model_n_params(model)) +
+           "|" + std::to_string(llama_model_size(model));
+}
+
+void model_registry_set_budget(size_t budget_bytes) {
+    std::lock_guard<std::mutex> lock(g_registry_mutex);
+    g_budget_bytes = budget_bytes;
+    evict_idle_locked(g_budget_bytes);
+}
+
+size_t model_registry_evict_idle(size_t target_bytes) {
+    std::lock_guard<std::mutex> lock(g_registry_mutex);
+    return evict_idle_locked(target_bytes);
+}
+
+size_t model_registry_release_pages() {
+    std::lock_guard<std::mutex> lock(g_registry_mutex);
+    size_t freed = 0;
+    std::vector<std::string> released;
+    for (const auto & entry : g_models) {
+        if (entry.refs > 0 || !entry.params.use_mmap || entry.params.use_mlock) continue;
+        // The same file may also be mapped by a model in use under other parameters
+        const bool in_use = std::any_of(g_models.begin(), g_models.end(), [&](const registry_entry & other) {
+            return other.path == entry.path && other.refs > 0;
+        });
+        if (in_use || std::find(released.begin(), released.end(), entry.path) != released.end()) continue;
+        released.push_back(entry.path);
+
+        const size_t bytes = release_mapped_pages(entry.path);
+        LOGI("Released %zu resident bytes of idle model %s", bytes, entry.path.c_str());
+        freed += bytes;
+    }
+    return freed;
+}
+
+size_t model_registry_resident_bytes() {
+    std::lock_guard<std::mutex> lock(g_registry_mutex);
+    return resident_bytes_locked();
+}
+
+std::string model_registry_stats_json() {
+    std::lock_guard<std::mutex> lock(g_registry_mutex);
+
+    std::string json = "{";
+    json += "\"budget_bytes\":" + std::to_string(g_budget_bytes) + ",";
+    json += "\"resident_bytes\":" + std::to_string(resident_bytes_locked()) + ",";
+    json += "\"loads\":" + std::to_string(g_loads) + ",";
+    json += "\"reuses\":" + std::to_string(g_reuses) + ",";
+    json += "\"evictions\":" + std::to_string(g_evictions) + ",";
+    json += "\"models\":[";
+    for (size_t i = 0; i < g_models.size(); i++) {
+        const auto & entry = g_models[i];
+        std::string path;
+        for (char c : entry.path) {
+            if (c == '"' || c == '\\') path += '\\';
+            path += c;
+        }
+        if (i > 0) json += ",";
+        json += "{\"path\":\"" + path + "\",";
+        json += "\"refs\":" + std::to_string(entry.refs) + ",";
+        json += "\"resident_bytes\":" + std::to_string(entry.resident_bytes) + ",";
+        json += "\"gpu_layers\":" + std::to_string(entry.params.n_gpu_layers) + "}";
+    }
+    json += "]}";
+    return json;
+}
@@ -0,0 +1,67 @@
+/**
+ * model_registry.h - Shared registry of loaded llama models
+ *
+ * Every model the app loads (chat, Whisper) goes through this registry.
+ * Loads of the same file with the same parameters return the same handle,
+ * handles are reference counted, and models whose last reference is released
+ * stay resident until the memory budget or a trim request evicts them in
+ * least-recently-used order.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "llama.h"
+
+struct model_registry_params {
+    int n_gpu_layers = 0;
+    bool use_mmap = true;
+    bool use_mlock = false;
+};
+
+/**
+ * Return a model for the file, loading it only if no matching model is
+ * resident. The returned handle holds one reference. Returns nullptr on failure.
+ */
+llama_model * model_registry_acquire(const std::string & path, const model_registry_params & params);
+
+/**
+ * Drop one reference. Idle models stay warm while the registry is within its
+ * budget. Returns false if the model was not loaded through the registry.
+ */
+bool model_registry_release(llama_model * model);
+
+// Path the model was loaded from, or an empty string for unknown handles
+std::string model_registry_path(const llama_model * model);
+
+// Identify a model by its content rather than its pointer, so cached
+// state keyed on it survives a reload of the same file
+std::string model_registry_fingerprint(const llama_model * model);
+
+/**
+ * Set the budget for resident model bytes. 0 means idle models are freed as
+ * soon as their last reference is released.
+ */
+void model_registry_set_budget(size_t budget_bytes);
+
+/**
+ * Evict idle models, least recently used first, until resident bytes are at or
+ * below target_bytes. Models still referenced are never evicted.
+ * Returns the number of bytes freed.
+ */
+size_t model_registry_evict_idle(size_t target_bytes);
+
+/**
+ * Drop the resident pages of idle memory-mapped models without unloading
+ * them (madvise MADV_DONTNEED). They are read back from the file on next
+ * use, which is far cheaper than a reload. Returns the bytes released.
+ */
+size_t model_registry_release_pages();
+
+size_t model_registry_resident_bytes();
+
+// Registry contents and accounting as a JSON object string
+std::string model_registry_stats_json();
@@ -0,0 +1,411 @@
+/**
+ * parallel_generation.cpp - Several generations decoded together in one context
+ */
+
+#include "parallel_generation.h"
+#include "context_growth.h"
+#include "generation_scheduler.h"
+#include "logging.h"
+#include "prompt_snapshot.h"
+#include "token_pieces.h"
+#include "tokenizer.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#define LOG_TAG "ParallelGen"
+
+namespace {
+
+double ms_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void add_token(llama_batch & batch, llama_token token, llama_pos pos, llama_seq_id seq, bool logits) {
+    batch.token[batch.n_tokens] = token;
+    batch.pos[batch.n_tokens] = pos;
+    batch.n_seq_id[batch.n_tokens] = 1;
+    batch.seq_id[batch.n_tokens][0] = seq;
+    batch.logits[batch.n_tokens] = logits ? 1 : 0;
+    batch.n_tokens++;
+}
+
+struct batch_holder {
+    llama_batch batch = {};
+    explicit batch_holder(int n_tokens) : batch(llama_batch_init(n_tokens, 0, 1)) {}
+    ~batch_holder() { if (batch.token != nullptr) llama_batch_free(batch); }
+};
+
+// One generation and the sequence it runs in
+struct item_state {
+    int index = 0;
+    const std::vector<llama_token> * prompt = nullptr;  // tokens after the shared prompt
+    size_t n_fed = 0;                  // prompt tokens decoded so far
+    llama_seq_id seq = 0;
+    llama_pos pos = 0;                 // next position in seq
+    size_t reserved = 0;               // cells held back for this item
+    llama_sampler * sampler = nullptr;
+    token_detokenizer detokenizer;
+    llama_token next = -1;             // sampled token waiting to be decoded
+    int logits_index = -1;             // row of this item's logits in the last batch
+    parallel_result result;
+
+    ~item_state() { if (sampler != nullptr) llama_sampler_free(sampler); }
+};
+
+/**
+ * KV state of the sequences a parked job had in use. The shared prompt is
+ * kept once, with sequence 0; the other sequences keep only the cells past
+ * it and get the prompt back by llama_memory_seq_cp, so their cells stay
+ * shared. Buffers are reused from one preemption to the next.
+ */
+struct parked_state {
+    std::vector<uint8_t> shared;                 // sequence 0, shared prompt included
+    std::vector<std::vector<uint8_t>> own;       // sequences 1.., cells past the shared prompt
+};
+
+bool save_seq(llama_context * ctx, llama_seq_id seq, std::vector<uint8_t> & out) {
+    out.resize(llama_state_seq_get_size(ctx, seq));
+    return llama_state_seq_get_data(ctx, out.data(), out.size(), seq) == out.size();
+}
+
+bool load_seq(llama_context * ctx, llama_seq_id seq, const std::vector<uint8_t> & in) {
+    return llama_state_seq_set_data(ctx, in.data(), in.size(), seq) == in.size();
+}
+
+/**
+ * Save sequences 0 to n_seq - 1, which share their first n_shared positions
+ * with sequence 0, hand the context to the waiting interactive requests and
+ * restore the sequences once they are done. Only the KV cells are kept, not
+ * the logits of the last batch: the job samples them before it parks.
+ * Interactive requests start from an empty cache, so every sequence in use
+ * is saved. They may also grow, shrink or clear gc's context meanwhile, so
+ * ctx is looked up again, at least as large as before, for the restore.
+ * Returns false if the state could not be kept.
+ */
+bool park(llama_context *& ctx, growing_context * gc, int n_seq, llama_pos n_shared, parked_state & saved,
+          parallel_stats & st) {
+    TRACE_SCOPE("parallel_park");
+    const auto start = std::chrono::steady_clock::now();
+    llama_memory_t mem = llama_get_memory(ctx);
+    saved.own.resize(std::max(0, n_seq - 1));
+    bool ok = save_seq(ctx, 0, saved.shared) && !saved.shared.empty();
+    size_t n_bytes = saved.shared.size();
+    for (llama_seq_id seq = 1; ok && seq < n_seq; seq++) {
+        std::vector<uint8_t> & own = saved.own[seq - 1];
+        // Drop the shared prompt from the sequence so it is not saved once per sequence
+        llama_memory_seq_rm(mem, seq, 0, n_shared);
+        if (llama_memory_seq_pos_max(mem, seq) < 0) {
+            own.clear();
+            continue;
+        }
+        ok = save_seq(ctx, seq, own);
+        n_bytes += own.size();
+    }
+    if (!ok) {
+        LOGE("Failed to save context state for preemption");
+        return false;
+    }
+    // The interactive request starts from an empty cache
+    llama_memory_clear(mem, true);
+    generation_invalidate_kv(ctx);
+    const int n_cells = (int) llama_n_ctx(ctx);
+    generation_scheduler_yield();
+
+    if (gc != nullptr) {
+        ctx = growing_context_reserve(gc, n_cells);
+        mem = llama_get_memory(ctx);
+    }
+    llama_memory_clear(mem, true);
+    generation_invalidate_kv(ctx);
+    // Setting a sequence replaces it, so the own cells go in before the shared prompt is copied back
+    bool restored = true;
+    for (llama_seq_id seq = 1; restored && seq < n_seq; seq++) {
+        if (!saved.own[seq - 1].empty()) restored = load_seq(ctx, seq, saved.own[seq - 1]);
+    }
+    restored = restored && load_seq(ctx, 0, saved.shared);
+    for (llama_seq_id seq = 1; restored && seq < n_seq; seq++) llama_memory_seq_cp(mem, 0, seq, 0, n_shared);
+    st.n_preemptions++;
+    st.parked_ms += ms_since(start);
+    if (!restored) LOGE("Failed to restore context state after preemption");
+    LOGD("Parked for %.0f ms, %zu bytes of state in %d sequences", ms_since(start), n_bytes, n_seq);
+    return restored;
+}
+
+/**
+ * Prefill prefix into sequence 0, copy it to the other sequences and run
+ * every item as its own sequence: its prompt tokens, then generation. Items
+ * beyond the number of sequences, or whose prompt and max_tokens would not
+ * fit in the cells left, wait for a running one to finish.
+ */
+bool run_items(llama_context * ctx, growing_context * gc, const llama_model * model,
+               const std::vector<llama_token> & prefix,
+               const std::vector<std::vector<llama_token>> & items, const generation_params & params,
+               const std::function<void(int index, const std::string & piece)> & on_piece,
+               const std::function<void(int index, const parallel_result & result)> & on_done,
+               std::string & error, parallel_stats & st) {
+    const auto start = std::chrono::steady_clock::now();
+    st = parallel_stats();
+    st.n_prompt = (int) prefix.size();
+    st.n_items = (int) items.size();
+    if (items.empty()) return true;
+
+    const llama_vocab * vocab = llama_model_get_vocab(model);
+    const std::shared_ptr<const token_piece_table> pieces = token_pieces_for(model);
+    llama_memory_t mem = llama_get_memory(ctx);
+    if (vocab == nullptr || pieces == nullptr || mem == nullptr) {
+        error = "Failed to get vocabulary";
+        return false;
+    }
+
+    const size_t n_ctx = llama_n_ctx(ctx);
+    const int n_batch = std::max<int>(1, llama_n_batch(ctx));
+    const int n_seq = std::min({parallel_generation_max_sequences(ctx), (int) items.size(), n_batch});
+    if (prefix.size() + 1 >= n_ctx) {
+        error = "Prompt too long for context";
+        return false;
+    }
+
+    batch_holder holder(n_batch);
+    llama_batch & batch = holder.batch;
+    if (batch.token == nullptr) {
+        error = "Failed to allocate batch";
+        return false;
+    }
+
+    parked_state saved;
+
+    // Shared prompt into sequence 0, starting from a snapshot when one matches
+    llama_memory_clear(mem, true);
+    generation_invalidate_kv(ctx);
+    const auto prefill_start = std::chrono::steady_clock::now();
+    st.n_restored = prefix.empty() ? 0 : prompt_snapshot_restore(ctx, model, prefix.data(), (int) prefix.size());
+    {
+        TRACE_SCOPE("parallel_prefill");
+        for (size_t i = st.n_restored; i < prefix.size(); i += n_batch) {
+            const size_t n_eval = std::min<size_t>(n_batch, prefix.size() - i);
+            batch.n_tokens = 0;
+            for (size_t j = 0; j < n_eval; j++) add_token(batch, prefix[i + j], (llama_pos) (i + j), 0, false);
+            if (llama_decode(ctx, batch) != 0) {
+                llama_memory_clear(mem, true);
+                error = "Failed to process prompt";
+                return false;
+            }
+            // A long shared prompt must not hold off an interactive request until it is done
+            if (i + n_eval < prefix.size() && params.preemptible && generation_scheduler_should_yield()) {
+                const bool kept = park(ctx, gc, 1, 0, saved, st);
+                mem = llama_get_memory(ctx);
+                if (!kept) {
+                    llama_memory_clear(mem, true);
+                    error = "Failed to keep state while preempted";
+                    return false;
+                }
+            }
+        }
+    }
+    for (llama_seq_id seq = 1; seq < n_seq; seq++) llama_memory_seq_cp(mem, 0, seq, -1, -1);
+    st.prefill_ms = ms_since(prefill_start);
+
+    const size_t max_tokens = (size_t) std::max(0, params.max_tokens);
+    std::vector<std::unique_ptr<item_state>> slots(n_seq);
+    size_t next_item = 0;
+    size_t reserved = prefix.size();
+    int n_active = 0;
+    bool first_token = true;
+
+    auto finish = [&](int slot, bool completed) {
+        item_state & item = *slots[slot];
+        item.result.completed = completed;
+        on_done(item.index, item.result);
+        // Back to the shared prompt, ready for the next item
+        llama_memory_seq_rm(mem, item.seq, (llama_pos) prefix.size(), -1);
+        reserved -= item.reserved;
+        slots[slot].reset();
+        n_active--;
+    };
+
+    auto admit = [&]() {
+        for (int slot = 0; slot < n_seq && next_item < items.size(); slot++) {
+            if (slots[slot]) continue;
+            const std::vector<llama_token> & prompt = items[next_item];
+            const size_t need = std::min(prompt.size() + max_tokens, n_ctx - prefix.size());
+            if (n_active > 0 && reserved + need > n_ctx) return;
+
+            std::unique_ptr<item_state> item(new item_state());
+            item->index = (int) next_item++;
+            item->prompt = &prompt;
+            item->seq = slot;
+            item->pos = (llama_pos) prefix.size();
+            item->reserved = need;
+            generation_params item_params = params;
+            item_params.seed = params.seed + (uint32_t) item->index;
+            item->sampler = generation_make_sampler(item_params);
+            item->detokenizer.reset(pieces.get(), true);
+            slots[slot] = std::move(item);
+            reserved += need;
+            n_active++;
+            if (prompt.empty() || slots[slot]->sampler == nullptr) finish(slot, false);
+        }
+    };
+
+    TRACE_SCOPE("parallel_generate");
+    admit();
+    while (n_active > 0) {
+        if (params.cancel != nullptr && params.cancel->load()) {
+            LOGI("Parallel generation cancelled");
+            for (int slot = 0; slot < n_seq; slot++) {
+                if (slots[slot]) finish(slot, false);
+            }
+            break;
+        }
+        if (params.preemptible && generation_scheduler_should_yield()) {
+            const bool kept = park(ctx, gc, n_seq, (llama_pos) prefix.size(), saved, st);
+            // The context may have been replaced while parked
+            mem = llama_get_memory(ctx);
+            if (!kept) {
+                llama_memory_clear(mem, true);
+                for (int slot = 0; slot < n_seq; slot++) {
+                    if (slots[slot]) finish(slot, false);
+                }
+                break;
+            }
+        }
+
+        // One token per generating sequence, then prompt tokens of new items in what is left
+        batch.n_tokens = 0;
+        for (auto & item : slots) {
+            if (!item || item->next < 0) continue;
+            item->logits_index = batch.n_tokens;
+            add_token(batch, item->next, item->pos++, item->seq, true);
+        }
+        for (auto & item : slots) {
+            if (!item || item->n_fed == item->prompt->size()) continue;
+            while (batch.n_tokens < n_batch && item->n_fed < item->prompt->size()) {
+                const bool last = ++item->n_fed == item->prompt->size();
+                if (last) item->logits_index = batch.n_tokens;
+                add_token(batch, (*item->prompt)[item->n_fed - 1], item->pos++, item->seq, last);
+            }
+        }
+        st.max_parallel = std::max(st.max_parallel, n_active);
+
+        int ret = 0;
+        {
+            TRACE_SCOPE("parallel_decode");
+            ret = llama_decode(ctx, batch);
+        }
+        st.n_steps++;
+        if (ret != 0) {
+            LOGE("llama_decode failed with %d sequences running, error: %d", n_active, ret);
+            for (int slot = 0; slot < n_seq; slot++) {
+                if (slots[slot]) finish(slot, false);
+            }
+            break;
+        }
+
+        for (int slot = 0; slot < n_seq; slot++) {
+            item_state * item = slots[slot].get();
+            if (item == nullptr || item->logits_index < 0) continue;
+            const llama_token token = llama_sampler_sample(item->sampler, ctx, item->logits_index);
+            item->logits_index = -1;
+            item->next = -1;
+
+            if (!params.ignore_eog && llama_vocab_is_eog(vocab, token)) {
+                finish(slot, true);
+                continue;
+            }
+            if (first_token) {
+                st.ttft_ms = ms_since(start);
+                first_token = false;
+            }
+            item->result.n_generated++;
+            st.n_generated++;
+
+            std::string piece;
+            item->detokenizer.push(token);
+            if (item->detokenizer.take(piece)) {
+                item->result.text += piece;
+                on_piece(item->index, piece);
+            }
+
+            if ((size_t) item->result.n_generated >= max_tokens) {
+                finish(slot, true);
+            } else if ((size_t) item->pos >= n_ctx - 1) {
+                finish(slot, false);
+            } else {
+                item->next = token;
+            }
+        }
+        admit();
+    }
+
+    st.total_ms = ms_since(start);
+    LOGI("Parallel generation: %d items, %d shared prompt tokens, %d tokens in %d steps "
+         "(up to %d sequences) in %.0f ms, parked %d times for %.0f ms",
+         st.n_items, st.n_prompt, st.n_generated, st.n_steps, st.max_parallel, st.total_ms,
+         st.n_preemptions, st.parked_ms);
+    return true;
+}
+
+} // namespace
+
+int parallel_generation_max_sequences(const llama_context * ctx) {
+    return ctx != nullptr ? (int) llama_n_seq_max(ctx) : 0;
+}
+
+bool parallel_generation_run(growing_context * gc, const llama_model * model, const std::string & prefix,
+                             const std::vector<std::string> & suffixes, const generation_params & params,
+                             const std::function<void(int index, const std::string & piece)> & on_piece,
+                             const std::function<void(int index, const parallel_result & result)> & on_done,
+                             std::string & error, parallel_stats * stats) {
+    TRACE_SCOPE("parallel_generation_run");
+    parallel_stats local_stats;
+    parallel_stats & st = stats != nullptr ? *stats : local_stats;
+
+    tokenizer_flags flags;
+    std::vector<llama_token> prefix_tokens;
+    if (!tokenizer_tokenize(model, prefix.data(), prefix.size(), flags, prefix_tokens)) {
+        error = "Failed to tokenize prompt";
+        return false;
+    }
+    // BOS and friends belong to the start of the sequence only
+    flags.add_special = prefix_tokens.empty();
+    std::vector<std::vector<llama_token>> items(suffixes.size());
+    for (size_t i = 0; i < suffixes.size(); i++) {
+        if (!tokenizer_tokenize(model, suffixes[i].data(), suffixes[i].size(), flags, items[i])) {
+            error = "Failed to tokenize prompt";
+            return false;
+        }
+    }
+    return run_items(growing_context_get(gc), gc, model, prefix_tokens, items, params, on_piece, on_done, error, st);
+}
+
+bool parallel_generation_completions(llama_context * ctx, const llama_model * model, const std::string & prompt,
+                                     int n, const generation_params & params,
+                                     const std::function<void(int index, const std::string & piece)> & on_piece,
+                                     const std::function<void(int index, const parallel_result & result)> & on_done,
+                                     std::string & error, parallel_stats * stats) {
+    TRACE_SCOPE("parallel_generation_completions");
+    parallel_stats local_stats;
+    parallel_stats & st = stats != nullptr ? *stats : local_stats;
+    if (n <= 0) {
+        error = "Nothing to generate";
+        return false;
+    }
+
+    tokenizer_flags flags;
+    std::vector<llama_token> prefix;
+    if (!tokenizer_tokenize(model, prompt.data(), prompt.size(), flags, prefix) || prefix.empty()) {
+        error = "Failed to tokenize prompt";
+        return false;
+    }
+
+    // Every completion decodes the last prompt token itself, so all of them
+    // get their logits from the same step and the rest of the prompt is shared
+    std::vector<std::vector<llama_token>> items(n, std::vector<llama_token>(1, prefix.back()));
+    prefix.pop_back();
+    return run_items(ctx, nullptr, model, prefix, items, params, on_piece, on_done, error, st);
+}
@@ -0,0 +1,84 @@
+/**
+ * parallel_generation.h - Several generations decoded together in one context
+ *
+ * A shared prompt is prefilled once into sequence 0 and its cells are shared
+ * with the other sequences of the context through llama_memory_seq_cp. Every
+ * step then puts one token per running sequence, plus prompt tokens of items
+ * just started, into a single llama_decode, each sequence sampling with its
+ * own sampler chain. Decode is bound by memory bandwidth, so N sequences cost
+ * little more than one.
+ *
+ * The context must have been created with more than one sequence
+ * (generation_context_params); its KV cache is cleared first, as by
+ * generation_run.
+ *
+ * With params.preemptible set, the run checks generation_scheduler between
+ * steps and between batches of the shared prompt. When an interactive
+ * request is waiting, the KV cells of the sequences in use are saved to
+ * memory (the shared prompt once), the context handed over, and the cells
+ * restored afterwards, so every sequence continues where it stopped. The
+ * interactive requests may grow or clear the context meanwhile: the run
+ * looks its context up again in the growing_context when it resumes.
+ */
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "context_growth.h"
+#include "generation.h"
+#include "llama.h"
+
+struct parallel_result {
+    std::string text;
+    int n_generated = 0;
+    bool completed = false;           // false when cancelled, cut off by the context or a decode failed
+};
+
+struct parallel_stats {
+    int n_prompt = 0;                 // prompt tokens shared by all sequences
+    int n_restored = 0;               // of which restored from a prompt snapshot
+    int n_items = 0;
+    int max_parallel = 0;             // most sequences decoded in one step
+    int n_steps = 0;                  // llama_decode calls after the shared prompt
+    int n_generated = 0;              // over all sequences
+    double prefill_ms = 0;
+    double ttft_ms = 0;               // to the first token of any sequence
+    double total_ms = 0;
+    int n_preemptions = 0;            // times parked for interactive requests
+    double parked_ms = 0;             // included in total_ms
+};
+
+/**
+ * Generate one completion for each of prefix + suffixes[i]. The prefix is
+ * prefilled once; the suffixes are decoded as separate sequences, up to the
+ * context's sequence count at a time, and the next suffix starts as soon as
+ * one finishes. Tokenizing the parts separately can split a word across the
+ * boundary differently from the joined text, so end the prefix at a newline.
+ * Item i samples with seed params.seed + i. on_piece and on_done are called
+ * with the item index as tokens arrive and as each item finishes.
+ * Runs in gc's current context, which the caller has sized for the job.
+ * Returns false with a message in error if the prefix could not be processed.
+ */
+bool parallel_generation_run(growing_context * gc, const llama_model * model, const std::string & prefix,
+                             const std::vector<std::string> & suffixes, const generation_params & params,
+                             const std::function<void(int index, const std::string & piece)> & on_piece,
+                             const std::function<void(int index, const parallel_result & result)> & on_done,
+                             std::string & error, parallel_stats * stats = nullptr);
+
+/**
+ * Generate n completions of prompt at once. Completion i samples with seed
+ * params.seed + i. on_piece receives (index, text piece) as tokens arrive,
+ * on_done (index, result) as each completion finishes.
+ * Returns false with a message in error if the prompt could not be processed.
+ */
+bool parallel_generation_completions(llama_context * ctx, const llama_model * model, const std::string & prompt,
+                                     int n, const generation_params & params,
+                                     const std::function<void(int index, const std::string & piece)> & on_piece,
+                                     const std::function<void(int index, const parallel_result & result)> & on_done,
+                                     std::string & error, parallel_stats * stats = nullptr);
+
+// Most sequences ctx can decode together
+int parallel_generation_max_sequences(const llama_context * ctx);
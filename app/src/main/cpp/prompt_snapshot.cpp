@@ -0,0 +1,308 @@
+/**
+ * prompt_snapshot.cpp - Persisted KV state of fixed prompt preambles
+ */
+
+#include "prompt_snapshot.h"
+#include "generation.h"
+#include "logging.h"
+#include "model_registry.h"
+#include "tokenizer.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#define LOG_TAG "PromptSnapshot"
+
+namespace {
+
+constexpr const char * SNAPSHOT_SUFFIX = ".kvs";
+
+struct snapshot_entry {
+    std::string model_id;
+    std::string name;
+    std::vector<llama_token> tokens;
+    std::string path;
+};
+
+std::mutex g_snapshot_mutex;
+std::string g_dir;
+std::vector<snapshot_entry> g_entries;
+
+uint64_t g_computed = 0;          // snapshots prefilled and written by prepare
+uint64_t g_found = 0;             // snapshots prepare found already on disk
+uint64_t g_restores = 0;
+uint64_t g_restore_failures = 0;
+uint64_t g_tokens_restored = 0;
+double g_restore_ms = 0;
+
+uint64_t fnv1a(uint64_t hash, const void * data, size_t size) {
+    const unsigned char * bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+std::string hex(uint64_t value) {
+    char buf[17];
+    snprintf(buf, sizeof(buf), "%016llx", (unsigned long long) value);
+    return buf;
+}
+
+// Names become part of a file name: keep [A-Za-z0-9_-]
+std::string sanitize(const std::string & name) {
+    std::string out;
+    for (char c : name) {
+        const bool ok = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '-';
+        out += ok ? c : '_';
+    }
+    return out.empty() ? "_" : out;
+}
+
+bool file_exists(const std::string & path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+}
+
+// <model>-<name>-<tokens>.kvs; the model and token hashes make stale files unreachable
+std::string file_prefix(const std::string & model_id, const std::string & name) {
+    return hex(fnv1a(14695981039346656037ULL, model_id.data(), model_id.size())) + "-" + sanitize(name) + "-";
+}
+
+// Delete files of model_id/name other than keep
+void delete_stale_locked(const std::string & prefix, const std::string & keep) {
+    DIR * dir = opendir(g_dir.c_str());
+    if (dir == nullptr) return;
+    while (dirent * entry = readdir(dir)) {
+        const std::string file = entry->d_name;
+        if (file.compare(0, prefix.size(), prefix) != 0) continue;
+        const std::string path = g_dir + "/" + file;
+        if (path != keep) {
+            LOGD("Deleting stale snapshot %s", file.c_str());
+            remove(path.c_str());
+        }
+    }
+    closedir(dir);
+}
+
+void register_locked(snapshot_entry entry) {
+    for (auto & existing : g_entries) {
+        if (existing.model_id == entry.model_id && existing.name == entry.name) {
+            existing = std::move(entry);
+            return;
+        }
+    }
+    g_entries.push_back(std::move(entry));
+}
+
+void forget_locked(const std::string & path) {
+    g_entries.erase(std::remove_if(g_entries.begin(), g_entries.end(),
+                                   [&](const snapshot_entry & e) { return e.path == path; }),
+                    g_entries.end());
+}
+
+size_t common_prefix(const std::vector<llama_token> & a, const llama_token * b, size_t n_b) {
+    const size_t n = std::min(a.size(), n_b);
+    size_t i = 0;
+    while (i < n && a[i] == b[i]) i++;
+    return i;
+}
+
+// Snapshot of model sharing the longest token prefix with tokens, and the length of that prefix
+size_t best_snapshot(const llama_model * model, const llama_token * tokens, int n_tokens, snapshot_entry & best) {
+    size_t best_match = 0;
+    std::lock_guard<std::mutex> lock(g_snapshot_mutex);
+    if (g_entries.empty()) return 0;
+    const std::string model_id = model_registry_fingerprint(model);
+    for (const auto & entry : g_entries) {
+        if (entry.model_id != model_id) continue;
+        const size_t match = common_prefix(entry.tokens, tokens, n_tokens);
+        if (match > best_match) {
+            best_match = match;
+            best = entry;
+        }
+    }
+    return best_match;
+}
+
+} // namespace
+
+void prompt_snapshot_set_dir(const std::string & dir) {
+    std::lock_guard<std::mutex> lock(g_snapshot_mutex);
+    if (dir == g_dir) return;
+    g_dir = dir;
+    g_entries.clear();
+    if (!dir.empty()) mkdir(dir.c_str(), 0700);
+}
+
+bool prompt_snapshot_prepare(llama_context * ctx, const llama_model * model, const std::string & name,
+                             const std::string & text, std::string & error) {
+    TRACE_SCOPE("prompt_snapshot_prepare");
+    tokenizer_flags flags;
+    std::vector<llama_token> tokens;
+    if (!tokenizer_tokenize(model, text.data(), text.size(), flags, tokens)) {
+        error = "Failed to tokenize preamble";
+        return false;
+    }
+    if (tokens.size() < PROMPT_SNAPSHOT_MIN_TOKENS) {
+        LOGD("Preamble '%s' is only %zu tokens, not snapshotting", name.c_str(), tokens.size());
+        return true;
+    }
+    if (tokens.size() >= llama_n_ctx(ctx)) {
+        error = "Preamble too long for context";
+        return false;
+    }
+
+    const std::string model_id = model_registry_fingerprint(model);
+    const std::string prefix = file_prefix(model_id, name);
+    std::string path;
+    {
+        std::lock_guard<std::mutex> lock(g_snapshot_mutex);
+        if (g_dir.empty()) {
+            error = "Snapshot directory not set";
+            return false;
+        }
+        path = g_dir + "/" + prefix + hex(fnv1a(14695981039346656037ULL, tokens.data(),
+                                                 tokens.size() * sizeof(llama_token))) + SNAPSHOT_SUFFIX;
+        for (const auto & entry : g_entries) {
+            if (entry.path == path) return true;
+        }
+        if (file_exists(path)) {
+            delete_stale_locked(prefix, path);
+            register_locked({model_id, name, tokens, path});
+            g_found++;
+            return true;
+        }
+    }
+
+    // Prefill the preamble on its own and save sequence 0
+    const auto start = std::chrono::steady_clock::now();
+    llama_memory_t mem = llama_get_memory(ctx);
+    if (mem != nullptr) llama_memory_clear(mem, true);
+    generation_invalidate_kv(ctx);
+
+    const int n_batch = std::max<int>(1, llama_n_batch(ctx));
+    for (size_t i = 0; i < tokens.size(); i += n_batch) {
+        const int n_eval = (int) std::min<size_t>(n_batch, tokens.size() - i);
+        if (llama_decode(ctx, llama_batch_get_one(tokens.data() + i, n_eval)) != 0) {
+            if (mem != nullptr) llama_memory_clear(mem, true);
+            error = "Failed to process preamble";
+            return false;
+        }
+    }
+
+    const std::string tmp_path = path + ".tmp";
+    const size_t written = llama_state_seq_save_file(ctx, tmp_path.c_str(), 0, tokens.data(), tokens.size());
+    if (mem != nullptr) llama_memory_clear(mem, true);
+    if (written == 0 || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        remove(tmp_path.c_str());
+        error = "Failed to write snapshot";
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(g_snapshot_mutex);
+    delete_stale_locked(prefix, path);
+    register_locked({model_id, name, std::move(tokens), path});
+    g_computed++;
+    LOGI("Saved snapshot '%s': %zu bytes in %.0f ms", name.c_str(), written,
+         std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    return true;
+}
+
+int prompt_snapshot_match(const llama_model * model, const llama_token * tokens, int n_tokens) {
+    if (n_tokens <= PROMPT_SNAPSHOT_MIN_TOKENS) return 0;
+    snapshot_entry best;
+    const size_t best_match = best_snapshot(model, tokens, n_tokens, best);
+    if (best_match < PROMPT_SNAPSHOT_MIN_TOKENS) return 0;
+    return (int) std::min(best_match, (size_t) n_tokens - 1);
+}
+
+int prompt_snapshot_restore(llama_context * ctx, const llama_model * model,
+                            const llama_token * tokens, int n_tokens) {
+    if (n_tokens <= PROMPT_SNAPSHOT_MIN_TOKENS) return 0;
+
+    snapshot_entry best;
+    const size_t best_match = best_snapshot(model, tokens, n_tokens, best);
+    if (best_match < PROMPT_SNAPSHOT_MIN_TOKENS) return 0;
+
+    TRACE_SCOPE("prompt_snapshot_restore");
+    const auto start = std::chrono::steady_clock::now();
+    llama_memory_t mem = llama_get_memory(ctx);
+    std::vector<llama_token> file_tokens(best.tokens.size());
+    size_t n_read = 0;
+    const size_t read = llama_state_seq_load_file(ctx, best.path.c_str(), 0, file_tokens.data(),
+                                                  file_tokens.size(), &n_read);
+    file_tokens.resize(n_read);
+    if (read == 0 || file_tokens != best.tokens) {
+        // Unreadable, written for another KV layout, or tampered with: rebuild on the next prepare
+        LOGW("Snapshot '%s' could not be restored, discarding it", best.name.c_str());
+        if (mem != nullptr) llama_memory_clear(mem, true);
+        std::lock_guard<std::mutex> lock(g_snapshot_mutex);
+        forget_locked(best.path);
+        remove(best.path.c_str());
+        g_restore_failures++;
+        return 0;
+    }
+
+    // Keep only the shared prefix, and leave at least one prompt token to decode
+    const size_t n_keep = std::min(best_match, (size_t) n_tokens - 1);
+    if (n_keep < best.tokens.size() && mem != nullptr && !llama_memory_seq_rm(mem, 0, (llama_pos) n_keep, -1)) {
+        llama_memory_clear(mem, true);
+        std::lock_guard<std::mutex> lock(g_snapshot_mutex);
+        g_restore_failures++;
+        return 0;
+    }
+
+    const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::lock_guard<std::mutex> lock(g_snapshot_mutex);
+    g_restores++;
+    g_tokens_restored += n_keep;
+    g_restore_ms += ms;
+    LOGI("Restored snapshot '%s': %zu of %d prompt tokens in %.1f ms", best.name.c_str(), n_keep, n_tokens, ms);
+    return (int) n_keep;
+}
+
+int prompt_snapshot_clear() {
+    std::lock_guard<std::mutex> lock(g_snapshot_mutex);
+    g_entries.clear();
+    int deleted = 0;
+    DIR * dir = g_dir.empty() ? nullptr : opendir(g_dir.c_str());
+    if (dir == nullptr) return 0;
+    const std::string suffix = SNAPSHOT_SUFFIX;
+    while (dirent * entry = readdir(dir)) {
+        const std::string file = entry->d_name;
+        if (file.size() <= suffix.size() || file.compare(file.size() - suffix.size(), suffix.size(), suffix) != 0) continue;
+        if (remove((g_dir + "/" + file).c_str()) == 0) deleted++;
+    }
+    closedir(dir);
+    return deleted;
+}
+
+std::string prompt_snapshot_stats_json() {
+    std::lock_guard<std::mutex> lock(g_snapshot_mutex);
+    std::string json = "{";
+    json += "\"snapshots\":[";
+    for (size_t i = 0; i < g_entries.size(); i++) {
+        if (i > 0) json += ",";
+        json += "{\"name\":\"" + sanitize(g_entries[i].name) + "\",";
+        json += "\"tokens\":" + std::to_string(g_entries[i].tokens.size()) + "}";
+    }
+    json += "],";
+    json += "\"computed\":" + std::to_string(g_computed) + ",";
+    json += "\"found_on_disk\":" + std::to_string(g_found) + ",";
+    json += "\"restores\":" + std::to_string(g_restores) + ",";
+    json += "\"restore_failures\":" + std::to_string(g_restore_failures) + ",";
+    json += "\"tokens_restored\":" + std::to_string(g_tokens_restored) + ",";
+    json += "\"avg_restore_ms\":" + std::to_string(g_restores > 0 ? g_restore_ms / g_restores : 0.0);
+    json += "}";
+    return json;
+}
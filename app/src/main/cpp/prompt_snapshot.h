@@ -0,0 +1,58 @@
+/**
+ * prompt_snapshot.h - Persisted KV state of fixed prompt preambles
+ *
+ * Features such as Quiz, Flashcards and Code Companion start every request
+ * with the same long system prompt. A snapshot is the KV state of such a
+ * preamble, computed once per model and written to app storage with
+ * llama_state_seq_save_file. A generation whose prompt tokens start with a
+ * snapshot's tokens reads that state back into sequence 0 instead of
+ * prefilling it, so only the rest of the prompt is decoded.
+ *
+ * Snapshots are matched by tokens, not text: the longest common token
+ * prefix with any snapshot of the model is restored and the cache trimmed
+ * to it, so a preamble whose last tokens merge differently with the text
+ * after it still saves everything before the merge.
+ */
+
+#pragma once
+
+#include <string>
+
+#include "llama.h"
+
+// Preambles shorter than this are cheaper to prefill than to load
+#define PROMPT_SNAPSHOT_MIN_TOKENS 32
+
+// Directory for snapshot files, e.g. <files dir>/kv_snapshots; snapshots are disabled until set
+void prompt_snapshot_set_dir(const std::string & dir);
+
+/**
+ * Make sure a snapshot of text exists for model under name, computing it in
+ * ctx if needed (this clears ctx's KV cache). A snapshot previously stored
+ * for the same name with different text is replaced. Preambles shorter than
+ * PROMPT_SNAPSHOT_MIN_TOKENS are skipped and count as success.
+ */
+bool prompt_snapshot_prepare(llama_context * ctx, const llama_model * model, const std::string & name,
+                             const std::string & text, std::string & error);
+
+/**
+ * Restore the snapshot sharing the longest token prefix with tokens into
+ * sequence 0 of ctx, whose memory must be empty. At most n_tokens - 1
+ * positions are restored so the caller always decodes at least one token.
+ * Returns the number of positions now in the cache, 0 if nothing matched.
+ */
+int prompt_snapshot_restore(llama_context * ctx, const llama_model * model,
+                            const llama_token * tokens, int n_tokens);
+
+/**
+ * Number of positions prompt_snapshot_restore would restore for tokens,
+ * without touching any context. Used to plan a request before its cache is
+ * cleared.
+ */
+int prompt_snapshot_match(const llama_model * model, const llama_token * tokens, int n_tokens);
+
+// Delete every snapshot file and forget all snapshots. Returns the number of files deleted.
+int prompt_snapshot_clear();
+
+// Registered snapshots and restore statistics as a JSON object string
+std::string prompt_snapshot_stats_json();
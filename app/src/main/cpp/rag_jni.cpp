@@ -0,0 +1,67 @@
+/**
+ * rag_jni.cpp - JNI bridge for native RAG indexing helpers
+ */
+
+#include <jni.h>
+#include <string>
+#include <vector>
+
+#include "chunk_dedup.h"
+#include "logging.h"
+
+#define LOG_TAG "RagJNI"
+
+// Helper to convert jstring to std::string
+static std::string jstring_to_string(JNIEnv *env, jstring jstr) {
+    if (jstr == nullptr) return "";
+    const char *chars = env->GetStringUTFChars(jstr, nullptr);
+    std::string result(chars);
+    env->ReleaseStringUTFChars(jstr, chars);
+    return result;
+}
+
+extern "C" {
+
+// Map each chunk to the index of its near-duplicate representative
+JNIEXPORT jintArray JNICALL
+Java_com_localllm_app_rag_ChunkDeduplicator_findRepresentativesNative(
+        JNIEnv *env,
+        jobject thiz,
+        jobjectArray texts,
+        jfloat similarity_threshold) {
+
+    if (texts == nullptr) return nullptr;
+
+    try {
+        jsize n_texts = env->GetArrayLength(texts);
+        std::vector<std::string> chunks;
+        chunks.reserve(n_texts);
+
+        for (jsize i = 0; i < n_texts; i++) {
+            jstring jtext = (jstring) env->GetObjectArrayElement(texts, i);
+            chunks.push_back(jstring_to_string(env, jtext));
+            env->DeleteLocalRef(jtext);
+        }
+
+        std::vector<int> reps = chunk_dedup_representatives(chunks, similarity_threshold);
+
+        int n_kept = 0;
+        for (int i = 0; i < (int) reps.size(); i++) {
+            if (reps[i] == i) n_kept++;
+        }
+        LOGI("Chunk dedup: %d chunks -> %d representatives (threshold %.2f)",
+             (int) n_texts, n_kept, similarity_threshold);
+
+        jintArray result = env->NewIntArray(n_texts);
+        env->SetIntArrayRegion(result, 0, n_texts, reinterpret_cast<const jint *>(reps.data()));
+        return result;
+    } catch (const std::exception& e) {
+        LOGE("Exception during chunk dedup: %s", e.what());
+        return nullptr;
+    } catch (...) {
+        LOGE("Unknown exception during chunk dedup");
+        return nullptr;
+    }
+}
+
+} // extern "C"
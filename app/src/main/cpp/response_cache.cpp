@@ -0,0 +1,301 @@
+/**
+ * response_cache.cpp - Semantic response cache for repeated prompts
+ *
+ * Queries are embedded with feature hashing over word unigrams, word bigrams
+ * and character trigrams. That is cheap enough to run on every request and
+ * is good at spotting a reworded or re-cased topic. Only the query is
+ * embedded: the fixed prompt around it is compared by hash, so a changed
+ * count or difficulty misses.
+ */
+
+#include "response_cache.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <mutex>
+
+namespace {
+
+struct cache_entry {
+    std::string partition;
+    std::string normalized;
+    uint64_t prompt_hash = 0;
+    uint64_t template_hash = 0;  // prompt without the query, 0 when there is none
+    float embedding[RESPONSE_CACHE_EMBD_DIM];  // of the query
+    std::vector<std::string> pieces;
+    int stop_reason = 0;
+    uint64_t last_used = 0;
+};
+
+struct cache_stats {
+    uint64_t lookups = 0;
+    uint64_t exact_hits = 0;
+    uint64_t semantic_hits = 0;
+    uint64_t misses = 0;
+    uint64_t insertions = 0;
+    uint64_t evictions = 0;
+};
+
+std::mutex g_cache_mutex;
+std::vector<cache_entry> g_entries;
+cache_stats g_stats;
+uint64_t g_clock = 0;
+bool g_enabled = true;
+float g_threshold = 0.97f;
+size_t g_capacity = 128;
+
+uint64_t fnv1a(const char * data, size_t len, uint64_t seed = 1469598103934665603ULL) {
+    uint64_t h = seed;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (uint8_t) data[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// Collapse whitespace runs and trim, keeping case so code prompts stay distinct
+std::string normalize_prompt(const std::string & prompt) {
+    std::string out;
+    out.reserve(prompt.size());
+    bool pending_space = false;
+    for (char c : prompt) {
+        if (std::isspace((unsigned char) c)) {
+            pending_space = !out.empty();
+            continue;
+        }
+        if (pending_space) {
+            out += ' ';
+            pending_space = false;
+        }
+        out += c;
+    }
+    return out;
+}
+
+// Hash of the prompt with every occurrence of the query cut out
+uint64_t template_hash_of(const std::string & normalized, const std::string & query) {
+    if (query.empty()) return 0;
+    std::string rest;
+    rest.reserve(normalized.size());
+    size_t pos = 0;
+    for (size_t found; (found = normalized.find(query, pos)) != std::string::npos; pos = found + query.size()) {
+        rest.append(normalized, pos, found - pos);
+        rest += '\x1f';
+    }
+    if (pos == 0) return 0;  // the query is not part of the prompt
+    rest.append(normalized, pos, std::string::npos);
+    return fnv1a(rest.data(), rest.size()) | 1;
+}
+
+void add_feature(float * embd, uint64_t h, float weight) {
+    const size_t bucket = h % RESPONSE_CACHE_EMBD_DIM;
+    embd[bucket] += (h >> 63) ? -weight : weight;
+}
+
+void embed_prompt(const std::string & normalized, float * embd) {
+    std::fill(embd, embd + RESPONSE_CACHE_EMBD_DIM, 0.0f);
+
+    std::string lower(normalized);
+    for (char & c : lower) {
+        c = (char) std::tolower((unsigned char) c);
+    }
+
+    // Character trigrams capture small edits inside words
+    for (size_t i = 0; i + 3 <= lower.size(); i++) {
+        add_feature(embd, fnv1a(lower.data() + i, 3, 0x9e3779b97f4a7c15ULL), 0.5f);
+    }
+
+    // Word unigrams and bigrams capture vocabulary and local order
+    uint64_t prev = 0;
+    size_t start = 0;
+    while (start < lower.size()) {
+        size_t end = lower.find(' ', start);
+        if (end == std::string::npos) end = lower.size();
+        const uint64_t word = fnv1a(lower.data() + start, end - start);
+        add_feature(embd, word, 1.0f);
+        if (prev != 0) {
+            add_feature(embd, word * 31 + prev, 1.0f);
+        }
+        prev = word;
+        start = end + 1;
+    }
+
+    float norm = 0.0f;
+    for (int i = 0; i < RESPONSE_CACHE_EMBD_DIM; i++) norm += embd[i] * embd[i];
+    norm = std::sqrt(norm);
+    if (norm > 0.0f) {
+        for (int i = 0; i < RESPONSE_CACHE_EMBD_DIM; i++) embd[i] /= norm;
+    }
+}
+
+float dot(const float * a, const float * b) {
+    float sum = 0.0f;
+    for (int i = 0; i < RESPONSE_CACHE_EMBD_DIM; i++) sum += a[i] * b[i];
+    return sum;
+}
+
+std::string partition_of(const response_cache_key & key) {
+    char params[128];
+    snprintf(params, sizeof(params), "|%.3f|%.3f|%d|%.3f|%d",
+             key.temperature, key.top_p, key.top_k, key.repeat_penalty, key.max_tokens);
+    return key.model_id + "|" + key.ns + params;
+}
+
+void evict_to_capacity_locked() {
+    while (g_entries.size() > g_capacity) {
+        auto lru = std::min_element(g_entries.begin(), g_entries.end(),
+            [](const cache_entry & a, const cache_entry & b) { return a.last_used < b.last_used; });
+        g_entries.erase(lru);
+        g_stats.evictions++;
+    }
+}
+
+} // namespace
+
+void response_cache_configure(bool enabled, float similarity_threshold, int capacity) {
+    std::lock_guard<std::mutex> lock(g_cache_mutex);
+    g_enabled = enabled;
+    if (similarity_threshold > 0.0f) {
+        g_threshold = similarity_threshold;
+    }
+    if (capacity > 0) {
+        g_capacity = (size_t) capacity;
+        evict_to_capacity_locked();
+    }
+}
+
+bool response_cache_enabled() {
+    std::lock_guard<std::mutex> lock(g_cache_mutex);
+    return g_enabled;
+}
+
+bool response_cache_lookup(const response_cache_key & key, const std::string & prompt,
+                           const std::string & query, response_cache_hit & hit) {
+    const std::string normalized = normalize_prompt(prompt);
+    const uint64_t prompt_hash = fnv1a(normalized.data(), normalized.size());
+    const std::string partition = partition_of(key);
+
+    // Sampled completions are only replayed for the identical prompt
+    const bool greedy = key.temperature <= 0.0f;
+    const std::string normalized_query = normalize_prompt(query);
+    const uint64_t template_hash = greedy ? template_hash_of(normalized, normalized_query) : 0;
+    float embd[RESPONSE_CACHE_EMBD_DIM];
+    if (template_hash != 0) embed_prompt(normalized_query, embd);
+
+    std::lock_guard<std::mutex> lock(g_cache_mutex);
+    if (!g_enabled) return false;
+    g_stats.lookups++;
+
+    cache_entry * best = nullptr;
+    float best_sim = -1.0f;
+    bool exact = false;
+
+    for (auto & entry : g_entries) {
+        if (entry.partition != partition) continue;
+        if (entry.prompt_hash == prompt_hash && entry.normalized == normalized) {
+            best = &entry;
+            best_sim = 1.0f;
+            exact = true;
+            break;
+        }
+        if (template_hash == 0 || entry.template_hash != template_hash) continue;
+        const float sim = dot(embd, entry.embedding);
+        if (sim > best_sim) {
+            best_sim = sim;
+            best = &entry;
+        }
+    }
+
+    if (best == nullptr || (!exact && best_sim < g_threshold)) {
+        g_stats.misses++;
+        return false;
+    }
+
+    best->last_used = ++g_clock;
+    hit.pieces = best->pieces;
+    hit.stop_reason = best->stop_reason;
+    hit.similarity = best_sim;
+    hit.exact = exact;
+    if (exact) {
+        g_stats.exact_hits++;
+    } else {
+        g_stats.semantic_hits++;
+    }
+    return true;
+}
+
+void response_cache_insert(const response_cache_key & key, const std::string & prompt,
+                           const std::string & query, const std::vector<std::string> & pieces,
+                           int stop_reason) {
+    if (pieces.empty()) return;
+
+    cache_entry entry;
+    entry.partition = partition_of(key);
+    entry.normalized = normalize_prompt(prompt);
+    entry.prompt_hash = fnv1a(entry.normalized.data(), entry.normalized.size());
+    const std::string normalized_query = normalize_prompt(query);
+    entry.template_hash = template_hash_of(entry.normalized, normalized_query);
+    embed_prompt(normalized_query, entry.embedding);
+    entry.pieces = pieces;
+    entry.stop_reason = stop_reason;
+
+    std::lock_guard<std::mutex> lock(g_cache_mutex);
+    if (!g_enabled) return;
+
+    entry.last_used = ++g_clock;
+    for (auto & existing : g_entries) {
+        if (existing.partition == entry.partition &&
+            existing.prompt_hash == entry.prompt_hash &&
+            existing.normalized == entry.normalized) {
+            existing = std::move(entry);
+            g_stats.insertions++;
+            return;
+        }
+    }
+
+    g_entries.push_back(std::move(entry));
+    g_stats.insertions++;
+    evict_to_capacity_locked();
+}
+
+void response_cache_clear() {
+    std::lock_guard<std::mutex> lock(g_cache_mutex);
+    g_entries.clear();
+    g_stats = cache_stats();
+}
+
+size_t response_cache_trim() {
+    std::lock_guard<std::mutex> lock(g_cache_mutex);
+    size_t bytes = 0;
+    for (const auto & entry : g_entries) {
+        bytes += sizeof(cache_entry) + entry.partition.capacity() + entry.normalized.capacity();
+        for (const auto & piece : entry.pieces) bytes += sizeof(piece) + piece.capacity();
+    }
+    g_stats.evictions += g_entries.size();
+    g_entries.clear();
+    g_entries.shrink_to_fit();
+    return bytes;
+}
+
+std::string response_cache_stats_json() {
+    std::lock_guard<std::mutex> lock(g_cache_mutex);
+    const uint64_t hits = g_stats.exact_hits + g_stats.semantic_hits;
+    const double hit_rate = g_stats.lookups > 0 ? (double) hits / g_stats.lookups : 0.0;
+
+    std::string json = "{";
+    json += "\"enabled\":" + std::string(g_enabled ? "true" : "false") + ",";
+    json += "\"entries\":" + std::to_string(g_entries.size()) + ",";
+    json += "\"capacity\":" + std::to_string(g_capacity) + ",";
+    json += "\"threshold\":" + std::to_string(g_threshold) + ",";
+    json += "\"lookups\":" + std::to_string(g_stats.lookups) + ",";
+    json += "\"exact_hits\":" + std::to_string(g_stats.exact_hits) + ",";
+    json += "\"semantic_hits\":" + std::to_string(g_stats.semantic_hits) + ",";
+    json += "\"misses\":" + std::to_string(g_stats.misses) + ",";
+    json += "\"hit_rate\":" + std::to_string(hit_rate) + ",";
+    json += "\"insertions\":" + std::to_string(g_stats.insertions) + ",";
+    json += "\"evictions\":" + std::to_string(g_stats.evictions);
+    json += "}";
+    return json;
+}
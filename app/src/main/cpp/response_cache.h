@@ -0,0 +1,74 @@
+/**
+ * response_cache.h - Semantic response cache for repeated prompts
+ *
+ * Completions are stored per partition (model fingerprint, feature namespace
+ * and sampling parameters) under the normalized prompt. A prompt seen before
+ * returns its completion. Greedy requests may also reuse the completion of a
+ * near-identical request: the caller names the variable part of the prompt
+ * (the user's topic or input), the rest of the prompt must match exactly and
+ * the hashed n-gram embeddings of the variable parts must reach the
+ * configured cosine similarity. Feature boilerplate therefore never makes two
+ * different requests look alike.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Dimension of the hashed n-gram prompt embedding
+#define RESPONSE_CACHE_EMBD_DIM 256
+
+// Identifies which completions are interchangeable with each other
+struct response_cache_key {
+    std::string model_id;
+    std::string ns;
+    float temperature = 0.0f;
+    float top_p = 0.0f;
+    int top_k = 0;
+    float repeat_penalty = 0.0f;
+    int max_tokens = 0;
+};
+
+struct response_cache_hit {
+    std::vector<std::string> pieces;  // completion as originally streamed
+    int stop_reason = 0;              // generation_stop_reason the completion ended with
+    float similarity = 0.0f;
+    bool exact = false;
+};
+
+/**
+ * Configure the cache. A capacity of 0 keeps the current capacity.
+ * Shrinking the capacity evicts least recently used entries.
+ */
+void response_cache_configure(bool enabled, float similarity_threshold, int capacity);
+
+bool response_cache_enabled();
+
+/**
+ * Look up a completion for the prompt. query is the variable text inside the
+ * prompt; empty allows exact hits only. Near-identical queries hit only at
+ * temperature 0, since a sampled completion is one of many. Callers wanting a
+ * fresh sample of a repeated prompt skip the lookup and insert the new one.
+ */
+bool response_cache_lookup(const response_cache_key & key, const std::string & prompt,
+                           const std::string & query, response_cache_hit & hit);
+
+/**
+ * Store a completed generation, replacing the entry of an identical prompt.
+ * Callers should only insert completions that ended naturally
+ * (end-of-generation or max_tokens), never cancelled ones, and pass that
+ * generation_stop_reason so a replay reports a truncated completion as such.
+ */
+void response_cache_insert(const response_cache_key & key, const std::string & prompt,
+                           const std::string & query, const std::vector<std::string> & pieces,
+                           int stop_reason);
+
+void response_cache_clear();
+
+// Drop all entries under memory pressure, keeping the statistics. Returns the approximate bytes freed.
+size_t response_cache_trim();
+
+// Hit-rate statistics as a JSON object string
+std::string response_cache_stats_json();
@@ -0,0 +1,155 @@
+/**
+ * thread_tuner.cpp - Online tuning of the decode thread count
+ */
+
+#include "thread_tuner.h"
+#include "logging.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#define LOG_TAG "ThreadTuner"
+
+namespace {
+
+// Windows measured before a thread count is compared against others
+constexpr int MIN_SAMPLES = 2;
+// Windows between re-probes of a neighbour once the search has settled
+constexpr uint64_t REPROBE_INTERVAL = 32;
+// A count must be this much faster than the current best to replace it
+constexpr double SWITCH_MARGIN = 0.97;
+constexpr double EMA_ALPHA = 0.3;
+
+struct tuner_state {
+    int max_threads = 0;
+    int best = 0;
+    std::vector<double> ema_ms;   // indexed by thread count
+    std::vector<int> samples;
+    uint64_t windows = 0;
+    uint64_t reprobes = 0;
+};
+
+std::mutex g_tuner_mutex;
+std::map<std::string, tuner_state> g_states;
+bool g_enabled = true;
+
+tuner_state & state_for_locked(const std::string & key, int max_threads) {
+    tuner_state & state = g_states[key];
+    if (state.max_threads != max_threads) {
+        state = tuner_state();
+        state.max_threads = max_threads;
+        state.best = max_threads;
+        state.ema_ms.assign(max_threads + 1, 0.0);
+        state.samples.assign(max_threads + 1, 0);
+    }
+    return state;
+}
+
+bool measured(const tuner_state & state, int n) {
+    return n >= 1 && n <= state.max_threads && state.samples[n] >= MIN_SAMPLES;
+}
+
+} // namespace
+
+void thread_tuner_set_enabled(bool enabled) {
+    std::lock_guard<std::mutex> lock(g_tuner_mutex);
+    g_enabled = enabled;
+}
+
+bool thread_tuner_enabled() {
+    std::lock_guard<std::mutex> lock(g_tuner_mutex);
+    return g_enabled;
+}
+
+int thread_tuner_decode_threads(const std::string & key, int max_threads) {
+    if (max_threads <= 1) return 1;
+
+    std::lock_guard<std::mutex> lock(g_tuner_mutex);
+    if (!g_enabled) return max_threads;
+
+    tuner_state & state = state_for_locked(key, max_threads);
+    const int lower = state.best - 1;
+    const int upper = state.best + 1;
+
+    // Hill climb: the best count and both neighbours need measurements first
+    if (!measured(state, state.best)) return state.best;
+    if (lower >= 1 && !measured(state, lower)) return lower;
+    if (upper <= max_threads && !measured(state, upper)) return upper;
+
+    // Settled, but keep checking a neighbour now and then
+    if (state.windows % REPROBE_INTERVAL == 0) {
+        state.reprobes++;
+        const bool try_lower = (state.reprobes % 2 == 1 && lower >= 1) || upper > max_threads;
+        return try_lower ? lower : upper;
+    }
+    return state.best;
+}
+
+void thread_tuner_report(const std::string & key, int n_threads, double ms_per_token) {
+    if (ms_per_token <= 0) return;
+
+    std::lock_guard<std::mutex> lock(g_tuner_mutex);
+    auto it = g_states.find(key);
+    if (it == g_states.end()) return;
+
+    tuner_state & state = it->second;
+    if (n_threads < 1 || n_threads > state.max_threads) return;
+
+    double & ema = state.ema_ms[n_threads];
+    ema = state.samples[n_threads] == 0 ? ms_per_token : (1 - EMA_ALPHA) * ema + EMA_ALPHA * ms_per_token;
+    state.samples[n_threads]++;
+    state.windows++;
+
+    if (!measured(state, state.best)) return;
+    int fastest = state.best;
+    for (int n = 1; n <= state.max_threads; n++) {
+        if (measured(state, n) && state.ema_ms[n] < state.ema_ms[fastest]) fastest = n;
+    }
+    if (fastest != state.best && state.ema_ms[fastest] < state.ema_ms[state.best] * SWITCH_MARGIN) {
+        LOGI("Decode threads %d -> %d (%.1f -> %.1f ms/token)",
+             state.best, fastest, state.ema_ms[state.best], state.ema_ms[fastest]);
+        state.best = fastest;
+    }
+}
+
+void thread_tuner_reset() {
+    std::lock_guard<std::mutex> lock(g_tuner_mutex);
+    g_states.clear();
+}
+
+std::string thread_tuner_stats_json() {
+    std::lock_guard<std::mutex> lock(g_tuner_mutex);
+
+    std::string json = "{";
+    json += "\"enabled\":" + std::string(g_enabled ? "true" : "false") + ",";
+    json += "\"models\":[";
+    bool first = true;
+    for (const auto & kv : g_states) {
+        const tuner_state & state = kv.second;
+        std::string key;
+        for (char c : kv.first) {
+            if (c == '"' || c == '\\') key += '\\';
+            key += c;
+        }
+        if (!first) json += ",";
+        first = false;
+        json += "{\"model\":\"" + key + "\",";
+        json += "\"max_threads\":" + std::to_string(state.max_threads) + ",";
+        json += "\"decode_threads\":" + std::to_string(state.best) + ",";
+        json += "\"windows\":" + std::to_string(state.windows) + ",";
+        json += "\"ms_per_token\":{";
+        bool first_count = true;
+        for (int n = 1; n <= state.max_threads; n++) {
+            if (state.samples[n] == 0) continue;
+            if (!first_count) json += ",";
+            first_count = false;
+            json += "\"" + std::to_string(n) + "\":" + std::to_string(state.ema_ms[n]);
+        }
+        json += "}}";
+    }
+    json += "]}";
+    return json;
+}
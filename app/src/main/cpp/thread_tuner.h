@@ -0,0 +1,38 @@
+/**
+ * thread_tuner.h - Online tuning of the decode thread count
+ *
+ * Prompt processing is compute bound and uses every thread it gets, while
+ * single-token decode is bound by memory bandwidth and often runs faster with
+ * fewer threads. llama.cpp already picks n_threads_batch for multi-token
+ * batches and n_threads for single tokens, so the generate loop keeps the
+ * context's thread count for prefill and asks this tuner for the decode count.
+ *
+ * Decode latency is measured in windows of THREAD_TUNER_WINDOW tokens. The
+ * tuner hill-climbs from the full thread count towards the fastest setting,
+ * keeps a moving average per thread count for every model, and re-probes a
+ * neighbouring count from time to time so it follows thermal changes.
+ */
+
+#pragma once
+
+#include <string>
+
+#define THREAD_TUNER_WINDOW 16
+
+void thread_tuner_set_enabled(bool enabled);
+
+bool thread_tuner_enabled();
+
+/**
+ * Thread count to use for the next decode window of the model identified by
+ * key. Returns max_threads when tuning is disabled.
+ */
+int thread_tuner_decode_threads(const std::string & key, int max_threads);
+
+// Record the mean per-token decode latency measured with n_threads
+void thread_tuner_report(const std::string & key, int n_threads, double ms_per_token);
+
+// Forget all measurements, e.g. after the user changed the thread setting
+void thread_tuner_reset();
+
+std::string thread_tuner_stats_json();
@@ -0,0 +1,128 @@
+/**
+ * token_pieces.cpp - Precomputed token piece table and incremental detokenizer
+ */
+
+#include "token_pieces.h"
+#include "logging.h"
+
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <mutex>
+
+#define LOG_TAG "TokenPieces"
+
+namespace {
+
+std::mutex g_tables_mutex;
+std::map<const llama_model *, std::shared_ptr<const token_piece_table>> g_tables;
+
+std::shared_ptr<const token_piece_table> build_table(const llama_model * model) {
+    const auto start = std::chrono::steady_clock::now();
+    const llama_vocab * vocab = llama_model_get_vocab(model);
+    const int n_vocab = vocab != nullptr ? llama_vocab_n_tokens(vocab) : 0;
+    if (n_vocab <= 0) return nullptr;
+
+    auto table = std::make_shared<token_piece_table>();
+    table->offsets.reserve(n_vocab + 1);
+    table->control.reserve(n_vocab);
+    table->bytes.reserve((size_t) n_vocab * 6);
+
+    std::vector<char> buf(256);
+    for (llama_token token = 0; token < n_vocab; token++) {
+        int len = llama_token_to_piece(vocab, token, buf.data(), (int32_t) buf.size(), 0, true);
+        if (len < 0) {
+            buf.resize(-len);
+            len = llama_token_to_piece(vocab, token, buf.data(), (int32_t) buf.size(), 0, true);
+        }
+        table->offsets.push_back((uint32_t) table->bytes.size());
+        if (len > 0) table->bytes.append(buf.data(), len);
+        table->control.push_back((llama_vocab_get_attr(vocab, token) & LLAMA_TOKEN_ATTR_CONTROL) != 0);
+    }
+    table->offsets.push_back((uint32_t) table->bytes.size());
+    table->bytes.shrink_to_fit();
+
+    LOGI("Built token piece table: %d tokens, %zu bytes in %.1f ms", n_vocab, table->size_bytes(),
+         std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    return table;
+}
+
+// Length of the prefix of s that ends on a complete UTF-8 character
+size_t complete_utf8_prefix(const std::string & s) {
+    const size_t size = s.size();
+    for (size_t back = 1; back <= 4 && back <= size; back++) {
+        const unsigned char c = (unsigned char) s[size - back];
+        if ((c & 0xC0) == 0x80) continue;  // continuation byte, keep looking for the lead
+
+        size_t need = 1;
+        if ((c & 0xE0) == 0xC0) need = 2;
+        else if ((c & 0xF0) == 0xE0) need = 3;
+        else if ((c & 0xF8) == 0xF0) need = 4;
+        return back >= need ? size : size - back;
+    }
+    return size;  // no lead byte in the tail: not valid UTF-8 anyway, pass it through
+}
+
+} // namespace
+
+std::shared_ptr<const token_piece_table> token_pieces_for(const llama_model * model) {
+    if (model == nullptr) return nullptr;
+
+    std::lock_guard<std::mutex> lock(g_tables_mutex);
+    auto it = g_tables.find(model);
+    if (it != g_tables.end()) return it->second;
+
+    std::shared_ptr<const token_piece_table> table = build_table(model);
+    if (table != nullptr) g_tables[model] = table;
+    return table;
+}
+
+void token_pieces_drop(const llama_model * model) {
+    std::lock_guard<std::mutex> lock(g_tables_mutex);
+    g_tables.erase(model);
+}
+
+void token_pieces_detokenize(const token_piece_table & table, const int32_t * tokens, size_t n_tokens,
+                             bool render_special, std::string & out) {
+    const uint32_t * offsets = table.offsets.data();
+    size_t total = 0;
+    for (size_t i = 0; i < n_tokens; i++) {
+        const llama_token token = tokens[i];
+        if (!table.contains(token) || (!render_special && table.control[token])) continue;
+        total += offsets[token + 1] - offsets[token];
+    }
+
+    size_t pos = out.size();
+    out.resize(pos + total);
+    char * dst = &out[0];
+    const char * src = table.bytes.data();
+    for (size_t i = 0; i < n_tokens; i++) {
+        const llama_token token = tokens[i];
+        if (!table.contains(token) || (!render_special && table.control[token])) continue;
+        const uint32_t len = offsets[token + 1] - offsets[token];
+        memcpy(dst + pos, src + offsets[token], len);
+        pos += len;
+    }
+}
+
+void token_detokenizer::reset(const token_piece_table * table, bool render_special) {
+    table_ = table;
+    render_special_ = render_special;
+    pending_.clear();
+    pending_.reserve(256);
+}
+
+void token_detokenizer::push(llama_token token) {
+    if (table_ == nullptr || !table_->contains(token)) return;
+    if (!render_special_ && table_->control[token]) return;
+    const uint32_t begin = table_->offsets[token];
+    pending_.append(table_->bytes, begin, table_->offsets[token + 1] - begin);
+}
+
+bool token_detokenizer::take(std::string & chunk) {
+    const size_t n = complete_utf8_prefix(pending_);
+    if (n == 0) return false;
+    chunk.assign(pending_, 0, n);
+    pending_.erase(0, n);
+    return true;
+}
@@ -0,0 +1,73 @@
+/**
+ * token_pieces.h - Precomputed token piece table and incremental detokenizer
+ *
+ * The text of every vocab token is rendered once per model into one
+ * contiguous byte blob indexed by offsets. Detokenizing is then a memcpy per
+ * token instead of a llama_token_to_piece call, and a whole token array is
+ * a single pass of copies into a buffer sized up front.
+ *
+ * Pieces are rendered with special tokens visible. Control tokens are flagged
+ * so callers that want plain text (render_special = false) skip them, which
+ * matches llama_token_to_piece(..., special = false).
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "llama.h"
+
+struct token_piece_table {
+    std::vector<uint32_t> offsets;   // n_vocab + 1 entries into bytes
+    std::vector<uint8_t> control;    // 1 for control tokens
+    std::string bytes;
+
+    int n_vocab() const { return (int) control.size(); }
+    bool contains(llama_token token) const { return token >= 0 && token < n_vocab(); }
+    size_t size_bytes() const {
+        return bytes.capacity() + offsets.capacity() * sizeof(uint32_t) + control.capacity();
+    }
+};
+
+/**
+ * Return the table for a model, building it on first use. Build it right
+ * after loading so the first generation does not pay for it.
+ * Returns nullptr if the model has no vocabulary.
+ */
+std::shared_ptr<const token_piece_table> token_pieces_for(const llama_model * model);
+
+// Forget the table of a model that is being freed
+void token_pieces_drop(const llama_model * model);
+
+/**
+ * Append the text of tokens to out in one pass. Invalid token ids are skipped.
+ */
+void token_pieces_detokenize(const token_piece_table & table, const int32_t * tokens, size_t n_tokens,
+                             bool render_special, std::string & out);
+
+/**
+ * Streaming detokenizer. Tokens are pushed one at a time and text is taken
+ * out only up to the last complete UTF-8 character, so a multi-byte
+ * character split across tokens is never emitted in halves.
+ */
+class token_detokenizer {
+public:
+    void reset(const token_piece_table * table, bool render_special);
+
+    void push(llama_token token);
+
+    // Move the complete UTF-8 prefix of the pending text into chunk. Returns false if there is none.
+    bool take(std::string & chunk);
+
+    // Bytes held back waiting for the rest of a UTF-8 character
+    size_t pending() const { return pending_.size(); }
+
+private:
+    const token_piece_table * table_ = nullptr;
+    bool render_special_ = true;
+    std::string pending_;
+};
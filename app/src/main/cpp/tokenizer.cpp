@@ -0,0 +1,277 @@
+/**
+ * tokenizer.cpp - Cached, batched tokenization
+ */
+
+#include "tokenizer.h"
+#include "logging.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#define LOG_TAG "Tokenizer"
+
+namespace {
+
+constexpr size_t DEFAULT_CACHE_TOKENS = 64 * 1024;
+constexpr int MAX_WORKERS = 4;
+// Batches smaller than this are tokenized on the calling thread
+constexpr size_t PARALLEL_MIN_BYTES = 8 * 1024;
+
+// ============================================================================
+// LRU cache
+// ============================================================================
+
+struct cache_entry {
+    std::string key;
+    const llama_model * model = nullptr;
+    std::shared_ptr<const std::vector<llama_token>> tokens;
+};
+
+std::mutex g_cache_mutex;
+std::list<cache_entry> g_lru;  // most recently used first
+std::unordered_map<std::string, std::list<cache_entry>::iterator> g_index;
+size_t g_cached_tokens = 0;
+size_t g_capacity_tokens = DEFAULT_CACHE_TOKENS;
+uint64_t g_hits = 0;
+uint64_t g_misses = 0;
+
+std::string cache_key(const llama_model * model, const tokenizer_flags & flags, const char * text, size_t len) {
+    std::string key;
+    key.reserve(sizeof(model) + 1 + len);
+    key.append(reinterpret_cast<const char *>(&model), sizeof(model));
+    key += (char) ((flags.add_special ? 1 : 0) | (flags.parse_special ? 2 : 0));
+    key.append(text, len);
+    return key;
+}
+
+void evict_locked(size_t capacity) {
+    while (g_cached_tokens > capacity && !g_lru.empty()) {
+        const cache_entry & entry = g_lru.back();
+        g_cached_tokens -= entry.tokens->size();
+        g_index.erase(entry.key);
+        g_lru.pop_back();
+    }
+}
+
+bool tokenize_uncached(const llama_vocab * vocab, const char * text, size_t len,
+                       const tokenizer_flags & flags, std::vector<llama_token> & out) {
+    // Every token covers at least one byte, so this only falls short by the special tokens added
+    out.resize(len + 16);
+    int n = llama_tokenize(vocab, text, (int32_t) len, out.data(), (int32_t) out.size(),
+                           flags.add_special, flags.parse_special);
+    if (n < 0) {
+        out.resize(-n);
+        n = llama_tokenize(vocab, text, (int32_t) len, out.data(), (int32_t) out.size(),
+                           flags.add_special, flags.parse_special);
+    }
+    if (n < 0) {
+        out.clear();
+        return false;
+    }
+    out.resize(n);
+    return true;
+}
+
+// ============================================================================
+// Worker pool
+// ============================================================================
+
+// Persistent workers that run the indices of one job at a time alongside the caller
+struct worker_pool {
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::vector<std::thread> threads;
+    const std::function<void(size_t)> * fn = nullptr;
+    size_t n_tasks = 0;
+    std::atomic<size_t> next{0};
+    uint64_t generation = 0;
+    int busy = 0;
+    uint64_t jobs = 0;
+
+    std::mutex run_mutex;  // one job at a time
+
+    explicit worker_pool(int n_threads) {
+        for (int i = 0; i < n_threads; i++) {
+            threads.emplace_back([this]() { worker_loop(); });
+        }
+    }
+
+    void worker_loop() {
+        uint64_t seen = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            wake.wait(lock, [&]() { return generation != seen; });
+            seen = generation;
+            // Woken after the job already finished: fn was cleared and next may be
+            // reset by the following run() at any time, so there is nothing to claim
+            if (fn == nullptr) continue;
+            const std::function<void(size_t)> * job = fn;
+            const size_t n = n_tasks;
+            busy++;
+            lock.unlock();
+            for (size_t i = next.fetch_add(1); i < n; i = next.fetch_add(1)) (*job)(i);
+            lock.lock();
+            if (--busy == 0) done.notify_all();
+        }
+    }
+
+    void run(size_t n, const std::function<void(size_t)> & task) {
+        std::lock_guard<std::mutex> run_lock(run_mutex);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            fn = &task;
+            n_tasks = n;
+            next.store(0);
+            generation++;
+            jobs++;
+        }
+        wake.notify_all();
+
+        for (size_t i = next.fetch_add(1); i < n; i = next.fetch_add(1)) task(i);
+
+        // Workers that joined hold busy; any that wake later see fn cleared
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&]() { return busy == 0; });
+        fn = nullptr;
+        n_tasks = 0;
+    }
+};
+
+worker_pool & pool() {
+    // Never destroyed: workers live for the rest of the process
+    static worker_pool * instance = new worker_pool(
+            std::max(1, std::min(MAX_WORKERS, (int) std::thread::hardware_concurrency() - 1)));
+    return *instance;
+}
+
+} // namespace
+
+bool tokenizer_tokenize(const llama_model * model, const char * text, size_t len,
+                        const tokenizer_flags & flags, std::vector<llama_token> & out) {
+    const llama_vocab * vocab = model != nullptr ? llama_model_get_vocab(model) : nullptr;
+    if (vocab == nullptr) return false;
+
+    const bool cacheable = len <= TOKENIZER_CACHE_MAX_TEXT;
+    std::string key;
+    if (cacheable) {
+        key = cache_key(model, flags, text, len);
+        std::lock_guard<std::mutex> lock(g_cache_mutex);
+        auto it = g_index.find(key);
+        if (it != g_index.end()) {
+            g_lru.splice(g_lru.begin(), g_lru, it->second);
+            out.assign(it->second->tokens->begin(), it->second->tokens->end());
+            g_hits++;
+            return true;
+        }
+        g_misses++;
+    }
+
+    if (!tokenize_uncached(vocab, text, len, flags, out)) return false;
+
+    if (cacheable) {
+        std::lock_guard<std::mutex> lock(g_cache_mutex);
+        if (out.size() <= g_capacity_tokens && g_index.find(key) == g_index.end()) {
+            cache_entry entry;
+            entry.key = key;
+            entry.model = model;
+            entry.tokens = std::make_shared<const std::vector<llama_token>>(out);
+            g_cached_tokens += out.size();
+            g_lru.push_front(std::move(entry));
+            g_index[key] = g_lru.begin();
+            evict_locked(g_capacity_tokens);
+        }
+    }
+    return true;
+}
+
+bool tokenizer_tokenize_batch(const llama_model * model, const char * utf8, const int32_t * offsets, size_t n,
+                              const tokenizer_flags & flags, std::vector<llama_token> * tokens,
+                              std::vector<int32_t> & token_offsets) {
+    if (model == nullptr || llama_model_get_vocab(model) == nullptr) return false;
+
+    std::vector<std::vector<llama_token>> results(n);
+    std::atomic<int> failures{0};
+    std::function<void(size_t)> task = [&](size_t i) {
+        if (!tokenizer_tokenize(model, utf8 + offsets[i], offsets[i + 1] - offsets[i], flags, results[i])) {
+            failures++;
+        }
+    };
+
+    const size_t total_bytes = n > 0 ? (size_t) (offsets[n] - offsets[0]) : 0;
+    if (n > 1 && total_bytes >= PARALLEL_MIN_BYTES) {
+        pool().run(n, task);
+    } else {
+        for (size_t i = 0; i < n; i++) task(i);
+    }
+    if (failures > 0) LOGW("%d of %zu texts failed to tokenize", failures.load(), n);
+
+    token_offsets.assign(1, 0);
+    token_offsets.reserve(n + 1);
+    for (const auto & result : results) token_offsets.push_back(token_offsets.back() + (int32_t) result.size());
+
+    if (tokens != nullptr) {
+        tokens->reserve(tokens->size() + token_offsets.back());
+        for (const auto & result : results) tokens->insert(tokens->end(), result.begin(), result.end());
+    }
+    return true;
+}
+
+void tokenizer_set_cache_capacity(size_t max_tokens) {
+    std::lock_guard<std::mutex> lock(g_cache_mutex);
+    g_capacity_tokens = max_tokens;
+    evict_locked(max_tokens);
+}
+
+size_t tokenizer_trim_cache() {
+    std::lock_guard<std::mutex> lock(g_cache_mutex);
+    size_t bytes = g_cached_tokens * sizeof(llama_token);
+    for (const auto & entry : g_lru) bytes += entry.key.capacity() + sizeof(cache_entry);
+    g_lru.clear();
+    g_index.clear();
+    g_cached_tokens = 0;
+    return bytes;
+}
+
+void tokenizer_drop_model(const llama_model * model) {
+    std::lock_guard<std::mutex> lock(g_cache_mutex);
+    for (auto it = g_lru.begin(); it != g_lru.end();) {
+        if (it->model == model) {
+            g_cached_tokens -= it->tokens->size();
+            g_index.erase(it->key);
+            it = g_lru.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+std::string tokenizer_stats_json() {
+    uint64_t jobs = 0;
+    size_t workers = 0;
+    {
+        worker_pool & p = pool();
+        std::lock_guard<std::mutex> lock(p.mutex);
+        jobs = p.jobs;
+        workers = p.threads.size();
+    }
+
+    std::lock_guard<std::mutex> lock(g_cache_mutex);
+    std::string json = "{";
+    json += "\"entries\":" + std::to_string(g_lru.size()) + ",";
+    json += "\"cached_tokens\":" + std::to_string(g_cached_tokens) + ",";
+    json += "\"capacity_tokens\":" + std::to_string(g_capacity_tokens) + ",";
+    json += "\"hits\":" + std::to_string(g_hits) + ",";
+    json += "\"misses\":" + std::to_string(g_misses) + ",";
+    json += "\"workers\":" + std::to_string(workers) + ",";
+    json += "\"parallel_batches\":" + std::to_string(jobs);
+    json += "}";
+    return json;
+}
@@ -0,0 +1,55 @@
+/**
+ * tokenizer.h - Cached, batched tokenization
+ *
+ * RAG indexing, context budgeting and the token counter tokenize many
+ * strings, often the same ones (system prompts, templates). Results are kept
+ * in an LRU cache keyed by model, flags and text, and batches are split
+ * across a small persistent worker pool. Buffers are sized from the byte
+ * length, which bounds the token count, so a string is tokenized once.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "llama.h"
+
+// Texts longer than this are tokenized but not cached
+#define TOKENIZER_CACHE_MAX_TEXT 16384
+
+struct tokenizer_flags {
+    bool add_special = true;
+    bool parse_special = true;
+};
+
+/**
+ * Tokenize one string, using the cache. Returns false if tokenization failed.
+ */
+bool tokenizer_tokenize(const llama_model * model, const char * text, size_t len,
+                        const tokenizer_flags & flags, std::vector<llama_token> & out);
+
+/**
+ * Tokenize n texts stored back to back in utf8, text i spanning
+ * [offsets[i], offsets[i + 1]). Tokens are appended to tokens and
+ * token_offsets receives n + 1 entries delimiting each text's tokens.
+ * With tokens == nullptr only token_offsets is filled, which is all a
+ * count needs. A text that fails to tokenize gets zero tokens.
+ */
+bool tokenizer_tokenize_batch(const llama_model * model, const char * utf8, const int32_t * offsets, size_t n,
+                              const tokenizer_flags & flags, std::vector<llama_token> * tokens,
+                              std::vector<int32_t> & token_offsets);
+
+// Cap the cache by total cached tokens; 0 disables caching
+void tokenizer_set_cache_capacity(size_t max_tokens);
+
+// Forget cached results of a model that is being freed
+void tokenizer_drop_model(const llama_model * model);
+
+// Empty the cache, keeping its capacity. Returns the approximate bytes freed.
+size_t tokenizer_trim_cache();
+
+// Cache and worker pool statistics as a JSON object string
+std::string tokenizer_stats_json();
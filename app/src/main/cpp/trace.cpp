@@ -0,0 +1,143 @@
+/**
+ * trace.cpp - Scoped trace spans exported as Chrome Trace Event JSON
+ */
+
+#include "trace.h"
+#include "logging.h"
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define LOG_TAG "Trace"
+
+std::atomic<bool> g_trace_enabled{false};
+
+namespace {
+
+struct trace_event {
+    const char * name;
+    int64_t start_us;
+    int64_t dur_us;
+};
+
+// Written only by its thread; readers take a snapshot of head
+struct trace_buffer {
+    int tid = 0;
+    std::vector<trace_event> events = std::vector<trace_event>(TRACE_BUFFER_EVENTS);
+    std::atomic<uint64_t> head{0};
+    std::atomic<uint64_t> cleared{0};
+};
+
+// Buffers live until process exit so spans of finished threads can still be dumped
+std::mutex g_buffers_mutex;
+std::vector<std::unique_ptr<trace_buffer>> g_buffers;
+thread_local trace_buffer * t_buffer = nullptr;
+
+trace_buffer * thread_buffer() {
+    if (t_buffer == nullptr) {
+        auto buffer = std::make_unique<trace_buffer>();
+        buffer->tid = (int) syscall(SYS_gettid);
+        t_buffer = buffer.get();
+        std::lock_guard<std::mutex> lock(g_buffers_mutex);
+        g_buffers.push_back(std::move(buffer));
+    }
+    return t_buffer;
+}
+
+void write_escaped(FILE * file, const char * s) {
+    for (; *s != '\0'; s++) {
+        if (*s == '"' || *s == '\\') fputc('\\', file);
+        fputc(*s, file);
+    }
+}
+
+} // namespace
+
+void trace_set_enabled(bool enabled) {
+    g_trace_enabled.store(enabled, std::memory_order_relaxed);
+    LOGI("Tracing %s", enabled ? "enabled" : "disabled");
+}
+
+int64_t trace_now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void trace_record(const char * name, int64_t start_us, int64_t dur_us) {
+    trace_buffer * buffer = thread_buffer();
+    const uint64_t head = buffer->head.load(std::memory_order_relaxed);
+    buffer->events[head % TRACE_BUFFER_EVENTS] = {name, start_us, dur_us};
+    buffer->head.store(head + 1, std::memory_order_release);
+}
+
+int trace_dump(const std::string & path) {
+    FILE * file = fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        LOGE("Failed to open trace file %s", path.c_str());
+        return -1;
+    }
+
+    const int pid = (int) getpid();
+    int written = 0;
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", file);
+
+    std::lock_guard<std::mutex> lock(g_buffers_mutex);
+    for (const auto & buffer : g_buffers) {
+        const uint64_t head = buffer->head.load(std::memory_order_acquire);
+        uint64_t begin = buffer->cleared.load(std::memory_order_relaxed);
+        if (head - begin > TRACE_BUFFER_EVENTS) begin = head - TRACE_BUFFER_EVENTS;
+
+        for (uint64_t i = begin; i < head; i++) {
+            const trace_event & event = buffer->events[i % TRACE_BUFFER_EVENTS];
+            if (written > 0) fputc(',', file);
+            fputs("{\"name\":\"", file);
+            write_escaped(file, event.name);
+            fprintf(file, "\",\"cat\":\"localllm\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":%d,\"tid\":%d}",
+                    (long long) event.start_us, (long long) event.dur_us, pid, buffer->tid);
+            written++;
+        }
+    }
+
+    fputs("]}\n", file);
+    const bool ok = fclose(file) == 0;
+    if (!ok) {
+        LOGE("Failed to write trace file %s", path.c_str());
+        return -1;
+    }
+    LOGI("Wrote %d trace spans to %s", written, path.c_str());
+    return written;
+}
+
+void trace_clear() {
+    std::lock_guard<std::mutex> lock(g_buffers_mutex);
+    for (const auto & buffer : g_buffers) {
+        buffer->cleared.store(buffer->head.load(std::memory_order_acquire), std::memory_order_relaxed);
+    }
+}
+
+std::string trace_stats_json() {
+    std::lock_guard<std::mutex> lock(g_buffers_mutex);
+    uint64_t recorded = 0;
+    uint64_t buffered = 0;
+    for (const auto & buffer : g_buffers) {
+        const uint64_t head = buffer->head.load(std::memory_order_acquire);
+        const uint64_t pending = head - buffer->cleared.load(std::memory_order_relaxed);
+        recorded += head;
+        buffered += pending < TRACE_BUFFER_EVENTS ? pending : TRACE_BUFFER_EVENTS;
+    }
+
+    std::string json = "{";
+    json += "\"enabled\":" + std::string(trace_enabled() ? "true" : "false") + ",";
+    json += "\"threads\":" + std::to_string(g_buffers.size()) + ",";
+    json += "\"buffer_events\":" + std::to_string(TRACE_BUFFER_EVENTS) + ",";
+    json += "\"recorded\":" + std::to_string(recorded) + ",";
+    json += "\"buffered\":" + std::to_string(buffered);
+    json += "}";
+    return json;
+}
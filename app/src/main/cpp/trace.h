@@ -0,0 +1,74 @@
+/**
+ * trace.h - Scoped trace spans exported as Chrome Trace Event JSON
+ *
+ * TRACE_SCOPE("name") records the duration of the enclosing block into a
+ * per-thread ring buffer. Each thread writes only its own buffer, so
+ * recording takes no locks; when tracing is off a span costs one relaxed
+ * atomic load. trace_dump() writes every buffered span as a JSON file that
+ * loads in Perfetto (ui.perfetto.dev) or chrome://tracing.
+ *
+ * Names must be string literals or otherwise outlive the trace. Define
+ * LOCALLLM_DISABLE_TRACE to compile the spans out entirely.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Spans kept per thread; older spans are overwritten
+#define TRACE_BUFFER_EVENTS 4096
+
+extern std::atomic<bool> g_trace_enabled;
+
+inline bool trace_enabled() {
+    return g_trace_enabled.load(std::memory_order_relaxed);
+}
+
+void trace_set_enabled(bool enabled);
+
+int64_t trace_now_us();
+
+// Append a completed span to the calling thread's buffer
+void trace_record(const char * name, int64_t start_us, int64_t dur_us);
+
+/**
+ * Write all buffered spans to path as Chrome Trace Event JSON.
+ * Returns the number of spans written, or -1 if the file could not be written.
+ * Spans recorded while the dump runs may be torn; dump after the work of interest.
+ */
+int trace_dump(const std::string & path);
+
+// Forget buffered spans. Buffers stay allocated for their threads.
+void trace_clear();
+
+// Tracing state and buffer usage as a JSON object string
+std::string trace_stats_json();
+
+class trace_scope {
+public:
+    explicit trace_scope(const char * name)
+        : name_(trace_enabled() ? name : nullptr),
+          start_us_(name_ != nullptr ? trace_now_us() : 0) {}
+
+    ~trace_scope() {
+        if (name_ != nullptr) trace_record(name_, start_us_, trace_now_us() - start_us_);
+    }
+
+    trace_scope(const trace_scope &) = delete;
+    trace_scope & operator=(const trace_scope &) = delete;
+
+private:
+    const char * name_;
+    int64_t start_us_;
+};
+
+#ifdef LOCALLLM_DISABLE_TRACE
+#define TRACE_SCOPE(name) do {} while (0)
+#else
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name) trace_scope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#endif
@@ -0,0 +1,53 @@
+/**
+ * whisper_audio.h - Audio loading and log-mel features for Whisper
+ *
+ * WAV/PCM parsing, resampling and the mel spectrogram have no JNI
+ * dependencies, so they are part of the core library and can be exercised
+ * on a host build.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Whisper constants
+#define WHISPER_SAMPLE_RATE 16000
+#define WHISPER_N_FFT 400
+#define WHISPER_N_MEL 80
+#define WHISPER_HOP_LENGTH 160
+#define WHISPER_CHUNK_SIZE 30
+
+/**
+ * Read WAV file and return float samples normalized to [-1, 1]
+ */
+bool read_wav_file(const std::string & path, std::vector<float> & samples, int & sample_rate);
+
+/**
+ * Simple linear resampling
+ */
+void resample_audio(const std::vector<float> & input, int input_rate,
+                    std::vector<float> & output, int output_rate);
+
+/**
+ * Read raw PCM file (16-bit, 16kHz, mono)
+ */
+bool read_raw_pcm(const std::string & path, std::vector<float> & samples);
+
+/**
+ * Load audio from file (supports WAV and raw PCM), resampled to 16 kHz
+ */
+bool load_audio_file(const std::string & path, std::vector<float> & samples);
+
+// Triangular mel filterbank, WHISPER_N_MEL rows of WHISPER_N_FFT / 2 + 1 bins
+std::vector<float> get_mel_filters();
+
+// In-place Cooley-Tukey FFT
+void fft(std::vector<float> & real, std::vector<float> & imag);
+
+/**
+ * Compute log mel spectrogram from audio samples, laid out mel-major
+ */
+bool compute_mel_spectrogram(const std::vector<float> & samples,
+                             std::vector<float> & mel_spec,
+                             int & n_frames);
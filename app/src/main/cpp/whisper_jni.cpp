@@ -6,10 +6,8 @@
  */
 
 #include <jni.h>
-#include <android/log.h>
 #include <string>
 #include <vector>
-#include <fstream>
 #include <cmath>
 #include <cstdint>
 #include <algorithm>
@@ -17,19 +15,12 @@
 // llama.cpp includes
 #include "llama.h"
 #include "ggml.h"
+#include "logging.h"
+#include "model_registry.h"
+#include "trace.h"
+#include "whisper_audio.h"
 
-#define TAG "WhisperJNI"
-#define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, TAG, __VA_ARGS__)
-#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, TAG, __VA_ARGS__)
-#define LOGW(...) __android_log_print(ANDROID_LOG_WARN, TAG, __VA_ARGS__)
-#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, TAG, __VA_ARGS__)
-
-// Whisper constants
-#define WHISPER_SAMPLE_RATE 16000
-#define WHISPER_N_FFT 400
-#define WHISPER_N_MEL 80
-#define WHISPER_HOP_LENGTH 160
-#define WHISPER_CHUNK_SIZE 30
+#define LOG_TAG "WhisperJNI"
 
 // Simple Whisper context structure
 struct whisper_context {
@@ -43,380 +34,6 @@ struct whisper_context {
 // Global context pointer
 static whisper_context * g_whisper_ctx = nullptr;
 
-// ============================================================================
-// Audio Processing Functions
-// ============================================================================
-
-/**
- * Read WAV file and return float samples normalized to [-1, 1]
- */
-static bool read_wav_file(const std::string & path, std::vector<float> & samples, int & sample_rate) {
-    std::ifstream file(path, std::ios::binary);
-    if (!file.is_open()) {
-        LOGE("Failed to open WAV file: %s", path.c_str());
-        return false;
-    }
-
-    // Read RIFF header
-    char riff[4];
-    file.read(riff, 4);
-    if (std::string(riff, 4) != "RIFF") {
-        LOGE("Invalid WAV file: missing RIFF header");
-        return false;
-    }
-
-    // Skip file size
-    file.seekg(4, std::ios::cur);
-
-    // Read WAVE format
-    char wave[4];
-    file.read(wave, 4);
-    if (std::string(wave, 4) != "WAVE") {
-        LOGE("Invalid WAV file: missing WAVE format");
-        return false;
-    }
-
-    // Find fmt chunk
-    while (file.good()) {
-        char chunk_id[4];
-        file.read(chunk_id, 4);
-        
-        uint32_t chunk_size;
-        file.read(reinterpret_cast<char*>(&chunk_size), 4);
-
-        if (std::string(chunk_id, 4) == "fmt ") {
-            uint16_t audio_format;
-            file.read(reinterpret_cast<char*>(&audio_format), 2);
-            
-            uint16_t num_channels;
-            file.read(reinterpret_cast<char*>(&num_channels), 2);
-            
-            uint32_t sr;
-            file.read(reinterpret_cast<char*>(&sr), 4);
-            sample_rate = sr;
-            
-            // Skip byte rate and block align
-            file.seekg(6, std::ios::cur);
-            
-            uint16_t bits_per_sample;
-            file.read(reinterpret_cast<char*>(&bits_per_sample), 2);
-            
-            LOGI("WAV format: %d Hz, %d channels, %d bits", sample_rate, num_channels, bits_per_sample);
-            
-            // Skip rest of fmt chunk
-            if (chunk_size > 16) {
-                file.seekg(chunk_size - 16, std::ios::cur);
-            }
-            
-            // Find data chunk
-            while (file.good()) {
-                file.read(chunk_id, 4);
-                file.read(reinterpret_cast<char*>(&chunk_size), 4);
-                
-                if (std::string(chunk_id, 4) == "data") {
-                    int bytes_per_sample = bits_per_sample / 8;
-                    int num_samples = chunk_size / bytes_per_sample / num_channels;
-                    
-                    samples.resize(num_samples);
-                    
-                    if (bits_per_sample == 16) {
-                        std::vector<int16_t> raw_samples(num_samples * num_channels);
-                        file.read(reinterpret_cast<char*>(raw_samples.data()), chunk_size);
-                        
-                        // Convert to mono float
-                        for (int i = 0; i < num_samples; i++) {
-                            float sum = 0.0f;
-                            for (int c = 0; c < num_channels; c++) {
-                                sum += raw_samples[i * num_channels + c];
-                            }
-                            samples[i] = (sum / num_channels) / 32768.0f;
-                        }
-                    } else if (bits_per_sample == 32) {
-                        std::vector<float> raw_samples(num_samples * num_channels);
-                        file.read(reinterpret_cast<char*>(raw_samples.data()), chunk_size);
-                        
-                        // Convert to mono
-                        for (int i = 0; i < num_samples; i++) {
-                            float sum = 0.0f;
-                            for (int c = 0; c < num_channels; c++) {
-                                sum += raw_samples[i * num_channels + c];
-                            }
-                            samples[i] = sum / num_channels;
-                        }
-                    } else {
-                        LOGE("Unsupported bits per sample: %d", bits_per_sample);
-                        return false;
-                    }
-                    
-                    LOGI("Loaded %d samples from WAV", num_samples);
-                    return true;
-                } else {
-                    file.seekg(chunk_size, std::ios::cur);
-                }
-            }
-        } else {
-            file.seekg(chunk_size, std::ios::cur);
-        }
-    }
-
-    LOGE("Failed to parse WAV file");
-    return false;
-}
-
-/**
- * Simple linear resampling
- */
-static void resample_audio(const std::vector<float> & input, int input_rate,
-                           std::vector<float> & output, int output_rate) {
-    if (input_rate == output_rate) {
-        output = input;
-        return;
-    }
-
-    double ratio = (double)output_rate / input_rate;
-    size_t output_size = (size_t)(input.size() * ratio);
-    output.resize(output_size);
-
-    for (size_t i = 0; i < output_size; i++) {
-        double src_idx = i / ratio;
-        size_t idx0 = (size_t)src_idx;
-        size_t idx1 = std::min(idx0 + 1, input.size() - 1);
-        double frac = src_idx - idx0;
-        
-        output[i] = (float)((1.0 - frac) * input[idx0] + frac * input[idx1]);
-    }
-
-    LOGI("Resampled from %d Hz to %d Hz: %zu -> %zu samples", 
-         input_rate, output_rate, input.size(), output_size);
-}
-
-/**
- * Read raw PCM file (16-bit, 16kHz, mono)
- */
-static bool read_raw_pcm(const std::string & path, std::vector<float> & samples) {
-    std::ifstream file(path, std::ios::binary | std::ios::ate);
-    if (!file.is_open()) {
-        LOGE("Failed to open PCM file: %s", path.c_str());
-        return false;
-    }
-
-    size_t file_size = file.tellg();
-    file.seekg(0, std::ios::beg);
-
-    size_t num_samples = file_size / 2;  // 16-bit samples
-    std::vector<int16_t> raw_samples(num_samples);
-    file.read(reinterpret_cast<char*>(raw_samples.data()), file_size);
-
-    samples.resize(num_samples);
-    for (size_t i = 0; i < num_samples; i++) {
-        samples[i] = raw_samples[i] / 32768.0f;
-    }
-
-    LOGI("Loaded %zu raw PCM samples", num_samples);
-    return true;
-}
-
-/**
- * Load audio from file (supports WAV and raw PCM)
- */
-static bool load_audio_file(const std::string & path, std::vector<float> & samples) {
-    int sample_rate = WHISPER_SAMPLE_RATE;
-    
-    // Try WAV first
-    if (path.size() > 4 && 
-        (path.substr(path.size() - 4) == ".wav" || path.substr(path.size() - 4) == ".WAV")) {
-        std::vector<float> raw_samples;
-        if (read_wav_file(path, raw_samples, sample_rate)) {
-            if (sample_rate != WHISPER_SAMPLE_RATE) {
-                resample_audio(raw_samples, sample_rate, samples, WHISPER_SAMPLE_RATE);
-            } else {
-                samples = std::move(raw_samples);
-            }
-            return true;
-        }
-    }
-    
-    // Try raw PCM
-    return read_raw_pcm(path, samples);
-}
-
-// ============================================================================
-// Mel Spectrogram Computation (Whisper-compatible)
-// ============================================================================
-
-// Precomputed mel filterbank for 80 mel bins
-// These values are computed to match OpenAI Whisper's mel filterbank
-static std::vector<float> get_mel_filters() {
-    // Whisper uses 80 mel bins with n_fft=400
-    // This is a simplified filterbank - for production, use whisper.cpp's implementation
-    std::vector<float> filters(WHISPER_N_MEL * (WHISPER_N_FFT / 2 + 1), 0.0f);
-    
-    const int n_fft = WHISPER_N_FFT;
-    const int n_mel = WHISPER_N_MEL;
-    const int n_freqs = n_fft / 2 + 1;
-    const float sample_rate = WHISPER_SAMPLE_RATE;
-    const float fmin = 0.0f;
-    const float fmax = sample_rate / 2.0f;
-    
-    // Mel scale conversion
-    auto hz_to_mel = [](float hz) -> float {
-        return 2595.0f * std::log10(1.0f + hz / 700.0f);
-    };
-    
-    auto mel_to_hz = [](float mel) -> float {
-        return 700.0f * (std::pow(10.0f, mel / 2595.0f) - 1.0f);
-    };
-    
-    float mel_min = hz_to_mel(fmin);
-    float mel_max = hz_to_mel(fmax);
-    
-    std::vector<float> mel_points(n_mel + 2);
-    for (int i = 0; i < n_mel + 2; i++) {
-        float mel = mel_min + (mel_max - mel_min) * i / (n_mel + 1);
-        mel_points[i] = mel_to_hz(mel);
-    }
-    
-    // Create triangular filters
-    for (int m = 0; m < n_mel; m++) {
-        float f_left = mel_points[m];
-        float f_center = mel_points[m + 1];
-        float f_right = mel_points[m + 2];
-        
-        for (int k = 0; k < n_freqs; k++) {
-            float freq = k * sample_rate / n_fft;
-            
-            if (freq >= f_left && freq <= f_center) {
-                filters[m * n_freqs + k] = (freq - f_left) / (f_center - f_left);
-            } else if (freq > f_center && freq <= f_right) {
-                filters[m * n_freqs + k] = (f_right - freq) / (f_right - f_center);
-            }
-        }
-    }
-    
-    return filters;
-}
-
-// Simple FFT implementation (Cooley-Tukey)
-static void fft(std::vector<float> & real, std::vector<float> & imag) {
-    int n = real.size();
-    if (n <= 1) return;
-    
-    // Bit reversal permutation
-    for (int i = 1, j = 0; i < n; i++) {
-        int bit = n >> 1;
-        for (; j & bit; bit >>= 1) {
-            j ^= bit;
-        }
-        j ^= bit;
-        
-        if (i < j) {
-            std::swap(real[i], real[j]);
-            std::swap(imag[i], imag[j]);
-        }
-    }
-    
-    // Cooley-Tukey iterative FFT
-    for (int len = 2; len <= n; len <<= 1) {
-        float angle = -2 * M_PI / len;
-        float wpr = std::cos(angle);
-        float wpi = std::sin(angle);
-        
-        for (int i = 0; i < n; i += len) {
-            float wr = 1.0f, wi = 0.0f;
-            
-            for (int j = 0; j < len / 2; j++) {
-                float tempr = wr * real[i + j + len/2] - wi * imag[i + j + len/2];
-                float tempi = wr * imag[i + j + len/2] + wi * real[i + j + len/2];
-                
-                real[i + j + len/2] = real[i + j] - tempr;
-                imag[i + j + len/2] = imag[i + j] - tempi;
-                real[i + j] += tempr;
-                imag[i + j] += tempi;
-                
-                float wtemp = wr;
-                wr = wr * wpr - wi * wpi;
-                wi = wi * wpr + wtemp * wpi;
-            }
-        }
-    }
-}
-
-/**
- * Compute log mel spectrogram from audio samples
- */
-static bool compute_mel_spectrogram(const std::vector<float> & samples,
-                                    std::vector<float> & mel_spec,
-                                    int & n_frames) {
-    const int n_fft = WHISPER_N_FFT;
-    const int n_mel = WHISPER_N_MEL;
-    const int hop_length = WHISPER_HOP_LENGTH;
-    const int n_samples = samples.size();
-    
-    // Pad samples to ensure we have complete frames
-    int padded_length = n_samples + n_fft;
-    std::vector<float> padded(padded_length, 0.0f);
-    std::copy(samples.begin(), samples.end(), padded.begin() + n_fft / 2);
-    
-    // Calculate number of frames
-    n_frames = (padded_length - n_fft) / hop_length + 1;
-    
-    // Get mel filterbank
-    std::vector<float> mel_filters = get_mel_filters();
-    
-    // Hann window
-    std::vector<float> hann(n_fft);
-    for (int i = 0; i < n_fft; i++) {
-        hann[i] = 0.5f * (1.0f - std::cos(2.0f * M_PI * i / n_fft));
-    }
-    
-    // Allocate mel spectrogram
-    mel_spec.resize(n_mel * n_frames);
-    
-    // Process each frame
-    for (int frame = 0; frame < n_frames; frame++) {
-        int start = frame * hop_length;
-        
-        // Apply window and prepare for FFT
-        std::vector<float> real(n_fft);
-        std::vector<float> imag(n_fft, 0.0f);
-        
-        for (int i = 0; i < n_fft; i++) {
-            real[i] = padded[start + i] * hann[i];
-        }
-        
-        // Compute FFT
-        fft(real, imag);
-        
-        // Compute power spectrum (only positive frequencies)
-        std::vector<float> power(n_fft / 2 + 1);
-        for (int i = 0; i <= n_fft / 2; i++) {
-            power[i] = real[i] * real[i] + imag[i] * imag[i];
-        }
-        
-        // Apply mel filterbank
-        for (int m = 0; m < n_mel; m++) {
-            float sum = 0.0f;
-            for (int k = 0; k <= n_fft / 2; k++) {
-                sum += mel_filters[m * (n_fft / 2 + 1) + k] * power[k];
-            }
-            
-            // Log mel spectrogram with floor
-            sum = std::max(sum, 1e-10f);
-            mel_spec[m * n_frames + frame] = std::log10(sum);
-        }
-    }
-    
-    // Normalize (match Whisper's normalization)
-    float max_val = *std::max_element(mel_spec.begin(), mel_spec.end());
-    for (auto & val : mel_spec) {
-        val = std::max(val, max_val - 8.0f);
-        val = (val + 4.0f) / 4.0f;
-    }
-    
-    LOGI("Computed mel spectrogram: %d frames x %d mels", n_frames, n_mel);
-    return true;
-}
-
 // ============================================================================
 // JNI Functions
 // ============================================================================
@@ -439,11 +56,11 @@ Java_com_localllm_app_inference_WhisperAndroid_whisperInit(
     llama_backend_init();
     
     // Load model parameters
-    llama_model_params model_params = llama_model_default_params();
+    model_registry_params model_params;
     model_params.n_gpu_layers = 0;  // CPU only for now
     
-    // Load the model
-    ctx->model = llama_model_load_from_file(path, model_params);
+    // Load the model through the shared registry so it is accounted with chat models
+    ctx->model = model_registry_acquire(path, model_params);
     env->ReleaseStringUTFChars(model_path, path);
     
     if (!ctx->model) {
@@ -460,7 +77,7 @@ Java_com_localllm_app_inference_WhisperAndroid_whisperInit(
     ctx->ctx = llama_init_from_model(ctx->model, ctx_params);
     if (!ctx->ctx) {
         LOGE("Failed to create Whisper context");
-        llama_model_free(ctx->model);
+        model_registry_release(ctx->model);
         delete ctx;
         return 0;
     }
@@ -484,7 +101,7 @@ Java_com_localllm_app_inference_WhisperAndroid_whisperFree(
             llama_free(ctx->ctx);
         }
         if (ctx->model) {
-            llama_model_free(ctx->model);
+            model_registry_release(ctx->model);
         }
         delete ctx;
         
@@ -505,6 +122,7 @@ Java_com_localllm_app_inference_WhisperAndroid_whisperTranscribe(
         jstring language,
         jboolean translate) {
     
+    TRACE_SCOPE("whisperTranscribe");
     whisper_context * ctx = reinterpret_cast<whisper_context *>(context_ptr);
     if (!ctx || !ctx->is_loaded) {
         LOGE("Whisper context not initialized");
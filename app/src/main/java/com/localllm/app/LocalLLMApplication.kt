@@ -1,11 +1,16 @@
 package com.localllm.app
 
 import android.app.Application
+import com.localllm.app.inference.ModelManager
 import dagger.hilt.android.HiltAndroidApp
+import javax.inject.Inject
 
 @HiltAndroidApp
 class LocalLLMApplication : Application() {
     
+    @Inject
+    lateinit var modelManager: ModelManager
+    
     override fun onCreate() {
         super.onCreate()
         
@@ -13,6 +18,13 @@ class LocalLLMApplication : Application() {
         initializeNativeLibrary()
     }
     
+    override fun onTrimMemory(level: Int) {
+        super.onTrimMemory(level)
+        
+        // Give back native caches and idle model memory before the system kills us
+        modelManager.trimMemory(level)
+    }
+    
     private fun initializeNativeLibrary() {
         try {
             System.loadLibrary("llama-android")
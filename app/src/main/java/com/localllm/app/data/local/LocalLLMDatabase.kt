@@ -24,7 +24,7 @@ import com.localllm.app.rag.DocumentChunkEntity
         ChatMessage::class,
         DocumentChunkEntity::class
     ],
-    version = 5,
+    version = 6,
     exportSchema = false
 )
 @TypeConverters(ModelTypeConverters::class, MessageRoleConverter::class)
@@ -94,6 +94,15 @@ abstract class LocalLLMDatabase : RoomDatabase() {
                 database.execSQL("CREATE INDEX IF NOT EXISTS index_document_chunks_timestamp ON document_chunks(timestamp)")
             }
         }
+        
+        /**
+         * Migration from version 5 to 6: Add back-references for deduplicated chunks.
+         */
+        val MIGRATION_5_6 = object : Migration(5, 6) {
+            override fun migrate(database: SupportSQLiteDatabase) {
+                database.execSQL("ALTER TABLE document_chunks ADD COLUMN sourceRanges TEXT NOT NULL DEFAULT ''")
+            }
+        }
     }
 }
 
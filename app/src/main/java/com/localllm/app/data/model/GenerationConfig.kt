@@ -11,7 +11,12 @@ data class GenerationConfig(
     val repeatPenalty: Float = 1.1f,
     val contextSize: Int = 2048,
     val stopSequences: List<String> = emptyList(),
-    val seed: Int = -1 // -1 means random seed
+    val seed: Int = -1, // -1 means random seed
+    val cacheNamespace: String? = null, // opt-in to the native response cache
+    val cacheQuery: String? = null, // variable part of the prompt (the user's input), for near-duplicate hits
+    val cacheRefresh: Boolean = false, // generate anew instead of replaying a cached response
+    val ttftBudgetMs: Int = 0, // time to first token budget, 0 = none
+    val totalBudgetMs: Int = 0 // total time budget, 0 = none; shortens the output to fit
 ) {
     companion object {
         /**
@@ -49,6 +54,31 @@ data class GenerationConfig(
     }
 }
 
+/**
+ * Why native generation stopped.
+ */
+enum class StopReason {
+    EOG,         // the model ended its output
+    MAX_TOKENS,
+    BUDGET,      // a time budget ran out or could not be met
+    CANCELLED,
+    CONTEXT,     // the context is full
+    ERROR,
+    UNKNOWN;
+
+    companion object {
+        fun fromNative(name: String): StopReason = when (name) {
+            "eog" -> EOG
+            "max_tokens" -> MAX_TOKENS
+            "budget" -> BUDGET
+            "cancelled" -> CANCELLED
+            "context" -> CONTEXT
+            "error" -> ERROR
+            else -> UNKNOWN
+        }
+    }
+}
+
 /**
  * Represents the result of a generation operation.
  */
@@ -56,7 +86,8 @@ sealed class GenerationResult {
     data class Success(
         val text: String,
         val tokensGenerated: Int,
-        val generationTimeMs: Long
+        val generationTimeMs: Long,
+        val stopReason: StopReason = StopReason.UNKNOWN
     ) : GenerationResult()
 
     data class Error(
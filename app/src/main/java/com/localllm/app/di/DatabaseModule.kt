@@ -32,7 +32,8 @@ object DatabaseModule {
                 LocalLLMDatabase.MIGRATION_1_2,
                 LocalLLMDatabase.MIGRATION_2_3,
                 LocalLLMDatabase.MIGRATION_3_4,
-                LocalLLMDatabase.MIGRATION_4_5
+                LocalLLMDatabase.MIGRATION_4_5,
+                LocalLLMDatabase.MIGRATION_5_6
             )
             .fallbackToDestructiveMigration()
             .build()
@@ -28,9 +28,11 @@ object InferenceModule {
     @Provides
     @Singleton
     fun provideModelManager(
-        llamaAndroid: LlamaAndroid
+        @ApplicationContext context: Context,
+        llamaAndroid: LlamaAndroid,
+        memoryMonitor: MemoryMonitor
     ): ModelManager {
-        return ModelManager(llamaAndroid)
+        return ModelManager(context, llamaAndroid, memoryMonitor)
     }
     
     @Provides
@@ -62,9 +64,10 @@ object InferenceModule {
     @Singleton
     fun provideHardwareCapabilities(
         @ApplicationContext context: Context,
-        memoryMonitor: MemoryMonitor
+        memoryMonitor: MemoryMonitor,
+        llamaAndroid: LlamaAndroid
     ): HardwareCapabilities {
-        return HardwareCapabilities(context, memoryMonitor)
+        return HardwareCapabilities(context, memoryMonitor, llamaAndroid)
     }
     
     @Provides
@@ -6,6 +6,7 @@ import com.localllm.app.data.model.GenerationConfig
 import com.localllm.app.data.model.GenerationResult
 import com.localllm.app.data.model.MessageRole
 import com.localllm.app.data.model.PromptTemplate
+import com.localllm.app.data.model.StopReason
 import kotlinx.coroutines.Dispatchers
 import kotlinx.coroutines.flow.Flow
 import kotlinx.coroutines.flow.flow
@@ -26,6 +27,10 @@ class InferenceEngine @Inject constructor(
 ) {
     companion object {
         private const val TAG = "InferenceEngine"
+
+        // Token allowance per entry of generateList
+        private const val LIST_ENTRY_MAX_TOKENS = 24
+        private val LIST_MARKER = Regex("^(\\d+[.)]|[-*•])\\s*")
     }
 
     /**
@@ -40,6 +45,89 @@ class InferenceEngine @Inject constructor(
         prompt: String,
         config: GenerationConfig = GenerationConfig(),
         onTokenGenerated: (String) -> Unit = {}
+    ): Flow<GenerationResult> = streamGeneration(config, onTokenGenerated) { contextPtr, callback ->
+        llamaAndroid.generateTokens(
+            ctxPtr = contextPtr,
+            prompt = prompt,
+            maxTokens = config.maxTokens,
+            temperature = config.temperature,
+            topP = config.topP,
+            topK = config.topK,
+            repeatPenalty = config.repeatPenalty,
+            callback = callback,
+            cacheNamespace = config.cacheNamespace,
+            cacheQuery = config.cacheQuery,
+            cacheRefresh = config.cacheRefresh,
+            ttftBudgetMs = config.ttftBudgetMs,
+            totalBudgetMs = config.totalBudgetMs
+        )
+    }
+
+    /**
+     * Generate the next reply of a conversation with streaming token output.
+     *
+     * The conversation is kept in a native chat session, so each turn only
+     * tokenizes and decodes the messages added since the previous one. Templates
+     * without a llama.cpp equivalent fall back to [buildPrompt] and a full prefill.
+     *
+     * @param messages Conversation history, ending with the message to answer
+     * @param systemPrompt Optional system prompt
+     * @param promptTemplate The prompt template format to use
+     * @param conversationId Conversation the messages belong to, lets the
+     *        native session keep idle conversations' KV state on disk
+     * @param config Generation configuration
+     * @param onTokenGenerated Callback for each generated token
+     * @return Flow emitting the generation result
+     */
+    fun generateChatStream(
+        messages: List<ChatMessage>,
+        systemPrompt: String? = null,
+        promptTemplate: String = PromptTemplate.CHATML,
+        conversationId: String? = null,
+        config: GenerationConfig = GenerationConfig(),
+        onTokenGenerated: (String) -> Unit = {}
+    ): Flow<GenerationResult> = streamGeneration(config, onTokenGenerated) { contextPtr, callback ->
+        val turns = buildList {
+            if (!systemPrompt.isNullOrBlank()) add("system" to systemPrompt)
+            for (message in messages) {
+                val role = when (message.role) {
+                    MessageRole.USER -> "user"
+                    MessageRole.ASSISTANT -> "assistant"
+                    MessageRole.SYSTEM -> "system"
+                }
+                add(role to message.content)
+            }
+        }
+        llamaAndroid.generateChat(
+            messages = turns,
+            template = promptTemplate,
+            conversationId = conversationId,
+            maxTokens = config.maxTokens,
+            temperature = config.temperature,
+            topP = config.topP,
+            topK = config.topK,
+            callback = callback
+        ) ?: llamaAndroid.generateTokens(
+            ctxPtr = contextPtr,
+            prompt = buildPrompt(messages, systemPrompt, promptTemplate),
+            maxTokens = config.maxTokens,
+            temperature = config.temperature,
+            topP = config.topP,
+            topK = config.topK,
+            repeatPenalty = config.repeatPenalty,
+            callback = callback,
+            cacheNamespace = config.cacheNamespace,
+            cacheQuery = config.cacheQuery,
+            cacheRefresh = config.cacheRefresh,
+            ttftBudgetMs = config.ttftBudgetMs,
+            totalBudgetMs = config.totalBudgetMs
+        )
+    }
+
+    private fun streamGeneration(
+        config: GenerationConfig,
+        onTokenGenerated: (String) -> Unit,
+        generate: (contextPtr: Long, callback: LlamaAndroid.TokenCallback) -> String
     ): Flow<GenerationResult> = flow {
         val contextPtr = modelManager.getContextPtr()
             ?: throw IllegalStateException("No model loaded")
@@ -47,6 +135,8 @@ class InferenceEngine @Inject constructor(
         val startTime = System.currentTimeMillis()
         var tokensGenerated = 0
 
+        var stopReason = StopReason.UNKNOWN
+
         try {
             Log.d(TAG, "Starting generation with ${config.maxTokens} max tokens")
 
@@ -55,19 +145,14 @@ class InferenceEngine @Inject constructor(
                     tokensGenerated++
                     onTokenGenerated(token)
                 }
+
+                override fun onStop(reason: String) {
+                    stopReason = StopReason.fromNative(reason)
+                }
             }
 
             val result = withContext(Dispatchers.Default) {
-                llamaAndroid.generateTokens(
-                    ctxPtr = contextPtr,
-                    prompt = prompt,
-                    maxTokens = config.maxTokens,
-                    temperature = config.temperature,
-                    topP = config.topP,
-                    topK = config.topK,
-                    repeatPenalty = config.repeatPenalty,
-                    callback = callback
-                )
+                generate(contextPtr, callback)
             }
 
             val generationTime = System.currentTimeMillis() - startTime
@@ -76,7 +161,8 @@ class InferenceEngine @Inject constructor(
             emit(GenerationResult.Success(
                 text = result,
                 tokensGenerated = tokensGenerated,
-                generationTimeMs = generationTime
+                generationTimeMs = generationTime,
+                stopReason = stopReason
             ))
         } catch (e: Exception) {
             Log.e(TAG, "Generation failed", e)
@@ -101,11 +187,17 @@ class InferenceEngine @Inject constructor(
         val startTime = System.currentTimeMillis()
         var tokensGenerated = 0
 
+        var stopReason = StopReason.UNKNOWN
+
         try {
             val callback = object : LlamaAndroid.TokenCallback {
                 override fun onToken(token: String) {
                     tokensGenerated++
                 }
+
+                override fun onStop(reason: String) {
+                    stopReason = StopReason.fromNative(reason)
+                }
             }
 
             val result = llamaAndroid.generateTokens(
@@ -116,7 +208,12 @@ class InferenceEngine @Inject constructor(
                 topP = config.topP,
                 topK = config.topK,
                 repeatPenalty = config.repeatPenalty,
-                callback = callback
+                callback = callback,
+                cacheNamespace = config.cacheNamespace,
+                cacheQuery = config.cacheQuery,
+                cacheRefresh = config.cacheRefresh,
+                ttftBudgetMs = config.ttftBudgetMs,
+                totalBudgetMs = config.totalBudgetMs
             )
 
             val generationTime = System.currentTimeMillis() - startTime
@@ -124,13 +221,124 @@ class InferenceEngine @Inject constructor(
             GenerationResult.Success(
                 text = result,
                 tokensGenerated = tokensGenerated,
-                generationTimeMs = generationTime
+                generationTimeMs = generationTime,
+                stopReason = stopReason
             )
         } catch (e: Exception) {
             GenerationResult.Error(e.message ?: "Unknown error", e)
         }
     }
 
+    /**
+     * Generate several candidate completions of one prompt at the cost of one
+     * prefill: the candidates are decoded side by side in the same batch.
+     *
+     * @param prompt The input prompt
+     * @param count Number of candidates
+     * @param config Generation configuration, applied to every candidate
+     * @param onTokenGenerated Callback with the candidate index for each generated token
+     * @return The candidates in order, or null on error
+     */
+    suspend fun generateCompletions(
+        prompt: String,
+        count: Int,
+        config: GenerationConfig = GenerationConfig(),
+        onTokenGenerated: (index: Int, token: String) -> Unit = { _, _ -> }
+    ): List<String>? = withContext(Dispatchers.Default) {
+        if (modelManager.getContextPtr() == null) return@withContext null
+        val callback = object : LlamaAndroid.ParallelCallback {
+            override fun onToken(index: Int, token: String) = onTokenGenerated(index, token)
+            override fun onComplete(index: Int, text: String) {}
+        }
+        llamaAndroid.generateCompletions(
+            prompt = prompt,
+            count = count,
+            maxTokens = config.maxTokens,
+            temperature = config.temperature,
+            topP = config.topP,
+            topK = config.topK,
+            callback = callback
+        )
+    }
+
+    /**
+     * Generate a short list, one entry per line, such as the concepts a batch
+     * of items should cover. Numbering and bullets are stripped.
+     *
+     * @param prompt Prompt asking for the list
+     * @param count Maximum number of entries
+     * @param config Generation configuration; maxTokens is derived from count
+     * @return The distinct entries, empty if generation failed
+     */
+    suspend fun generateList(
+        prompt: String,
+        count: Int,
+        config: GenerationConfig = GenerationConfig()
+    ): List<String> {
+        val result = generate(prompt, config.copy(maxTokens = count * LIST_ENTRY_MAX_TOKENS))
+        if (result !is GenerationResult.Success) return emptyList()
+        return result.text.lines()
+            .map { it.trim().replace(LIST_MARKER, "").trim() }
+            .filter { it.isNotEmpty() }
+            .distinct()
+            .take(count)
+    }
+
+    /**
+     * Generate one item per suffix after a shared prefix, such as one flashcard
+     * per concept. The prefix is prefilled once and the items are decoded
+     * together, so the batch takes about as long as its longest item.
+     * It runs as background work: chat and other interactive generation
+     * started meanwhile pause it until they are done.
+     *
+     * @param prefix Text every item prompt starts with, ending at a newline
+     * @param suffixes Rest of each item's prompt
+     * @param config Generation configuration, applied to every item. With a
+     *   cacheNamespace each item is looked up in the response cache as prefix +
+     *   suffix, with the suffix as its query; cacheQuery is not used.
+     * @param onItemComplete Called with the item index as soon as an item finishes
+     * @return The items in suffix order, or null on error
+     */
+    suspend fun generateBatch(
+        prefix: String,
+        suffixes: List<String>,
+        config: GenerationConfig = GenerationConfig(),
+        onItemComplete: (index: Int, text: String) -> Unit = { _, _ -> }
+    ): List<String>? = withContext(Dispatchers.Default) {
+        if (modelManager.getContextPtr() == null) return@withContext null
+        val callback = object : LlamaAndroid.ParallelCallback {
+            override fun onToken(index: Int, token: String) {}
+            override fun onComplete(index: Int, text: String) = onItemComplete(index, text)
+        }
+        llamaAndroid.generateBatch(
+            prefix = prefix,
+            suffixes = suffixes,
+            maxTokens = config.maxTokens,
+            temperature = config.temperature,
+            topP = config.topP,
+            topK = config.topK,
+            callback = callback,
+            cacheNamespace = config.cacheNamespace,
+            cacheRefresh = config.cacheRefresh
+        )
+    }
+
+    /**
+     * Prepare a KV snapshot of a feature's fixed prompt preamble, so that
+     * generations whose prompt starts with it only prefill the rest.
+     * Computes the snapshot once per model; later calls only look it up.
+     *
+     * @param name Feature name, e.g. "quiz"
+     * @param preamble Exact text the feature's prompts start with
+     * @return true if the snapshot is ready
+     */
+    suspend fun preparePreamble(name: String, preamble: String): Boolean = withContext(Dispatchers.Default) {
+        if (modelManager.getContextPtr() == null) return@withContext false
+        llamaAndroid.preparePromptSnapshot(name, preamble).also { ready ->
+            if (!ready) Log.d(TAG, "Preamble snapshot '$name' not prepared")
+        }
+    }
+
     /**
      * Cancel ongoing generation.
      */
@@ -139,6 +347,14 @@ class InferenceEngine @Inject constructor(
         Log.d(TAG, "Generation cancelled")
     }
 
+    /**
+     * Cancel a running background batch (generateBatch).
+     */
+    fun cancelBackgroundGeneration() {
+        llamaAndroid.cancelBackgroundGeneration()
+        Log.d(TAG, "Background generation cancelled")
+    }
+
     /**
      * Check if generation is currently in progress.
      */
@@ -18,14 +18,84 @@ class LlamaAndroid @Inject constructor() {
     // Store model and context pointers
     private var modelPtr: Long = 0
     private var contextPtr: Long = 0
+    private var chatSessionPtr: Long = 0
+    private var chatSessionTemplate: String? = null
 
     /**
      * Callback interface for streaming token generation.
      */
     interface TokenCallback {
         fun onToken(token: String)
+
+        /**
+         * Why this request stopped: "eog", "max_tokens", "budget", "cancelled",
+         * "context" or "error". Called once before the native call returns.
+         */
+        fun onStop(reason: String) {}
+    }
+
+    /**
+     * Callback interface for generations decoded in parallel, identified by index.
+     */
+    interface ParallelCallback {
+        fun onToken(index: Int, token: String)
+        fun onComplete(index: Int, text: String)
+    }
+
+    /**
+     * Element type of the KV cache. Values are ggml type ids.
+     * Quantized V caches need flash attention, which is enabled automatically.
+     */
+    enum class KvCacheType(val ggmlType: Int) {
+        F16(1),
+        Q8_0(8),
+        Q4_0(2)
+    }
+
+    /**
+     * Flash attention mode. AUTO lets llama.cpp enable it when the backend supports it.
+     */
+    enum class FlashAttention(val mode: Int) {
+        AUTO(-1),
+        DISABLED(0),
+        ENABLED(1)
+    }
+
+    /**
+     * Minimum level of native log messages. Release builds compile DEBUG out.
+     */
+    enum class NativeLogLevel(val level: Int) {
+        DEBUG(0),
+        INFO(1),
+        WARN(2),
+        ERROR(3)
+    }
+
+    /**
+     * Native memory trim levels; each level also does everything below it.
+     */
+    enum class TrimLevel(val level: Int) {
+        CACHES(1),      // response and tokenizer caches
+        SEQUENCES(2),   // parked chat branches, conversations spilled to disk, grown KV caches, idle pooled contexts
+        PAGES(3),       // resident pages of idle memory-mapped models
+        MODELS(4)       // idle models kept warm for fast switching
     }
 
+    /**
+     * Context options beyond size and threads, kept so prewarmed contexts match.
+     */
+    data class ContextOptions(
+        val batchSize: Int = 512,
+        val ubatchSize: Int = 0,
+        val kvCacheTypeK: KvCacheType = KvCacheType.F16,
+        val kvCacheTypeV: KvCacheType = KvCacheType.F16,
+        val flashAttention: FlashAttention = FlashAttention.AUTO,
+        // Start with a small KV cache and grow it up to the context size as the conversation needs
+        val growKvCache: Boolean = true
+    )
+
+    private var contextOptions = ContextOptions()
+
     companion object {
         private const val TAG = "LlamaAndroid"
         private var nativeLoaded = false
@@ -91,6 +161,7 @@ class LlamaAndroid @Inject constructor() {
      * @param useMmap Use memory-mapped file loading (recommended)
      * @param useNNAPI Legacy parameter (unused, use gpuLayers instead)
      * @param gpuLayers Number of model layers to offload to GPU (0 = CPU only)
+     * @param options KV cache type, flash attention and batch sizes for the context
      */
     fun loadModel(
         modelPath: String,
@@ -98,7 +169,8 @@ class LlamaAndroid @Inject constructor() {
         contextSize: Int = 2048,
         useMmap: Boolean = true,
         useNNAPI: Boolean = false,
-        gpuLayers: Int = 0
+        gpuLayers: Int = 0,
+        options: ContextOptions = ContextOptions()
     ): Long {
         if (stubMode) {
             Log.d(TAG, "[STUB] loadModel called with path: $modelPath, gpuLayers: $gpuLayers")
@@ -121,8 +193,19 @@ class LlamaAndroid @Inject constructor() {
             }
             
             // Create context
-            Log.i(TAG, "Creating context...")
-            contextPtr = createContextNative(modelPtr, contextSize, 512, threads)
+            Log.i(TAG, "Creating context with $options")
+            contextOptions = options
+            contextPtr = createContextNative(
+                modelPtr,
+                contextSize,
+                options.batchSize,
+                options.ubatchSize,
+                threads,
+                options.kvCacheTypeK.ggmlType,
+                options.kvCacheTypeV.ggmlType,
+                options.flashAttention.mode,
+                options.growKvCache
+            )
             Log.i(TAG, "createContextNative returned: $contextPtr")
             
             if (contextPtr == 0L) {
@@ -156,9 +239,308 @@ class LlamaAndroid @Inject constructor() {
         modelPtr: Long,
         nCtx: Int,
         nBatch: Int,
-        nThreads: Int
+        nUbatch: Int,
+        nThreads: Int,
+        typeK: Int,
+        typeV: Int,
+        flashAttn: Int,
+        growKv: Boolean
     ): Long
 
+    /**
+     * Estimate the KV cache size in bytes for the loaded model without allocating it.
+     */
+    fun estimateKvCacheBytes(
+        contextSize: Int,
+        typeK: KvCacheType = KvCacheType.F16,
+        typeV: KvCacheType = KvCacheType.F16
+    ): Long {
+        if (stubMode || modelPtr == 0L) return 0
+        return estimateKvCacheBytesNative(modelPtr, contextSize, typeK.ggmlType, typeV.ggmlType)
+    }
+
+    private external fun estimateKvCacheBytesNative(
+        modelPtr: Long,
+        nCtx: Int,
+        typeK: Int,
+        typeV: Int
+    ): Long
+
+    /**
+     * Pre-create idle contexts for the loaded model so that the next context
+     * creation with the same size is served from the native pool.
+     *
+     * @return Number of contexts created
+     */
+    fun prewarmContexts(contextSize: Int, threads: Int, count: Int = 1): Int {
+        if (stubMode || modelPtr == 0L) return 0
+        val options = contextOptions
+        return prewarmContextsNative(
+            modelPtr,
+            contextSize,
+            options.batchSize,
+            options.ubatchSize,
+            threads,
+            options.kvCacheTypeK.ggmlType,
+            options.kvCacheTypeV.ggmlType,
+            options.flashAttention.mode,
+            options.growKvCache,
+            count
+        )
+    }
+
+    private external fun prewarmContextsNative(
+        modelPtr: Long,
+        nCtx: Int,
+        nBatch: Int,
+        nUbatch: Int,
+        nThreads: Int,
+        typeK: Int,
+        typeV: Int,
+        flashAttn: Int,
+        growKv: Boolean,
+        count: Int
+    ): Int
+
+    /**
+     * Get native context pool statistics as JSON string.
+     */
+    fun getContextPoolStats(): String {
+        if (stubMode) return "{}"
+        return getContextPoolStatsNative()
+    }
+
+    private external fun getContextPoolStatsNative(): String
+
+    /**
+     * Get KV cache growth statistics and current context sizes as JSON string.
+     */
+    fun getContextGrowthStats(): String {
+        if (stubMode) return "{}"
+        return getContextGrowthStatsNative()
+    }
+
+    private external fun getContextGrowthStatsNative(): String
+
+    /**
+     * Configure the persistent threadpools attached to new contexts.
+     *
+     * @param enabled Pin inference workers to the performance cores
+     * @param pollLevel 0-100, how long workers spin between graphs before sleeping
+     * @param strictPinning Pin each worker to a single core
+     */
+    fun configureThreadpool(enabled: Boolean = true, pollLevel: Int = 50, strictPinning: Boolean = false) {
+        if (stubMode) return
+        configureThreadpoolNative(enabled, pollLevel, strictPinning)
+    }
+
+    private external fun configureThreadpoolNative(enabled: Boolean, poll: Int, strictCpu: Boolean)
+
+    /**
+     * Number of performance cores detected from sysfs, 0 in stub mode.
+     */
+    fun getPerformanceCoreCount(): Int {
+        if (stubMode) return 0
+        return try {
+            getPerformanceCoreCountNative()
+        } catch (e: UnsatisfiedLinkError) {
+            0
+        }
+    }
+
+    private external fun getPerformanceCoreCountNative(): Int
+
+    /**
+     * Get threadpool configuration and detected CPU clusters as JSON string.
+     */
+    fun getThreadpoolStats(): String {
+        if (stubMode) return "{}"
+        return getThreadpoolStatsNative()
+    }
+
+    private external fun getThreadpoolStatsNative(): String
+
+    /**
+     * Set the directory where auto-tune results are persisted.
+     */
+    fun setAutoTuneStoreDir(dir: String) {
+        if (stubMode) return
+        setAutoTuneStoreDirNative(dir)
+    }
+
+    private external fun setAutoTuneStoreDirNative(dir: String)
+
+    /**
+     * Enable or disable applying auto-tuned configurations to new contexts.
+     */
+    fun setAutoTuneEnabled(enabled: Boolean) {
+        if (stubMode) return
+        setAutoTuneEnabledNative(enabled)
+    }
+
+    private external fun setAutoTuneEnabledNative(enabled: Boolean)
+
+    /**
+     * Benchmark thread count, batch sizes, KV cache type and flash attention
+     * for the loaded model. Blocks for up to maxSeconds plus one trial.
+     * A generation request aborts the run without storing results.
+     *
+     * @return Stored Pareto-best configurations as JSON string
+     */
+    fun runAutoTune(maxSeconds: Float = 60f): String {
+        if (stubMode || modelPtr == 0L) return "{}"
+        return runAutoTuneNative(modelPtr, maxSeconds)
+    }
+
+    private external fun runAutoTuneNative(modelPtr: Long, maxSeconds: Float): String
+
+    /**
+     * Stop a running auto-tune and wait until it has returned.
+     */
+    fun abortAutoTune() {
+        if (stubMode) return
+        abortAutoTuneNative()
+    }
+
+    private external fun abortAutoTuneNative()
+
+    /**
+     * Check whether tuned configurations exist for the loaded model on this device.
+     */
+    fun hasAutoTuneResults(): Boolean {
+        if (stubMode || modelPtr == 0L) return false
+        return hasAutoTuneResultsNative(modelPtr)
+    }
+
+    private external fun hasAutoTuneResultsNative(modelPtr: Long): Boolean
+
+    /**
+     * Get tuned configurations for the loaded model as JSON string.
+     */
+    fun getAutoTuneResults(): String {
+        if (stubMode || modelPtr == 0L) return "{}"
+        return getAutoTuneResultsNative(modelPtr)
+    }
+
+    private external fun getAutoTuneResultsNative(modelPtr: Long): String
+
+    /**
+     * Enable or disable online tuning of the decode thread count.
+     * Prefill always uses the thread count the context was created with.
+     *
+     * @param reset Discard the latencies measured so far
+     */
+    fun setDecodeThreadTuning(enabled: Boolean, reset: Boolean = false) {
+        if (stubMode) return
+        setDecodeThreadTuningNative(enabled, reset)
+    }
+
+    private external fun setDecodeThreadTuningNative(enabled: Boolean, reset: Boolean)
+
+    /**
+     * Get the tuned decode thread count and measured latencies per model as JSON string.
+     */
+    fun getDecodeThreadStats(): String {
+        if (stubMode) return "{}"
+        return getDecodeThreadStatsNative()
+    }
+
+    private external fun getDecodeThreadStatsNative(): String
+
+    /**
+     * Get the metrics of the most recent generation as JSON string: tokenize,
+     * prefill, sampling, decode and callback time, throughput, TTFT and KV cells used.
+     */
+    fun getLastGenerationMetrics(): String {
+        if (stubMode) return "{}"
+        return getLastGenerationMetricsNative()
+    }
+
+    private external fun getLastGenerationMetricsNative(): String
+
+    /**
+     * Get rolling per-model distributions (TTFT, prefill/decode tok/s and a
+     * per-token latency histogram) over recent generations as JSON string.
+     */
+    fun getGenerationMetrics(): String {
+        if (stubMode) return "{}"
+        return getGenerationMetricsNative()
+    }
+
+    private external fun getGenerationMetricsNative(): String
+
+    /**
+     * Clear the recorded generation metrics.
+     */
+    fun resetGenerationMetrics() {
+        if (stubMode) return
+        resetGenerationMetricsNative()
+    }
+
+    private external fun resetGenerationMetricsNative()
+
+    /**
+     * Enable or disable native trace spans (decode, sampling, detokenize,
+     * callbacks, mel computation). Recording costs almost nothing while disabled.
+     *
+     * @param clear Discard spans recorded so far
+     */
+    fun setTraceEnabled(enabled: Boolean, clear: Boolean = false) {
+        if (stubMode) return
+        setTraceEnabledNative(enabled, clear)
+    }
+
+    private external fun setTraceEnabledNative(enabled: Boolean, clear: Boolean)
+
+    /**
+     * Write buffered trace spans to a Chrome Trace Event JSON file that can be
+     * opened in Perfetto (ui.perfetto.dev).
+     *
+     * @return Number of spans written, or -1 if the file could not be written
+     */
+    fun dumpTrace(path: String): Int {
+        if (stubMode) return 0
+        return dumpTraceNative(path)
+    }
+
+    private external fun dumpTraceNative(path: String): Int
+
+    /**
+     * Get tracing state and buffer usage as JSON string.
+     */
+    fun getTraceStats(): String {
+        if (stubMode) return "{}"
+        return getTraceStatsNative()
+    }
+
+    private external fun getTraceStatsNative(): String
+
+    /**
+     * Set the native log level and where messages below ERROR go.
+     *
+     * @param useRing Buffer messages in memory and write them to logcat only on
+     *   [dumpNativeLog] or before an error (the release default), instead of
+     *   writing each one to logcat immediately
+     */
+    fun setNativeLogLevel(level: NativeLogLevel, useRing: Boolean = true) {
+        if (stubMode) return
+        setNativeLogLevelNative(level.level, useRing)
+    }
+
+    private external fun setNativeLogLevelNative(level: Int, useRing: Boolean)
+
+    /**
+     * Write buffered native log messages to logcat.
+     *
+     * @return Number of messages written
+     */
+    fun dumpNativeLog(): Int {
+        if (stubMode) return 0
+        return dumpNativeLogNative()
+    }
+
+    private external fun dumpNativeLogNative(): Int
+
     /**
      * Free a loaded model and its context.
      */
@@ -170,6 +552,7 @@ class LlamaAndroid @Inject constructor() {
             return
         }
         
+        freeChatSession()
         if (contextPtr != 0L) {
             freeContextNative(contextPtr)
             contextPtr = 0
@@ -183,8 +566,69 @@ class LlamaAndroid @Inject constructor() {
     private external fun freeModelNative(modelPtr: Long): Unit
     private external fun freeContextNative(ctxPtr: Long): Unit
 
+    /**
+     * Set the RAM budget for resident models. Models released by their owner stay
+     * loaded while they fit the budget, so switching back to them skips the reload.
+     *
+     * @param budgetBytes Budget in bytes (0 = free models as soon as they are released)
+     */
+    fun setModelMemoryBudget(budgetBytes: Long) {
+        if (stubMode) {
+            Log.d(TAG, "[STUB] setModelMemoryBudget called")
+            return
+        }
+        setModelMemoryBudgetNative(budgetBytes)
+    }
+
+    private external fun setModelMemoryBudgetNative(budgetBytes: Long)
+
+    /**
+     * Free native memory up to the given level without waiting for a running
+     * generation (its context is then left alone).
+     * @return JSON report of the bytes each step freed
+     */
+    fun trimMemory(level: TrimLevel): String {
+        if (stubMode) return "{}"
+        return trimMemoryNative(level.level)
+    }
+
+    private external fun trimMemoryNative(level: Int): String
+
+    /**
+     * Get trim counts per level and total bytes freed as JSON string.
+     */
+    fun getMemoryTrimStats(): String {
+        if (stubMode) return "{}"
+        return getMemoryTrimStatsNative()
+    }
+
+    private external fun getMemoryTrimStatsNative(): String
+
+    /**
+     * Get the native model registry state as JSON string.
+     */
+    fun getModelRegistryStats(): String {
+        if (stubMode) return "{}"
+        return getModelRegistryStatsNative()
+    }
+
+    private external fun getModelRegistryStatsNative(): String
+
     /**
      * Generate tokens from a prompt with streaming callback support.
+     *
+     * @param cacheNamespace When non-null, the response may be served from (and is
+     *        stored in) the native response cache under this namespace.
+     * @param cacheQuery Variable part of the prompt, such as the user's topic. At
+     *        temperature 0 a request whose prompt differs from a cached one only
+     *        by a near-identical query reuses its response; otherwise only an
+     *        identical prompt does.
+     * @param cacheRefresh Skip the lookup and replace the cached response, e.g.
+     *        when the user asks for another answer to the same prompt
+     * @param ttftBudgetMs Time to first token budget in ms, 0 for none
+     * @param totalBudgetMs Total time budget in ms, 0 for none. Requests that cannot
+     *        meet their budgets at the model's measured speed return an empty string
+     *        at once; see [TokenCallback.onStop].
      */
     fun generateTokens(
         ctxPtr: Long,
@@ -194,7 +638,12 @@ class LlamaAndroid @Inject constructor() {
         topP: Float = 0.9f,
         topK: Int = 40,
         repeatPenalty: Float = 1.1f,
-        callback: TokenCallback? = null
+        callback: TokenCallback? = null,
+        cacheNamespace: String? = null,
+        cacheQuery: String? = null,
+        cacheRefresh: Boolean = false,
+        ttftBudgetMs: Int = 0,
+        totalBudgetMs: Int = 0
     ): String {
         if (stubMode) {
             Log.d(TAG, "[STUB] generateTokens called with prompt: ${prompt.take(50)}...")
@@ -224,7 +673,8 @@ class LlamaAndroid @Inject constructor() {
         
         return generateNative(
             contextPtr, modelPtr, prompt, maxTokens,
-            temperature, topP, topK, repeatPenalty, callback
+            temperature, topP, topK, repeatPenalty, callback, cacheNamespace,
+            cacheQuery, cacheRefresh, ttftBudgetMs, totalBudgetMs
         )
     }
     
@@ -237,9 +687,304 @@ class LlamaAndroid @Inject constructor() {
         topP: Float,
         topK: Int,
         repeatPenalty: Float,
+        callback: TokenCallback?,
+        cacheNamespace: String?,
+        cacheQuery: String?,
+        cacheRefresh: Boolean,
+        ttftBudgetMs: Int,
+        totalBudgetMs: Int
+    ): String
+
+    /**
+     * Why the last generateTokens or generateChat call in the process stopped:
+     * "eog", "max_tokens", "budget", "cancelled", "context", "error" or "none".
+     * Another generation may finish in between; a caller wanting the reason for
+     * its own request uses [TokenCallback.onStop].
+     */
+    fun getLastStopReason(): String {
+        if (stubMode) return "none"
+        return getLastStopReasonNative()
+    }
+
+    private external fun getLastStopReasonNative(): String
+
+    /**
+     * Generate the next assistant reply of a conversation through the native
+     * chat session. The session renders the conversation with the model's chat
+     * template and keeps it in the KV cache, so only messages added or changed
+     * since the previous call are tokenized and decoded.
+     *
+     * @param messages Full conversation as (role, content) pairs with roles
+     *        "system", "user" or "assistant", ending with the message to answer
+     * @param template App prompt template id, see PromptTemplate
+     * @param conversationId Id of the conversation; switching ids spills the
+     *        previous conversation's KV state to disk, and coming back to it
+     *        reads that state instead of prefilling it again
+     * @return The reply, or null when the template has no native equivalent
+     *         and the caller has to build the prompt itself
+     */
+    fun generateChat(
+        messages: List<Pair<String, String>>,
+        template: String,
+        conversationId: String? = null,
+        maxTokens: Int = 512,
+        temperature: Float = 0.7f,
+        topP: Float = 0.9f,
+        topK: Int = 40,
+        callback: TokenCallback? = null
+    ): String? {
+        if (stubMode || modelPtr == 0L || contextPtr == 0L) return null
+        val session = chatSession(template)
+        if (session == 0L) return null
+        return chatSessionGenerateNative(
+            session,
+            contextPtr,
+            conversationId ?: "",
+            Array(messages.size) { messages[it].first },
+            Array(messages.size) { messages[it].second },
+            maxTokens, temperature, topP, topK, callback
+        )
+    }
+
+    /**
+     * Forget the conversation held by the chat session, e.g. when switching conversations.
+     */
+    fun resetChatSession() {
+        if (chatSessionPtr != 0L) resetChatSessionNative(chatSessionPtr)
+    }
+
+    /**
+     * Get chat session token reuse statistics as JSON string.
+     */
+    fun getChatSessionStats(): String {
+        if (stubMode || chatSessionPtr == 0L) return "{}"
+        return getChatSessionStatsNative(chatSessionPtr)
+    }
+
+    // Session for the current context and template, created on first use
+    private fun chatSession(template: String): Long {
+        if (chatSessionPtr != 0L && chatSessionTemplate == template) return chatSessionPtr
+        freeChatSession()
+        chatSessionPtr = createChatSessionNative(modelPtr, contextPtr, template)
+        chatSessionTemplate = template
+        if (chatSessionPtr == 0L) Log.d(TAG, "No native chat template for $template")
+        return chatSessionPtr
+    }
+
+    private fun freeChatSession() {
+        if (chatSessionPtr != 0L) {
+            freeChatSessionNative(chatSessionPtr)
+            chatSessionPtr = 0
+        }
+        chatSessionTemplate = null
+    }
+
+    private external fun createChatSessionNative(modelPtr: Long, ctxPtr: Long, template: String): Long
+    private external fun freeChatSessionNative(sessionPtr: Long)
+    private external fun resetChatSessionNative(sessionPtr: Long)
+    private external fun getChatSessionStatsNative(sessionPtr: Long): String
+
+    private external fun chatSessionGenerateNative(
+        sessionPtr: Long,
+        ctxPtr: Long,
+        conversationId: String,
+        roles: Array<String>,
+        contents: Array<String>,
+        maxTokens: Int,
+        temperature: Float,
+        topP: Float,
+        topK: Int,
         callback: TokenCallback?
     ): String
 
+    /**
+     * Set the directory where preamble KV snapshots are stored.
+     */
+    fun setPromptSnapshotDir(dir: String) {
+        if (stubMode) return
+        setPromptSnapshotDirNative(dir)
+    }
+
+    /**
+     * Make sure a KV snapshot of a feature's fixed prompt preamble exists for
+     * the loaded model, computing and saving it if needed. Prompts starting
+     * with the preamble then load its KV state instead of prefilling it.
+     *
+     * @param name Feature name, one snapshot is kept per model and name
+     * @param preamble Exact text every prompt of the feature starts with
+     * @return false if the snapshot could not be prepared or a generation is running
+     */
+    fun preparePromptSnapshot(name: String, preamble: String): Boolean {
+        if (stubMode || modelPtr == 0L || contextPtr == 0L) return false
+        return preparePromptSnapshotNative(modelPtr, contextPtr, name, preamble)
+    }
+
+    /**
+     * Delete all stored preamble snapshots.
+     *
+     * @return Number of snapshot files deleted
+     */
+    fun clearPromptSnapshots(): Int {
+        if (stubMode) return 0
+        return clearPromptSnapshotsNative()
+    }
+
+    /**
+     * Get preamble snapshot statistics as JSON string.
+     */
+    fun getPromptSnapshotStats(): String {
+        if (stubMode) return "{}"
+        return getPromptSnapshotStatsNative()
+    }
+
+    private external fun setPromptSnapshotDirNative(dir: String)
+    private external fun preparePromptSnapshotNative(modelPtr: Long, ctxPtr: Long, name: String, preamble: String): Boolean
+    private external fun clearPromptSnapshotsNative(): Int
+    private external fun getPromptSnapshotStatsNative(): String
+
+    /**
+     * Set the directory and disk budget for the KV state of idle conversations.
+     * Spilling is disabled until this is called.
+     */
+    fun setKvSpillDir(dir: String, maxBytes: Long) {
+        if (stubMode) return
+        setKvSpillDirNative(dir, maxBytes)
+    }
+
+    /**
+     * Get spilled conversation statistics (hits, misses, restore times) as JSON string.
+     */
+    fun getKvSpillStats(): String {
+        if (stubMode) return "{}"
+        return getKvSpillStatsNative()
+    }
+
+    private external fun setKvSpillDirNative(dir: String, maxBytes: Long)
+    private external fun getKvSpillStatsNative(): String
+
+    /**
+     * Generate several completions of one prompt. The prompt is prefilled once
+     * and shared by all completions, which are then decoded together in one
+     * batch per step, each with its own sampler seeded with seed + index.
+     *
+     * @param count Number of completions, more than the context's sequences are queued
+     * @return The completions in order, or null on error
+     */
+    fun generateCompletions(
+        prompt: String,
+        count: Int,
+        maxTokens: Int = 512,
+        temperature: Float = 0.7f,
+        topP: Float = 0.9f,
+        topK: Int = 40,
+        seed: Int = (System.nanoTime() and 0x7fffffff).toInt(),
+        callback: ParallelCallback? = null
+    ): List<String>? {
+        if (stubMode || modelPtr == 0L || contextPtr == 0L) return null
+        return generateCompletionsNative(
+            modelPtr, contextPtr, prompt, count, maxTokens, temperature, topP, topK, seed, callback
+        )?.toList()
+    }
+
+    /**
+     * Generate one completion for each of prefix + suffixes[i]. The prefix is
+     * prefilled once and the items are decoded together as separate sequences;
+     * callback.onComplete reports each item as soon as it finishes.
+     * End the prefix at a newline so the parts tokenize as the joined text would.
+     * Runs as a background job: interactive generation started meanwhile
+     * pauses it between decode steps and it resumes afterwards.
+     *
+     * @param cacheNamespace Opt-in to the response cache, item by item; null disables it
+     * @param cacheRefresh Generate every item anew and replace its cached response
+     * @return The completions in suffix order, or null on error
+     */
+    fun generateBatch(
+        prefix: String,
+        suffixes: List<String>,
+        maxTokens: Int = 256,
+        temperature: Float = 0.7f,
+        topP: Float = 0.9f,
+        topK: Int = 40,
+        seed: Int = (System.nanoTime() and 0x7fffffff).toInt(),
+        callback: ParallelCallback? = null,
+        cacheNamespace: String? = null,
+        cacheRefresh: Boolean = false
+    ): List<String>? {
+        if (stubMode || modelPtr == 0L || contextPtr == 0L) return null
+        return generateBatchNative(
+            modelPtr, contextPtr, prefix, suffixes.toTypedArray(), maxTokens, temperature, topP, topK, seed, callback,
+            cacheNamespace, cacheRefresh
+        )?.toList()
+    }
+
+    private external fun generateCompletionsNative(
+        modelPtr: Long,
+        ctxPtr: Long,
+        prompt: String,
+        count: Int,
+        maxTokens: Int,
+        temperature: Float,
+        topP: Float,
+        topK: Int,
+        seed: Int,
+        callback: ParallelCallback?
+    ): Array<String>?
+
+    private external fun generateBatchNative(
+        modelPtr: Long,
+        ctxPtr: Long,
+        prefix: String,
+        suffixes: Array<String>,
+        maxTokens: Int,
+        temperature: Float,
+        topP: Float,
+        topK: Int,
+        seed: Int,
+        callback: ParallelCallback?,
+        cacheNamespace: String?,
+        cacheRefresh: Boolean
+    ): Array<String>?
+
+    /**
+     * Configure the native response cache.
+     *
+     * @param similarityThreshold Minimum prompt similarity for a semantic hit (<= 0 keeps current)
+     * @param capacity Maximum number of cached responses (<= 0 keeps current)
+     */
+    fun configureResponseCache(enabled: Boolean, similarityThreshold: Float = 0f, capacity: Int = 0) {
+        if (stubMode) {
+            Log.d(TAG, "[STUB] configureResponseCache called")
+            return
+        }
+        configureResponseCacheNative(enabled, similarityThreshold, capacity)
+    }
+
+    private external fun configureResponseCacheNative(
+        enabled: Boolean,
+        similarityThreshold: Float,
+        capacity: Int
+    )
+
+    /**
+     * Get response cache hit-rate statistics as JSON string.
+     */
+    fun getResponseCacheStats(): String {
+        if (stubMode) return "{}"
+        return getResponseCacheStatsNative()
+    }
+
+    private external fun getResponseCacheStatsNative(): String
+
+    /**
+     * Drop all cached responses.
+     */
+    fun clearResponseCache() {
+        if (stubMode) return
+        clearResponseCacheNative()
+    }
+
+    private external fun clearResponseCacheNative()
+
     /**
      * Cancel ongoing token generation.
      */
@@ -254,6 +999,40 @@ class LlamaAndroid @Inject constructor() {
     
     private external fun cancelGenerationNative(): Unit
 
+    /**
+     * Cancel a running background job (generateBatch) without touching
+     * interactive generation.
+     */
+    fun cancelBackgroundGeneration() {
+        if (stubMode) return
+        cancelBackgroundGenerationNative()
+    }
+
+    private external fun cancelBackgroundGenerationNative()
+
+    /**
+     * Set the minimum fraction of time background jobs keep while
+     * interactive requests keep arriving, so they are not starved.
+     *
+     * @param share Fraction between 0 and 0.9
+     */
+    fun setBackgroundShare(share: Float) {
+        if (stubMode) return
+        setBackgroundShareNative(share)
+    }
+
+    private external fun setBackgroundShareNative(share: Float)
+
+    /**
+     * Get interactive/background scheduling statistics as JSON string.
+     */
+    fun getSchedulerStats(): String {
+        if (stubMode) return "{}"
+        return getSchedulerStatsNative()
+    }
+
+    private external fun getSchedulerStatsNative(): String
+
     /**
      * Check if generation is currently in progress.
      */
@@ -345,7 +1124,75 @@ class LlamaAndroid @Inject constructor() {
         addSpecial: Boolean,
         parseSpecial: Boolean
     ): IntArray?
-    
+
+    /**
+     * Tokenize many strings in one native call. The texts are tokenized in
+     * parallel and repeated ones (system prompts, templates) come from a cache.
+     * Returns one token array per text, or null if tokenization failed.
+     */
+    fun tokenizeBatch(texts: List<String>, addSpecial: Boolean = true): List<IntArray>? {
+        if (stubMode) {
+            return texts.map { text -> text.split(" ").indices.map { it }.toIntArray() }
+        }
+        if (modelPtr == 0L) return null
+        if (texts.isEmpty()) return emptyList()
+        val (utf8, offsets) = packUtf8(texts)
+        val packed = tokenizeBatchNative(modelPtr, utf8, offsets, addSpecial, true, false) ?: return null
+        // Layout: texts.size + 1 token offsets, then the flattened tokens
+        val base = texts.size + 1
+        return List(texts.size) { i -> packed.copyOfRange(base + packed[i], base + packed[i + 1]) }
+    }
+
+    /**
+     * Count the tokens of each string without copying the tokens back.
+     * Returns null if tokenization failed.
+     */
+    fun countTokens(texts: List<String>, addSpecial: Boolean = true): IntArray? {
+        if (stubMode) {
+            return texts.map { it.split(" ").size }.toIntArray()
+        }
+        if (modelPtr == 0L) return null
+        if (texts.isEmpty()) return IntArray(0)
+        val (utf8, offsets) = packUtf8(texts)
+        return tokenizeBatchNative(modelPtr, utf8, offsets, addSpecial, true, true)
+    }
+
+    /**
+     * Count the tokens of a single string, or -1 if tokenization failed.
+     */
+    fun countTokens(text: String, addSpecial: Boolean = true): Int {
+        return countTokens(listOf(text), addSpecial)?.firstOrNull() ?: -1
+    }
+
+    /**
+     * Get tokenizer cache and worker pool statistics as JSON.
+     */
+    fun getTokenizerStats(): String {
+        if (stubMode) return "{}"
+        return getTokenizerStatsNative()
+    }
+
+    // Encode texts back to back as standard UTF-8 with byte offsets delimiting each one
+    private fun packUtf8(texts: List<String>): Pair<ByteArray, IntArray> {
+        val encoded = texts.map { it.toByteArray(Charsets.UTF_8) }
+        val offsets = IntArray(texts.size + 1)
+        for (i in encoded.indices) offsets[i + 1] = offsets[i] + encoded[i].size
+        val utf8 = ByteArray(offsets[texts.size])
+        for (i in encoded.indices) encoded[i].copyInto(utf8, offsets[i])
+        return utf8 to offsets
+    }
+
+    private external fun tokenizeBatchNative(
+        modelPtr: Long,
+        utf8: ByteArray,
+        offsets: IntArray,
+        addSpecial: Boolean,
+        parseSpecial: Boolean,
+        countsOnly: Boolean
+    ): IntArray?
+
+    private external fun getTokenizerStatsNative(): String
+
     /**
      * Detokenize token IDs back to string.
      */
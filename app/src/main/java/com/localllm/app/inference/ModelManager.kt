@@ -1,14 +1,22 @@
 package com.localllm.app.inference
 
+import android.content.ComponentCallbacks2
+import android.content.Context
 import android.util.Log
 import com.localllm.app.data.model.GenerationConfig
 import com.localllm.app.data.model.GenerationResult
 import com.localllm.app.data.model.ModelInfo
+import com.localllm.app.util.MemoryMonitor
+import dagger.hilt.android.qualifiers.ApplicationContext
+import kotlinx.coroutines.CoroutineScope
 import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.SupervisorJob
+import kotlinx.coroutines.delay
 import kotlinx.coroutines.flow.Flow
 import kotlinx.coroutines.flow.MutableStateFlow
 import kotlinx.coroutines.flow.StateFlow
 import kotlinx.coroutines.flow.asStateFlow
+import kotlinx.coroutines.launch
 import kotlinx.coroutines.sync.Mutex
 import kotlinx.coroutines.sync.withLock
 import kotlinx.coroutines.withContext
@@ -20,13 +28,31 @@ import javax.inject.Singleton
  */
 @Singleton
 class ModelManager @Inject constructor(
-    private val llamaAndroid: LlamaAndroid
+    @ApplicationContext private val context: Context,
+    private val llamaAndroid: LlamaAndroid,
+    private val memoryMonitor: MemoryMonitor
 ) {
     companion object {
         private const val TAG = "ModelManager"
+        
+        // Share of total device RAM that resident models may occupy
+        private const val MODEL_MEMORY_BUDGET_FRACTION = 0.5
+        
+        // Auto-tune a newly seen model once the first requests have gone through
+        private const val AUTO_TUNE_DELAY_MS = 30_000L
+        private const val AUTO_TUNE_MAX_SECONDS = 60f
+        
+        // Preamble KV snapshots, under filesDir
+        private const val PROMPT_SNAPSHOT_DIR = "kv_snapshots"
+
+        // KV state of idle conversations, under filesDir
+        private const val KV_SPILL_DIR = "kv_spill"
+        private const val KV_SPILL_MAX_BYTES = 512L * 1024 * 1024
     }
 
     private val mutex = Mutex()
+    private val tuneScope = CoroutineScope(SupervisorJob() + Dispatchers.Default)
+    private val trimScope = CoroutineScope(SupervisorJob() + Dispatchers.Default)
     
     private var currentContextPtr: Long? = null
     private var _currentModelId: String? = null
@@ -52,7 +78,13 @@ class ModelManager @Inject constructor(
         try {
             llamaAndroid.initBackend()
             backendInitialized = true
-            Log.i(TAG, "Backend initialized")
+            
+            val budgetBytes = (memoryMonitor.getTotalMemoryMb() * MODEL_MEMORY_BUDGET_FRACTION).toLong() * 1024 * 1024
+            llamaAndroid.setModelMemoryBudget(budgetBytes)
+            llamaAndroid.setAutoTuneStoreDir(context.filesDir.absolutePath)
+            llamaAndroid.setPromptSnapshotDir(java.io.File(context.filesDir, PROMPT_SNAPSHOT_DIR).absolutePath)
+            llamaAndroid.setKvSpillDir(java.io.File(context.filesDir, KV_SPILL_DIR).absolutePath, KV_SPILL_MAX_BYTES)
+            Log.i(TAG, "Backend initialized, model memory budget ${budgetBytes / (1024 * 1024)} MB")
         } catch (e: Exception) {
             Log.e(TAG, "Failed to initialize backend", e)
         }
@@ -81,6 +113,7 @@ class ModelManager @Inject constructor(
      * @param useMmap Whether to use memory-mapped files
      * @param useNNAPI Whether to use NNAPI acceleration
      * @param gpuLayers Number of layers to offload to GPU (0 = CPU only)
+     * @param contextOptions KV cache type, flash attention and batch sizes
      * @return Result indicating success or failure
      */
     suspend fun loadModel(
@@ -89,71 +122,78 @@ class ModelManager @Inject constructor(
         contextSize: Int = 2048,
         useMmap: Boolean = true,
         useNNAPI: Boolean = false,
-        gpuLayers: Int = 0
-    ): Result<Unit> = mutex.withLock {
-        return withContext(Dispatchers.IO) {
-            try {
-                // Ensure backend is initialized
-                if (!backendInitialized) {
-                    Log.i(TAG, "Initializing backend before model load")
-                    initBackend()
-                }
-                
-                _loadingState.value = ModelLoadingState.Loading(0f)
-                Log.i(TAG, "Loading model: ${model.name} from ${model.localPath}")
-                Log.i(TAG, "GPU layers requested: $gpuLayers")
-                
-                // Unload existing model first
-                unloadModelInternal()
-                
-                val modelPath = model.localPath
-                    ?: return@withContext Result.failure(IllegalStateException("Model not downloaded"))
-                
-                // Verify the file exists
-                val modelFile = java.io.File(modelPath)
-                if (!modelFile.exists()) {
-                    Log.e(TAG, "Model file does not exist: $modelPath")
-                    _loadingState.value = ModelLoadingState.Error("Model file not found")
-                    return@withContext Result.failure(IllegalStateException("Model file not found: $modelPath"))
+        gpuLayers: Int = 0,
+        contextOptions: LlamaAndroid.ContextOptions = LlamaAndroid.ContextOptions()
+    ): Result<Unit> {
+        // A running benchmark holds the lock, stop it instead of waiting for it
+        llamaAndroid.abortAutoTune()
+        return mutex.withLock {
+            withContext(Dispatchers.IO) {
+                try {
+                    // Ensure backend is initialized
+                    if (!backendInitialized) {
+                        Log.i(TAG, "Initializing backend before model load")
+                        initBackend()
+                    }
+                    
+                    _loadingState.value = ModelLoadingState.Loading(0f)
+                    Log.i(TAG, "Loading model: ${model.name} from ${model.localPath}")
+                    Log.i(TAG, "GPU layers requested: $gpuLayers")
+                    
+                    // Unload existing model first
+                    unloadModelInternal()
+                    
+                    val modelPath = model.localPath
+                        ?: return@withContext Result.failure(IllegalStateException("Model not downloaded"))
+                    
+                    // Verify the file exists
+                    val modelFile = java.io.File(modelPath)
+                    if (!modelFile.exists()) {
+                        Log.e(TAG, "Model file does not exist: $modelPath")
+                        _loadingState.value = ModelLoadingState.Error("Model file not found")
+                        return@withContext Result.failure(IllegalStateException("Model file not found: $modelPath"))
+                    }
+                    
+                    Log.i(TAG, "Model file exists, size: ${modelFile.length()} bytes")
+                    
+                    val adjustedThreads = threads.coerceIn(1, Runtime.getRuntime().availableProcessors())
+                    val adjustedContextSize = minOf(contextSize, model.contextLength).coerceAtLeast(512)
+                    
+                    Log.i(TAG, "Loading with threads=$adjustedThreads, contextSize=$adjustedContextSize, useMmap=$useMmap, gpuLayers=$gpuLayers")
+                    
+                    _loadingState.value = ModelLoadingState.Loading(0.3f)
+                    
+                    val contextPtr = llamaAndroid.loadModel(
+                        modelPath = modelPath,
+                        threads = adjustedThreads,
+                        contextSize = adjustedContextSize,
+                        useMmap = useMmap,
+                        useNNAPI = useNNAPI,
+                        gpuLayers = gpuLayers,
+                        options = contextOptions
+                    )
+                    
+                    Log.i(TAG, "loadModel returned contextPtr: $contextPtr")
+                    
+                    if (contextPtr == 0L) {
+                        _loadingState.value = ModelLoadingState.Error("Failed to load model - native library returned 0")
+                        Log.e(TAG, "Failed to load model: returned null context")
+                        return@withContext Result.failure(RuntimeException("Failed to load model - check logs for details"))
+                    }
+                    
+                    currentContextPtr = contextPtr
+                    _currentModelId = model.id
+                    _currentModel.value = model
+                    _loadingState.value = ModelLoadingState.Loaded(model)
+                    
+                    Log.i(TAG, "Model loaded successfully: ${model.name}, contextPtr: $contextPtr")
+                    scheduleAutoTune(model.id)
+                    Result.success(Unit)
+                } catch (e: Exception) {
+                    Log.e(TAG, "Error loading model", e)
+                    _loadingState.value = ModelLoadingState.Error(e.message ?: "Unknown error: ${e.javaClass.simpleName}")
+                    Result.failure(e)
                 }
-                
-                Log.i(TAG, "Model file exists, size: ${modelFile.length()} bytes")
-                
-                val adjustedThreads = threads.coerceIn(1, Runtime.getRuntime().availableProcessors())
-                val adjustedContextSize = minOf(contextSize, model.contextLength).coerceAtLeast(512)
-                
-                Log.i(TAG, "Loading with threads=$adjustedThreads, contextSize=$adjustedContextSize, useMmap=$useMmap, gpuLayers=$gpuLayers")
-                
-                _loadingState.value = ModelLoadingState.Loading(0.3f)
-                
-                val contextPtr = llamaAndroid.loadModel(
-                    modelPath = modelPath,
-                    threads = adjustedThreads,
-                    contextSize = adjustedContextSize,
-                    useMmap = useMmap,
-                    useNNAPI = useNNAPI,
-                    gpuLayers = gpuLayers
-                )
-                
-                Log.i(TAG, "loadModel returned contextPtr: $contextPtr")
-                
-                if (contextPtr == 0L) {
-                    _loadingState.value = ModelLoadingState.Error("Failed to load model - native library returned 0")
-                    Log.e(TAG, "Failed to load model: returned null context")
-                    return@withContext Result.failure(RuntimeException("Failed to load model - check logs for details"))
-                }
-                
-                currentContextPtr = contextPtr
-                _currentModelId = model.id
-                _currentModel.value = model
-                _loadingState.value = ModelLoadingState.Loaded(model)
-                
-                Log.i(TAG, "Model loaded successfully: ${model.name}, contextPtr: $contextPtr")
-                Result.success(Unit)
-            } catch (e: Exception) {
-                Log.e(TAG, "Error loading model", e)
-                _loadingState.value = ModelLoadingState.Error(e.message ?: "Unknown error: ${e.javaClass.simpleName}")
-                Result.failure(e)
             }
         }
     }
@@ -161,8 +201,30 @@ class ModelManager @Inject constructor(
     /**
      * Unload the currently loaded model.
      */
-    suspend fun unloadModel() = mutex.withLock {
-        unloadModelInternal()
+    suspend fun unloadModel() {
+        llamaAndroid.abortAutoTune()
+        mutex.withLock {
+            unloadModelInternal()
+        }
+    }
+
+    /**
+     * Benchmark context configurations for a model the first time it is loaded
+     * on this device. The results are applied natively the next time a context
+     * is created for the model. A generation request aborts the run.
+     */
+    private fun scheduleAutoTune(modelId: String) {
+        if (llamaAndroid.hasAutoTuneResults()) return
+        
+        tuneScope.launch {
+            delay(AUTO_TUNE_DELAY_MS)
+            mutex.withLock {
+                if (_currentModelId != modelId || llamaAndroid.hasAutoTuneResults()) return@withLock
+                Log.i(TAG, "Auto-tuning model $modelId")
+                val results = llamaAndroid.runAutoTune(AUTO_TUNE_MAX_SECONDS)
+                Log.i(TAG, "Auto-tune results: $results")
+            }
+        }
     }
 
     private fun unloadModelInternal() {
@@ -196,6 +258,27 @@ class ModelManager @Inject constructor(
         }
     }
 
+    /**
+     * Release native memory in proportion to a level reported by onTrimMemory.
+     * Leaving the app (UI hidden, background) only drops caches, so coming back
+     * costs nothing; conversations and model pages are only given up when the
+     * system runs critically low or is about to kill the process. Returns at
+     * once, the trim copies KV state and re-creates contexts on a worker thread.
+     */
+    fun trimMemory(level: Int) {
+        val trimLevel = when {
+            level >= ComponentCallbacks2.TRIM_MEMORY_COMPLETE -> LlamaAndroid.TrimLevel.MODELS
+            level >= ComponentCallbacks2.TRIM_MEMORY_MODERATE -> LlamaAndroid.TrimLevel.PAGES
+            level == ComponentCallbacks2.TRIM_MEMORY_RUNNING_CRITICAL -> LlamaAndroid.TrimLevel.SEQUENCES
+            level >= ComponentCallbacks2.TRIM_MEMORY_RUNNING_MODERATE -> LlamaAndroid.TrimLevel.CACHES
+            else -> return
+        }
+        trimScope.launch {
+            val report = llamaAndroid.trimMemory(trimLevel)
+            Log.i(TAG, "Trimmed native memory ($trimLevel for level $level): $report")
+        }
+    }
+
     /**
      * Get context size of the loaded model.
      */
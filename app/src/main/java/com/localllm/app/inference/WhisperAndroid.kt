@@ -27,7 +27,7 @@ class WhisperAndroid @Inject constructor() {
         // Load native library
         init {
             try {
-                System.loadLibrary("llama-android")
+                System.loadLibrary("localllm")
                 Log.d(TAG, "Native library loaded successfully")
             } catch (e: UnsatisfiedLinkError) {
                 Log.e(TAG, "Failed to load native library: ${e.message}")
@@ -0,0 +1,52 @@
+package com.localllm.app.rag
+
+import android.util.Log
+import javax.inject.Inject
+import javax.inject.Singleton
+
+/**
+ * Near-duplicate chunk elimination for RAG indexing.
+ * Wraps the native MinHash-LSH pass; without the native library every chunk is kept.
+ */
+@Singleton
+class ChunkDeduplicator @Inject constructor() {
+
+    companion object {
+        private const val TAG = "ChunkDeduplicator"
+        const val DEFAULT_SIMILARITY_THRESHOLD = 0.85f
+        private var nativeLoaded = false
+
+        init {
+            try {
+                System.loadLibrary("localllm")
+                nativeLoaded = true
+            } catch (e: UnsatisfiedLinkError) {
+                Log.w(TAG, "Native library not loaded - chunk dedup disabled: ${e.message}")
+            }
+        }
+    }
+
+    /**
+     * Map each chunk to the index of the earlier chunk it duplicates.
+     * Kept chunks map to themselves.
+     */
+    fun findRepresentatives(
+        texts: List<String>,
+        similarityThreshold: Float = DEFAULT_SIMILARITY_THRESHOLD
+    ): IntArray {
+        val identity = IntArray(texts.size) { it }
+        if (!nativeLoaded || texts.size < 2) return identity
+
+        return try {
+            findRepresentativesNative(texts.toTypedArray(), similarityThreshold) ?: identity
+        } catch (e: UnsatisfiedLinkError) {
+            Log.e(TAG, "findRepresentativesNative not found", e)
+            identity
+        }
+    }
+
+    private external fun findRepresentativesNative(
+        texts: Array<String>,
+        similarityThreshold: Float
+    ): IntArray?
+}
@@ -35,6 +35,9 @@ data class DocumentChunkEntity(
     @ColumnInfo(name = "endChar")
     val endChar: Int,
     
+    @ColumnInfo(name = "sourceRanges")
+    val sourceRanges: String = "", // "start-end;start-end" of near-duplicates collapsed into this chunk
+    
     @ColumnInfo(name = "timestamp")
     val timestamp: Long = System.currentTimeMillis()
 )
@@ -31,7 +31,8 @@ sealed class IndexingState {
 class VectorStore @Inject constructor(
     private val documentChunkDao: DocumentChunkDao,
     private val embeddingGenerator: EmbeddingGenerator,
-    private val documentParser: DocumentParser
+    private val documentParser: DocumentParser,
+    private val chunkDeduplicator: ChunkDeduplicator
 ) {
     
     companion object {
@@ -68,16 +69,28 @@ class VectorStore @Inject constructor(
             
             Log.d(TAG, "Document split into ${textChunks.size} chunks")
             
+            // Collapse near-duplicate chunks (repeated headers, boilerplate) into
+            // their first occurrence, remembering where each duplicate came from
+            val representatives = chunkDeduplicator.findRepresentatives(textChunks.map { it.content })
+            val keptIndices = textChunks.indices.filter { representatives[it] == it }
+            val sourceRanges = textChunks.indices.groupBy(
+                keySelector = { representatives[it] },
+                valueTransform = { "${textChunks[it].startChar}-${textChunks[it].endChar}" }
+            )
+            
+            Log.d(TAG, "Kept ${keptIndices.size} of ${textChunks.size} chunks after dedup")
+            
             // Build vocabulary from all chunks if not already built
             if (!embeddingGenerator.isVocabularyBuilt()) {
-                val allTexts = textChunks.map { it.content }
+                val allTexts = keptIndices.map { textChunks[it].content }
                 embeddingGenerator.buildVocabulary(allTexts)
             }
             
             // Generate embeddings for each chunk
             val documentChunkEntities = mutableListOf<DocumentChunkEntity>()
             
-            for ((index, textChunk) in textChunks.withIndex()) {
+            for ((index, originalIndex) in keptIndices.withIndex()) {
+                val textChunk = textChunks[originalIndex]
                 val embedding = embeddingGenerator.generateEmbedding(textChunk.content)
                 val embeddingString = embedding.joinToString(",")
                 
@@ -88,14 +101,15 @@ class VectorStore @Inject constructor(
                     content = textChunk.content,
                     embedding = embeddingString,
                     startChar = textChunk.startChar,
-                    endChar = textChunk.endChar
+                    endChar = textChunk.endChar,
+                    sourceRanges = sourceRanges[originalIndex].orEmpty().joinToString(";")
                 )
                 
                 documentChunkEntities.add(entity)
                 
                 // Update progress
-                val progress = (index + 1).toFloat() / textChunks.size
-                _indexingState.value = IndexingState.Indexing(progress, index + 1, textChunks.size)
+                val progress = (index + 1).toFloat() / keptIndices.size
+                _indexingState.value = IndexingState.Indexing(progress, index + 1, keptIndices.size)
             }
             
             // Insert all chunks into database
@@ -149,6 +149,10 @@ fun PromptLabScreen(
                         focusManager.clearFocus()
                         viewModel.generate()
                     },
+                    onCompare = {
+                        focusManager.clearFocus()
+                        viewModel.generateCandidates()
+                    },
                     onStop = viewModel::stopGeneration,
                     onClear = viewModel::clearAll
                 )
@@ -471,6 +475,7 @@ private fun ActionButtonsRow(
     isGenerating: Boolean,
     isModelLoaded: Boolean,
     onGenerate: () -> Unit,
+    onCompare: () -> Unit,
     onStop: () -> Unit,
     onClear: () -> Unit
 ) {
@@ -500,6 +505,12 @@ private fun ActionButtonsRow(
                 Spacer(modifier = Modifier.width(8.dp))
                 Text("Generate")
             }
+            OutlinedButton(
+                onClick = onCompare,
+                enabled = isModelLoaded
+            ) {
+                Text("Compare 3")
+            }
         }
         
         OutlinedButton(
@@ -124,7 +124,8 @@ class ChatViewModel @Inject constructor(
      */
     fun setCurrentConversation(conversationId: String) {
         // Only clear KV cache when switching to a DIFFERENT conversation
-        // This preserves context for follow-up queries within the same conversation
+        // This preserves context for follow-up queries within the same conversation;
+        // the previous conversation's KV state is spilled to disk and read back on return
         val previousConversationId = _currentConversationId.value
         if (previousConversationId != null && previousConversationId != conversationId) {
             modelManager.clearKVCache()
@@ -246,20 +247,16 @@ class ChatViewModel @Inject constructor(
                 completedMessages
             }
             
-            // Build prompt from conversation history
-            val prompt = inferenceEngine.buildPrompt(
-                messages = messagesForPrompt,
-                systemPrompt = systemPrompt,
-                promptTemplate = model?.promptTemplate ?: "chatml"
-            )
-
             val startTime = System.currentTimeMillis()
             var tokensGenerated = 0
             var currentContent = ""
 
-            // Generate with streaming
-            inferenceEngine.generateStream(
-                prompt = prompt,
+            // Generate with streaming; the native chat session only processes what changed since the last turn
+            inferenceEngine.generateChatStream(
+                messages = messagesForPrompt,
+                systemPrompt = systemPrompt,
+                promptTemplate = model?.promptTemplate ?: "chatml",
+                conversationId = conversationId,
                 config = preferences.defaultGenerationConfig,
                 onTokenGenerated = { token ->
                     tokensGenerated++
@@ -362,8 +359,7 @@ class ChatViewModel @Inject constructor(
                 conversationRepository.deleteMessage(lastMessage.id)
             }
             
-            // Clear KV cache and regenerate
-            modelManager.clearKVCache()
+            // Keep the KV cache: the chat session forks it at the last user message
             generateResponse(conversationId)
         }
     }
@@ -124,6 +124,7 @@ class CodeCompanionViewModel @Inject constructor(
 
         generationJob = viewModelScope.launch(Dispatchers.IO) {
             try {
+                inferenceEngine.preparePreamble("code_${action.name.lowercase()}", preambleForAction(action))
                 val prompt = buildPromptForAction(action, code)
                 val resultBuilder = StringBuilder()
 
@@ -149,12 +150,13 @@ class CodeCompanionViewModel @Inject constructor(
         }
     }
 
-    private fun buildPromptForAction(action: CodeAction, code: String): String {
-        val language = _uiState.value.selectedLanguage.displayName
-        val targetLang = _uiState.value.targetLanguage.displayName
-
-        return when (action) {
-            CodeAction.EXPLAIN -> """You are an expert programmer. Explain the following $language code in detail.
+    /**
+     * Fixed instructions each action's prompt starts with. They come before
+     * anything the user picked or typed, so their KV state is loaded from a
+     * snapshot instead of being prefilled on every request.
+     */
+    private fun preambleForAction(action: CodeAction): String = when (action) {
+        CodeAction.EXPLAIN -> """You are an expert programmer. Explain the code below in detail.
 
 Explain:
 1. What the code does overall
@@ -162,14 +164,9 @@ Explain:
 3. Key concepts used
 4. Any potential issues
 
-CODE:
-```$language
-$code
-```
-
-EXPLANATION:"""
+"""
 
-            CodeAction.DEBUG -> """You are an expert code reviewer. Analyze the following $language code for bugs, issues, and potential improvements.
+        CodeAction.DEBUG -> """You are an expert code reviewer. Analyze the code below for bugs, issues, and potential improvements.
 
 Look for:
 1. Bugs and logical errors
@@ -178,14 +175,9 @@ Look for:
 4. Edge cases not handled
 5. Best practice violations
 
-CODE:
-```$language
-$code
-```
+"""
 
-ANALYSIS:"""
-
-            CodeAction.OPTIMIZE -> """You are an expert programmer specializing in performance optimization. Optimize the following $language code for better performance and efficiency.
+        CodeAction.OPTIMIZE -> """You are an expert programmer specializing in performance optimization. Optimize the code below for better performance and efficiency.
 
 Consider:
 1. Time complexity improvements
@@ -193,27 +185,17 @@ Consider:
 3. Code simplification
 4. Better algorithms
 
-Original CODE:
-```$language
-$code
-```
-
-Provide the optimized code with explanations:
+Provide the optimized code with explanations.
 
-OPTIMIZED CODE:"""
+"""
 
-            CodeAction.CONVERT -> """You are an expert programmer fluent in multiple languages. Convert the following $language code to $targetLang.
+        CodeAction.CONVERT -> """You are an expert programmer fluent in multiple languages. Convert the code below to the target language given after it.
 
-Maintain the same functionality while following $targetLang best practices and idioms.
+Maintain the same functionality while following the target language's best practices and idioms.
 
-SOURCE CODE ($language):
-```$language
-$code
-```
+"""
 
-CONVERTED CODE ($targetLang):"""
-
-            CodeAction.DOCUMENT -> """You are an expert programmer. Add comprehensive documentation comments to the following $language code.
+        CodeAction.DOCUMENT -> """You are an expert programmer. Add comprehensive documentation comments to the code below.
 
 Include:
 1. Function/method documentation
@@ -222,14 +204,9 @@ Include:
 4. Inline comments for complex logic
 5. Usage examples where appropriate
 
-CODE:
-```$language
-$code
-```
-
-DOCUMENTED CODE:"""
+"""
 
-            CodeAction.TEST -> """You are an expert software tester. Generate comprehensive unit tests for the following $language code.
+        CodeAction.TEST -> """You are an expert software tester. Generate comprehensive unit tests for the code below.
 
 Include tests for:
 1. Normal/expected behavior
@@ -237,14 +214,9 @@ Include tests for:
 3. Error handling
 4. Boundary conditions
 
-CODE:
-```$language
-$code
-```
+"""
 
-UNIT TESTS:"""
-
-            CodeAction.REFACTOR -> """You are an expert programmer specializing in clean code and design patterns. Refactor the following $language code to improve its structure, readability, and maintainability.
+        CodeAction.REFACTOR -> """You are an expert programmer specializing in clean code and design patterns. Refactor the code below to improve its structure, readability, and maintainability.
 
 Apply:
 1. SOLID principles
@@ -253,12 +225,22 @@ Apply:
 4. Better naming conventions
 5. Code organization
 
-Original CODE:
-```$language
-$code
-```
+"""
+    }
+
+    private fun buildPromptForAction(action: CodeAction, code: String): String {
+        val language = _uiState.value.selectedLanguage.displayName
+        val targetLang = _uiState.value.targetLanguage.displayName
 
-REFACTORED CODE:"""
+        val codeBlock = "```$language\n$code\n```"
+        return preambleForAction(action) + when (action) {
+            CodeAction.EXPLAIN -> "CODE ($language):\n$codeBlock\n\nEXPLANATION:"
+            CodeAction.DEBUG -> "CODE ($language):\n$codeBlock\n\nANALYSIS:"
+            CodeAction.OPTIMIZE -> "Original CODE ($language):\n$codeBlock\n\nOPTIMIZED CODE:"
+            CodeAction.CONVERT -> "SOURCE CODE ($language):\n$codeBlock\n\nTARGET LANGUAGE: $targetLang\n\nCONVERTED CODE ($targetLang):"
+            CodeAction.DOCUMENT -> "CODE ($language):\n$codeBlock\n\nDOCUMENTED CODE:"
+            CodeAction.TEST -> "CODE ($language):\n$codeBlock\n\nUNIT TESTS:"
+            CodeAction.REFACTOR -> "Original CODE ($language):\n$codeBlock\n\nREFACTORED CODE:"
         }
     }
 
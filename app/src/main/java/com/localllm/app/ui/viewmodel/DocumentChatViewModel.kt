@@ -48,6 +48,19 @@ class DocumentChatViewModel @Inject constructor(
     private val documentParser: DocumentParser
 ) : ViewModel() {
 
+    companion object {
+        // Fixed start of every prompt, ahead of the document context; its KV state is loaded from a snapshot
+        private const val DOCUMENT_PREAMBLE = """You are a helpful AI assistant that answers questions about documents.
+
+INSTRUCTIONS:
+- Answer questions based ONLY on the document content provided below
+- If the information is not in the document, say so clearly
+- Quote relevant parts of the document when helpful
+- Be concise but thorough in your answers
+
+"""
+    }
+
     private val _uiState = MutableStateFlow(DocumentChatUiState())
     val uiState: StateFlow<DocumentChatUiState> = _uiState.asStateFlow()
 
@@ -150,6 +163,7 @@ class DocumentChatViewModel @Inject constructor(
                 val relevantContext = findRelevantContext(input)
 
                 // Build the prompt with document context
+                inferenceEngine.preparePreamble("document_chat", DOCUMENT_PREAMBLE)
                 val systemPrompt = buildDocumentSystemPrompt(relevantContext)
                 val fullPrompt = buildConversationPrompt(systemPrompt, updatedMessages)
 
@@ -237,16 +251,8 @@ class DocumentChatViewModel @Inject constructor(
     }
 
     private fun buildDocumentSystemPrompt(context: String): String {
-        return """You are a helpful AI assistant that answers questions about documents.
-            
-DOCUMENT CONTEXT:
-$context
-
-INSTRUCTIONS:
-- Answer questions based ONLY on the document content provided above
-- If the information is not in the document, say so clearly
-- Quote relevant parts of the document when helpful
-- Be concise but thorough in your answers"""
+        return """${DOCUMENT_PREAMBLE}DOCUMENT CONTEXT:
+$context"""
     }
 
     private fun buildConversationPrompt(systemPrompt: String, messages: List<ChatMessage>): String {
@@ -3,6 +3,7 @@ package com.localllm.app.ui.viewmodel
 import androidx.lifecycle.ViewModel
 import androidx.lifecycle.viewModelScope
 import com.localllm.app.data.local.PreferencesDataStore
+import com.localllm.app.data.model.GenerationConfig
 import com.localllm.app.inference.InferenceEngine
 import com.localllm.app.inference.ModelManager
 import dagger.hilt.android.lifecycle.HiltViewModel
@@ -79,9 +80,17 @@ class FlashcardViewModel @Inject constructor(
     private val preferencesDataStore: PreferencesDataStore
 ) : ViewModel() {
 
+    companion object {
+        // Token allowance for a single generated card
+        private const val CARD_MAX_TOKENS = 160
+    }
+
     private val _uiState = MutableStateFlow(FlashcardUiState())
     val uiState: StateFlow<FlashcardUiState> = _uiState.asStateFlow()
 
+    // Asking for the same cards again generates new ones instead of replaying the cached response
+    private var lastRequest: String? = null
+
     private val _generationState = MutableStateFlow(FlashcardGenerationState())
     val generationState: StateFlow<FlashcardGenerationState> = _generationState.asStateFlow()
 
@@ -260,54 +269,63 @@ class FlashcardViewModel @Inject constructor(
                 val preferences = preferencesDataStore.userPreferencesFlow.first()
                 val model = modelManager.currentModel.value
                 
-                val prompt = """Generate exactly $count flashcards about: $topic
-
-Format each flashcard EXACTLY like this:
-Q: [question or term]
-A: [answer or definition]
-
-Generate educational, clear, and accurate flashcards. Each question should test understanding of a key concept.
-
-Flashcards:"""
-
                 val systemPrompt = "You are an expert educator creating study flashcards. Generate clear, concise flashcards in the exact format requested. Each Q: should be followed by A: on the next line."
                 
-                val fullPrompt = inferenceEngine.buildPrompt(
+                // Every request starts with this preamble; its KV state is loaded from a snapshot
+                val preamble = inferenceEngine.buildPrompt(
                     messages = emptyList(),
                     systemPrompt = systemPrompt,
                     promptTemplate = model?.promptTemplate ?: "chatml"
-                ) + "\n\nUser: $prompt\n\nAssistant:"
-
-                var response = ""
-                inferenceEngine.generateStream(
-                    prompt = fullPrompt,
-                    config = preferences.defaultGenerationConfig.copy(
-                        maxTokens = 1024,
-                        temperature = 0.7f
-                    ),
-                    onTokenGenerated = { token ->
-                        response += token
-                    }
-                ).collect { /* wait for completion */ }
+                )
+                inferenceEngine.preparePreamble("flashcards", preamble)
+                // The batch caches each item by its own prompt; cacheQuery is for the serial fallback
+                val config = preferences.defaultGenerationConfig.copy(
+                    temperature = 0.7f,
+                    cacheNamespace = "flashcards",
+                    cacheQuery = topic,
+                    cacheRefresh = "$topic|$count" == lastRequest
+                )
+                lastRequest = "$topic|$count"
+
+                // Pick one concept per card, then write all cards at once, one sequence each
+                val concepts = inferenceEngine.generateList(
+                    prompt = preamble + "\n\nUser: List $count distinct key concepts about $topic " +
+                        "that a flashcard could test, one per line, nothing else.\n\nAssistant:",
+                    count = count,
+                    // The list only makes sense for this topic, never reuse another request's
+                    config = config.copy(cacheNamespace = null)
+                )
+                val prefix = preamble + """
 
-                // Parse generated flashcards
-                val cards = parseGeneratedFlashcards(response, deckName)
-                
-                if (cards.isNotEmpty()) {
-                    // Find or create deck
-                    val decks = _uiState.value.decks.toMutableList()
-                    val existingDeckIndex = decks.indexOfFirst { it.name == deckName }
-                    
-                    if (existingDeckIndex >= 0) {
-                        decks[existingDeckIndex] = decks[existingDeckIndex].copy(
-                            cards = decks[existingDeckIndex].cards + cards
-                        )
-                    } else {
-                        val newDeck = FlashcardDeck(name = deckName, cards = cards)
-                        decks.add(newDeck)
+User: Write one flashcard about $topic, testing the concept given below.
+
+Format the flashcard EXACTLY like this:
+Q: [question or term]
+A: [answer or definition]
+
+"""
+                var completed = 0
+                val results = if (concepts.isNotEmpty()) {
+                    inferenceEngine.generateBatch(
+                        prefix = prefix,
+                        suffixes = concepts.map { "Concept: $it\n\nAssistant:" },
+                        config = config.copy(maxTokens = CARD_MAX_TOKENS)
+                    ) { _, text ->
+                        // Cards show up as soon as each one is written; the callback runs on the
+                        // native generation thread, so the state is updated on the main thread
+                        viewModelScope.launch {
+                            addCards(deckName, parseGeneratedFlashcards(text, deckName).take(1))
+                            completed++
+                            _generationState.value = FlashcardGenerationState(
+                                isGenerating = true,
+                                progress = completed.toFloat() / concepts.size
+                            )
+                        }
                     }
-                    
-                    _uiState.value = _uiState.value.copy(decks = decks)
+                } else null
+
+                if (results == null) {
+                    addCards(deckName, generateFlashcardsSerial(preamble, topic, count, config, deckName))
                 }
                 
                 _generationState.value = FlashcardGenerationState(isGenerating = false)
@@ -321,6 +339,57 @@ Flashcards:"""
         }
     }
 
+    /**
+     * Generate all cards through one prompt, for when they cannot be generated in parallel
+     */
+    private suspend fun generateFlashcardsSerial(
+        preamble: String,
+        topic: String,
+        count: Int,
+        config: GenerationConfig,
+        deckName: String
+    ): List<Flashcard> {
+        val prompt = """Generate exactly $count flashcards about: $topic
+
+Format each flashcard EXACTLY like this:
+Q: [question or term]
+A: [answer or definition]
+
+Generate educational, clear, and accurate flashcards. Each question should test understanding of a key concept.
+
+Flashcards:"""
+
+        var response = ""
+        inferenceEngine.generateStream(
+            prompt = preamble + "\n\nUser: $prompt\n\nAssistant:",
+            config = config.copy(maxTokens = 1024),
+            onTokenGenerated = { token ->
+                response += token
+            }
+        ).collect { /* wait for completion */ }
+        return parseGeneratedFlashcards(response, deckName)
+    }
+
+    /**
+     * Add cards to the deck named deckName, creating it if needed
+     */
+    private fun addCards(deckName: String, cards: List<Flashcard>) {
+        if (cards.isEmpty()) return
+        val decks = _uiState.value.decks.toMutableList()
+        val existingDeckIndex = decks.indexOfFirst { it.name == deckName }
+        
+        if (existingDeckIndex >= 0) {
+            decks[existingDeckIndex] = decks[existingDeckIndex].copy(
+                cards = decks[existingDeckIndex].cards + cards
+            )
+        } else {
+            val newDeck = FlashcardDeck(name = deckName, cards = cards)
+            decks.add(newDeck)
+        }
+        
+        _uiState.value = _uiState.value.copy(decks = decks)
+    }
+
     /**
      * Parse AI-generated flashcard text
      */
@@ -32,6 +32,7 @@ class PromptLabViewModel @Inject constructor(
 
     companion object {
         private const val TAG = "PromptLabViewModel"
+        private const val CANDIDATE_COUNT = 3
     }
 
     private val _prompt = MutableStateFlow("")
@@ -57,6 +58,9 @@ class PromptLabViewModel @Inject constructor(
 
     private var generationJob: Job? = null
 
+    // Generating the same prompt again asks for a new answer, not the cached one
+    private var lastGeneratedPrompt: String? = null
+
     init {
         observeModelState()
     }
@@ -108,34 +112,13 @@ class PromptLabViewModel @Inject constructor(
 
                 Log.d(TAG, "Starting generation with prompt: ${_prompt.value.take(50)}...")
 
-                // Create a single-turn message for generation
-                val message = ChatMessage(
-                    id = UUID.randomUUID().toString(),
-                    conversationId = "prompt_lab",
-                    role = MessageRole.USER,
-                    content = _prompt.value,
-                    timestamp = System.currentTimeMillis()
-                )
-
-                // Build prompt with appropriate template (use chatml for prompt lab)
-                val fullPrompt = inferenceEngine.buildPrompt(
-                    messages = listOf(message),
-                    systemPrompt = "You are a helpful AI assistant. Respond directly to the user's request.",
-                    promptTemplate = "chatml"
-                )
+                val refresh = _prompt.value == lastGeneratedPrompt
+                lastGeneratedPrompt = _prompt.value
 
                 // Generate response using streaming
-                val config = GenerationConfig(
-                    maxTokens = _maxTokens.value,
-                    temperature = _temperature.value,
-                    topP = 0.9f,
-                    topK = 40,
-                    repeatPenalty = 1.1f
-                )
-
                 inferenceEngine.generateStream(
-                    prompt = fullPrompt,
-                    config = config,
+                    prompt = buildFullPrompt(),
+                    config = generationConfig().copy(cacheRefresh = refresh),
                     onTokenGenerated = { token ->
                         _output.value += token
                     }
@@ -165,6 +148,75 @@ class PromptLabViewModel @Inject constructor(
         }
     }
 
+    /**
+     * Generate several candidate answers to compare. They share one prefill
+     * and are decoded together, so this takes about as long as one answer.
+     */
+    fun generateCandidates(count: Int = CANDIDATE_COUNT) {
+        if (_prompt.value.isBlank() || _isGenerating.value) return
+
+        generationJob = viewModelScope.launch {
+            try {
+                _isGenerating.value = true
+                _output.value = ""
+
+                val candidates = List(count) { StringBuilder() }
+                val results = inferenceEngine.generateCompletions(
+                    prompt = buildFullPrompt(),
+                    count = count,
+                    config = generationConfig()
+                ) { index, token ->
+                    synchronized(candidates) {
+                        candidates[index].append(token)
+                        _output.value = formatCandidates(candidates)
+                    }
+                }
+
+                _output.value = if (results != null) {
+                    formatCandidates(results)
+                } else {
+                    "Error: Could not generate candidates"
+                }
+            } catch (e: Exception) {
+                Log.e(TAG, "Candidate generation error", e)
+                _output.value = "Error: ${e.message}"
+            } finally {
+                _isGenerating.value = false
+            }
+        }
+    }
+
+    // Single-turn chatml prompt for the current input
+    private fun buildFullPrompt(): String {
+        val message = ChatMessage(
+            id = UUID.randomUUID().toString(),
+            conversationId = "prompt_lab",
+            role = MessageRole.USER,
+            content = _prompt.value,
+            timestamp = System.currentTimeMillis()
+        )
+        return inferenceEngine.buildPrompt(
+            messages = listOf(message),
+            systemPrompt = "You are a helpful AI assistant. Respond directly to the user's request.",
+            promptTemplate = "chatml"
+        )
+    }
+
+    private fun generationConfig() = GenerationConfig(
+        maxTokens = _maxTokens.value,
+        temperature = _temperature.value,
+        topP = 0.9f,
+        topK = 40,
+        repeatPenalty = 1.1f,
+        cacheNamespace = "prompt_lab",
+        cacheQuery = _prompt.value
+    )
+
+    private fun formatCandidates(candidates: List<CharSequence>): String =
+        candidates.withIndex().joinToString("\n\n") { (index, text) ->
+            "--- Candidate ${index + 1} ---\n$text"
+        }
+
     fun stopGeneration() {
         generationJob?.cancel()
         inferenceEngine.cancelGeneration()
@@ -3,6 +3,7 @@ package com.localllm.app.ui.viewmodel
 import androidx.lifecycle.ViewModel
 import androidx.lifecycle.viewModelScope
 import com.localllm.app.data.local.PreferencesDataStore
+import com.localllm.app.data.model.GenerationConfig
 import com.localllm.app.inference.InferenceEngine
 import com.localllm.app.inference.ModelManager
 import dagger.hilt.android.lifecycle.HiltViewModel
@@ -66,9 +67,17 @@ class QuizViewModel @Inject constructor(
     private val preferencesDataStore: PreferencesDataStore
 ) : ViewModel() {
 
+    companion object {
+        // Token allowance for a single generated question
+        private const val QUESTION_MAX_TOKENS = 256
+    }
+
     private val _uiState = MutableStateFlow(QuizUiState())
     val uiState: StateFlow<QuizUiState> = _uiState.asStateFlow()
 
+    // Asking for the same quiz again writes new questions instead of replaying the cached response
+    private var lastRequest: String? = null
+
     private val _generationState = MutableStateFlow(QuizGenerationState())
     val generationState: StateFlow<QuizGenerationState> = _generationState.asStateFlow()
 
@@ -94,10 +103,40 @@ class QuizViewModel @Inject constructor(
                 val preferences = preferencesDataStore.userPreferencesFlow.first()
                 val model = modelManager.currentModel.value
                 
-                val prompt = """Generate exactly $questionCount multiple choice quiz questions about: $topic
+                val systemPrompt = """You are an expert quiz creator. Generate clear, educational multiple choice questions. 
+Each question must have exactly 4 options (A, B, C, D), one correct answer, and a brief explanation.
+Follow the exact format requested. Questions should be factually accurate and test real knowledge."""
+                
+                // Every request starts with this preamble; its KV state is loaded from a snapshot
+                val preamble = inferenceEngine.buildPrompt(
+                    messages = emptyList(),
+                    systemPrompt = systemPrompt,
+                    promptTemplate = model?.promptTemplate ?: "chatml"
+                )
+                inferenceEngine.preparePreamble("quiz", preamble)
+                // The batch caches each item by its own prompt; cacheQuery is for the serial fallback
+                val config = preferences.defaultGenerationConfig.copy(
+                    temperature = 0.7f,
+                    cacheNamespace = "quiz",
+                    cacheQuery = topic,
+                    cacheRefresh = "$topic|$questionCount|$difficulty" == lastRequest
+                )
+                lastRequest = "$topic|$questionCount|$difficulty"
+
+                // Pick one subtopic per question, then write all questions at once, one sequence each
+                val subtopics = inferenceEngine.generateList(
+                    prompt = preamble + "\n\nUser: List $questionCount distinct subtopics of $topic " +
+                        "for $difficulty quiz questions, one per line, nothing else.\n\nAssistant:",
+                    count = questionCount,
+                    // The list only makes sense for this topic, never reuse another request's
+                    config = config.copy(cacheNamespace = null)
+                )
+                val prefix = preamble + """
+
+User: Write one multiple choice quiz question about $topic, on the subtopic given below.
 Difficulty level: $difficulty
 
-Format EACH question EXACTLY like this:
+Format the question EXACTLY like this:
 QUESTION: [The question text]
 A) [First option]
 B) [Second option]
@@ -106,31 +145,24 @@ D) [Fourth option]
 CORRECT: [Letter of correct answer: A, B, C, or D]
 EXPLANATION: [Brief explanation of why this is correct]
 
-Make sure questions are educational, accurate, and appropriately challenging for $difficulty difficulty.
-
-Generate the quiz now:"""
-
-                val systemPrompt = """You are an expert quiz creator. Generate clear, educational multiple choice questions. 
-Each question must have exactly 4 options (A, B, C, D), one correct answer, and a brief explanation.
-Follow the exact format requested. Questions should be factually accurate and test real knowledge."""
-                
-                val fullPrompt = inferenceEngine.buildPrompt(
-                    messages = emptyList(),
-                    systemPrompt = systemPrompt,
-                    promptTemplate = model?.promptTemplate ?: "chatml"
-                ) + "\n\nUser: $prompt\n\nAssistant:"
-
-                var response = ""
-                inferenceEngine.generateStream(
-                    prompt = fullPrompt,
-                    config = preferences.defaultGenerationConfig.copy(
-                        maxTokens = 2048,
-                        temperature = 0.7f
-                    ),
-                    onTokenGenerated = { token ->
-                        response += token
+"""
+                var completed = 0
+                val items = if (subtopics.isNotEmpty()) {
+                    inferenceEngine.generateBatch(
+                        prefix = prefix,
+                        suffixes = subtopics.map { "Subtopic: $it\n\nAssistant:" },
+                        config = config.copy(maxTokens = QUESTION_MAX_TOKENS)
+                    ) { _, _ ->
+                        completed++
+                        _generationState.value = QuizGenerationState(
+                            isGenerating = true,
+                            progress = completed.toFloat() / subtopics.size
+                        )
                     }
-                ).collect { /* wait for completion */ }
+                } else null
+
+                val response = items?.joinToString("\n\n")
+                    ?: generateQuizSerial(preamble, topic, questionCount, difficulty, config)
 
                 // Parse generated quiz
                 val questions = parseGeneratedQuiz(response)
@@ -160,6 +192,43 @@ Follow the exact format requested. Questions should be factually accurate and te
         }
     }
 
+    /**
+     * Generate all questions through one prompt, for when they cannot be generated in parallel
+     */
+    private suspend fun generateQuizSerial(
+        preamble: String,
+        topic: String,
+        questionCount: Int,
+        difficulty: String,
+        config: GenerationConfig
+    ): String {
+        val prompt = """Generate exactly $questionCount multiple choice quiz questions about: $topic
+Difficulty level: $difficulty
+
+Format EACH question EXACTLY like this:
+QUESTION: [The question text]
+A) [First option]
+B) [Second option]
+C) [Third option]
+D) [Fourth option]
+CORRECT: [Letter of correct answer: A, B, C, or D]
+EXPLANATION: [Brief explanation of why this is correct]
+
+Make sure questions are educational, accurate, and appropriately challenging for $difficulty difficulty.
+
+Generate the quiz now:"""
+
+        var response = ""
+        inferenceEngine.generateStream(
+            prompt = preamble + "\n\nUser: $prompt\n\nAssistant:",
+            config = config.copy(maxTokens = 2048),
+            onTokenGenerated = { token ->
+                response += token
+            }
+        ).collect { /* wait for completion */ }
+        return response
+    }
+
     /**
      * Parse AI-generated quiz text into questions
      */
@@ -54,6 +54,9 @@ class RAGChatViewModel @Inject constructor(
         private const val TAG = "RAGChatViewModel"
         private const val MAX_CONTEXT_LENGTH = 2000
         private const val TOP_K_CHUNKS = 3
+
+        // Fixed start of every prompt with retrieved context; its KV state is loaded from a snapshot
+        private const val RAG_PREAMBLE = "You are a helpful AI assistant with access to relevant document context.\n\nINSTRUCTIONS:\n- Answer the question based on the context provided below\n- If the context contains the answer, cite the relevant parts\n- If the context doesn't contain enough information, say so and provide a general answer\n- Be concise but thorough\n- Use markdown formatting for readability\n\n"
     }
 
     private val _uiState = MutableStateFlow(RAGChatUiState())
@@ -157,6 +160,7 @@ class RAGChatViewModel @Inject constructor(
                     null
                 }
 
+                if (relevantContext != null) inferenceEngine.preparePreamble("rag", RAG_PREAMBLE)
                 val systemPrompt = buildRAGPrompt(relevantContext, input)
 
                 val assistantMessage = ChatMessage(
@@ -223,7 +227,7 @@ class RAGChatViewModel @Inject constructor(
 
     private fun buildRAGPrompt(context: String?, query: String): String {
         return if (context != null) {
-            "You are a helpful AI assistant with access to relevant document context.\n\nRELEVANT CONTEXT:\n$context\n\nUSER QUESTION: $query\n\nINSTRUCTIONS:\n- Answer the question based on the context provided above\n- If the context contains the answer, cite the relevant parts\n- If the context doesn't contain enough information, say so and provide a general answer\n- Be concise but thorough\n- Use markdown formatting for readability\n\nAssistant: $query"
+            "${RAG_PREAMBLE}RELEVANT CONTEXT:\n$context\n\nUSER QUESTION: $query\n\nAssistant: $query"
         } else {
             query
         }
@@ -14,6 +14,7 @@ import com.localllm.app.data.model.DeviceInfo
 import com.localllm.app.data.model.GPUInfo
 import com.localllm.app.data.model.StorageOption
 import com.localllm.app.data.model.StorageType
+import com.localllm.app.inference.LlamaAndroid
 import dagger.hilt.android.qualifiers.ApplicationContext
 import java.io.File
 import javax.inject.Inject
@@ -26,7 +27,8 @@ import javax.inject.Singleton
 @Singleton
 class HardwareCapabilities @Inject constructor(
     @ApplicationContext private val context: Context,
-    private val memoryMonitor: MemoryMonitor
+    private val memoryMonitor: MemoryMonitor,
+    private val llamaAndroid: LlamaAndroid
 ) {
     /**
      * Check if the device supports Android NNAPI.
@@ -220,6 +222,10 @@ class HardwareCapabilities @Inject constructor(
      * Get optimal thread count for inference.
      */
     fun getOptimalThreadCount(): Int {
+        // Efficiency cores slow down every matmul they take part in, stay on the big cores
+        val performanceCores = llamaAndroid.getPerformanceCoreCount()
+        if (performanceCores > 0) return performanceCores
+        
         val cores = Runtime.getRuntime().availableProcessors()
         // Use all cores except one for system responsiveness
         return maxOf(1, cores - 1)